@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+
+#include "archivew24.h"
+#include "readerw24.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_RECORD_SIZE 10240  // tar's default blocking factor of 20
+#define READ_BUFFER_SIZE 65536
+#define MAX_OCTAL_SIZE 077777777777LL
+#define MAX_OCTAL_ID 07777777
+#define OWNER_CACHE_SIZE 16
+
+// POSIX ustar header block
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+} TarHeader;
+
+// Tar stream state feeding the compressor and the sink
+typedef struct {
+    Compressor* compressor;
+    unsigned long long tarBytes;  // Uncompressed bytes, used to pad the final record
+    uid_t cachedUid;
+    gid_t cachedGid;
+    char cachedUname[32];
+    char cachedGname[32];
+} ArchiveWriter;
+
+// Compresses a run of tar bytes; the compressor hands its output to the sink
+static int compressBytes(ArchiveWriter* writer, const void* data, size_t length, int finish) {
+    writer->tarBytes += length;
+    return compressorWrite(writer->compressor, data, length, finish);
+}
+
+// Writes an octal number into a fixed-width, NUL-terminated header field
+static void formatOctal(char* field, size_t width, unsigned long long value) {
+    char digits[32];
+    snprintf(digits, sizeof(digits), "%0*llo", (int)(width - 1), value);
+    memcpy(field, digits, width - 1);
+    field[width - 1] = '\0';
+}
+
+// Appends one "length key=value\n" pax record, where length counts the whole record
+static size_t appendPaxRecord(char* buffer, size_t used, size_t capacity, const char* key, const char* value) {
+    size_t payload = strlen(key) + strlen(value) + 3;  // Space, equals sign and newline
+    size_t length = payload + 1;
+    while (snprintf(NULL, 0, "%zu", length) + payload > length) length++;
+    if (used + length > capacity) return used;
+    snprintf(buffer + used, capacity - used, "%zu %s=%s\n", length, key, value);
+    return used + length;
+}
+
+// Splits a member name into ustar name/prefix fields; returns -1 when it needs a pax record
+static int splitMemberName(const char* memberName, TarHeader* header) {
+    size_t length = strlen(memberName);
+    if (length <= sizeof(header->name)) {
+        memcpy(header->name, memberName, length);
+        return 0;
+    }
+
+    for (size_t split = length - 1; split > 0; split--) {
+        if (memberName[split] != '/') continue;
+        if (split > sizeof(header->prefix)) continue;
+        if (length - split - 1 > sizeof(header->name) || length - split - 1 == 0) break;
+        memcpy(header->prefix, memberName, split);
+        memcpy(header->name, memberName + split + 1, length - split - 1);
+        return 0;
+    }
+    return -1;
+}
+
+// User and group names already looked up by this process, replaced round robin once full
+static struct {
+    pthread_mutex_t lock;
+    struct {
+        unsigned int id;
+        int isGroup;
+        char name[32];
+    } entries[OWNER_CACHE_SIZE];
+    int count;
+    int next;
+} ownerNames = { PTHREAD_MUTEX_INITIALIZER };
+
+// Copies the name of a user or group into name, "" when it has none. NSS lookups are slow and read the
+// passwd and group files through stdio, which allocates, so each owner is looked up once per process
+static void lookupOwnerName(unsigned int id, int isGroup, char* name, size_t nameSize) {
+    pthread_mutex_lock(&ownerNames.lock);
+    for (int i = 0; i < ownerNames.count; i++) {
+        if (ownerNames.entries[i].id == id && ownerNames.entries[i].isGroup == isGroup) {
+            snprintf(name, nameSize, "%s", ownerNames.entries[i].name);
+            pthread_mutex_unlock(&ownerNames.lock);
+            return;
+        }
+    }
+
+    char buffer[1024];
+    name[0] = '\0';
+    if (isGroup) {
+        struct group entry, *result = NULL;
+        if (getgrgid_r(id, &entry, buffer, sizeof(buffer), &result) == 0 && result) {
+            snprintf(name, nameSize, "%s", result->gr_name);
+        }
+    } else {
+        struct passwd entry, *result = NULL;
+        if (getpwuid_r(id, &entry, buffer, sizeof(buffer), &result) == 0 && result) {
+            snprintf(name, nameSize, "%s", result->pw_name);
+        }
+    }
+
+    int slot = ownerNames.count < OWNER_CACHE_SIZE ? ownerNames.count++ : ownerNames.next++ % OWNER_CACHE_SIZE;
+    ownerNames.entries[slot].id = id;
+    ownerNames.entries[slot].isGroup = isGroup;
+    snprintf(ownerNames.entries[slot].name, sizeof(ownerNames.entries[slot].name), "%s", name);
+    pthread_mutex_unlock(&ownerNames.lock);
+}
+
+// Fills in user and group names, asking the process-wide cache only when the owner changes between files
+static void fillOwnerNames(ArchiveWriter* writer, const struct stat* fileInfo, TarHeader* header) {
+    if (fileInfo->st_uid != writer->cachedUid) {
+        writer->cachedUid = fileInfo->st_uid;
+        lookupOwnerName(fileInfo->st_uid, 0, writer->cachedUname, sizeof(writer->cachedUname));
+    }
+    if (fileInfo->st_gid != writer->cachedGid) {
+        writer->cachedGid = fileInfo->st_gid;
+        lookupOwnerName(fileInfo->st_gid, 1, writer->cachedGname, sizeof(writer->cachedGname));
+    }
+    memcpy(header->uname, writer->cachedUname, sizeof(header->uname) - 1);
+    memcpy(header->gname, writer->cachedGname, sizeof(header->gname) - 1);
+}
+
+// Fills in magic, checksum and padding, then compresses the header block
+static int emitHeader(ArchiveWriter* writer, TarHeader* header) {
+    memcpy(header->magic, "ustar", 6);
+    memcpy(header->version, "00", 2);
+    memset(header->checksum, ' ', sizeof(header->checksum));
+
+    unsigned int checksum = 0;
+    const unsigned char* bytes = (const unsigned char*)header;
+    for (size_t i = 0; i < sizeof(TarHeader); i++) checksum += bytes[i];
+    snprintf(header->checksum, sizeof(header->checksum), "%06o", checksum);  // Six digits, NUL, space
+    header->checksum[7] = ' ';
+
+    return compressBytes(writer, header, sizeof(TarHeader), 0);
+}
+
+// Pads the stream to the next 512-byte block boundary
+static int padToBlock(ArchiveWriter* writer) {
+    static const char zeros[TAR_BLOCK_SIZE];
+    size_t remainder = writer->tarBytes % TAR_BLOCK_SIZE;
+    return remainder ? compressBytes(writer, zeros, TAR_BLOCK_SIZE - remainder, 0) : 0;
+}
+
+// Emits a pax extended header for long names and values that overflow ustar fields
+static int emitPaxHeader(ArchiveWriter* writer, const char* memberName, const struct stat* fileInfo, int longName) {
+    char records[8192];
+    char value[32];
+    size_t used = 0;
+
+    if (longName) used = appendPaxRecord(records, used, sizeof(records), "path", memberName);
+    if (fileInfo->st_size > MAX_OCTAL_SIZE) {
+        snprintf(value, sizeof(value), "%lld", (long long)fileInfo->st_size);
+        used = appendPaxRecord(records, used, sizeof(records), "size", value);
+    }
+    if (fileInfo->st_uid > MAX_OCTAL_ID) {
+        snprintf(value, sizeof(value), "%u", (unsigned int)fileInfo->st_uid);
+        used = appendPaxRecord(records, used, sizeof(records), "uid", value);
+    }
+    if (fileInfo->st_gid > MAX_OCTAL_ID) {
+        snprintf(value, sizeof(value), "%u", (unsigned int)fileInfo->st_gid);
+        used = appendPaxRecord(records, used, sizeof(records), "gid", value);
+    }
+
+    TarHeader header = {0};
+    const char* baseName = strrchr(memberName, '/');
+    snprintf(header.name, sizeof(header.name), "PaxHeaders/%.80s", baseName ? baseName + 1 : memberName);
+    formatOctal(header.mode, sizeof(header.mode), 0644);
+    formatOctal(header.uid, sizeof(header.uid), 0);
+    formatOctal(header.gid, sizeof(header.gid), 0);
+    formatOctal(header.size, sizeof(header.size), used);
+    formatOctal(header.mtime, sizeof(header.mtime), fileInfo->st_mtime);
+    header.typeflag = 'x';
+
+    if (emitHeader(writer, &header) != 0) return -1;
+    if (compressBytes(writer, records, used, 0) != 0) return -1;
+    return padToBlock(writer);
+}
+
+// Adds one regular file, opened and read ahead by the reader, to the archive; files that vanished or cannot be
+// read are skipped
+static int addFile(ArchiveWriter* writer, const ReadFile* file, unsigned char* readBuffer) {
+    if (file->skipped) return 0;
+    struct stat fileInfo = file->info;
+
+    // tar strips the leading '/' from absolute member names
+    const char* memberName = file->path;
+    while (*memberName == '/') memberName++;
+
+    TarHeader header = {0};
+    int longName = splitMemberName(memberName, &header) != 0;
+    int needsPax = longName || fileInfo.st_size > MAX_OCTAL_SIZE ||
+                   fileInfo.st_uid > MAX_OCTAL_ID || fileInfo.st_gid > MAX_OCTAL_ID;
+    if (needsPax && emitPaxHeader(writer, memberName, &fileInfo, longName) != 0) return -1;
+    if (longName) {
+        snprintf(header.name, sizeof(header.name), "%.99s", memberName);
+    }
+
+    formatOctal(header.mode, sizeof(header.mode), fileInfo.st_mode & 07777);
+    formatOctal(header.uid, sizeof(header.uid), fileInfo.st_uid > MAX_OCTAL_ID ? 0 : fileInfo.st_uid);
+    formatOctal(header.gid, sizeof(header.gid), fileInfo.st_gid > MAX_OCTAL_ID ? 0 : fileInfo.st_gid);
+    formatOctal(header.size, sizeof(header.size), fileInfo.st_size > MAX_OCTAL_SIZE ? 0 : fileInfo.st_size);
+    formatOctal(header.mtime, sizeof(header.mtime), fileInfo.st_mtime);
+    header.typeflag = '0';
+    fillOwnerNames(writer, &fileInfo, &header);
+
+    if (emitHeader(writer, &header) != 0) return -1;
+
+    // Copy exactly the size recorded in the header: a file that shrank is zero-padded, one that grew is cut.
+    // Small files were read whole by the reader; larger ones continue where its read-ahead stopped
+    off_t offset = (off_t)file->length < fileInfo.st_size ? (off_t)file->length : fileInfo.st_size;
+    if (offset > 0 && compressBytes(writer, file->data, offset, 0) != 0) return -1;
+    while (offset < fileInfo.st_size) {
+        size_t wanted = fileInfo.st_size - offset < READ_BUFFER_SIZE ? fileInfo.st_size - offset : READ_BUFFER_SIZE;
+        ssize_t bytesRead = pread(file->fd, readBuffer, wanted, offset);
+        if (bytesRead <= 0) {
+            memset(readBuffer, 0, wanted);
+            bytesRead = wanted;
+        }
+        if (compressBytes(writer, readBuffer, bytesRead, 0) != 0) return -1;
+        offset += bytesRead;
+    }
+    return padToBlock(writer);
+}
+
+int writeTarArchive(const FileList* list, const CodecChoice* codec, ArchiveSink* sink, Arena* arena) {
+    Arena scratch = {0};
+    if (!arena) arena = &scratch;
+    ArchiveWriter* writer = arenaCalloc(arena, 1, sizeof(ArchiveWriter));
+    unsigned char* readBuffer = arenaAlloc(arena, READ_BUFFER_SIZE);
+    if (!writer || !readBuffer) {
+        arenaDestroy(&scratch);
+        return -1;
+    }
+    writer->cachedUid = (uid_t)-1;
+    writer->cachedGid = (gid_t)-1;
+
+    unsigned long long expectedBytes = 0;
+    for (size_t i = 0; i < list->count; i++) expectedBytes += list->files[i].size;
+    writer->compressor = createCompressor(codec, expectedBytes, sink->write, sink->context, arena);
+    FileReader* reader = writer->compressor ? openFileReader(list, arena) : NULL;
+    if (!reader) {
+        if (writer->compressor) destroyCompressor(writer->compressor);
+        arenaDestroy(&scratch);
+        return -1;
+    }
+
+    // Files are opened, statted and read ahead of the writer, which takes them in list order
+    int result = 0;
+    ReadFile file;
+    int status = 0;
+    while (result == 0 && (status = nextReadFile(reader, &file)) > 0) {
+        result = addFile(writer, &file, readBuffer);
+    }
+    if (status < 0) result = -1;
+    closeFileReader(reader);
+
+    if (result == 0) {
+        // End-of-archive marker (two zero blocks), then pad to a full tar record
+        static const char zeros[TAR_RECORD_SIZE];
+        result = compressBytes(writer, zeros, 2 * TAR_BLOCK_SIZE, 0);
+        size_t recordRemainder = writer->tarBytes % TAR_RECORD_SIZE;
+        size_t padding = recordRemainder ? TAR_RECORD_SIZE - recordRemainder : 0;
+        if (result == 0) result = compressBytes(writer, zeros, padding, 1);
+    }
+
+    destroyCompressor(writer->compressor);
+    arenaDestroy(&scratch);
+    return result;
+}
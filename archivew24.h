@@ -0,0 +1,20 @@
+#ifndef ARCHIVEW24_H
+#define ARCHIVEW24_H
+
+#include <stddef.h>
+
+#include "searchw24.h"
+#include "codecw24.h"
+
+// Destination for compressed archive bytes; write returns 0 on success
+typedef struct {
+    CompressedWriteFn write;
+    void* context;
+} ArchiveSink;
+
+// Writes the listed files as a ustar stream compressed with the chosen codec into the sink
+// Unreadable files are skipped, like tar does; returns 0 on success and -1 when compression or the sink fails.
+// The writer, compressor and reader take their memory from the arena, or from a scratch arena freed on return
+int writeTarArchive(const FileList* list, const CodecChoice* codec, ArchiveSink* sink, Arena* arena);
+
+#endif
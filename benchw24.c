@@ -0,0 +1,1400 @@
+// Build: gcc -o benchw24 benchw24.c protocolw24.c scanw24.c listw24.c searchw24.c archivew24.c codecw24.c indexw24.c readerw24.c poolw24.c -pthread -lz -lm
+// Optional codecs: add -DHAVE_ZSTD -lzstd and/or -DHAVE_LZ4 -llz4
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <math.h>
+
+#include "protocolw24.h"
+#include "scanw24.h"
+#include "listw24.h"
+#include "archivew24.h"
+#include "indexw24.h"
+#include "readerw24.h"
+
+#define BUFFER_SIZE 1024
+
+// Settings shared by every benchmark thread
+typedef struct {
+    const char* serverIP;
+    int serverPort;
+    const char* command;
+    int connectionsPerThread;
+} BenchConfig;
+
+// Per-thread results
+typedef struct {
+    BenchConfig* config;
+    int completed;
+    int failed;
+    double totalLatency;
+} BenchThread;
+
+// Synthetic home trees are laid out from a seed, so the same arguments always produce the same tree.
+// File i is named file<i>.<extension i mod BENCH_EXTENSION_COUNT>, which lets the load generator ask w24fn
+// for names that exist without reading the tree, and mtimes fall in the days after BENCH_EPOCH.
+#define BENCH_EXTENSION_COUNT 8
+#define BENCH_EPOCH 1672531200  // 2023-01-01 00:00:00 UTC
+#define BENCH_SUBDIRECTORIES 8  // Subdirectories per directory
+#define BENCH_DEFAULT_FILES 2000
+#define BENCH_DEFAULT_DAYS 365
+#define BENCH_DEFAULT_MIN_SIZE 64
+#define BENCH_DEFAULT_MAX_SIZE (256 * 1024)
+
+// Commands in the load mix
+typedef enum {
+    LOAD_W24FN, LOAD_DIRLIST_A, LOAD_DIRLIST_T, LOAD_W24FZ, LOAD_W24FT, LOAD_W24FDB, LOAD_W24FDA, LOAD_KINDS
+} LoadKind;
+
+// One finished request
+typedef struct {
+    unsigned char kind;
+    unsigned char failed;  // Connection or protocol failure
+    unsigned char refused; // RESP_ERROR, such as "No file found."
+    float latency;         // Seconds from sending the request to the last byte of the reply
+    float firstByte;       // Seconds from sending the request to the first reply frame
+    unsigned long long bytes;
+} LoadSample;
+
+// Settings shared by the load threads
+typedef struct {
+    const char* serverIP;
+    int serverPort;
+    long requestsPerConnection;  // 0: run until the deadline
+    double deadline;
+    int weights[LOAD_KINDS];
+    int totalWeight;
+    long fileCount;
+    long days;
+    long minSize;
+    long maxSize;
+    unsigned long long seed;
+} LoadConfig;
+
+void runConnectionRate(const char* serverIP, int serverPort, int connections, int concurrency, const char* command);
+void runArchiveRate(const char* serverIP, int serverPort, int requests, const char* command);
+int makeSmallFileTree(const char* directoryPath, int fileCount, int fileSize, int filesPerDirectory);
+void runScanBenchmark(const char* directoryPath, int threadCount);
+int makeSubdirectories(const char* directoryPath, int count);
+void runListingBenchmark(const char* directoryPath);
+void runCompressionBenchmark(const char* directoryPath, const char* codecSpec, int maxThreads);
+void runInputBenchmark(const char* directoryPath, const char* codecSpec, int cold);
+double currentTimeSeconds();
+int connectToServer(const char* serverIP, int serverPort);
+int parseBenchOptions(int argc, char* argv[], int first, const char* const* names, long* values, const char** texts);
+int makeHomeTree(const char* rootPath, long fileCount, long depth, long minSize, long maxSize, long days,
+                 unsigned long long seed);
+void runSelectBenchmark(const char* directoryPath, long queries, const LoadConfig* tree, const char* indexDirectory);
+void runLoadBenchmark(const char* serverIP, int serverPort, int connections, double seconds, long requestsPerConnection,
+                      const char* mix, const char* label, const LoadConfig* tree);
+int runAllocationBenchmark(const char* serverIP, int serverPort, long requests, long warmup, const char* mix,
+                           const LoadConfig* tree);
+void runLatencyBenchmark(const char* serverIP, int serverPort, long requests, long warmup, const char* file,
+                         const char* archiveCommand);
+
+int main(int argc, char *argv[]) {
+    if (argc >= 6 && strcmp(argv[1], "connrate") == 0) {
+        const char* command = argc >= 7 ? argv[6] : "dirlist -a";
+        runConnectionRate(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]), command);
+        return 0;
+    }
+    if (argc == 6 && strcmp(argv[1], "archive") == 0) {
+        runArchiveRate(argv[2], atoi(argv[3]), atoi(argv[4]), argv[5]);
+        return 0;
+    }
+    if ((argc == 5 || argc == 6) && strcmp(argv[1], "mktree") == 0) {
+        int filesPerDirectory = argc == 6 ? atoi(argv[5]) : 0;
+        return makeSmallFileTree(argv[2], atoi(argv[3]), atoi(argv[4]), filesPerDirectory) == 0 ? 0 : 1;
+    }
+    if (argc == 4 && strcmp(argv[1], "mkdirs") == 0) {
+        return makeSubdirectories(argv[2], atoi(argv[3])) == 0 ? 0 : 1;
+    }
+    if (argc == 3 && strcmp(argv[1], "dirlist") == 0) {
+        runListingBenchmark(argv[2]);
+        return 0;
+    }
+    if (argc == 5 && strcmp(argv[1], "compress") == 0) {
+        runCompressionBenchmark(argv[2], argv[3], atoi(argv[4]));
+        return 0;
+    }
+    if (argc >= 3 && strcmp(argv[1], "input") == 0) {
+        static const char* const names[] = { "--codec", "--cold", NULL };
+        long values[] = { 0, 1 };
+        const char* texts[2] = { "gzip:1", NULL };
+        if (parseBenchOptions(argc, argv, 3, names, values, texts) == 0) {
+            runInputBenchmark(argv[2], texts[0], values[1]);
+            return 0;
+        }
+    }
+    if (argc >= 3 && strcmp(argv[1], "mkhome") == 0) {
+        static const char* const names[] = { "--files", "--depth", "--min-size", "--max-size", "--days", "--seed", NULL };
+        long values[] = { BENCH_DEFAULT_FILES, 3, BENCH_DEFAULT_MIN_SIZE, BENCH_DEFAULT_MAX_SIZE, BENCH_DEFAULT_DAYS, 1 };
+        if (parseBenchOptions(argc, argv, 3, names, values, NULL) == 0) {
+            return makeHomeTree(argv[2], values[0], values[1], values[2], values[3], values[4], values[5]) == 0 ? 0 : 1;
+        }
+    }
+    if (argc >= 4 && strcmp(argv[1], "load") == 0) {
+        // The tree options must match the ones the tree was made with, so requests name files and dates that exist
+        static const char* const names[] = { "--connections", "--seconds", "--requests", "--mix", "--label",
+                                             "--files", "--days", "--min-size", "--max-size", "--seed", NULL };
+        long values[] = { 8, 10, 0, 0, 0, BENCH_DEFAULT_FILES, BENCH_DEFAULT_DAYS, BENCH_DEFAULT_MIN_SIZE,
+                          BENCH_DEFAULT_MAX_SIZE, 1 };
+        const char* texts[10] = { NULL };
+        texts[3] = "w24fn=50,dirlist-a=10,dirlist-t=10,w24fz=10,w24ft=10,w24fdb=5,w24fda=5";
+        texts[4] = "default";
+        if (parseBenchOptions(argc, argv, 4, names, values, texts) == 0) {
+            LoadConfig tree = { .fileCount = values[5], .days = values[6], .minSize = values[7],
+                                .maxSize = values[8], .seed = values[9] };
+            runLoadBenchmark(argv[2], atoi(argv[3]), values[0], values[1], values[2], texts[3], texts[4], &tree);
+            return 0;
+        }
+    }
+    if (argc >= 4 && strcmp(argv[1], "allocs") == 0) {
+        static const char* const names[] = { "--requests", "--warmup", "--mix", "--files", "--days", "--min-size",
+                                             "--max-size", "--seed", NULL };
+        long values[] = { 200, 50, 0, BENCH_DEFAULT_FILES, BENCH_DEFAULT_DAYS, BENCH_DEFAULT_MIN_SIZE,
+                          BENCH_DEFAULT_MAX_SIZE, 1 };
+        const char* texts[8] = { NULL };
+        texts[2] = "w24fn=1,dirlist-a=1,dirlist-t=1,w24fz=1,w24ft=1,w24fdb=1,w24fda=1";
+        if (parseBenchOptions(argc, argv, 4, names, values, texts) == 0) {
+            LoadConfig tree = { .fileCount = values[3], .days = values[4], .minSize = values[5],
+                                .maxSize = values[6], .seed = values[7] };
+            return runAllocationBenchmark(argv[2], atoi(argv[3]), values[0], values[1], texts[2], &tree);
+        }
+    }
+    if (argc >= 4 && strcmp(argv[1], "latency") == 0) {
+        // The defaults name a file and a small archive of a tree made by mkhome with its default options
+        static const char* const names[] = { "--requests", "--warmup", "--file", "--archive", NULL };
+        long values[] = { 200, 20, 0, 0 };
+        const char* texts[4] = { NULL, NULL, "file000000.txt", "w24fz 64 128" };
+        if (parseBenchOptions(argc, argv, 4, names, values, texts) == 0) {
+            runLatencyBenchmark(argv[2], atoi(argv[3]), values[0], values[1], texts[2], texts[3]);
+            return 0;
+        }
+    }
+    if (argc >= 3 && strcmp(argv[1], "select") == 0) {
+        // --index-dir keeps the persisted index between runs, so a second run measures a warm start
+        static const char* const names[] = { "--queries", "--files", "--days", "--min-size", "--max-size", "--seed",
+                                             "--index-dir", NULL };
+        long values[] = { 200, BENCH_DEFAULT_FILES, BENCH_DEFAULT_DAYS, BENCH_DEFAULT_MIN_SIZE, BENCH_DEFAULT_MAX_SIZE, 1, 0 };
+        const char* texts[7] = { NULL };
+        if (parseBenchOptions(argc, argv, 3, names, values, texts) == 0) {
+            LoadConfig tree = { .fileCount = values[1], .days = values[2], .minSize = values[3],
+                                .maxSize = values[4], .seed = values[5] };
+            runSelectBenchmark(argv[2], values[0], &tree, texts[6]);
+            return 0;
+        }
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "scan") == 0) {
+        runScanBenchmark(argv[2], argc == 4 ? atoi(argv[3]) : defaultScanThreads());
+        return 0;
+    }
+
+    fprintf(stderr, "Usage: %s connrate <server IP> <port> <connections> <concurrency> [command]\n", argv[0]);
+    fprintf(stderr, "       %s archive <server IP> <port> <requests> <archive command>\n", argv[0]);
+    fprintf(stderr, "       %s mktree <directory> <file count> <file size> [files per subdirectory]\n", argv[0]);
+    fprintf(stderr, "       %s scan <directory> [threads]\n", argv[0]);
+    fprintf(stderr, "       %s mkdirs <directory> <count>\n", argv[0]);
+    fprintf(stderr, "       %s dirlist <directory>\n", argv[0]);
+    fprintf(stderr, "       %s compress <directory> <codec[:level]> <max threads>\n", argv[0]);
+    fprintf(stderr, "       %s input <directory> [--codec codec[:level]] [--cold 0|1]\n", argv[0]);
+    fprintf(stderr, "       %s mkhome <directory> [--files N] [--depth N] [--min-size N] [--max-size N] [--days N] [--seed N]\n", argv[0]);
+    fprintf(stderr, "       %s load <server IP> <port> [--connections N] [--seconds N | --requests N per connection]\n"
+                    "              [--mix name=weight,...] [--label text] [--files N] [--days N] [--min-size N] [--max-size N] [--seed N]\n", argv[0]);
+    fprintf(stderr, "       %s allocs <server IP> <port> [--requests N] [--warmup N] [--mix name=weight,...]\n"
+                    "              [--files N] [--days N] [--min-size N] [--max-size N] [--seed N]\n", argv[0]);
+    fprintf(stderr, "       %s latency <server IP> <port> [--requests N] [--warmup N] [--file name] [--archive command]\n", argv[0]);
+    fprintf(stderr, "       %s select <directory> [--queries N] [--files N] [--days N] [--min-size N] [--max-size N] [--seed N]\n"
+                    "              [--index-dir DIR]\n", argv[0]);
+    return 1;
+}
+
+// Returns a monotonic timestamp in seconds
+double currentTimeSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Opens a connection, runs one command, reads the reply and disconnects; returns 0 on success
+int runOneConnection(BenchConfig* config) {
+    struct sockaddr_in serverAddr = {0};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = inet_addr(config->serverIP);
+    serverAddr.sin_port = htons(config->serverPort);
+
+    int socketDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketDescriptor < 0) return -1;
+    if (connect(socketDescriptor, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
+        close(socketDescriptor);
+        return -1;
+    }
+
+    char reply[BUFFER_SIZE];
+    int result = -1;
+    if (send(socketDescriptor, config->command, strlen(config->command), 0) > 0 &&
+        recv(socketDescriptor, reply, sizeof(reply), 0) > 0) {
+        result = 0;
+    }
+    send(socketDescriptor, "quitc", 5, 0);
+    close(socketDescriptor);
+    return result;
+}
+
+// Benchmark thread: opens connections back to back and records their latency
+void* connectionRateThread(void* argument) {
+    BenchThread* thread = argument;
+    for (int i = 0; i < thread->config->connectionsPerThread; i++) {
+        double start = currentTimeSeconds();
+        if (runOneConnection(thread->config) == 0) {
+            thread->completed++;
+            thread->totalLatency += currentTimeSeconds() - start;
+        } else {
+            thread->failed++;
+        }
+    }
+    return NULL;
+}
+
+// Measures how many connect/command/close cycles per second the server sustains
+void runConnectionRate(const char* serverIP, int serverPort, int connections, int concurrency, const char* command) {
+    if (concurrency < 1) concurrency = 1;
+    BenchConfig config = { serverIP, serverPort, command, connections / concurrency };
+    if (config.connectionsPerThread < 1) config.connectionsPerThread = 1;
+
+    pthread_t* threads = calloc(concurrency, sizeof(pthread_t));
+    BenchThread* results = calloc(concurrency, sizeof(BenchThread));
+
+    double start = currentTimeSeconds();
+    for (int i = 0; i < concurrency; i++) {
+        results[i].config = &config;
+        pthread_create(&threads[i], NULL, connectionRateThread, &results[i]);
+    }
+
+    int completed = 0, failed = 0;
+    double totalLatency = 0;
+    for (int i = 0; i < concurrency; i++) {
+        pthread_join(threads[i], NULL);
+        completed += results[i].completed;
+        failed += results[i].failed;
+        totalLatency += results[i].totalLatency;
+    }
+    double elapsed = currentTimeSeconds() - start;
+
+    printf("port %d: %d connections (%d failed) in %.2f s, %.1f conn/s, mean latency %.3f ms\n",
+           serverPort, completed, failed, elapsed, completed / elapsed,
+           completed ? totalLatency / completed * 1000.0 : 0.0);
+
+    free(threads);
+    free(results);
+}
+
+// Connects to the server, or returns -1
+int connectToServer(const char* serverIP, int serverPort) {
+    struct sockaddr_in serverAddr = {0};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = inet_addr(serverIP);
+    serverAddr.sin_port = htons(serverPort);
+
+    int socketDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketDescriptor < 0) return -1;
+    if (connect(socketDescriptor, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
+        close(socketDescriptor);
+        return -1;
+    }
+    return socketDescriptor;
+}
+
+// Receives one chunked archive reply and returns its size, or -1
+long receiveArchive(int socketDescriptor) {
+    char buffer[65536];
+    long total = 0, chunkLength;
+    int isError;
+    while ((chunkLength = receiveChunkHeader(socketDescriptor, &isError)) > 0) {
+        while (chunkLength > 0) {
+            long wanted = chunkLength < (long)sizeof(buffer) ? chunkLength : (long)sizeof(buffer);
+            if (recvAll(socketDescriptor, buffer, wanted) != 0) return -1;
+            chunkLength -= wanted;
+            total += isError ? 0 : wanted;
+        }
+        if (isError) total = -1;
+    }
+    return chunkLength < 0 ? -1 : total;
+}
+
+// Issues the same archive command repeatedly on one connection and reports requests per second
+// Also works for any other chunked reply, such as "dirlist -t"
+void runArchiveRate(const char* serverIP, int serverPort, int requests, const char* command) {
+    int socketDescriptor = connectToServer(serverIP, serverPort);
+    if (socketDescriptor < 0) {
+        perror("Connection to server failed");
+        return;
+    }
+
+    long archiveSize = 0;
+    int completed = 0;
+    double start = currentTimeSeconds();
+    for (int i = 0; i < requests; i++) {
+        send(socketDescriptor, command, strlen(command), 0);
+        archiveSize = receiveArchive(socketDescriptor);
+        if (archiveSize < 0) break;
+        completed++;
+    }
+    double elapsed = currentTimeSeconds() - start;
+    send(socketDescriptor, "quitc", 5, 0);
+    close(socketDescriptor);
+
+    printf("port %d: %d x '%s' (%ld byte archive) in %.2f s, %.1f req/s, mean latency %.3f ms\n",
+           serverPort, completed, command, archiveSize, elapsed, completed / elapsed,
+           completed ? elapsed / completed * 1000.0 : 0.0);
+}
+
+// Creates fileCount files of fileSize bytes for the archive and scan benchmarks.
+// With filesPerDirectory > 0 the files are spread over numbered subdirectories, 100 per parent, so large trees stay shallow but wide.
+int makeSmallFileTree(const char* directoryPath, int fileCount, int fileSize, int filesPerDirectory) {
+    mkdir(directoryPath, 0775);
+    char* content = malloc(fileSize > 0 ? fileSize : 1);
+    for (int i = 0; i < fileSize; i++) content[i] = 'a' + (i * 7 + i / 13) % 26;
+
+    char path[1100];
+    char directory[1024];
+    snprintf(directory, sizeof(directory), "%s", directoryPath);
+    for (int i = 0; i < fileCount; i++) {
+        if (filesPerDirectory > 0 && i % filesPerDirectory == 0) {
+            int leaf = i / filesPerDirectory;
+            snprintf(directory, sizeof(directory), "%s/d%03d", directoryPath, leaf / 100);
+            mkdir(directory, 0775);
+            snprintf(directory, sizeof(directory), "%s/d%03d/d%05d", directoryPath, leaf / 100, leaf);
+            mkdir(directory, 0775);
+        }
+        snprintf(path, sizeof(path), "%s/bench%05d.txt", directory, i);
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+            perror(path);
+            free(content);
+            return -1;
+        }
+        fwrite(content, 1, fileSize, file);
+        fclose(file);
+    }
+    free(content);
+    printf("Created %d files of %d bytes in %s\n", fileCount, fileSize, directoryPath);
+    return 0;
+}
+
+static atomic_long scannedFiles;
+
+// Scanner callback for the scan benchmark: only counts
+static void countScannedFile(const ScanEntry* entry, void* threadContext) {
+    (void)entry;
+    (void)threadContext;
+    atomic_fetch_add_explicit(&scannedFiles, 1, memory_order_relaxed);
+}
+
+// Times one find subprocess listing every regular file with its size and mtime, which, like the
+// scanner's callers, needs a stat of each file; returns the number of lines it printed
+static long timeFind(const char* directoryPath, double* elapsed) {
+    char command[1200];
+    snprintf(command, sizeof(command), "find '%s' -type f -printf '%%s %%T@\\n'", directoryPath);
+
+    double start = currentTimeSeconds();
+    FILE* pipe = popen(command, "r");
+    if (!pipe) return -1;
+    char line[4096];
+    long count = 0;
+    while (fgets(line, sizeof(line), pipe)) count++;
+    pclose(pipe);
+    *elapsed = currentTimeSeconds() - start;
+    return count;
+}
+
+// Compares the parallel scanner against find on the same tree, each one run warm (after a first pass fills the dentry cache)
+void runScanBenchmark(const char* directoryPath, int threadCount) {
+    double findElapsed = 0;
+    timeFind(directoryPath, &findElapsed);
+    long findCount = timeFind(directoryPath, &findElapsed);
+
+    ScanOptions options = {0};
+    options.regularFilesOnly = 1;
+    options.visit = countScannedFile;
+
+    for (int threads = 1; threads <= threadCount; threads *= 2) {
+        options.threadCount = threads;
+        atomic_store(&scannedFiles, 0);
+        double start = currentTimeSeconds();
+        if (scanTree(directoryPath, &options) != 0) {
+            perror(directoryPath);
+            return;
+        }
+        double elapsed = currentTimeSeconds() - start;
+        long count = atomic_load(&scannedFiles);
+        printf("scanTree %2d threads: %ld files in %.3f s (%.0f files/s, %.2fx find)\n",
+               threads, count, elapsed, count / elapsed, findElapsed / elapsed);
+        if (threads < threadCount && threads * 2 > threadCount) threads = threadCount / 2;
+    }
+    printf("find -printf:        %ld files in %.3f s (%.0f files/s)\n",
+           findCount, findElapsed, findCount / findElapsed);
+}
+
+// Creates count empty subdirectories with shuffled modification times for the listing benchmark
+int makeSubdirectories(const char* directoryPath, int count) {
+    mkdir(directoryPath, 0775);
+    char path[1100];
+    time_t now = time(NULL);
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/sub%06d", directoryPath, i);
+        if (mkdir(path, 0775) != 0) {
+            perror(path);
+            return -1;
+        }
+        struct timespec times[2] = { { now, 0 }, { now - (i * 7919L) % 1000003, 0 } };
+        utimensat(AT_FDCWD, path, times, 0);
+    }
+    printf("Created %d subdirectories in %s\n", count, directoryPath);
+    return 0;
+}
+
+static const char* legacyListingRoot;
+static atomic_long legacyStatCalls;
+
+static int legacyDirectoryFilter(const struct dirent* entry) {
+    return entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+}
+
+// The previous dirlist -t comparator: two stat calls per comparison
+static int legacyCompareByTime(const struct dirent** a, const struct dirent** b) {
+    struct stat sa, sb;
+    char pathA[1100], pathB[1100];
+    snprintf(pathA, sizeof(pathA), "%s/%s", legacyListingRoot, (*a)->d_name);
+    snprintf(pathB, sizeof(pathB), "%s/%s", legacyListingRoot, (*b)->d_name);
+    stat(pathA, &sa);
+    stat(pathB, &sb);
+    legacyStatCalls += 2;
+    return (sa.st_ctime > sb.st_ctime) - (sa.st_ctime < sb.st_ctime);
+}
+
+// Compares the old scandir listing, which stats inside the comparator, with listSubdirectories
+void runListingBenchmark(const char* directoryPath) {
+    struct dirent** namelist;
+    legacyListingRoot = directoryPath;
+    double start = currentTimeSeconds();
+    int legacyCount = scandir(directoryPath, &namelist, legacyDirectoryFilter, legacyCompareByTime);
+    double legacyElapsed = currentTimeSeconds() - start;
+    for (int i = 0; i < legacyCount; i++) free(namelist[i]);
+    if (legacyCount >= 0) free(namelist);
+
+    DirectoryListing listing;
+    start = currentTimeSeconds();
+    if (listSubdirectories(directoryPath, 1, NULL, &listing) != 0) {
+        perror(directoryPath);
+        return;
+    }
+    double elapsed = currentTimeSeconds() - start;
+
+    printf("scandir + stat in comparator: %d entries in %.3f s (%ld stat calls)\n",
+           legacyCount, legacyElapsed, (long)legacyStatCalls);
+    printf("listSubdirectories:           %zu entries in %.3f s (%zu stat calls, %.1fx faster)\n",
+           listing.count, elapsed, listing.count, legacyElapsed / elapsed);
+    freeDirectoryListing(&listing);
+}
+
+// Archive output is only counted and hashed, so the benchmark measures tar + compression alone
+typedef struct {
+    unsigned long long bytes;
+    unsigned long long hash;
+} CountingSink;
+
+static int countArchiveBytes(void* context, const void* data, size_t length) {
+    CountingSink* counter = context;
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        counter->hash = (counter->hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    counter->bytes += length;
+    return 0;
+}
+
+// Archives every file under a directory with 1, 2, 4 ... maxThreads compression threads.
+// The hash column shows the output is identical whatever the thread count.
+void runCompressionBenchmark(const char* directoryPath, const char* codecSpec, int maxThreads) {
+    CodecChoice codec;
+    if (parseCodecSpec(codecSpec, &codec) != 0 || !codecAvailable(codec.id)) {
+        fprintf(stderr, "Unsupported codec: %s\n", codecSpec);
+        return;
+    }
+
+    SearchQuery query = { .maxDepth = 1000 };
+    FileList files;
+    if (collectMatchingFiles(directoryPath, &query, &files) != 0) {
+        perror(directoryPath);
+        return;
+    }
+    unsigned long long inputBytes = 0;
+    for (size_t i = 0; i < files.count; i++) inputBytes += files.files[i].size;
+
+    // The pool keeps the thread count it starts with, so each run uses its own process
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            setCompressionThreads(threads);
+            CountingSink counter = { 0, 14695981039346656037ULL };
+            ArchiveSink sink = { countArchiveBytes, &counter };
+            double start = currentTimeSeconds();
+            int result = writeTarArchive(&files, &codec, &sink, NULL);
+            double elapsed = currentTimeSeconds() - start;
+            printf("%s %2d threads: %zu files, %.1f MB -> %.1f MB in %.2f s (%.1f MB/s) hash %016llx%s\n",
+                   codecSpec, threads, files.count, inputBytes / 1e6, counter.bytes / 1e6, elapsed,
+                   inputBytes / 1e6 / elapsed, counter.hash, result == 0 ? "" : " FAILED");
+            fflush(stdout);
+            _exit(result == 0 ? 0 : 1);
+        }
+        waitpid(pid, NULL, 0);
+        if (threads < maxThreads && threads * 2 > maxThreads) threads = maxThreads / 2;
+    }
+    freeFileList(&files);
+}
+
+// Drops the files from the page cache so the next pass reads them from disk. Dropping every cache
+// (root only) also forgets the inodes and dentries; otherwise only the file contents are evicted
+static const char* evictFileCache(const FileList* files) {
+    sync();
+    FILE* dropCaches = fopen("/proc/sys/vm/drop_caches", "w");
+    if (dropCaches && fputs("3\n", dropCaches) >= 0 && fclose(dropCaches) == 0) return "cold";
+    if (dropCaches) fclose(dropCaches);
+    for (size_t i = 0; i < files->count; i++) {
+        int fd = open(files->files[i].path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    return "data evicted";
+}
+
+// Times one tar subprocess archiving the list uncompressed to a pipe, the way archives used to be built;
+// returns the bytes it wrote
+static unsigned long long timeTarSubprocess(const FileList* files, double* elapsed) {
+    char listPath[] = "/tmp/benchw24-files-XXXXXX";
+    int listFd = mkstemp(listPath);
+    if (listFd < 0) return 0;
+    FILE* list = fdopen(listFd, "w");
+    for (size_t i = 0; i < files->count; i++) fprintf(list, "%s%c", files->files[i].path, '\0');
+    fclose(list);
+
+    char command[1200];
+    snprintf(command, sizeof(command), "tar --null -T '%s' -cf - 2>/dev/null", listPath);
+    double start = currentTimeSeconds();
+    FILE* pipe = popen(command, "r");
+    unsigned long long bytes = 0;
+    if (pipe) {
+        char buffer[65536];
+        size_t length;
+        while ((length = fread(buffer, 1, sizeof(buffer), pipe)) > 0) bytes += length;
+        pclose(pipe);
+    }
+    *elapsed = currentTimeSeconds() - start;
+    unlink(listPath);
+    return bytes;
+}
+
+// Compares the archive input backends on every file under a directory: the reader alone, which is the
+// open/stat/read latency the tar writer waits on, then whole archives with the given codec, and a tar
+// subprocess for reference. With cold set, caches are dropped before every pass
+void runInputBenchmark(const char* directoryPath, const char* codecSpec, int cold) {
+    CodecChoice codec;
+    if (parseCodecSpec(codecSpec, &codec) != 0 || !codecAvailable(codec.id)) {
+        fprintf(stderr, "Unsupported codec: %s\n", codecSpec);
+        return;
+    }
+    SearchQuery query = { .maxDepth = 1000 };
+    FileList files;
+    if (collectMatchingFiles(directoryPath, &query, &files) != 0) {
+        perror(directoryPath);
+        return;
+    }
+    unsigned long long inputBytes = 0;
+    for (size_t i = 0; i < files.count; i++) inputBytes += files.files[i].size;
+    printf("%zu files, %.1f MB; io_uring %s\n", files.count, inputBytes / 1e6,
+           effectiveReaderBackend() == READER_URING ? "available" : "unavailable");
+
+    static const ReaderBackend backends[] = { READER_URING, READER_THREADS, READER_BLOCKING };
+    Arena arena = {0};
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        setReaderBackend(backends[b]);
+        const char* name = readerBackendName(effectiveReaderBackend());
+        if (backends[b] == READER_URING && effectiveReaderBackend() != READER_URING) continue;
+
+        const char* cache = cold ? evictFileCache(&files) : "warm";
+        double start = currentTimeSeconds();
+        FileReader* reader = openFileReader(&files, &arena);
+        ReadFile file;
+        unsigned long long bytes = 0;
+        size_t skipped = 0;
+        while (reader && nextReadFile(reader, &file) > 0) {
+            bytes += file.length;
+            skipped += file.skipped;
+        }
+        closeFileReader(reader);
+        arenaReset(&arena);
+        double elapsed = currentTimeSeconds() - start;
+        printf("read    %-8s %-12s %.3f s (%.0f files/s, %.1f MB/s)%s\n", name, cache, elapsed,
+               files.count / elapsed, bytes / 1e6 / elapsed, skipped ? " SKIPPED FILES" : "");
+
+        cache = cold ? evictFileCache(&files) : "warm";
+        CountingSink counter = { 0, 14695981039346656037ULL };
+        ArchiveSink sink = { countArchiveBytes, &counter };
+        start = currentTimeSeconds();
+        int result = writeTarArchive(&files, &codec, &sink, &arena);
+        arenaReset(&arena);
+        elapsed = currentTimeSeconds() - start;
+        printf("archive %-8s %-12s %.3f s (%.0f files/s) %s %.1f MB hash %016llx%s\n", name, cache, elapsed,
+               files.count / elapsed, codecSpec, counter.bytes / 1e6, counter.hash, result == 0 ? "" : " FAILED");
+    }
+
+    const char* cache = cold ? evictFileCache(&files) : "warm";
+    double tarElapsed = 0;
+    unsigned long long tarBytes = timeTarSubprocess(&files, &tarElapsed);
+    printf("tar     %-8s %-12s %.3f s (%.0f files/s) uncompressed %.1f MB\n", "process", cache, tarElapsed,
+           files.count / tarElapsed, tarBytes / 1e6);
+    arenaDestroy(&arena);
+    freeFileList(&files);
+}
+
+static const char* benchExtensions[BENCH_EXTENSION_COUNT] = { "txt", "c", "h", "pdf", "jpg", "log", "md", "csv" };
+
+// xorshift64*: small, fast and identical on every platform
+static unsigned long long nextRandom(unsigned long long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+// Uniform in [0, 1)
+static double randomUnit(unsigned long long* state) {
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Log-uniform between minimum and maximum, so most files are small and a few are large, like a real home directory
+static long randomLogUniform(unsigned long long* state, long minimum, long maximum) {
+    if (maximum <= minimum) return minimum;
+    double logMinimum = log((double)minimum), logMaximum = log((double)maximum);
+    return (long)exp(logMinimum + randomUnit(state) * (logMaximum - logMinimum));
+}
+
+// Reads "--name value" options after the positional arguments; returns -1 on an unknown option
+int parseBenchOptions(int argc, char* argv[], int first, const char* const* names, long* values, const char** texts) {
+    for (int i = first; i < argc; i++) {
+        int known = 0;
+        for (int option = 0; names[option] && !known; option++) {
+            if (strcmp(argv[i], names[option]) != 0 || i + 1 >= argc) continue;
+            if (texts) texts[option] = argv[i + 1];
+            values[option] = atol(argv[i + 1]);
+            known = 1;
+        }
+        if (!known) return -1;
+        i++;
+    }
+    return 0;
+}
+
+// Builds a reproducible synthetic home tree: fileCount files spread over up to depth directory levels,
+// sizes log-uniform between minSize and maxSize, mtimes spread over days after BENCH_EPOCH.
+// Half of the files sit directly in the root, where w24ft and w24fdb look, and most of the rest one level down
+int makeHomeTree(const char* rootPath, long fileCount, long depth, long minSize, long maxSize, long days,
+                 unsigned long long seed) {
+    if (depth < 1) depth = 1;
+    if (days < 1) days = 1;
+    mkdir(rootPath, 0775);
+    unsigned long long state = seed ? seed : 1;
+    unsigned char* content = malloc(maxSize > 0 ? maxSize : 1);
+    if (!content) return -1;
+
+    char directory[1024], path[1100];
+    unsigned long long totalBytes = 0;
+    for (long i = 0; i < fileCount; i++) {
+        // Depth 1 for half of the files, then each deeper level gets half of what is left
+        long fileDepth = 1;
+        while (fileDepth < depth && (nextRandom(&state) & 1)) fileDepth++;
+
+        int length = snprintf(directory, sizeof(directory), "%s", rootPath);
+        for (long level = 1; level < fileDepth; level++) {
+            length += snprintf(directory + length, sizeof(directory) - length, "/dir%02llu",
+                               nextRandom(&state) % BENCH_SUBDIRECTORIES);
+            mkdir(directory, 0775);
+        }
+        snprintf(path, sizeof(path), "%s/file%06ld.%s", directory, i, benchExtensions[i % BENCH_EXTENSION_COUNT]);
+
+        // Words from a small alphabet compress about as well as text
+        long size = randomLogUniform(&state, minSize, maxSize);
+        for (long byte = 0; byte < size; byte++) {
+            content[byte] = (byte % 8 == 7) ? ' ' : 'a' + nextRandom(&state) % 16;
+        }
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+            perror(path);
+            free(content);
+            return -1;
+        }
+        fwrite(content, 1, size, file);
+        fclose(file);
+        totalBytes += size;
+
+        struct timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = BENCH_EPOCH + (time_t)(nextRandom(&state) % (days * 86400));
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        utimensat(AT_FDCWD, path, times, 0);
+    }
+    free(content);
+    printf("Created %ld files (%.1f MB) up to depth %ld in %s\n", fileCount, totalBytes / 1e6, depth, rootPath);
+    return 0;
+}
+
+static const char* loadKindNames[LOAD_KINDS] = {
+    "w24fn", "dirlist-a", "dirlist-t", "w24fz", "w24ft", "w24fdb", "w24fda"
+};
+
+// One connection's thread and the samples it collected
+typedef struct {
+    LoadConfig* config;
+    int index;
+    LoadSample* samples;
+    size_t count;
+    size_t capacity;
+} LoadThread;
+
+// Parses "name=weight,..." into per-command weights
+static int parseLoadMix(const char* mix, LoadConfig* config) {
+    memset(config->weights, 0, sizeof(config->weights));
+    config->totalWeight = 0;
+    char copy[512];
+    snprintf(copy, sizeof(copy), "%s", mix);
+    for (char* item = strtok(copy, ","); item; item = strtok(NULL, ",")) {
+        char* equals = strchr(item, '=');
+        if (!equals) return -1;
+        *equals = '\0';
+        int kind = -1;
+        for (int i = 0; i < LOAD_KINDS; i++) {
+            if (strcmp(item, loadKindNames[i]) == 0) kind = i;
+        }
+        if (kind < 0 || atoi(equals + 1) < 0) return -1;
+        config->weights[kind] = atoi(equals + 1);
+        config->totalWeight += config->weights[kind];
+    }
+    return config->totalWeight > 0 ? 0 : -1;
+}
+
+// Formats a date within the synthetic tree's mtime range
+static void randomBenchDate(unsigned long long* state, const LoadConfig* config, char* buffer, size_t bufferSize) {
+    time_t when = BENCH_EPOCH + (time_t)(nextRandom(state) % (config->days * 86400));
+    struct tm date;
+    gmtime_r(&when, &date);
+    strftime(buffer, bufferSize, "%Y-%m-%d", &date);
+}
+
+// Picks a command from the mix and writes its text
+static LoadKind makeLoadCommand(unsigned long long* state, const LoadConfig* config, char* command, size_t commandSize) {
+    int pick = nextRandom(state) % config->totalWeight;
+    int kind = 0;
+    while (pick >= config->weights[kind]) pick -= config->weights[kind++];
+
+    char date[16];
+    long size;
+    switch (kind) {
+    case LOAD_W24FN: {
+        long file = nextRandom(state) % config->fileCount;
+        snprintf(command, commandSize, "w24fn file%06ld.%s", file, benchExtensions[file % BENCH_EXTENSION_COUNT]);
+        break;
+    }
+    case LOAD_DIRLIST_A:
+        snprintf(command, commandSize, "dirlist -a");
+        break;
+    case LOAD_DIRLIST_T:
+        snprintf(command, commandSize, "dirlist -t");
+        break;
+    case LOAD_W24FZ:
+        size = randomLogUniform(state, config->minSize, config->maxSize);
+        snprintf(command, commandSize, "w24fz %ld %ld", size, size * 2);
+        break;
+    case LOAD_W24FT:
+        snprintf(command, commandSize, "w24ft %s %s", benchExtensions[nextRandom(state) % BENCH_EXTENSION_COUNT],
+                 benchExtensions[nextRandom(state) % BENCH_EXTENSION_COUNT]);
+        break;
+    case LOAD_W24FDB:
+        randomBenchDate(state, config, date, sizeof(date));
+        snprintf(command, commandSize, "w24fdb %s", date);
+        break;
+    default:
+        randomBenchDate(state, config, date, sizeof(date));
+        snprintf(command, commandSize, "w24fda %s", date);
+        break;
+    }
+    return kind;
+}
+
+// Sends one text command as a binary request and reads its reply, returning flow-control credit as data
+// arrives. Returns 0 when the reply was complete, 1 when the server answered with an error, -1 on failure
+static int runLoadRequest(int socketDescriptor, uint32_t requestId, const char* command, LoadSample* sample) {
+    FrameHeader header = { WIRE_VERSION, OP_TEXT_COMMAND, 0, requestId, strlen(command) };
+    double start = currentTimeSeconds();
+    if (sendFrame(socketDescriptor, &header, command, 0) != 0) return -1;
+
+    char buffer[65536];
+    unsigned long long unacknowledged = 0;
+    int first = 1;
+    while (receiveFrameHeader(socketDescriptor, &header) == 0) {
+        if (first) {
+            sample->firstByte = currentTimeSeconds() - start;
+            first = 0;
+        }
+        unsigned long long remaining = header.length;
+        while (remaining > 0) {
+            size_t wanted = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+            if (recvAll(socketDescriptor, buffer, wanted) != 0) return -1;
+            remaining -= wanted;
+        }
+        if (header.requestId != requestId) continue;
+        sample->bytes += header.length;
+
+        switch (header.opcode) {
+        case RESP_DATA:
+            unacknowledged += header.length;
+            if (unacknowledged >= INITIAL_STREAM_WINDOW / 4) {
+                unsigned char credit[8];
+                for (int i = 0; i < 8; i++) credit[i] = unacknowledged >> (56 - 8 * i);
+                FrameHeader update = { WIRE_VERSION, OP_WINDOW_UPDATE, 0, requestId, sizeof(credit) };
+                if (sendFrame(socketDescriptor, &update, credit, 0) != 0) return -1;
+                unacknowledged = 0;
+            }
+            break;
+        case RESP_TEXT:
+        case RESP_END:
+            sample->latency = currentTimeSeconds() - start;
+            return 0;
+        case RESP_ERROR:
+            sample->latency = currentTimeSeconds() - start;
+            return 1;
+        default:
+            break;
+        }
+    }
+    return -1;
+}
+
+// Load thread: one connection issuing requests back to back, reconnecting if the server drops it
+void* loadThread(void* argument) {
+    LoadThread* thread = argument;
+    LoadConfig* config = thread->config;
+    unsigned long long state = config->seed * 7919 + thread->index + 1;
+    int socketDescriptor = -1;
+    uint32_t requestId = 0;
+    char command[256];
+
+    for (long i = 0; config->requestsPerConnection ? i < config->requestsPerConnection
+                                                   : currentTimeSeconds() < config->deadline; i++) {
+        if (socketDescriptor < 0) socketDescriptor = connectToServer(config->serverIP, config->serverPort);
+        if (thread->count == thread->capacity) {
+            thread->capacity = thread->capacity ? thread->capacity * 2 : 1024;
+            thread->samples = realloc(thread->samples, thread->capacity * sizeof(LoadSample));
+        }
+        LoadSample* sample = &thread->samples[thread->count++];
+        memset(sample, 0, sizeof(LoadSample));
+        sample->kind = makeLoadCommand(&state, config, command, sizeof(command));
+
+        int result = socketDescriptor < 0 ? -1 : runLoadRequest(socketDescriptor, ++requestId, command, sample);
+        if (result < 0) {
+            sample->failed = 1;
+            if (socketDescriptor >= 0) close(socketDescriptor);
+            socketDescriptor = -1;
+            if (!config->requestsPerConnection) usleep(10000);  // Do not spin on a server that refuses connections
+        }
+        sample->refused = result == 1;
+    }
+    if (socketDescriptor >= 0) {
+        FrameHeader quit = { WIRE_VERSION, OP_QUIT, 0, ++requestId, 0 };
+        sendFrame(socketDescriptor, &quit, NULL, 0);
+        close(socketDescriptor);
+    }
+    return NULL;
+}
+
+static int compareFloats(const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Prints {"p50":..,"p99":..,"p999":..,"mean":..,"max":..} in milliseconds; sorts values
+static void printLatencyJson(float* values, size_t count) {
+    if (count == 0) {
+        printf("{\"p50\": null, \"p99\": null, \"p999\": null, \"mean\": null, \"max\": null}");
+        return;
+    }
+    qsort(values, count, sizeof(float), compareFloats);
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) sum += values[i];
+    const double quantiles[3] = { 0.50, 0.99, 0.999 };
+    double result[3];
+    for (int q = 0; q < 3; q++) {
+        size_t rank = (size_t)ceil(quantiles[q] * count);  // Nearest-rank percentile
+        result[q] = values[rank > 0 ? rank - 1 : 0] * 1000.0;
+    }
+    printf("{\"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"mean\": %.3f, \"max\": %.3f}",
+           result[0], result[1], result[2], sum / count * 1000.0, values[count - 1] * 1000.0);
+}
+
+// Prints the counts and latency distributions of the successful samples of one kind, or of all when kind < 0
+static void printLoadSummaryJson(const LoadSample* samples, size_t count, int kind, float* scratch) {
+    size_t completed = 0, refused = 0, failed = 0;
+    unsigned long long bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (kind >= 0 && samples[i].kind != kind) continue;
+        if (samples[i].failed) failed++;
+        else if (samples[i].refused) refused++;
+        else completed++;
+        bytes += samples[i].bytes;
+    }
+    printf("{\"completed\": %zu, \"error_replies\": %zu, \"failed\": %zu, \"bytes\": %llu, \"latency_ms\": ",
+           completed, refused, failed, bytes);
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        if ((kind < 0 || samples[i].kind == kind) && !samples[i].failed) scratch[used++] = samples[i].latency;
+    }
+    printLatencyJson(scratch, used);
+    printf(", \"ttfb_ms\": ");
+    used = 0;
+    for (size_t i = 0; i < count; i++) {
+        if ((kind < 0 || samples[i].kind == kind) && !samples[i].failed) scratch[used++] = samples[i].firstByte;
+    }
+    printLatencyJson(scratch, used);
+    printf("}");
+}
+
+// Drives connections concurrent connections with a weighted mix of commands against a server, either for
+// a fixed time or a fixed number of requests per connection, and prints throughput and latency as JSON.
+// Latencies cover replies that arrived in full, including error replies; failed requests are only counted
+void runLoadBenchmark(const char* serverIP, int serverPort, int connections, double seconds, long requestsPerConnection,
+                      const char* mix, const char* label, const LoadConfig* tree) {
+    LoadConfig config = *tree;
+    config.serverIP = serverIP;
+    config.serverPort = serverPort;
+    config.requestsPerConnection = requestsPerConnection;
+    if (parseLoadMix(mix, &config) != 0) {
+        fprintf(stderr, "Bad mix '%s', expected name=weight,... with names w24fn, dirlist-a, dirlist-t, w24fz, w24ft, w24fdb, w24fda\n", mix);
+        return;
+    }
+    if (connections < 1) connections = 1;
+    if (config.fileCount < 1) config.fileCount = 1;
+    if (config.days < 1) config.days = 1;
+
+    pthread_t* threads = calloc(connections, sizeof(pthread_t));
+    LoadThread* results = calloc(connections, sizeof(LoadThread));
+    double start = currentTimeSeconds();
+    config.deadline = start + seconds;
+    for (int i = 0; i < connections; i++) {
+        results[i].config = &config;
+        results[i].index = i;
+        pthread_create(&threads[i], NULL, loadThread, &results[i]);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < connections; i++) {
+        pthread_join(threads[i], NULL);
+        total += results[i].count;
+    }
+    double elapsed = currentTimeSeconds() - start;
+
+    LoadSample* samples = malloc((total ? total : 1) * sizeof(LoadSample));
+    float* scratch = malloc((total ? total : 1) * sizeof(float));
+    size_t count = 0, completed = 0;
+    for (int i = 0; i < connections; i++) {
+        memcpy(samples + count, results[i].samples, results[i].count * sizeof(LoadSample));
+        count += results[i].count;
+        free(results[i].samples);
+    }
+    for (size_t i = 0; i < count; i++) completed += !samples[i].failed;
+
+    printf("{\"label\": \"%s\", \"server\": \"%s:%d\", \"connections\": %d, \"mix\": \"%s\", \"seed\": %llu,\n",
+           label, serverIP, serverPort, connections, mix, config.seed);
+    printf(" \"elapsed_s\": %.3f, \"requests\": %zu, \"throughput_rps\": %.1f,\n", elapsed, count, completed / elapsed);
+    printf(" \"all\": ");
+    printLoadSummaryJson(samples, count, -1, scratch);
+    printf(",\n \"commands\": {");
+    int printed = 0;
+    for (int kind = 0; kind < LOAD_KINDS; kind++) {
+        if (!config.weights[kind]) continue;
+        printf("%s\n  \"%s\": ", printed++ ? "," : "", loadKindNames[kind]);
+        printLoadSummaryJson(samples, count, kind, scratch);
+    }
+    printf("\n }}\n");
+
+    free(samples);
+    free(scratch);
+    free(threads);
+    free(results);
+}
+
+// Runs "stats" on a binary connection and returns the server's malloc_calls counter, or -1 when the reply
+// has none (the server was not built with -DCOUNT_ALLOCATIONS) or the request failed
+static long long readServerAllocations(int socketDescriptor, uint32_t requestId) {
+    FrameHeader header = { WIRE_VERSION, OP_TEXT_COMMAND, 0, requestId, 5 };
+    if (sendFrame(socketDescriptor, &header, "stats", 0) != 0) return -1;
+
+    char reply[65536];
+    size_t used = 0;
+    while (receiveFrameHeader(socketDescriptor, &header) == 0) {
+        unsigned long long remaining = header.length;
+        while (remaining > 0) {
+            char discard[4096];
+            size_t room = sizeof(reply) - 1 - used;
+            char* target = header.requestId == requestId && room > 0 ? reply + used : discard;
+            size_t wanted = target == discard ? sizeof(discard) : room;
+            if (wanted > remaining) wanted = remaining;
+            if (recvAll(socketDescriptor, target, wanted) != 0) return -1;
+            if (target != discard) used += wanted;
+            remaining -= wanted;
+        }
+        if (header.requestId != requestId) continue;
+        if (header.opcode == RESP_TEXT || header.opcode == RESP_END || header.opcode == RESP_ERROR) break;
+    }
+    reply[used] = '\0';
+    const char* line = strstr(reply, "malloc_calls ");
+    return line ? atoll(line + strlen("malloc_calls ")) : -1;
+}
+
+// Measures how many mallocs the server makes per request of each command in the mix, on one connection:
+// each command first runs warmup times so pools and arenas reach their working size, then requests times
+// between two reads of the server's malloc counter. A steady-state server reports 0 for every command; a
+// stray count can remain when requests first overlap and the server makes another arena, which more warmup
+// settles. Exits non-zero when any command allocates, so it can gate a build
+int runAllocationBenchmark(const char* serverIP, int serverPort, long requests, long warmup, const char* mix,
+                           const LoadConfig* tree) {
+    LoadConfig config = *tree;
+    if (parseLoadMix(mix, &config) != 0) {
+        fprintf(stderr, "Bad mix '%s', expected name=weight,... with names w24fn, dirlist-a, dirlist-t, w24fz, w24ft, w24fdb, w24fda\n", mix);
+        return 1;
+    }
+    if (config.fileCount < 1) config.fileCount = 1;
+    if (config.days < 1) config.days = 1;
+    if (requests < 1) requests = 1;
+
+    int socketDescriptor = connectToServer(serverIP, serverPort);
+    if (socketDescriptor < 0) return 1;
+    uint32_t requestId = 0;
+    unsigned long long state = config.seed * 7919 + 1;
+    int allocating = 0;
+    char command[256];
+
+    printf("{\"server\": \"%s:%d\", \"requests\": %ld, \"warmup\": %ld, \"mallocs_per_request\": {", serverIP,
+           serverPort, requests, warmup);
+    int printed = 0;
+    for (int kind = 0; kind < LOAD_KINDS; kind++) {
+        if (!config.weights[kind]) continue;
+        LoadConfig only = config;
+        memset(only.weights, 0, sizeof(only.weights));
+        only.weights[kind] = only.totalWeight = 1;
+
+        LoadSample sample;
+        int failed = 0;
+        for (long i = 0; i < warmup && !failed; i++) {
+            makeLoadCommand(&state, &only, command, sizeof(command));
+            memset(&sample, 0, sizeof(sample));
+            failed = runLoadRequest(socketDescriptor, ++requestId, command, &sample) < 0;
+        }
+        // The stats request is warmed up too: what it does after reading the counter lands in the window
+        if (!failed) readServerAllocations(socketDescriptor, ++requestId);
+        long long before = failed ? -1 : readServerAllocations(socketDescriptor, ++requestId);
+        for (long i = 0; i < requests && before >= 0 && !failed; i++) {
+            makeLoadCommand(&state, &only, command, sizeof(command));
+            memset(&sample, 0, sizeof(sample));
+            failed = runLoadRequest(socketDescriptor, ++requestId, command, &sample) < 0;
+        }
+        long long after = failed || before < 0 ? -1 : readServerAllocations(socketDescriptor, ++requestId);
+        if (before < 0 || after < 0) {
+            printf("%s\n  \"%s\": null", printed++ ? "," : "", loadKindNames[kind]);
+            fprintf(stderr, "%s: %s\n", loadKindNames[kind], failed ? "request failed"
+                                        : "no malloc_calls in stats; build the server with -DCOUNT_ALLOCATIONS");
+            allocating = 1;
+            break;
+        }
+        printf("%s\n  \"%s\": %.2f", printed++ ? "," : "", loadKindNames[kind], (double)(after - before) / requests);
+        allocating |= after != before;
+    }
+    printf("\n}}\n");
+
+    FrameHeader quit = { WIRE_VERSION, OP_QUIT, 0, ++requestId, 0 };
+    sendFrame(socketDescriptor, &quit, NULL, 0);
+    close(socketDescriptor);
+    return allocating;
+}
+
+// Replies slower than this most likely waited on a delayed ACK, whose shortest timeout on Linux is 40 ms
+#define STALL_SECONDS 0.035
+#define LATENCY_PROBES 5
+
+// One command the latency benchmark times
+typedef struct {
+    const char* name;
+    char command[256];
+    int chunked;     // The text-mode reply is chunks and a terminator rather than one message
+    int textOnly;    // Binary requests would take the same path as another probe
+} LatencyProbe;
+
+// Sends one text command on a text-mode connection and reads its whole reply; returns 0 on success
+static int runTextRequest(int socketDescriptor, const LatencyProbe* probe, float* latency, float* firstByte) {
+    double start = currentTimeSeconds();
+    if (sendAll(socketDescriptor, probe->command, strlen(probe->command)) != 0) return -1;
+    if (!probe->chunked) {
+        char reply[BUFFER_SIZE];
+        if (recv(socketDescriptor, reply, sizeof(reply), 0) <= 0) return -1;
+        *latency = *firstByte = currentTimeSeconds() - start;
+        return 0;
+    }
+
+    char buffer[65536];
+    int isError, first = 1;
+    while (1) {
+        long chunkLength = receiveChunkHeader(socketDescriptor, &isError);
+        if (chunkLength < 0) return -1;
+        if (first) {
+            *firstByte = currentTimeSeconds() - start;
+            first = 0;
+        }
+        if (chunkLength == 0) break;
+        while (chunkLength > 0) {
+            long wanted = chunkLength < (long)sizeof(buffer) ? chunkLength : (long)sizeof(buffer);
+            if (recvAll(socketDescriptor, buffer, wanted) != 0) return -1;
+            chunkLength -= wanted;
+        }
+    }
+    *latency = currentTimeSeconds() - start;
+    return 0;
+}
+
+// Prints {"latency_ms": .., "ttfb_ms": .., "stalls": n} for count samples, or null when none succeeded
+static void printProbeJson(float* latency, float* firstByte, size_t count) {
+    if (count == 0) {
+        printf("null");
+        return;
+    }
+    size_t stalls = 0;
+    for (size_t i = 0; i < count; i++) stalls += latency[i] >= STALL_SECONDS;
+    printf("{\"latency_ms\": ");
+    printLatencyJson(latency, count);
+    printf(", \"ttfb_ms\": ");
+    printLatencyJson(firstByte, count);
+    printf(", \"stalls\": %zu}", stalls);
+}
+
+// Times every probe requests times on one connection, in text mode or as binary requests, after warmup
+// untimed runs. Prints the probes as JSON members
+static void runLatencyProbes(const char* serverIP, int serverPort, int binary, const LatencyProbe* probes,
+                             long requests, long warmup, float* latency, float* firstByte) {
+    int socketDescriptor = connectToServer(serverIP, serverPort);
+    uint32_t requestId = 0;
+    int printed = 0;
+    for (int p = 0; p < LATENCY_PROBES; p++) {
+        if (binary && probes[p].textOnly) continue;
+        size_t count = 0;
+        for (long i = 0; i < warmup + requests && socketDescriptor >= 0; i++) {
+            LoadSample sample = {0};
+            int failed;
+            if (binary) {
+                failed = runLoadRequest(socketDescriptor, ++requestId, probes[p].command, &sample) < 0;
+            } else {
+                failed = runTextRequest(socketDescriptor, &probes[p], &sample.latency, &sample.firstByte) != 0;
+            }
+            if (failed) {
+                close(socketDescriptor);
+                socketDescriptor = -1;
+            } else if (i >= warmup) {
+                latency[count] = sample.latency;
+                firstByte[count++] = sample.firstByte;
+            }
+        }
+        printf("%s\n  \"%s\": ", printed++ ? "," : "", probes[p].name);
+        printProbeJson(latency, firstByte, count);
+    }
+    if (socketDescriptor < 0) {
+        fprintf(stderr, "%s connection failed\n", binary ? "Binary" : "Text");
+        return;
+    }
+    if (binary) {
+        FrameHeader quit = { WIRE_VERSION, OP_QUIT, 0, ++requestId, 0 };
+        sendFrame(socketDescriptor, &quit, NULL, 0);
+    } else {
+        send(socketDescriptor, "quitc", 5, 0);
+    }
+    close(socketDescriptor);
+}
+
+// Measures the round trip of replies that need several writes, one request at a time, where the server's
+// socket options show most: a lookup, a listing, an archive that matches nothing (an error reply) and a small
+// archive, in text mode and as binary requests, and connection setup up to the first reply. Replies held back
+// by Nagle's algorithm and a delayed ACK show as stalls of 40 ms or more; compare runs against servers started
+// with "--nodelay no", "--cork no" or several "--accept-loops"
+void runLatencyBenchmark(const char* serverIP, int serverPort, long requests, long warmup, const char* file,
+                         const char* archiveCommand) {
+    if (requests < 1) requests = 1;
+    if (warmup < 0) warmup = 0;
+    LatencyProbe probes[LATENCY_PROBES] = {
+        { "w24fn", "", 0, 0 },
+        { "w24fn-missing", "w24fn no-such-file.none", 0, 1 },
+        { "dirlist", "dirlist -a", 1, 0 },
+        { "no-match", "w24fdb 1970-01-02", 1, 0 },
+        { "archive", "", 1, 0 },
+    };
+    snprintf(probes[0].command, sizeof(probes[0].command), "w24fn %s", file);
+    snprintf(probes[4].command, sizeof(probes[4].command), "%s", archiveCommand);
+
+    float* latency = malloc(requests * sizeof(float));
+    float* firstByte = malloc(requests * sizeof(float));
+    printf("{\"server\": \"%s:%d\", \"requests\": %ld, \"warmup\": %ld,\n \"text\": {", serverIP, serverPort,
+           requests, warmup);
+    runLatencyProbes(serverIP, serverPort, 0, probes, requests, warmup, latency, firstByte);
+    printf("\n },\n \"binary\": {");
+    runLatencyProbes(serverIP, serverPort, 1, probes, requests, warmup, latency, firstByte);
+
+    // A fresh connection per lookup: the handshake, accept and the first reply
+    size_t count = 0;
+    for (long i = 0; i < warmup + requests; i++) {
+        LoadSample sample = {0};
+        double start = currentTimeSeconds();
+        int socketDescriptor = connectToServer(serverIP, serverPort);
+        if (socketDescriptor < 0) break;
+        int failed = runTextRequest(socketDescriptor, &probes[0], &sample.latency, &sample.firstByte) != 0;
+        send(socketDescriptor, "quitc", 5, 0);
+        close(socketDescriptor);
+        if (failed) break;
+        if (i >= warmup) {
+            latency[count] = firstByte[count] = currentTimeSeconds() - start;
+            count++;
+        }
+    }
+    printf("\n },\n \"connect\": ");
+    printProbeJson(latency, firstByte, count);
+    printf("}\n");
+    free(latency);
+    free(firstByte);
+}
+
+// Makes a random archive query over a synthetic tree: a size range, a date bound, extensions or a mix,
+// at a random depth limit
+static void makeSelectQuery(unsigned long long* state, const LoadConfig* tree, SearchQuery* query) {
+    memset(query, 0, sizeof(*query));
+    query->maxDepth = nextRandom(state) % 4;  // 0 means unlimited
+    int kind = nextRandom(state) % 5;
+    if (kind == 0 || kind == 4) {
+        query->matchSize = 1;
+        query->minSize = randomLogUniform(state, tree->minSize, tree->maxSize);
+        query->maxSize = query->minSize * 2;
+    }
+    if (kind == 1) {
+        query->matchBefore = 1;
+        query->before = BENCH_EPOCH + (time_t)(nextRandom(state) % (tree->days * 86400));
+    }
+    if (kind == 2 || kind == 4) {
+        query->matchAfter = 1;
+        query->after = BENCH_EPOCH + (time_t)(nextRandom(state) % (tree->days * 86400));
+    }
+    if (kind == 3) {
+        query->extensionCount = 1 + nextRandom(state) % 3;
+        for (int i = 0; i < query->extensionCount; i++) {
+            query->extensions[i] = benchExtensions[nextRandom(state) % BENCH_EXTENSION_COUNT];
+        }
+    }
+}
+
+// True when two sorted match lists hold the same files with the same sizes and mtimes
+static int sameFileLists(const FileList* a, const FileList* b) {
+    if (a->count != b->count) return 0;
+    for (size_t i = 0; i < a->count; i++) {
+        if (strcmp(a->files[i].path, b->files[i].path) != 0 || a->files[i].size != b->files[i].size ||
+            a->files[i].mtime.tv_sec != b->files[i].mtime.tv_sec || a->files[i].mtime.tv_nsec != b->files[i].mtime.tv_nsec) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Indexes a tree (publishing the snapshot in indexDirectory, or a scratch directory), then runs random archive
+// queries through both the index's file table and the walk. Every pair of results must agree; the timings
+// show the difference. With an index directory left by an earlier run, the index starts from its snapshot
+void runSelectBenchmark(const char* directoryPath, long queries, const LoadConfig* tree, const char* indexDirectory) {
+    char sharedDirectory[1024] = "/tmp/benchw24-index-XXXXXX";
+    if (indexDirectory) {
+        snprintf(sharedDirectory, sizeof(sharedDirectory), "%s", indexDirectory);
+        mkdir(sharedDirectory, 0755);
+    } else if (!mkdtemp(sharedDirectory)) {
+        perror("mkdtemp");
+        return;
+    }
+    double start = currentTimeSeconds();
+    if (startFileIndex(directoryPath, sharedDirectory) != 0) return;
+    while (!fileIndexPublished()) usleep(10000);
+    SearchQuery everything = {0};
+    FileList files;
+    if (selectIndexedFiles(&everything, NULL, &files) != 0) {
+        fprintf(stderr, "Index selection failed\n");
+        return;
+    }
+    printf("Index of %zu files published in %.2f s\n", files.count, currentTimeSeconds() - start);
+    freeFileList(&files);
+
+    unsigned long long state = tree->seed * 2654435761ULL + 1;
+    double indexTotal = 0, indexWorst = 0, walkTotal = 0;
+    long matched = 0, mismatches = 0;
+    for (long i = 0; i < queries; i++) {
+        SearchQuery query;
+        FileList indexed, walked;
+        makeSelectQuery(&state, tree, &query);
+
+        double queryStart = currentTimeSeconds();
+        if (selectIndexedFiles(&query, NULL, &indexed) != 0) {
+            fprintf(stderr, "Index selection failed\n");
+            break;
+        }
+        double indexElapsed = currentTimeSeconds() - queryStart;
+        queryStart = currentTimeSeconds();
+        if (collectMatchingFiles(directoryPath, &query, &walked) != 0) {
+            perror(directoryPath);
+            freeFileList(&indexed);
+            break;
+        }
+        walkTotal += currentTimeSeconds() - queryStart;
+
+        indexTotal += indexElapsed;
+        if (indexElapsed > indexWorst) indexWorst = indexElapsed;
+        matched += indexed.count;
+        if (!sameFileLists(&indexed, &walked)) {
+            char key[512];
+            formatQueryKey(&query, key, sizeof(key));
+            fprintf(stderr, "Mismatch for %s: index %zu files, walk %zu files\n", key, indexed.count, walked.count);
+            mismatches++;
+        }
+        freeFileList(&indexed);
+        freeFileList(&walked);
+    }
+
+    printf("index: %ld queries, %ld files matched, %.3f ms mean, %.3f ms worst\n",
+           queries, matched, indexTotal * 1000 / queries, indexWorst * 1000);
+    printf("walk:  %.3f ms mean (%.0fx the index)\n", walkTotal * 1000 / queries, walkTotal / indexTotal);
+    printf("mismatches: %ld\n", mismatches);
+    if (indexDirectory) return;
+
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/.file-index", sharedDirectory);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/.file-index.lock", sharedDirectory);
+    unlink(path);
+    rmdir(sharedDirectory);
+}
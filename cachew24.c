@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "cachew24.h"
+
+#define CACHE_SLOTS 1024
+#define MAX_QUERY_KEY 512
+#define CACHE_TABLE_MAGIC 0x77323443u  // "w24C"
+#define CACHE_TABLE_VERSION 1
+
+// One cached archive. The file is named after keyHash and fingerprint, so its path is not stored
+typedef struct {
+    int inUse;
+    unsigned int keyHash;
+    unsigned long long fingerprint;
+    unsigned long long size;
+    unsigned long long lastUsed;  // Value of the table's use clock at the last hit, for LRU eviction
+    char queryKey[MAX_QUERY_KEY];
+} CacheSlot;
+
+// The cache table lives in a file mapped by every server instance (and forked child) using the directory,
+// so an archive built for one port is a hit on all of them
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    pthread_mutex_t lock;
+    unsigned long long byteBudget;
+    unsigned long long bytesUsed;
+    unsigned long long useClock;
+    unsigned long entryCount;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+    CacheSlot slots[CACHE_SLOTS];
+} CacheTable;
+
+typedef struct {
+    int enabled;
+    char directory[512];
+    CacheTable* table;
+} ArchiveCache;
+
+static ArchiveCache archiveCache;
+
+// FNV-1a hash of a query key
+static unsigned int hashKey(const char* key) {
+    unsigned int hash = 2166136261u;
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void lockTable() {
+    if (pthread_mutex_lock(&archiveCache.table->lock) == EOWNERDEAD) {
+        // Its owner died mid-update; the counters may be slightly off but every slot is still usable
+        pthread_mutex_consistent(&archiveCache.table->lock);
+    }
+}
+
+static void unlockTable() {
+    pthread_mutex_unlock(&archiveCache.table->lock);
+}
+
+static void formatSlotPath(const CacheSlot* slot, char* path, size_t pathSize) {
+    snprintf(path, pathSize, "%s/%08x-%016llx.archive", archiveCache.directory, slot->keyHash, slot->fingerprint);
+}
+
+// Removes an entry from the table and deletes its file; senders holding it open are unaffected
+static void dropEntry(CacheSlot* slot) {
+    char path[1024];
+    formatSlotPath(slot, path, sizeof(path));
+    unlink(path);
+    archiveCache.table->bytesUsed -= slot->size;
+    archiveCache.table->entryCount--;
+    slot->inUse = 0;
+}
+
+// Finds the entry for a query key; caller holds the lock
+static CacheSlot* findEntry(const char* queryKey) {
+    unsigned int keyHash = hashKey(queryKey);
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        CacheSlot* slot = &archiveCache.table->slots[i];
+        if (slot->inUse && slot->keyHash == keyHash && strcmp(slot->queryKey, queryKey) == 0) return slot;
+    }
+    return NULL;
+}
+
+// Least recently used entry, or NULL when the table is empty; caller holds the lock
+static CacheSlot* oldestEntry() {
+    CacheSlot* oldest = NULL;
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        CacheSlot* slot = &archiveCache.table->slots[i];
+        if (slot->inUse && (!oldest || slot->lastUsed < oldest->lastUsed)) oldest = slot;
+    }
+    return oldest;
+}
+
+// Process-shared and robust, so a process dying while holding it does not wedge the others
+static void initTableLock(CacheTable* table) {
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&table->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+// Starts a fresh table; archives left by an earlier run are not in it, so they are removed
+static void resetTable(CacheTable* table, unsigned long long byteBudget) {
+    memset(table, 0, sizeof(CacheTable));
+    initTableLock(table);
+    table->byteBudget = byteBudget;
+    table->version = CACHE_TABLE_VERSION;
+    table->magic = CACHE_TABLE_MAGIC;
+
+    DIR* dir = opendir(archiveCache.directory);
+    if (!dir) return;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+    closedir(dir);
+}
+
+int initArchiveCache(const char* directory, unsigned long long byteBudget) {
+    snprintf(archiveCache.directory, sizeof(archiveCache.directory), "%s", directory);
+    archiveCache.enabled = 0;
+    if (byteBudget == 0) return 0;
+
+    mkdir(directory, 0775);
+
+    char tablePath[1024];
+    snprintf(tablePath, sizeof(tablePath), "%s/.cache-table", directory);
+    int fd = open(tablePath, O_RDWR | O_CREAT | O_CLOEXEC, 0664);
+    if (fd < 0) {
+        perror("Failed to open cache table");
+        return -1;
+    }
+
+    // Every attached instance holds a shared lock for its lifetime, so one that gets the exclusive lock
+    // knows it is alone and may set the table up. Entries from an earlier run are kept: their files are
+    // named after their content and checked against the fingerprint on every hit
+    int alone = flock(fd, LOCK_EX | LOCK_NB) == 0;
+    struct stat fileInfo;
+    int fresh = fstat(fd, &fileInfo) != 0 || fileInfo.st_size != sizeof(CacheTable);
+    if (alone && fresh && ftruncate(fd, sizeof(CacheTable)) != 0) {
+        perror("Failed to size cache table");
+        close(fd);
+        return -1;
+    }
+    if (!alone) flock(fd, LOCK_SH);  // Waits until the instance setting the table up is done
+    CacheTable* table = mmap(NULL, sizeof(CacheTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (table == MAP_FAILED) {
+        perror("Failed to map cache table");
+        close(fd);
+        return -1;
+    }
+    archiveCache.table = table;
+    if (alone) {
+        if (fresh || table->magic != CACHE_TABLE_MAGIC || table->version != CACHE_TABLE_VERSION) {
+            resetTable(table, byteBudget);
+        } else {
+            initTableLock(table);  // Whoever held it last is gone
+            table->byteBudget = byteBudget;
+        }
+        flock(fd, LOCK_SH);
+    }
+    // fd stays open: the shared lock marks this process, and its forked children, as attached
+
+    archiveCache.enabled = 1;
+    return 0;
+}
+
+int archiveCacheEnabled(void) {
+    return archiveCache.enabled;
+}
+
+void setArchiveCacheBudget(unsigned long long byteBudget) {
+    if (!archiveCache.table) {
+        if (byteBudget > 0) initArchiveCache(archiveCache.directory, byteBudget);
+        return;
+    }
+    // A zero budget only stops this instance using the table, which other instances may still share
+    archiveCache.enabled = byteBudget > 0;
+    if (byteBudget == 0) return;
+
+    lockTable();
+    CacheTable* table = archiveCache.table;
+    table->byteBudget = byteBudget;
+    CacheSlot* oldest;
+    while (table->bytesUsed > byteBudget && (oldest = oldestEntry()) != NULL) {
+        dropEntry(oldest);
+        table->evictions++;
+    }
+    unlockTable();
+}
+
+int lookupCachedArchive(const char* queryKey, unsigned long long fingerprint) {
+    if (!archiveCache.enabled) return -1;
+
+    lockTable();
+    CacheTable* table = archiveCache.table;
+    CacheSlot* slot = findEntry(queryKey);
+    int fd = -1;
+    if (slot && slot->fingerprint != fingerprint) {
+        dropEntry(slot);  // Matched files were added, removed or modified since it was built
+        table->invalidations++;
+    } else if (slot) {
+        char path[1024];
+        formatSlotPath(slot, path, sizeof(path));
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) slot->lastUsed = ++table->useClock;
+        else dropEntry(slot);
+    }
+    if (fd >= 0) table->hits++;
+    else table->misses++;
+    unlockTable();
+    return fd;
+}
+
+unsigned long long archiveContentId(const char* queryKey, unsigned long long fingerprint) {
+    unsigned long long hash = 14695981039346656037ULL;  // 64-bit FNV-1a over the key, then the fingerprint
+    for (const char* c = queryKey; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ULL;
+    }
+    for (int i = 0; i < 8; i++) {
+        hash ^= (fingerprint >> (8 * i)) & 0xff;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+int createCacheFile(char* tempPath, size_t tempPathSize) {
+    snprintf(tempPath, tempPathSize, "%s/.building-XXXXXX", archiveCache.directory);
+    return mkostemp(tempPath, O_CLOEXEC);
+}
+
+void storeCachedArchive(const char* queryKey, unsigned long long fingerprint, const char* tempPath) {
+    struct stat fileInfo;
+    CacheTable* table = archiveCache.table;
+    if (strlen(queryKey) >= MAX_QUERY_KEY || stat(tempPath, &fileInfo) != 0 ||
+        (unsigned long long)fileInfo.st_size > table->byteBudget) {
+        unlink(tempPath);  // Larger than the whole budget: not worth caching
+        return;
+    }
+
+    lockTable();
+    CacheSlot* existing = findEntry(queryKey);
+    if (existing) dropEntry(existing);
+
+    // Evict least recently used entries until the archive fits the budget and a slot is free
+    CacheSlot* freeSlot = NULL;
+    while (1) {
+        freeSlot = NULL;
+        for (int i = 0; i < CACHE_SLOTS && !freeSlot; i++) {
+            if (!table->slots[i].inUse) freeSlot = &table->slots[i];
+        }
+        if (freeSlot && table->bytesUsed + fileInfo.st_size <= table->byteBudget) break;
+        CacheSlot* oldest = oldestEntry();
+        if (!oldest) break;
+        dropEntry(oldest);
+        table->evictions++;
+    }
+
+    // Files are named after the query and content they hold, so concurrent builds of the same result coincide
+    freeSlot->keyHash = hashKey(queryKey);
+    freeSlot->fingerprint = fingerprint;
+    char path[1024];
+    formatSlotPath(freeSlot, path, sizeof(path));
+    if (rename(tempPath, path) != 0) {
+        unlockTable();
+        unlink(tempPath);
+        return;
+    }
+    snprintf(freeSlot->queryKey, sizeof(freeSlot->queryKey), "%s", queryKey);
+    freeSlot->size = fileInfo.st_size;
+    freeSlot->lastUsed = ++table->useClock;
+    freeSlot->inUse = 1;
+    table->bytesUsed += fileInfo.st_size;
+    table->entryCount++;
+    unlockTable();
+}
+
+size_t invalidateCachedArchives(int (*affected)(const char* queryKey, void* context), void* context) {
+    if (!archiveCache.enabled) return 0;
+
+    size_t dropped = 0;
+    lockTable();
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        CacheSlot* slot = &archiveCache.table->slots[i];
+        if (!slot->inUse || !affected(slot->queryKey, context)) continue;
+        dropEntry(slot);
+        archiveCache.table->invalidations++;
+        dropped++;
+    }
+    unlockTable();
+    return dropped;
+}
+
+void formatCacheStats(char* buffer, size_t bufferSize) {
+    if (!archiveCache.enabled) {
+        snprintf(buffer, bufferSize, "cache_enabled 0\n");
+        return;
+    }
+    lockTable();
+    CacheTable* table = archiveCache.table;
+    snprintf(buffer, bufferSize,
+             "cache_enabled 1\ncache_hits %lu\ncache_misses %lu\ncache_evictions %lu\ncache_invalidations %lu\n"
+             "cache_entries %lu\ncache_bytes %llu\ncache_budget_bytes %llu\n",
+             table->hits, table->misses, table->evictions, table->invalidations,
+             table->entryCount, table->bytesUsed, table->byteBudget);
+    unlockTable();
+}
@@ -0,0 +1,39 @@
+#ifndef CACHEW24_H
+#define CACHEW24_H
+
+#include <stddef.h>
+
+// Sets up the archive cache in directory with the given byte budget (0 disables caching)
+int initArchiveCache(const char* directory, unsigned long long byteBudget);
+
+// Returns 1 when the cache is enabled
+int archiveCacheEnabled(void);
+
+// Changes the budget of a running cache, evicting least recently used entries down to it; 0 disables
+// caching here, and a budget for a cache that was disabled at startup sets it up in the same directory
+void setArchiveCacheBudget(unsigned long long byteBudget);
+
+// Looks up the archive for a normalized query and matched-set fingerprint.
+// Returns an open read-only fd on a hit, or -1 on a miss; an entry for the same query
+// with an older fingerprint is dropped, since the files it was built from have changed.
+int lookupCachedArchive(const char* queryKey, unsigned long long fingerprint);
+
+// Names the archive built for a query key and fingerprint; equal ids mean byte-identical archives, since
+// the writer is deterministic. Clients quote it to resume a download
+unsigned long long archiveContentId(const char* queryKey, unsigned long long fingerprint);
+
+// Creates a temporary file that a new archive is written into before it is stored
+int createCacheFile(char* tempPath, size_t tempPathSize);
+
+// Moves a finished archive into the cache and evicts least recently used entries to fit the budget
+void storeCachedArchive(const char* queryKey, unsigned long long fingerprint, const char* tempPath);
+
+// Drops every entry for which affected(queryKey, context) returns true, counting them as invalidations, and
+// returns how many were dropped. Used when the file index reports changes, so archives of matched sets that
+// changed stop taking up the budget before their query is repeated
+size_t invalidateCachedArchives(int (*affected)(const char* queryKey, void* context), void* context);
+
+// Formats hit/miss/eviction counters and usage as text for the stats command
+void formatCacheStats(char* buffer, size_t bufferSize);
+
+#endif
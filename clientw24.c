@@ -1,3 +1,4 @@
+// Build: gcc -o clientw24 clientw24.c protocolw24.c -pthread
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -8,45 +9,105 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include "protocolw24.h"
 
 #define BUFFER_SIZE 1024
-#define COUNTER_FILE_PATH "client_count.txt"
+#define SERVER_COUNT 3
+#define PROBE_TIMEOUT_MS 500
+#define ARCHIVE_JOB_WEIGHT 4 // An archive in progress costs the server about as much as this many idle connections
+#define DOWNLOAD_DIRECTORY "/home/patel489/w24project"
+
+const int serverPorts[SERVER_COUNT] = { 6969, 6970, 6971 }; // Served by one serverw24 or by separate instances
 
 int globalSocket = -1; // Global socket descriptor, accessible across different functions for network operations
+uint32_t nextRequestId = 1; // Tags each request so its reply frames can be matched to it
+
+// What a server reported to the load probe, and the probe connection, kept open for the chosen server
+typedef struct {
+    int port;
+    int socket;
+    long activeConnections;
+    long archiveJobs;
+    long cpuLoadPermille;
+} ServerCandidate;
+
+// A request whose reply is still arriving. Requests are pipelined: the prompt returns as soon as one is sent,
+// and a receiver thread sorts the interleaved reply frames by request id
+typedef struct {
+    uint32_t requestId;
+    int active;
+    int finishing;
+    int archive;
+    int discard;                        // The server refused or failed the request, so a partial archive is useless
+    char command[BUFFER_SIZE];          // As typed, to recognize the same command run again
+    FILE* file;                         // Archive being downloaded, written to partialPath until it is complete
+    char fullPath[1024];
+    char partialPath[1024];
+    unsigned long long contentId;       // Names the archive's exact contents, so a broken download can be resumed
+    int resuming;                       // Asked for the rest of an earlier partial download
+    long long resumeOffset;
+    long long totalReceived;
+    FILE* output;                       // Text of the reply, printed whole once it is complete
+    char* outputText;
+    size_t outputLength;
+    unsigned long long unacknowledged;  // Data consumed since the last window update
+} PendingRequest;
+
+PendingRequest pendingRequests[MAX_STREAMS_PER_CONNECTION];
+pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER; // Guards the active flags and connectionLost
+pthread_cond_t pendingChanged = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t sendLock = PTHREAD_MUTEX_INITIALIZER;    // Requests and window updates are sent from two threads
+pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;  // Keeps each reply's output in one piece
+int connectionLost = 0;
 
 // Function declarations
 void handleSIGINT(int signalNumber);
-void resetClientCounters();
-void incrementClientCounter(int *currentCount);
-int calculateServerPort(int clientCount);
+int connectWithTimeout(const char* serverIP, int serverPort, int timeoutMs);
+int probeServer(const char* serverIP, ServerCandidate* candidate);
+double serverScore(const ServerCandidate* candidate);
+int connectToLeastLoadedServer(const char* serverIP, int* serverPort);
 void initiateServerRequest(const char* serverIP, int serverPort);
-void processServerResponse();
-void downloadFile(const char *fileName, int socketDescriptor);
+int commandInPath(const char* program);
+unsigned acceptedCodecMask();
+int extractCodecOption(char* command, unsigned char* prefix);
+int sendRequest(int socketDescriptor, char* command, PendingRequest* request);
+int copyPayload(int socketDescriptor, unsigned long long length, FILE* output);
+unsigned long long readUint64(const unsigned char* data);
+int findPartialDownload(PendingRequest* request);
+void savePartialDownload(const PendingRequest* request);
+FILE* openDownloadFile(PendingRequest* request, const char* baseName, int wireCodec, unsigned long long startOffset);
+PendingRequest* beginPendingRequest(uint32_t requestId);
+PendingRequest* findPendingRequest(uint32_t requestId);
+void finishPendingRequest(PendingRequest* request, int completed);
+void waitForPendingRequests();
+void returnCredit(int socketDescriptor, PendingRequest* request);
+void* receiveReplies(void* argument);
 void validateDirectory(const char* directoryPath);
 
 int main(int argc, char *argv[]) {
     // It will verify the right number of command-line args
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: %s <server IP> [--reset]\n", argv[0]);
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <server IP>\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    // Handle the '--reset' command-line argument to reset the client counter
-    if (argc == 3 && strcmp(argv[2], "--reset") == 0) {
-        resetClientCounters();
-        return 0;
-    }
-
     // Setup a signal handler for SIGINT to allow for graceful termination
     signal(SIGINT, handleSIGINT);
 
-    // Variable to store the number of clients that have connected to the server
-    int clientCount;
-    incrementClientCounter(&clientCount);
-
-    // Extract the server IP from command-line arguments and determine the server port based on the client count
+    // Connect to whichever of the server ports reports the least load
     const char* serverIP = argv[1];
-    int serverPort = calculateServerPort(clientCount);
+    int serverPort;
+    globalSocket = connectToLeastLoadedServer(serverIP, &serverPort);
+    if (globalSocket < 0) {
+        fprintf(stderr, "No server is reachable at %s\n", serverIP);
+        exit(EXIT_FAILURE);
+    }
 
     // Initiate a request to the server with the determined IP and port
     initiateServerRequest(serverIP, serverPort);
@@ -62,148 +123,554 @@ void handleSIGINT(int signalNumber) {
     exit(0);
 }
 
-void resetClientCounters() {
-    // Open the client count file for writing to reset its value
-    FILE *file = fopen(COUNTER_FILE_PATH, "w");
-    if (!file) {
-        perror("Failed to open client count file for reset");
-        exit(EXIT_FAILURE);
+int connectWithTimeout(const char* serverIP, int serverPort, int timeoutMs) {
+    // Connect without waiting on a dead host for the kernel's full SYN retry period
+    struct sockaddr_in serverAddr = {0};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = inet_addr(serverIP);
+    serverAddr.sin_port = htons(serverPort);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) return -1;
+    int flags = fcntl(sock, F_GETFL);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    int result = connect(sock, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
+    if (result < 0 && errno == EINPROGRESS) {
+        struct pollfd pending = { sock, POLLOUT, 0 };
+        int error = 0;
+        socklen_t errorLength = sizeof(error);
+        if (poll(&pending, 1, timeoutMs) == 1 && getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0) {
+            result = error == 0 ? 0 : -1;
+        }
+    }
+    if (result < 0) {
+        close(sock);
+        return -1;
     }
-    fprintf(file, "0"); // Reset counter to zero
-    fclose(file);
-    printf("Client counter has been reset.\n");
+    fcntl(sock, F_SETFL, flags);
+    return sock;
 }
 
-void incrementClientCounter(int *count) {
-    // Attempt to open the client count file for reading and writing
-    FILE *file = fopen(COUNTER_FILE_PATH, "r+");
-    if (!file) {
-        // If opening fails, attempt to create the file
-        file = fopen(COUNTER_FILE_PATH, "w+");
-        if (!file) {
-            perror("Failed to access client count file");
-            exit(EXIT_FAILURE);
-        }
+int probeServer(const char* serverIP, ServerCandidate* candidate) {
+    // Ask one server for its load; the connection stays open in case this server is chosen
+    candidate->socket = connectWithTimeout(serverIP, candidate->port, PROBE_TIMEOUT_MS);
+    if (candidate->socket < 0) return -1;
+
+    struct timeval timeout = { PROBE_TIMEOUT_MS / 1000, (PROBE_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(candidate->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    FrameHeader header = { WIRE_VERSION, OP_LOAD, 0, nextRequestId++, 0 };
+    char reply[BUFFER_SIZE] = {0};
+    int answered = sendFrame(candidate->socket, &header, NULL, 0) == 0 &&
+                   receiveFrameHeader(candidate->socket, &header) == 0 &&
+                   header.opcode == RESP_TEXT && header.length < sizeof(reply) &&
+                   recvAll(candidate->socket, reply, header.length) == 0;
+    if (!answered) {
+        close(candidate->socket); // A server too slow to answer the probe is treated as down
+        candidate->socket = -1;
+        return -1;
     }
-    // Read the current count, increment it, and write it back
-    if (fscanf(file, "%d", count) != 1) {
-        *count = 0; // Default to zero if the file is empty or unreadable
+    struct timeval noTimeout = { 0, 0 };
+    setsockopt(candidate->socket, SOL_SOCKET, SO_RCVTIMEO, &noTimeout, sizeof(noTimeout));
+
+    // Lines of "key value"; keys this client does not know are ignored
+    char key[64];
+    long value;
+    for (char* line = reply; sscanf(line, "%63s %ld", key, &value) == 2; line += strcspn(line, "\n") + 1) {
+        if (strcmp(key, "active_connections") == 0) candidate->activeConnections = value;
+        else if (strcmp(key, "archive_jobs") == 0) candidate->archiveJobs = value;
+        else if (strcmp(key, "cpu_load_permille") == 0) candidate->cpuLoadPermille = value;
+        if (!strchr(line, '\n')) break;
     }
-    (*count)++;
-    fseek(file, 0, SEEK_SET);
-    fprintf(file, "%d", *count);
-    fclose(file);
+    return 0;
 }
 
-int calculateServerPort(int clientCount) {
-    // Determine the appropriate server port based on the number of clients
-    const int basePort = 6969;
-    if (clientCount <= 3) return basePort; // Main server for first 3 clients
-    else if (clientCount <= 6) return basePort + 1; // First mirror for next 3 clients
-    else if (clientCount <= 9) return basePort + 2; // Second mirror for next 3 clients
-    else return basePort + ((clientCount - 1) % 3); // Use round-robin distribution for any additional clients
+double serverScore(const ServerCandidate* candidate) {
+    // Lower is better: work queued on the server, scaled up as its CPUs get busy
+    double work = 1 + candidate->activeConnections + ARCHIVE_JOB_WEIGHT * candidate->archiveJobs;
+    return work * (1000 + candidate->cpuLoadPermille);
 }
 
-void initiateServerRequest(const char* serverIP, int serverPort) {
-    // Setup and connect to the server using TCP
-    struct sockaddr_in serverAddr;
-    globalSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (globalSocket == -1) {
-        perror("Failed to create socket");
-        exit(EXIT_FAILURE);
+int connectToLeastLoadedServer(const char* serverIP, int* serverPort) {
+    // Power of two choices: probe two servers picked at random and keep the less loaded one.
+    // Servers that do not answer are skipped and the next one in the random order is probed instead
+    ServerCandidate candidates[SERVER_COUNT];
+    int order[SERVER_COUNT];
+    srand(time(NULL) ^ getpid());
+    for (int i = 0; i < SERVER_COUNT; i++) {
+        order[i] = i;
+        candidates[i] = (ServerCandidate){ .port = serverPorts[i], .socket = -1 };
+    }
+    for (int i = SERVER_COUNT - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
     }
 
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = inet_addr(serverIP);
-    serverAddr.sin_port = htons(serverPort);
+    ServerCandidate* best = NULL;
+    int answered = 0;
+    for (int i = 0; i < SERVER_COUNT && answered < 2; i++) {
+        ServerCandidate* candidate = &candidates[order[i]];
+        if (probeServer(serverIP, candidate) != 0) {
+            printf("Server on port %d is not responding, trying another.\n", candidate->port);
+            continue;
+        }
+        answered++;
+        if (!best || serverScore(candidate) < serverScore(best)) best = candidate;
+    }
 
-    if (connect(globalSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
-        perror("Connection to server failed");
-        exit(EXIT_FAILURE);
+    // Close the probe connections of the servers not chosen
+    for (int i = 0; i < SERVER_COUNT; i++) {
+        if (candidates[i].socket < 0 || &candidates[i] == best) continue;
+        FrameHeader quit = { WIRE_VERSION, OP_QUIT, 0, 0, 0 };
+        sendFrame(candidates[i].socket, &quit, NULL, 0);
+        close(candidates[i].socket);
     }
+    if (!best) return -1;
+
+    printf("Chose port %d: %ld connections, %ld archive jobs, CPU load %ld.%ld%%\n", best->port,
+           best->activeConnections, best->archiveJobs, best->cpuLoadPermille / 10, best->cpuLoadPermille % 10);
+    *serverPort = best->port;
+    return best->socket;
+}
 
+void initiateServerRequest(const char* serverIP, int serverPort) {
+    // The connection to the chosen server is already open in globalSocket
     printf("Connected to %s on port %d. Type your commands below.\n", serverIP, serverPort);
 
-    // Main loop to handle user input and send commands to the server
+    pthread_t receiver;
+    if (pthread_create(&receiver, NULL, receiveReplies, NULL) != 0) {
+        perror("Failed to start the reply receiver");
+        exit(EXIT_FAILURE);
+    }
+
+    // Main loop to handle user input and send commands to the server without waiting for earlier replies
     char command[BUFFER_SIZE];
     while (1) {
-        printf("Enter command ('dirlis -a', 'dirlist -t', 'w2fn <filename>', 'w24fz <size1> <size2>', 'w24ft <extensions>', 'w24fdb <date>', 'w24fda <date>'):- ");
-        fgets(command, BUFFER_SIZE, stdin);
+        printf("Enter command ('dirlist -a', 'dirlist -t', 'w24fn <filename>', 'w24fz <size1> <size2>', 'w24ft <extensions>', 'w24fdb <date>', 'w24fda <date>', archives take [--codec=gzip|zstd|lz4[:level]]):- ");
+        fflush(stdout);
+        if (!fgets(command, BUFFER_SIZE, stdin)) {
+            strcpy(command, "quitc"); // End of input quits like the quitc command
+        }
         command[strcspn(command, "\n")] = 0; // Remove newline character
 
-        if (strncmp(command, "w24fz", 5) == 0 || strncmp(command, "w24ft", 5) == 0 || 
-            strncmp(command, "w24fdb", 6) == 0 || strncmp(command, "w24fda", 6) == 0) {
-            send(globalSocket, command, strlen(command), 0);
-            downloadFile("temp.tar.gz", globalSocket); // Download file from the server
-            continue;
+        if (strcmp(command, "quitc") == 0) {
+            waitForPendingRequests(); // Let every download finish before closing the connection
         }
 
-        send(globalSocket, command, strlen(command), 0);
-
-        if (strcmp(command, "quitc") == 0) {
+        uint32_t requestId = nextRequestId++;
+        PendingRequest* request = beginPendingRequest(requestId); // Registered first, so no reply frame can beat it
+        if (!request) break; // Connection lost
+        snprintf(request->command, sizeof(request->command), "%s", command);
+        int opcode = sendRequest(globalSocket, command, request);
+        if (opcode <= 0 || opcode == OP_QUIT) {
+            finishPendingRequest(request, 0);
+        }
+        if (opcode < 0) {
+            perror("Failed to send request");
+            break;
+        }
+        if (opcode == OP_QUIT) {
             break; // Exit the loop if 'quitc' command is given
         }
-
-        processServerResponse(); // Handle non-file responses from the server
     }
 
-    // Close the socket when done
+    // Close the socket when done; the receiver sees the end of the connection and stops
+    shutdown(globalSocket, SHUT_RDWR);
+    pthread_join(receiver, NULL);
     if (globalSocket != -1) {
         close(globalSocket);
     }
     printf("Connection closed. Exiting client...\n");
 }
 
-void processServerResponse() {
-    // Receive and display the server response
-    char serverReply[BUFFER_SIZE] = {0};
-    ssize_t bytesRead = recv(globalSocket, serverReply, BUFFER_SIZE - 1, 0);
-    if (bytesRead > 0) {
-        serverReply[bytesRead] = '\0'; // Ensure the response is null-terminated
-        printf("Server response:\n%s\n", serverReply);
+int commandInPath(const char* program) {
+    // Check whether an executable is reachable through PATH
+    const char* path = getenv("PATH");
+    char candidate[1024];
+    while (path && *path) {
+        size_t length = strcspn(path, ":");
+        snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)length, path, program);
+        if (access(candidate, X_OK) == 0) return 1;
+        path += length + (path[length] == ':');
+    }
+    return 0;
+}
+
+unsigned acceptedCodecMask() {
+    // gzip is always accepted; zstd and lz4 only when their tools are installed to unpack the archive
+    unsigned mask = 1u << WIRE_CODEC_GZIP;
+    if (commandInPath("zstd")) mask |= 1u << WIRE_CODEC_ZSTD;
+    if (commandInPath("lz4")) mask |= 1u << WIRE_CODEC_LZ4;
+    return mask;
+}
+
+int extractCodecOption(char* command, unsigned char* prefix) {
+    // Fill the archive request prefix, taking an optional "--codec=name[:level]" out of the command
+    static const char* codecNames[] = { "gzip", "zstd", "lz4" }; // Indexed by WIRE_CODEC_*
+    prefix[0] = WIRE_CODEC_NEGOTIATE;
+    prefix[1] = 0;
+    prefix[2] = acceptedCodecMask();
+    prefix[3] = 0;
+
+    char* option = strstr(command, "--codec=");
+    if (!option) return 0;
+    char name[16] = {0};
+    int level = 0;
+    sscanf(option + 8, "%15[^: ]:%d", name, &level);
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, codecNames[i]) == 0) prefix[0] = i;
+    }
+    if (prefix[0] == WIRE_CODEC_NEGOTIATE || level < 0 || level > 255) return -1;
+    prefix[1] = level;
+
+    // Drop the option and the space before it, leaving just the command arguments
+    char* rest = option + strcspn(option, " ");
+    if (option > command && option[-1] == ' ') option--;
+    memmove(option, rest, strlen(rest) + 1);
+    return 0;
+}
+
+int sendRequest(int socketDescriptor, char* command, PendingRequest* request) {
+    // Encode the typed command as a binary request frame; returns the opcode sent, 0 if nothing was sent, -1 on error
+    unsigned char payload[MAX_REQUEST_PAYLOAD];
+    FrameHeader header = { WIRE_VERSION, OP_TEXT_COMMAND, 0, request->requestId, 0 };
+    const char* arguments = NULL;
+
+    int archiveOpcode = 0;
+    if (strncmp(command, "w24fz ", 6) == 0) archiveOpcode = OP_ARCHIVE_BY_SIZE;
+    else if (strncmp(command, "w24ft ", 6) == 0) archiveOpcode = OP_ARCHIVE_BY_TYPE;
+    else if (strncmp(command, "w24fdb ", 7) == 0) archiveOpcode = OP_ARCHIVE_BEFORE;
+    else if (strncmp(command, "w24fda ", 7) == 0) archiveOpcode = OP_ARCHIVE_AFTER;
+
+    if (strcmp(command, "quitc") == 0) {
+        header.opcode = OP_QUIT;
+    } else if (strcmp(command, "dirlist -a") == 0) {
+        header.opcode = OP_LIST_DIRECTORIES;
+    } else if (strcmp(command, "dirlist -t") == 0) {
+        header.opcode = OP_LIST_DIRECTORIES;
+        header.flags = LIST_BY_MTIME;
+    } else if (strcmp(command, "stats") == 0) {
+        header.opcode = OP_STATS;
+    } else if (strncmp(command, "w24fn ", 6) == 0 && command[6]) {
+        header.opcode = OP_FIND_FILE;
+        arguments = command + 6;
+    } else if (archiveOpcode) {
+        if (extractCodecOption(command, payload) != 0) {
+            printf("Unknown codec, expected --codec=gzip|zstd|lz4[:level]\n");
+            return 0;
+        }
+        header.length = ARCHIVE_PREFIX_SIZE;
+        arguments = command + (archiveOpcode == OP_ARCHIVE_BY_SIZE || archiveOpcode == OP_ARCHIVE_BY_TYPE ? 6 : 7);
+
+        // The same command broke off earlier: ask only for the bytes that are not on disk yet
+        if (findPartialDownload(request)) {
+            unsigned long long range[3] = { request->contentId, request->resumeOffset, 0 };
+            for (int field = 0; field < 3; field++) {
+                for (int i = 0; i < 8; i++) payload[header.length + 8 * field + i] = range[field] >> (56 - 8 * i);
+            }
+            header.flags = ARCHIVE_RANGE;
+            header.length += ARCHIVE_RANGE_SIZE;
+        }
+
+        long long size1, size2;
+        if (archiveOpcode != OP_ARCHIVE_BY_SIZE) {
+            header.opcode = archiveOpcode;
+        } else if (sscanf(arguments, "%lld %lld", &size1, &size2) == 2) {
+            header.opcode = archiveOpcode;
+            for (int i = 0; i < 8; i++) {
+                payload[header.length + i] = (unsigned long long)size1 >> (56 - 8 * i);
+                payload[header.length + 8 + i] = (unsigned long long)size2 >> (56 - 8 * i);
+            }
+            header.length += 16;
+            arguments = NULL;
+        } else {
+            header.length = 0; // Malformed sizes go to the server as text so it reports the syntax error
+            header.flags = 0;
+            arguments = command;
+        }
     } else {
-        printf("No response from server or connection error.\n");
+        arguments = command; // Anything else is passed through for the server to answer
     }
+
+    if (arguments) {
+        size_t length = strlen(arguments);
+        if (header.length + length > sizeof(payload)) length = sizeof(payload) - header.length;
+        memcpy(payload + header.length, arguments, length);
+        header.length += length;
+    }
+    pthread_mutex_lock(&sendLock);
+    int result = sendFrame(socketDescriptor, &header, payload, 0);
+    pthread_mutex_unlock(&sendLock);
+    return result == 0 ? header.opcode : -1;
 }
 
-void downloadFile(const char *fileName, int socketDescriptor) {
-    // Ensure the directory exists where the file will be saved
-    validateDirectory("/home/patel489/w24project");
+int copyPayload(int socketDescriptor, unsigned long long length, FILE* output) {
+    // Read a frame payload of any size in pieces, writing it to output (or dropping it when output is NULL)
+    char buffer[BUFFER_SIZE];
+    while (length > 0) {
+        size_t wanted = length < BUFFER_SIZE ? length : BUFFER_SIZE;
+        if (recvAll(socketDescriptor, buffer, wanted) != 0) return -1;
+        if (output) fwrite(buffer, 1, wanted, output);
+        length -= wanted;
+    }
+    return 0;
+}
 
-    // Create the full path for the file
-    char fullPath[1024];
-    snprintf(fullPath, sizeof(fullPath), "/home/patel489/w24project/%s", fileName);
+unsigned long long readUint64(const unsigned char* data) {
+    // Decode a big-endian 64-bit field of a reply
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; i++) value = (value << 8) | data[i];
+    return value;
+}
 
-    // Receive the file size first
-    int fileSize;
-    recv(socketDescriptor, &fileSize, sizeof(fileSize), 0);
+int findPartialDownload(PendingRequest* request) {
+    // Look for a broken download of the same command. Each partial archive ".partial-*" has a ".resume" note
+    // holding its content id and command; deleting the note claims the partial, so only one request resumes it
+    DIR* directory = opendir(DOWNLOAD_DIRECTORY);
+    if (!directory) return 0;
+    struct dirent* entry;
+    char notePath[1100], noteCommand[BUFFER_SIZE];
+    int found = 0;
+    while (!found && (entry = readdir(directory)) != NULL) {
+        size_t nameLength = strlen(entry->d_name);
+        if (strncmp(entry->d_name, ".partial-", 9) != 0 || nameLength < 7 ||
+            strcmp(entry->d_name + nameLength - 7, ".resume") != 0) continue;
+
+        snprintf(notePath, sizeof(notePath), "%s/%s", DOWNLOAD_DIRECTORY, entry->d_name);
+        FILE* note = fopen(notePath, "r");
+        if (!note) continue;
+        unsigned long long contentId = 0;
+        int valid = fscanf(note, "%llx\n", &contentId) == 1 && fgets(noteCommand, sizeof(noteCommand), note);
+        fclose(note);
+        noteCommand[strcspn(noteCommand, "\n")] = 0;
+        if (!valid || strcmp(noteCommand, request->command) != 0) continue;
+
+        // Skip a partial this client is still downloading into: its note was written when the archive began
+        int inProgress = 0;
+        snprintf(request->partialPath, sizeof(request->partialPath), "%.*s", (int)(strlen(notePath) - 7), notePath);
+        pthread_mutex_lock(&pendingLock);
+        for (int i = 0; i < MAX_STREAMS_PER_CONNECTION; i++) {
+            PendingRequest* other = &pendingRequests[i];
+            if (other != request && other->active && strcmp(other->partialPath, request->partialPath) == 0) inProgress = 1;
+        }
+        pthread_mutex_unlock(&pendingLock);
+
+        struct stat partialInfo;
+        if (inProgress || stat(request->partialPath, &partialInfo) != 0 || unlink(notePath) != 0) continue;
+        request->contentId = contentId;
+        request->resumeOffset = partialInfo.st_size;
+        request->resuming = 1;
+        found = 1;
+    }
+    closedir(directory);
+    return found;
+}
 
-    // Open the file in order to write
-    FILE *file = fopen(fullPath, "wb");
+void savePartialDownload(const PendingRequest* request) {
+    // Write the note that lets the same command resume this partial archive later
+    char notePath[1100];
+    snprintf(notePath, sizeof(notePath), "%s.resume", request->partialPath);
+    FILE* note = fopen(notePath, "w");
+    if (!note) return;
+    fprintf(note, "%016llx\n%s\n", request->contentId, request->command);
+    fclose(note);
+}
+
+FILE* openDownloadFile(PendingRequest* request, const char* baseName, int wireCodec, unsigned long long startOffset) {
+    // Ensure the directory exists where the file will be saved, then name the file after the codec
+    static const char* extensions[] = { ".tar.gz", ".tar.zst", ".tar.lz4" }; // Indexed by WIRE_CODEC_*
+    validateDirectory(DOWNLOAD_DIRECTORY);
+    snprintf(request->fullPath, sizeof(request->fullPath), "%s/%s%s", DOWNLOAD_DIRECTORY, baseName,
+             wireCodec >= 0 && wireCodec < 3 ? extensions[wireCodec] : ".tar");
+
+    // Continue the partial archive when the server sends the rest of it, otherwise start a new one.
+    // Either way the archive stays a hidden partial file until the last byte arrives
+    FILE* file = NULL;
+    if (request->resuming && startOffset == (unsigned long long)request->resumeOffset) {
+        file = fopen(request->partialPath, "r+b");
+        if (file && fseeko(file, startOffset, SEEK_SET) == 0) {
+            request->totalReceived = startOffset;
+            pthread_mutex_lock(&outputLock);
+            printf("\nResuming %s at byte %lld\n", request->fullPath, request->totalReceived);
+            fflush(stdout);
+            pthread_mutex_unlock(&outputLock);
+        }
+    } else {
+        if (request->resuming) remove(request->partialPath);
+        request->resuming = 0;
+        snprintf(request->partialPath, sizeof(request->partialPath), "%s/.partial-XXXXXX", DOWNLOAD_DIRECTORY);
+        int fd = mkstemp(request->partialPath);
+        if (fd >= 0) fchmod(fd, 0644); // mkstemp creates 0600; the finished archive gets the usual mode
+        if (fd >= 0) file = fdopen(fd, "wb");
+    }
     if (!file) {
         perror("Failed to create file on disk");
-        return;
+        return NULL;
     }
+    savePartialDownload(request); // Written up front, so even a killed client leaves a resumable partial
+    return file;
+}
 
-    // Receive the file in chunks and write to the file
-    int totalReceived = 0, bytesReceived;
-    char buffer[BUFFER_SIZE];
-    while (totalReceived < fileSize) {
-        bytesReceived = recv(socketDescriptor, buffer, BUFFER_SIZE, 0);
-        if (bytesReceived > 0) {
-            fwrite(buffer, 1, bytesReceived, file);
-            totalReceived += bytesReceived;
-        } else if (bytesReceived == 0) {
-            break; // Connection closed by server
+PendingRequest* beginPendingRequest(uint32_t requestId) {
+    // Take a free slot for a new request, waiting while the connection already has the most the server allows
+    PendingRequest* request = NULL;
+    pthread_mutex_lock(&pendingLock);
+    while (!connectionLost && !request) {
+        for (int i = 0; i < MAX_STREAMS_PER_CONNECTION && !request; i++) {
+            if (!pendingRequests[i].active) request = &pendingRequests[i];
+        }
+        if (!request) pthread_cond_wait(&pendingChanged, &pendingLock);
+    }
+    if (request) {
+        memset(request, 0, sizeof(PendingRequest));
+        request->requestId = requestId;
+        request->output = open_memstream(&request->outputText, &request->outputLength);
+        request->active = 1;
+    }
+    pthread_mutex_unlock(&pendingLock);
+    return request;
+}
+
+PendingRequest* findPendingRequest(uint32_t requestId) {
+    PendingRequest* request = NULL;
+    pthread_mutex_lock(&pendingLock);
+    for (int i = 0; i < MAX_STREAMS_PER_CONNECTION && !request; i++) {
+        if (pendingRequests[i].active && pendingRequests[i].requestId == requestId) request = &pendingRequests[i];
+    }
+    pthread_mutex_unlock(&pendingLock);
+    return request;
+}
+
+void finishPendingRequest(PendingRequest* request, int completed) {
+    // Print the reply in one piece, or discard it, and free the slot
+    pthread_mutex_lock(&pendingLock);
+    int finishedAlready = request->finishing;
+    request->finishing = 1;
+    pthread_mutex_unlock(&pendingLock);
+    if (finishedAlready) return;
+
+    if (request->output) fclose(request->output);
+    pthread_mutex_lock(&outputLock);
+    if (request->outputLength > 0) {
+        printf("\nServer response:\n%.*s\n", (int)request->outputLength, request->outputText);
+    }
+    if (request->file || request->resuming) {
+        char notePath[1100];
+        snprintf(notePath, sizeof(notePath), "%s.resume", request->partialPath);
+        struct stat partialInfo;
+        if (request->file) fclose(request->file);
+        if (completed && rename(request->partialPath, request->fullPath) == 0) {
+            remove(notePath);
+            printf("\nFile downloaded successfully: %s (%lld bytes)\n", request->fullPath, request->totalReceived);
+        } else if (!completed && !request->discard && stat(request->partialPath, &partialInfo) == 0 && partialInfo.st_size > 0) {
+            savePartialDownload(request); // Cut off, not refused: keep what arrived
+            printf("\nDownload interrupted after %lld bytes; run the same command again to resume it\n",
+                   (long long)partialInfo.st_size);
         } else {
-            perror("File receive error");
-            break;
+            remove(request->partialPath); // Never leave a useless partial archive behind
+            remove(notePath);
+        }
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&outputLock);
+    free(request->outputText);
+
+    pthread_mutex_lock(&pendingLock);
+    request->active = 0;
+    pthread_cond_broadcast(&pendingChanged);
+    pthread_mutex_unlock(&pendingLock);
+}
+
+void waitForPendingRequests() {
+    pthread_mutex_lock(&pendingLock);
+    for (int i = 0; i < MAX_STREAMS_PER_CONNECTION; i++) {
+        while (pendingRequests[i].active && !connectionLost) pthread_cond_wait(&pendingChanged, &pendingLock);
+    }
+    pthread_mutex_unlock(&pendingLock);
+}
+
+void returnCredit(int socketDescriptor, PendingRequest* request) {
+    // Tell the server the data was consumed, a quarter window at a time, so a reply never stalls on a fast client
+    if (request->unacknowledged < INITIAL_STREAM_WINDOW / 4) return;
+    unsigned char payload[8];
+    for (int i = 0; i < 8; i++) payload[i] = request->unacknowledged >> (56 - 8 * i);
+    FrameHeader header = { WIRE_VERSION, OP_WINDOW_UPDATE, 0, request->requestId, sizeof(payload) };
+    pthread_mutex_lock(&sendLock);
+    sendFrame(socketDescriptor, &header, payload, 0);
+    pthread_mutex_unlock(&sendLock);
+    request->unacknowledged = 0;
+}
+
+void* receiveReplies(void* argument) {
+    // Read frames for every request in flight. Lengths are 64-bit, so archives of any size arrive intact
+    int socketDescriptor = globalSocket;
+    FrameHeader header;
+    char baseName[32];
+
+    while (receiveFrameHeader(socketDescriptor, &header) == 0) {
+        PendingRequest* request = findPendingRequest(header.requestId);
+        if (!request) {
+            if (copyPayload(socketDescriptor, header.length, NULL) != 0) break; // Not ours, skip it
+            continue;
+        }
+
+        unsigned char begin[ARCHIVE_BEGIN_SIZE];
+        switch (header.opcode) {
+        case RESP_ARCHIVE_BEGIN:
+            if (header.length != ARCHIVE_BEGIN_SIZE || recvAll(socketDescriptor, begin, sizeof(begin)) != 0) {
+                goto connectionClosed;
+            }
+            request->archive = 1;
+            request->contentId = readUint64(begin + 1);
+            // Archives downloading side by side each get their own file
+            snprintf(baseName, sizeof(baseName), "temp");
+            pthread_mutex_lock(&pendingLock);
+            for (int i = 0; i < MAX_STREAMS_PER_CONNECTION; i++) {
+                if (pendingRequests[i].active && pendingRequests[i].file) {
+                    snprintf(baseName, sizeof(baseName), "temp-%u", request->requestId);
+                }
+            }
+            pthread_mutex_unlock(&pendingLock);
+            request->file = openDownloadFile(request, baseName, begin[0], readUint64(begin + 9));
+            continue;
+        case RESP_DATA:
+            if (copyPayload(socketDescriptor, header.length, request->archive ? request->file : request->output) != 0) {
+                goto connectionClosed;
+            }
+            request->totalReceived += header.length;
+            request->unacknowledged += header.length;
+            returnCredit(socketDescriptor, request);
+            continue;
+        case RESP_TEXT:
+        case RESP_ERROR:
+            if (copyPayload(socketDescriptor, header.length, request->output) != 0) goto connectionClosed;
+            request->discard = 1;
+            finishPendingRequest(request, 0);
+            continue;
+        case RESP_END:
+            finishPendingRequest(request, 1);
+            continue;
+        default:
+            if (copyPayload(socketDescriptor, header.length, NULL) != 0) goto connectionClosed;
+            continue; // Unknown frame types are skipped
         }
     }
 
-    // Close the file and report success
-    fclose(file);
-    printf("File downloaded successfully: %s\n", fullPath);
+connectionClosed:
+    // Whatever is still pending will never complete
+    pthread_mutex_lock(&pendingLock);
+    connectionLost = 1;
+    pthread_cond_broadcast(&pendingChanged);
+    pthread_mutex_unlock(&pendingLock);
+    for (int i = 0; i < MAX_STREAMS_PER_CONNECTION; i++) {
+        if (!pendingRequests[i].active) continue;
+        pthread_mutex_lock(&outputLock);
+        printf("\nNo response from server or connection error.\n");
+        pthread_mutex_unlock(&outputLock);
+        finishPendingRequest(&pendingRequests[i], 0);
+    }
+    return NULL;
 }
 
 void validateDirectory(const char* directoryPath) {
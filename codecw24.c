@@ -0,0 +1,640 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "codecw24.h"
+
+#define OUTPUT_BUFFER_SIZE 65536
+#define LZ4_INPUT_SLICE 65536
+#define PARALLEL_BLOCK_SIZE (128 * 1024)
+#define PARALLEL_OUTPUT_SIZE (PARALLEL_BLOCK_SIZE + PARALLEL_BLOCK_SIZE / 8 + 1024)  // Above deflate's worst case
+#define DICTIONARY_SIZE 32768
+#define PARALLEL_MIN_BYTES (4ULL * 1024 * 1024)
+#define MAX_COMPRESSION_THREADS 64
+
+// Name, extension, level range and default level of each codec
+typedef struct {
+    const char* name;
+    const char* extension;
+    int minLevel;
+    int maxLevel;
+    int defaultLevel;
+} CodecInfo;
+
+static const CodecInfo codecTable[CODEC_COUNT] = {
+    [CODEC_GZIP] = { "gzip", ".tar.gz", 1, 9, 6 },
+    [CODEC_ZSTD] = { "zstd", ".tar.zst", 1, 19, 3 },
+    [CODEC_LZ4] = { "lz4", ".tar.lz4", 1, 12, 1 },
+};
+
+// Codecs tried during negotiation, fastest first
+static const CodecId speedOrder[] = { CODEC_LZ4, CODEC_ZSTD, CODEC_GZIP };
+
+static int compressionThreads = 1;
+static int configuredLevels[CODEC_COUNT];  // Set by setDefaultCompressionLevel; 0 keeps the table's default
+
+// One block of a parallel gzip stream, compressed on the shared pool and emitted in submission order
+typedef struct CompressionJob {
+    struct ParallelGzip* owner;
+    unsigned char* input;
+    size_t inputLength;
+    unsigned char* output;
+    size_t outputLength;
+    unsigned char dictionary[DICTIONARY_SIZE];  // Last 32 KB of the previous block, so matches can span blocks
+    size_t dictionaryLength;
+    unsigned long crc;
+    int last;
+    int done;
+    int failed;
+    struct CompressionJob* nextQueued;
+} CompressionJob;
+
+// pigz-style gzip: the stream is cut into fixed-size blocks that are deflated independently and joined
+// with sync flushes. The output depends only on the input and level, never on the thread count, and at
+// most slotCount blocks (two per thread) are in memory per request.
+typedef struct ParallelGzip {
+    int level;
+    CompressionJob* slots;
+    int slotCount;
+    int oldest;              // Slot of the oldest block not yet written out
+    int inFlight;            // Blocks submitted but not yet written out
+    CompressionJob* filling; // Block receiving input
+    CompressionJob* previous;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    unsigned long crc;
+    unsigned long long totalIn;
+} ParallelGzip;
+
+// Worker threads shared by every request
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    CompressionJob* head;
+    CompressionJob* tail;
+} compressionPool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL };
+static int compressionWorkers;  // Pool threads started so far, under the pool's lock; the pool never shrinks
+
+struct Compressor {
+    CodecId id;
+    CompressedWriteFn write;
+    void* context;
+    z_stream gzip;
+    ParallelGzip* parallel;  // Set instead of gzip for large gzip archives when threads are available
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* zstd;
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_cctx* lz4;
+    LZ4F_preferences_t lz4Preferences;
+    size_t outputCapacity;
+#endif
+    unsigned char* output;
+};
+
+const char* codecName(CodecId id) {
+    return id < CODEC_COUNT ? codecTable[id].name : "unknown";
+}
+
+const char* codecFileExtension(CodecId id) {
+    return id < CODEC_COUNT ? codecTable[id].extension : ".tar";
+}
+
+int codecAvailable(CodecId id) {
+    switch (id) {
+    case CODEC_GZIP:
+        return 1;
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+        return 1;
+#endif
+#ifdef HAVE_LZ4
+    case CODEC_LZ4:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+// Threads a parallel stream of this codec choice compresses on
+static int streamThreads(const CodecChoice* codec) {
+    return codec->threads > 0 ? codec->threads : __atomic_load_n(&compressionThreads, __ATOMIC_RELAXED);
+}
+
+// Resolves level 0 to the codec's default
+static int effectiveLevel(const CodecChoice* codec) {
+    if (codec->level > 0) return codec->level;
+    int configured = __atomic_load_n(&configuredLevels[codec->id], __ATOMIC_RELAXED);
+    return configured > 0 ? configured : codecTable[codec->id].defaultLevel;
+}
+
+void setDefaultCompressionLevel(CodecId id, int level) {
+    if (id >= CODEC_COUNT || level < 0 || level > codecTable[id].maxLevel) return;
+    if (level > 0 && level < codecTable[id].minLevel) return;
+    __atomic_store_n(&configuredLevels[id], level, __ATOMIC_RELAXED);
+}
+
+// Finds a codec by name within the first length characters of text
+static int findCodec(const char* text, size_t length) {
+    for (int id = 0; id < CODEC_COUNT; id++) {
+        if (strlen(codecTable[id].name) == length && strncmp(codecTable[id].name, text, length) == 0) return id;
+    }
+    if (length == 2 && strncmp(text, "gz", 2) == 0) return CODEC_GZIP;
+    return -1;
+}
+
+int parseCodecSpec(const char* spec, CodecChoice* codec) {
+    const char* colon = strchr(spec, ':');
+    int id = findCodec(spec, colon ? (size_t)(colon - spec) : strlen(spec));
+    if (id < 0) return -1;
+
+    codec->id = id;
+    codec->level = 0;
+    codec->threads = 0;
+    if (colon) {
+        char* end;
+        long level = strtol(colon + 1, &end, 10);
+        if (*end != '\0' || level < codecTable[id].minLevel || level > codecTable[id].maxLevel) return -1;
+        codec->level = (int)level;
+    }
+    return 0;
+}
+
+void formatCodecSpec(const CodecChoice* codec, char* buffer, size_t bufferSize) {
+    snprintf(buffer, bufferSize, "%s:%d", codecName(codec->id), effectiveLevel(codec));
+}
+
+// Removes one whitespace-separated token, and the space before it, from a command string
+static void removeToken(char* command, char* token, size_t length) {
+    char* rest = token + length;
+    if (token > command && token[-1] == ' ') token--;
+    memmove(token, rest, strlen(rest) + 1);
+}
+
+int negotiateCodec(char* command, CodecChoice* codec) {
+    int requested = 0, status = 0;
+    unsigned accepted = 0;
+    codec->id = CODEC_GZIP;
+    codec->level = 0;
+
+    char* option;
+    while ((option = strstr(command, "--codec=")) != NULL || (option = strstr(command, "--accept=")) != NULL) {
+        size_t length = strcspn(option, " ");
+        char value[64];
+        int isCodec = strncmp(option, "--codec=", 8) == 0;
+        size_t prefix = isCodec ? 8 : 9;
+        snprintf(value, sizeof(value), "%.*s", (int)(length - prefix), option + prefix);
+
+        if (isCodec) {
+            requested = 1;
+            if (parseCodecSpec(value, codec) != 0 || !codecAvailable(codec->id)) status = -1;
+        } else {
+            // Comma-separated codec names; unknown names are ignored so newer clients keep working
+            for (char* name = value; *name; ) {
+                size_t nameLength = strcspn(name, ",");
+                int id = findCodec(name, nameLength);
+                if (id >= 0) accepted |= 1u << id;
+                name += nameLength + (name[nameLength] == ',');
+            }
+        }
+        removeToken(command, option, length);
+    }
+
+    if (!requested) selectCodec(-1, 0, accepted, codec);
+    codec->threads = __atomic_load_n(&compressionThreads, __ATOMIC_RELAXED);
+    return status;
+}
+
+int selectCodec(int requested, int level, unsigned acceptedMask, CodecChoice* codec) {
+    codec->id = CODEC_GZIP;
+    codec->level = 0;
+    codec->threads = __atomic_load_n(&compressionThreads, __ATOMIC_RELAXED);
+    if (requested >= 0) {
+        if (requested >= CODEC_COUNT || !codecAvailable(requested)) return -1;
+        if (level != 0 && (level < codecTable[requested].minLevel || level > codecTable[requested].maxLevel)) return -1;
+        codec->id = requested;
+        codec->level = level;
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(speedOrder) / sizeof(speedOrder[0]); i++) {
+        if ((acceptedMask & (1u << speedOrder[i])) && codecAvailable(speedOrder[i])) {
+            codec->id = speedOrder[i];
+            break;
+        }
+    }
+    return 0;
+}
+
+void setCompressionThreads(int threadCount) {
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > MAX_COMPRESSION_THREADS) threadCount = MAX_COMPRESSION_THREADS;
+    __atomic_store_n(&compressionThreads, threadCount, __ATOMIC_RELAXED);
+}
+
+int defaultCompressionThreads(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) return 1;
+    return cores > MAX_COMPRESSION_THREADS ? MAX_COMPRESSION_THREADS : (int)cores;
+}
+
+// Raw-deflates one block, preset with the previous block's tail; every block but the last ends on a byte boundary
+static void deflateBlock(z_stream* stream, int* streamLevel, CompressionJob* job) {
+    int level = job->owner->level;
+    if (*streamLevel != level) {
+        if (*streamLevel) deflateEnd(stream);
+        *streamLevel = 0;
+        memset(stream, 0, sizeof(*stream));
+        if (deflateInit2(stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            job->failed = 1;
+            return;
+        }
+        *streamLevel = level;
+    } else {
+        deflateReset(stream);
+    }
+
+    if (job->dictionaryLength > 0) deflateSetDictionary(stream, job->dictionary, job->dictionaryLength);
+    job->crc = crc32(0L, job->input, job->inputLength);
+    stream->next_in = job->input;
+    stream->avail_in = job->inputLength;
+    stream->next_out = job->output;
+    stream->avail_out = PARALLEL_OUTPUT_SIZE;
+    int status = deflate(stream, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+    job->failed = job->last ? status != Z_STREAM_END : (status != Z_OK || stream->avail_in != 0);
+    job->outputLength = PARALLEL_OUTPUT_SIZE - stream->avail_out;
+}
+
+// Pool thread: compresses queued blocks and wakes the request waiting for them
+static void* compressionWorkerMain(void* argument) {
+    (void)argument;
+    z_stream stream;
+    int streamLevel = 0;
+    while (1) {
+        pthread_mutex_lock(&compressionPool.lock);
+        while (!compressionPool.head) pthread_cond_wait(&compressionPool.available, &compressionPool.lock);
+        CompressionJob* job = compressionPool.head;
+        compressionPool.head = job->nextQueued;
+        if (!compressionPool.head) compressionPool.tail = NULL;
+        pthread_mutex_unlock(&compressionPool.lock);
+
+        deflateBlock(&stream, &streamLevel, job);
+
+        pthread_mutex_lock(&job->owner->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&job->owner->finished);
+        pthread_mutex_unlock(&job->owner->lock);
+    }
+    return NULL;
+}
+
+// Starts the shared pool the first time a large gzip archive is built, and grows it when the thread count
+// was raised since. Lowering the count only puts fewer blocks in flight per archive
+static void startCompressionWorkers(int threadCount) {
+    pthread_mutex_lock(&compressionPool.lock);
+    while (compressionWorkers < threadCount) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, compressionWorkerMain, NULL) != 0) break;
+        pthread_detach(thread);
+        compressionWorkers++;
+    }
+    pthread_mutex_unlock(&compressionPool.lock);
+}
+
+static ParallelGzip* createParallelGzip(int level, int threadCount, Arena* arena) {
+    ParallelGzip* parallel = arenaCalloc(arena, 1, sizeof(ParallelGzip));
+    if (!parallel) return NULL;
+    parallel->level = level;
+    parallel->slotCount = threadCount * 2;
+    parallel->slots = arenaCalloc(arena, parallel->slotCount, sizeof(CompressionJob));
+    int ready = parallel->slots != NULL;
+    for (int i = 0; ready && i < parallel->slotCount; i++) {
+        parallel->slots[i].owner = parallel;
+        parallel->slots[i].input = arenaAlloc(arena, PARALLEL_BLOCK_SIZE);
+        parallel->slots[i].output = arenaAlloc(arena, PARALLEL_OUTPUT_SIZE);
+        ready = parallel->slots[i].input && parallel->slots[i].output;
+    }
+    if (!ready) return NULL;
+    pthread_mutex_init(&parallel->lock, NULL);
+    pthread_cond_init(&parallel->finished, NULL);
+    parallel->crc = crc32(0L, Z_NULL, 0);
+    parallel->filling = &parallel->slots[0];
+    startCompressionWorkers(threadCount);
+    return parallel;
+}
+
+// Waits for the oldest in-flight block and writes it out; returns -1 if it failed or the sink did
+static int emitOldestBlock(Compressor* compressor) {
+    ParallelGzip* parallel = compressor->parallel;
+    CompressionJob* job = &parallel->slots[parallel->oldest];
+    pthread_mutex_lock(&parallel->lock);
+    while (!job->done) pthread_cond_wait(&parallel->finished, &parallel->lock);
+    pthread_mutex_unlock(&parallel->lock);
+
+    parallel->oldest = (parallel->oldest + 1) % parallel->slotCount;
+    parallel->inFlight--;
+    if (job->failed) return -1;
+    parallel->crc = crc32_combine(parallel->crc, job->crc, job->inputLength);
+    return compressor->write(compressor->context, job->output, job->outputLength);
+}
+
+// Hands the filling block to the pool, writing out the oldest block first if every slot is busy
+static int submitBlock(Compressor* compressor, int last) {
+    ParallelGzip* parallel = compressor->parallel;
+    CompressionJob* job = parallel->filling;
+    job->last = last;
+    job->done = 0;
+    job->failed = 0;
+    job->dictionaryLength = 0;
+    if (parallel->previous) {
+        // The previous block is always full, and its slot is not reused before this block is submitted
+        job->dictionaryLength = DICTIONARY_SIZE;
+        memcpy(job->dictionary, parallel->previous->input + PARALLEL_BLOCK_SIZE - DICTIONARY_SIZE, DICTIONARY_SIZE);
+    }
+    parallel->totalIn += job->inputLength;
+    parallel->previous = job;
+
+    job->nextQueued = NULL;
+    pthread_mutex_lock(&compressionPool.lock);
+    if (compressionPool.tail) compressionPool.tail->nextQueued = job;
+    else compressionPool.head = job;
+    compressionPool.tail = job;
+    pthread_cond_signal(&compressionPool.available);
+    pthread_mutex_unlock(&compressionPool.lock);
+    parallel->inFlight++;
+
+    int result = 0;
+    if (parallel->inFlight == parallel->slotCount) result = emitOldestBlock(compressor);
+    parallel->filling = &parallel->slots[(parallel->oldest + parallel->inFlight) % parallel->slotCount];
+    parallel->filling->inputLength = 0;
+    return result;
+}
+
+// Waits for every block still being compressed, so its buffers can be released
+static void drainParallelGzip(ParallelGzip* parallel) {
+    pthread_mutex_lock(&parallel->lock);
+    for (int i = 0; i < parallel->inFlight; i++) {
+        CompressionJob* job = &parallel->slots[(parallel->oldest + i) % parallel->slotCount];
+        while (!job->done) pthread_cond_wait(&parallel->finished, &parallel->lock);
+    }
+    pthread_mutex_unlock(&parallel->lock);
+}
+
+static void destroyParallelGzip(ParallelGzip* parallel) {
+    drainParallelGzip(parallel);
+    pthread_mutex_destroy(&parallel->lock);
+    pthread_cond_destroy(&parallel->finished);
+}
+
+// zlib allocation hooks: deflate's window and hash tables come from the arena and are dropped with it
+static voidpf arenaZalloc(voidpf opaque, uInt items, uInt size) {
+    return arenaAlloc(opaque, (size_t)items * size);
+}
+
+static void arenaZfree(voidpf opaque, voidpf address) {
+    (void)opaque;
+    (void)address;
+}
+
+// Writes the gzip header zlib would write: no name, mtime 0, Unix, level hint in XFL
+static int writeGzipHeader(Compressor* compressor, int level) {
+    unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    header[8] = level == 9 ? 2 : (level == 1 ? 4 : 0);
+    return compressor->write(compressor->context, header, sizeof(header));
+}
+
+// Copies input into blocks, submitting each full one; finishing submits the final block and appends the trailer
+static int writeParallelGzip(Compressor* compressor, const void* data, size_t length, int finish) {
+    ParallelGzip* parallel = compressor->parallel;
+    const unsigned char* input = data;
+    while (length > 0) {
+        CompressionJob* job = parallel->filling;
+        size_t room = PARALLEL_BLOCK_SIZE - job->inputLength;
+        size_t copied = length < room ? length : room;
+        memcpy(job->input + job->inputLength, input, copied);
+        job->inputLength += copied;
+        input += copied;
+        length -= copied;
+        if (job->inputLength == PARALLEL_BLOCK_SIZE && (length > 0 || !finish)) {
+            if (submitBlock(compressor, 0) != 0) return -1;
+        }
+    }
+    if (!finish) return 0;
+
+    if (submitBlock(compressor, 1) != 0) return -1;
+    while (parallel->inFlight > 0) {
+        if (emitOldestBlock(compressor) != 0) return -1;
+    }
+
+    unsigned char trailer[8];
+    for (int i = 0; i < 4; i++) {
+        trailer[i] = (parallel->crc >> (8 * i)) & 0xff;
+        trailer[4 + i] = (parallel->totalIn >> (8 * i)) & 0xff;
+    }
+    return compressor->write(compressor->context, trailer, sizeof(trailer));
+}
+
+Compressor* createCompressor(const CodecChoice* codec, unsigned long long expectedBytes,
+                             CompressedWriteFn write, void* context, Arena* arena) {
+    if (!codecAvailable(codec->id)) return NULL;
+    Compressor* compressor = arenaCalloc(arena, 1, sizeof(Compressor));
+    if (!compressor) return NULL;
+    compressor->id = codec->id;
+    compressor->write = write;
+    compressor->context = context;
+    int level = effectiveLevel(codec);
+    int ready = 0;
+
+    // Chosen by size alone, so the bytes of an archive never depend on the thread count
+    int parallel = expectedBytes >= PARALLEL_MIN_BYTES;
+
+    switch (codec->id) {
+    case CODEC_GZIP:
+        if (parallel) {
+            compressor->parallel = createParallelGzip(level, streamThreads(codec), arena);
+            ready = compressor->parallel && writeGzipHeader(compressor, level) == 0;
+            if (!ready && compressor->parallel) destroyParallelGzip(compressor->parallel);
+            break;
+        }
+        // windowBits 15 + 16 selects a gzip wrapper; the header mtime stays 0 so output is reproducible
+        compressor->output = arenaAlloc(arena, OUTPUT_BUFFER_SIZE);
+        compressor->gzip.zalloc = arenaZalloc;
+        compressor->gzip.zfree = arenaZfree;
+        compressor->gzip.opaque = arena;
+        ready = compressor->output &&
+                deflateInit2(&compressor->gzip, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        break;
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+        compressor->zstd = ZSTD_createCCtx();
+        compressor->output = arenaAlloc(arena, OUTPUT_BUFFER_SIZE);
+        ready = compressor->zstd && compressor->output &&
+                !ZSTD_isError(ZSTD_CCtx_setParameter(compressor->zstd, ZSTD_c_compressionLevel, level)) &&
+                !ZSTD_isError(ZSTD_CCtx_setParameter(compressor->zstd, ZSTD_c_checksumFlag, 1));
+        if (ready && parallel) {
+            // zstd's own worker threads; a library built without them keeps compressing on this thread
+            ZSTD_CCtx_setParameter(compressor->zstd, ZSTD_c_nbWorkers, streamThreads(codec));
+        }
+        if (!ready) ZSTD_freeCCtx(compressor->zstd);
+        break;
+#endif
+#ifdef HAVE_LZ4
+    case CODEC_LZ4:
+        compressor->lz4Preferences.compressionLevel = level;
+        compressor->lz4Preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+        compressor->outputCapacity = LZ4F_compressBound(LZ4_INPUT_SLICE, &compressor->lz4Preferences);
+        compressor->output = arenaAlloc(arena, compressor->outputCapacity);
+        ready = compressor->output && !LZ4F_isError(LZ4F_createCompressionContext(&compressor->lz4, LZ4F_VERSION));
+        if (ready) {
+            size_t headerSize = LZ4F_compressBegin(compressor->lz4, compressor->output, compressor->outputCapacity,
+                                                   &compressor->lz4Preferences);
+            ready = !LZ4F_isError(headerSize) && write(context, compressor->output, headerSize) == 0;
+        }
+        if (!ready) LZ4F_freeCompressionContext(compressor->lz4);
+        break;
+#endif
+    default:
+        break;
+    }
+
+    return ready ? compressor : NULL;
+}
+
+unsigned long long compressorMemoryBound(const CodecChoice* codec, unsigned long long expectedBytes) {
+    int parallel = expectedBytes >= PARALLEL_MIN_BYTES;
+    int threadCount = streamThreads(codec);
+    unsigned long long bound = sizeof(Compressor) + OUTPUT_BUFFER_SIZE;
+    switch (codec->id) {
+    case CODEC_GZIP:
+        if (parallel) {
+            // The pool's deflate streams are shared; each request owns two blocks per thread
+            return sizeof(Compressor) + sizeof(ParallelGzip) +
+                   2ULL * threadCount * (sizeof(CompressionJob) + PARALLEL_BLOCK_SIZE + PARALLEL_OUTPUT_SIZE);
+        }
+        return bound + (1ULL << (15 + 2)) + (1ULL << (8 + 9));  // deflate's window and hash tables at memLevel 8
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+    {
+        // Rounded up from ZSTD_estimateCCtxSize, which is not part of the stable API; every worker holds a
+        // context of its own next to the one that feeds them
+        int level = effectiveLevel(codec);
+        unsigned long long context = (level <= 3 ? 4ULL : level <= 9 ? 24ULL : 96ULL) * 1024 * 1024;
+        return bound + context * (parallel ? threadCount + 1ULL : 1ULL);
+    }
+#endif
+#ifdef HAVE_LZ4
+    case CODEC_LZ4: {
+        LZ4F_preferences_t preferences = { .compressionLevel = effectiveLevel(codec) };
+        return bound + LZ4F_compressBound(LZ4_INPUT_SLICE, &preferences) + 256 * 1024;  // The context, HC tables included
+    }
+#endif
+    default:
+        return bound;
+    }
+}
+
+// deflate until the input is consumed, handing every full output buffer to the sink
+static int writeGzip(Compressor* compressor, const void* data, size_t length, int finish) {
+    z_stream* stream = &compressor->gzip;
+    stream->next_in = (Bytef*)data;
+    stream->avail_in = length;
+    int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+
+    do {
+        stream->next_out = compressor->output;
+        stream->avail_out = OUTPUT_BUFFER_SIZE;
+        if (deflate(stream, flush) == Z_STREAM_ERROR) return -1;
+
+        size_t produced = OUTPUT_BUFFER_SIZE - stream->avail_out;
+        if (produced > 0 && compressor->write(compressor->context, compressor->output, produced) != 0) return -1;
+    } while (stream->avail_out == 0);
+    return 0;
+}
+
+#ifdef HAVE_ZSTD
+// ZSTD_compressStream2 until the input is consumed (and, when finishing, the frame is complete)
+static int writeZstd(Compressor* compressor, const void* data, size_t length, int finish) {
+    ZSTD_inBuffer input = { data, length, 0 };
+    ZSTD_EndDirective mode = finish ? ZSTD_e_end : ZSTD_e_continue;
+    size_t remaining;
+
+    do {
+        ZSTD_outBuffer output = { compressor->output, OUTPUT_BUFFER_SIZE, 0 };
+        remaining = ZSTD_compressStream2(compressor->zstd, &output, &input, mode);
+        if (ZSTD_isError(remaining)) return -1;
+        if (output.pos > 0 && compressor->write(compressor->context, compressor->output, output.pos) != 0) return -1;
+    } while (finish ? remaining != 0 : input.pos < input.size);
+    return 0;
+}
+#endif
+
+#ifdef HAVE_LZ4
+// LZ4F_compressUpdate in slices that fit the output buffer bound
+static int writeLz4(Compressor* compressor, const void* data, size_t length, int finish) {
+    const unsigned char* input = data;
+    while (length > 0) {
+        size_t slice = length < LZ4_INPUT_SLICE ? length : LZ4_INPUT_SLICE;
+        size_t produced = LZ4F_compressUpdate(compressor->lz4, compressor->output, compressor->outputCapacity,
+                                              input, slice, NULL);
+        if (LZ4F_isError(produced)) return -1;
+        if (produced > 0 && compressor->write(compressor->context, compressor->output, produced) != 0) return -1;
+        input += slice;
+        length -= slice;
+    }
+    if (finish) {
+        size_t produced = LZ4F_compressEnd(compressor->lz4, compressor->output, compressor->outputCapacity, NULL);
+        if (LZ4F_isError(produced)) return -1;
+        if (produced > 0 && compressor->write(compressor->context, compressor->output, produced) != 0) return -1;
+    }
+    return 0;
+}
+#endif
+
+int compressorWrite(Compressor* compressor, const void* data, size_t length, int finish) {
+    switch (compressor->id) {
+    case CODEC_GZIP:
+        if (compressor->parallel) return writeParallelGzip(compressor, data, length, finish);
+        return writeGzip(compressor, data, length, finish);
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+        return writeZstd(compressor, data, length, finish);
+#endif
+#ifdef HAVE_LZ4
+    case CODEC_LZ4:
+        return writeLz4(compressor, data, length, finish);
+#endif
+    default:
+        return -1;
+    }
+}
+
+void destroyCompressor(Compressor* compressor) {
+    if (!compressor) return;
+    switch (compressor->id) {
+    case CODEC_GZIP:
+        if (compressor->parallel) destroyParallelGzip(compressor->parallel);
+        else deflateEnd(&compressor->gzip);
+        break;
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+        ZSTD_freeCCtx(compressor->zstd);
+        break;
+#endif
+#ifdef HAVE_LZ4
+    case CODEC_LZ4:
+        LZ4F_freeCompressionContext(compressor->lz4);
+        break;
+#endif
+    default:
+        break;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef CODECW24_H
+#define CODECW24_H
+
+#include <stddef.h>
+
+#include "poolw24.h"
+
+// Compression codecs for archive replies. gzip is always built in; zstd and lz4 are compiled in
+// with -DHAVE_ZSTD -lzstd and -DHAVE_LZ4 -llz4.
+// The values double as the WIRE_CODEC_* numbers of the binary protocol
+typedef enum {
+    CODEC_GZIP,
+    CODEC_ZSTD,
+    CODEC_LZ4,
+    CODEC_COUNT
+} CodecId;
+
+typedef struct {
+    CodecId id;
+    int level;    // Codec-specific level; 0 selects the codec's default
+    int threads;  // Threads for a parallel stream, fixed when a request's codec is chosen; 0 reads the setting
+} CodecChoice;
+
+// Destination for compressed bytes; write returns 0 on success
+typedef int (*CompressedWriteFn)(void* context, const void* data, size_t length);
+
+typedef struct Compressor Compressor;
+
+// Starts a compressed stream; output is handed to write in blocks of up to 64 KB (128 KB when parallel).
+// Streams expected to hold at least 4 MB are compressed on several threads: gzip in independent
+// 128 KB blocks like pigz, zstd with its own workers. lz4 is fast enough to stay on one thread.
+// The compressor, its buffers and zlib's state are taken from the arena, which must outlive it; zstd and
+// lz4 allocate their contexts themselves
+Compressor* createCompressor(const CodecChoice* codec, unsigned long long expectedBytes,
+                             CompressedWriteFn write, void* context, Arena* arena);
+
+// Bytes a compressor for a stream of about expectedBytes holds at its peak: the codec state and the
+// output buffer, or every in-flight block of a parallel gzip stream. Used to budget concurrent archives
+unsigned long long compressorMemoryBound(const CodecChoice* codec, unsigned long long expectedBytes);
+
+// Compresses input; finish flushes everything and ends the stream. Returns 0 on success
+int compressorWrite(Compressor* compressor, const void* data, size_t length, int finish);
+
+// Ends the stream; the compressor's arena memory is left to the arena
+void destroyCompressor(Compressor* compressor);
+
+// Sets the number of threads used to compress large archives; with 1 thread compression still overlaps reading
+void setCompressionThreads(int threadCount);
+
+// One thread per online core
+int defaultCompressionThreads(void);
+
+// Level a codec compresses at when the client names none; 0 restores the codec's own default. Takes effect
+// for the next archive, and since cache keys carry the effective level, stale cached archives are not served
+void setDefaultCompressionLevel(CodecId id, int level);
+
+// "gzip", "zstd", "lz4", and the file extension clients should save the archive under
+const char* codecName(CodecId id);
+const char* codecFileExtension(CodecId id);
+
+// Returns 1 when the codec was compiled into this binary
+int codecAvailable(CodecId id);
+
+// Parses "name" or "name:level"; returns -1 for unknown names or out-of-range levels
+int parseCodecSpec(const char* spec, CodecChoice* codec);
+
+// Writes "name:level" with the effective level, for cache keys and logs
+void formatCodecSpec(const CodecChoice* codec, char* buffer, size_t bufferSize);
+
+// Picks the codec for a binary request: requested is a CodecId, or -1 to take the fastest codec in
+// acceptedMask (1 << CodecId) that is available, falling back to gzip. Returns -1 for an unusable request.
+// Like negotiateCodec, it fixes the thread count, so the memory budgeted for the request is what it uses
+int selectCodec(int requested, int level, unsigned acceptedMask, CodecChoice* codec);
+
+// Removes the "--codec=<name[:level]>" and "--accept=<name,name,...>" options from an archive command
+// and picks the codec: an explicit --codec wins, otherwise the fastest codec both sides support,
+// otherwise gzip. Returns -1 if the requested codec is unknown or not available here.
+int negotiateCodec(char* command, CodecChoice* codec);
+
+#endif
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "configw24.h"
+#include "reactorw24.h"
+#include "readerw24.h"
+
+#define DEFAULT_PORT 6969
+#define DEFAULT_BACKLOG 128
+#define DEFAULT_HOME_DIRECTORY "/home/patel489"
+#define DEFAULT_TEMP_DIRECTORY "/home/patel489/server_temp"
+#define CONFIG_LINE_SIZE 1024
+
+// How an option's text value is parsed and where it is stored
+typedef enum {
+    OPTION_INT,           // int within [min, max]
+    OPTION_FLAG,          // int set to 0 or 1; on the command line bare for 1, or followed by a value
+    OPTION_PATH,          // char[CONFIG_PATH_SIZE]
+    OPTION_BYTES,         // unsigned long long
+    OPTION_BUFFER,        // int byte count within [min, max], or "auto" for SEND_BUFFER_AUTO
+    OPTION_MEGABYTES,     // unsigned long long, given in MB
+    OPTION_PORT,          // Appends to ports
+    OPTION_CODEC_LEVEL,   // "name:level" into compressionLevels; a bare name restores the codec's default
+    OPTION_READER,        // Reader backend name
+} OptionKind;
+
+typedef struct {
+    const char* name;
+    OptionKind kind;
+    size_t offset;
+    long long min;
+    long long max;
+} ConfigOption;
+
+#define FIELD(member) offsetof(ServerConfig, member)
+
+static const ConfigOption configOptions[] = {
+    { "port", OPTION_PORT, FIELD(ports), 1, 65535 },
+    { "root", OPTION_PATH, FIELD(root), 0, 0 },
+    { "temp-dir", OPTION_PATH, FIELD(tempDirectory), 0, 0 },
+    { "backlog", OPTION_INT, FIELD(backlog), 1, 65535 },
+    { "send-buffer", OPTION_BUFFER, FIELD(sendBufferBytes), 0, INT_MAX / 2 },
+    { "receive-buffer", OPTION_INT, FIELD(receiveBufferBytes), 0, INT_MAX / 2 },
+    { "link-mbps", OPTION_INT, FIELD(linkMbps), 1, 400000 },
+    { "nodelay", OPTION_FLAG, FIELD(noDelay), 0, 1 },
+    { "cork", OPTION_FLAG, FIELD(batchReplies), 0, 1 },
+    { "accept-loops", OPTION_INT, FIELD(acceptLoops), 1, MAX_ACCEPT_LOOPS },
+    { "epoll", OPTION_FLAG, FIELD(eventLoop), 0, 1 },
+    { "workers", OPTION_INT, FIELD(workers), 1, 1024 },
+    { "compress-threads", OPTION_INT, FIELD(compressionThreads), 1, 64 },
+    { "spool", OPTION_FLAG, FIELD(spool), 0, 1 },
+    { "cache-bytes", OPTION_BYTES, FIELD(cacheBytes), 0, 0 },
+    { "compression-level", OPTION_CODEC_LEVEL, FIELD(compressionLevels), 0, 0 },
+    { "reader", OPTION_READER, FIELD(readerBackend), 0, 0 },
+    { "metrics-port", OPTION_INT, FIELD(metricsPort), 0, 65535 },
+    { "max-archive-jobs", OPTION_INT, FIELD(limits.maxRunning[JOB_HEAVY]), 1, 4096 },
+    { "max-lookups", OPTION_INT, FIELD(limits.maxRunning[JOB_CHEAP]), 1, 4096 },
+    { "archive-memory-mb", OPTION_MEGABYTES, FIELD(limits.heavyMemoryBudget), 1, 1LL << 30 },
+    { "queue-limit", OPTION_INT, FIELD(limits.maxQueued), 0, 4096 },
+    { "queue-per-client", OPTION_INT, FIELD(limits.maxQueuedPerClient), 0, 4096 },
+    { "queue-wait", OPTION_INT, FIELD(limits.maxWaitSeconds), 0, 3600 },
+    { "w24fz-depth", OPTION_INT, FIELD(searchDepth[DEPTH_W24FZ]), 0, 1000 },
+    { "w24ft-depth", OPTION_INT, FIELD(searchDepth[DEPTH_W24FT]), 0, 1000 },
+    { "w24fdb-depth", OPTION_INT, FIELD(searchDepth[DEPTH_W24FDB]), 0, 1000 },
+    { "w24fda-depth", OPTION_INT, FIELD(searchDepth[DEPTH_W24FDA]), 0, 1000 },
+};
+
+#define OPTION_COUNT (sizeof(configOptions) / sizeof(configOptions[0]))
+
+void defaultServerConfig(ServerConfig* config) {
+    memset(config, 0, sizeof(*config));
+    snprintf(config->root, sizeof(config->root), "%s", DEFAULT_HOME_DIRECTORY);
+    snprintf(config->tempDirectory, sizeof(config->tempDirectory), "%s", DEFAULT_TEMP_DIRECTORY);
+    config->backlog = DEFAULT_BACKLOG;
+    config->sendBufferBytes = SEND_BUFFER_AUTO;
+    config->linkMbps = 1000;
+    config->noDelay = 1;
+    config->batchReplies = 1;
+    config->acceptLoops = 1;
+    config->workers = defaultWorkerCount();
+    config->compressionThreads = defaultCompressionThreads();
+    config->cacheBytes = 256ULL * 1024 * 1024;
+    config->readerBackend = READER_AUTO;
+    defaultSchedulerLimits(&config->limits);
+
+    // The depths the commands always had: sizes and newer files two levels down, types and older files one
+    config->searchDepth[DEPTH_W24FZ] = 2;
+    config->searchDepth[DEPTH_W24FT] = 1;
+    config->searchDepth[DEPTH_W24FDB] = 1;
+    config->searchDepth[DEPTH_W24FDA] = 2;
+}
+
+static const ConfigOption* findOption(const char* name) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        if (strcmp(configOptions[i].name, name) == 0) return &configOptions[i];
+    }
+    return NULL;
+}
+
+// Parses a whole decimal number; returns -1 for anything else
+static int parseNumber(const char* text, unsigned long long* value) {
+    if (!isdigit((unsigned char)*text)) return -1;
+    char* end;
+    errno = 0;
+    *value = strtoull(text, &end, 10);
+    return errno == 0 && *end == '\0' ? 0 : -1;
+}
+
+int setConfigOption(ServerConfig* config, const char* name, const char* value, char* error, size_t errorSize) {
+    const ConfigOption* option = findOption(name);
+    if (!option) {
+        snprintf(error, errorSize, "unknown option '%s'", name);
+        return -1;
+    }
+    void* field = (char*)config + option->offset;
+    unsigned long long number = 0;
+    int valid = 1;
+
+    switch (option->kind) {
+    case OPTION_BUFFER:
+        if (strcmp(value, "auto") == 0) {
+            *(int*)field = SEND_BUFFER_AUTO;
+            break;
+        }
+        /* fall through */
+    case OPTION_INT:
+        valid = parseNumber(value, &number) == 0 && (long long)number >= option->min &&
+                (long long)number <= option->max;
+        if (valid) *(int*)field = (int)number;
+        break;
+    case OPTION_FLAG:
+        if (strcmp(value, "1") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "true") == 0) {
+            *(int*)field = 1;
+        } else if (strcmp(value, "0") == 0 || strcmp(value, "no") == 0 || strcmp(value, "false") == 0) {
+            *(int*)field = 0;
+        } else {
+            valid = 0;
+        }
+        break;
+    case OPTION_PATH:
+        valid = *value != '\0' && strlen(value) < CONFIG_PATH_SIZE;
+        if (valid) snprintf(field, CONFIG_PATH_SIZE, "%s", value);
+        break;
+    case OPTION_BYTES:
+        valid = parseNumber(value, &number) == 0;
+        if (valid) *(unsigned long long*)field = number;
+        break;
+    case OPTION_MEGABYTES:
+        valid = parseNumber(value, &number) == 0 && (long long)number >= option->min &&
+                (long long)number <= option->max;
+        if (valid) *(unsigned long long*)field = number * 1024 * 1024;
+        break;
+    case OPTION_PORT:
+        valid = parseNumber(value, &number) == 0 && (long long)number >= option->min &&
+                (long long)number <= option->max;
+        if (valid && config->portCount == MAX_PORTS) {
+            snprintf(error, errorSize, "more than %d ports", MAX_PORTS);
+            return -1;
+        }
+        if (valid) config->ports[config->portCount++] = (int)number;
+        break;
+    case OPTION_CODEC_LEVEL: {
+        CodecChoice codec;
+        valid = parseCodecSpec(value, &codec) == 0;
+        if (valid) config->compressionLevels[codec.id] = codec.level;
+        break;
+    }
+    case OPTION_READER:
+        valid = parseReaderBackend(value) >= 0;
+        if (valid) *(int*)field = parseReaderBackend(value);
+        break;
+    }
+    if (!valid) {
+        snprintf(error, errorSize, "bad value '%s' for %s", value, name);
+        return -1;
+    }
+    return 0;
+}
+
+// Values a flag may take, which tell "--nodelay no" from a bare flag followed by the next option
+static int isFlagValue(const char* text) {
+    static const char* const values[] = { "1", "0", "yes", "no", "true", "false" };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        if (strcmp(text, values[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Trims leading and trailing whitespace in place
+static char* trim(char* text) {
+    while (isspace((unsigned char)*text)) text++;
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char)text[length - 1])) text[--length] = '\0';
+    return text;
+}
+
+int loadConfigFile(const char* path, ServerConfig* config, char* error, size_t errorSize) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        snprintf(error, errorSize, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char line[CONFIG_LINE_SIZE];
+    int lineNumber = 0, status = 0;
+    while (status == 0 && fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        line[strcspn(line, "#")] = '\0';
+        char* text = trim(line);
+        if (*text == '\0') continue;
+
+        // "name = value", or "name value" like the command line
+        size_t nameLength = strcspn(text, " \t=");
+        char* value = text + nameLength;
+        if (*value) *value++ = '\0';
+        value = trim(value);
+        if (*value == '=') value = trim(value + 1);
+
+        char message[256];
+        if (*value == '\0') {
+            snprintf(message, sizeof(message), "missing value for %s", text);
+            status = -1;
+        } else {
+            status = setConfigOption(config, text, value, message, sizeof(message));
+        }
+        if (status != 0) snprintf(error, errorSize, "%s:%d: %s", path, lineNumber, message);
+    }
+    fclose(file);
+    return status;
+}
+
+int loadServerConfig(int argc, char* argv[], ServerConfig* config, char* error, size_t errorSize) {
+    defaultServerConfig(config);
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && loadConfigFile(argv[i + 1], config, error, errorSize) != 0) {
+            return -1;
+        }
+    }
+
+    int commandLinePorts = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* name = argv[i] + 2;
+        const ConfigOption* option = strncmp(argv[i], "--", 2) == 0 ? findOption(name) : NULL;
+        int isConfig = strcmp(argv[i], "--config") == 0;
+        if (!option && !isConfig) {
+            snprintf(error, errorSize, "unknown option '%s'", argv[i]);
+            return -1;
+        }
+        if (option && option->kind == OPTION_FLAG && (i + 1 >= argc || !isFlagValue(argv[i + 1]))) {
+            *(int*)((char*)config + option->offset) = 1;  // Bare, like --epoll; "--nodelay no" turns one off
+            continue;
+        }
+        if (i + 1 >= argc) {
+            snprintf(error, errorSize, "missing value for %s", argv[i]);
+            return -1;
+        }
+        if (isConfig) {
+            i++;  // Read above
+            continue;
+        }
+        if (option->kind == OPTION_PORT && commandLinePorts++ == 0) {
+            config->portCount = 0;
+        }
+        if (setConfigOption(config, name, argv[++i], error, errorSize) != 0) return -1;
+    }
+
+    if (config->portCount == 0) {
+        config->ports[config->portCount++] = DEFAULT_PORT;
+    }
+    return 0;
+}
+
+// Self-pipe written by the SIGHUP handler, so a signal landing on any thread wakes the accept loop
+static int reloadPipe[2] = { -1, -1 };
+
+static void requestReload(int signalNumber) {
+    (void)signalNumber;
+    int savedErrno = errno;
+    char byte = 1;
+    ssize_t written = write(reloadPipe[1], &byte, 1);  // Fails only when the pipe is full, so one is pending
+    (void)written;
+    errno = savedErrno;
+}
+
+int openReloadSignal(void) {
+    if (pipe2(reloadPipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    struct sigaction reload = {0};
+    reload.sa_handler = requestReload;
+    reload.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &reload, NULL);
+    return reloadPipe[0];
+}
+
+void acknowledgeReload(int fd) {
+    char bytes[64];
+    while (read(fd, bytes, sizeof(bytes)) > 0) {
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef CONFIGW24_H
+#define CONFIGW24_H
+
+#include <stddef.h>
+
+#include "schedw24.h"
+#include "codecw24.h"
+
+#define MAX_PORTS 8
+#define MAX_ACCEPT_LOOPS 64
+#define CONFIG_PATH_SIZE 512
+#define SEND_BUFFER_AUTO -1  // sendBufferBytes: size from the bandwidth-delay product, see sockw24.c
+
+// Commands whose search depth is configurable, in the order of ServerConfig.searchDepth
+typedef enum {
+    DEPTH_W24FZ,
+    DEPTH_W24FT,
+    DEPTH_W24FDB,
+    DEPTH_W24FDA,
+    DEPTH_COMMANDS
+} DepthCommand;
+
+// Everything an operator can tune without recompiling. Each field has an option of the same name in the
+// config file ("name = value") and on the command line ("--name value"); see the table in configw24.c
+typedef struct {
+    int ports[MAX_PORTS];
+    int portCount;
+    char root[CONFIG_PATH_SIZE];           // Tree the commands search, list and archive
+    char tempDirectory[CONFIG_PATH_SIZE];  // Spool files, the index snapshot and the archive cache
+    int backlog;                           // Pending connections per listening socket
+    int sendBufferBytes;                   // SO_SNDBUF and SO_RCVBUF of client sockets; 0 keeps the kernel's
+    int receiveBufferBytes;                // autotuning, and SEND_BUFFER_AUTO also grows it for distant clients
+    int linkMbps;                          // Bandwidth one client should be able to fill, for SEND_BUFFER_AUTO
+    int noDelay;                           // TCP_NODELAY on client sockets
+    int batchReplies;                      // MSG_MORE on archive and listing data, see ReplyChannel.batch
+    int acceptLoops;                       // Accepting threads, each with SO_REUSEPORT sockets of its own
+    int eventLoop;
+    int workers;
+    int compressionThreads;
+    int spool;
+    unsigned long long cacheBytes;
+    int compressionLevels[CODEC_COUNT];    // Level used when a client names none; 0 for the codec's default
+    int readerBackend;
+    int metricsPort;
+    SchedulerLimits limits;
+    int searchDepth[DEPTH_COMMANDS];       // 0 searches the whole tree
+} ServerConfig;
+
+// Built-in settings: port 6969, the original home and temp directories, defaults of every subsystem
+void defaultServerConfig(ServerConfig* config);
+
+// Sets one option from its text value; returns -1 with a message in error for unknown names and bad values
+int setConfigOption(ServerConfig* config, const char* name, const char* value, char* error, size_t errorSize);
+
+// Reads "name = value" lines; blank lines and everything after '#' are ignored
+int loadConfigFile(const char* path, ServerConfig* config, char* error, size_t errorSize);
+
+// Builds the settings from the defaults, then the file named by --config, then the other command-line
+// options, so the command line wins. Ports given on the command line replace the file's. Called again on
+// every reload with the same arguments
+int loadServerConfig(int argc, char* argv[], ServerConfig* config, char* error, size_t errorSize);
+
+// Makes SIGHUP request a reload: returns a descriptor that turns readable when one is pending, for the
+// accept loop to poll, or -1. acknowledgeReload drains it before the config is reread
+int openReloadSignal(void);
+void acknowledgeReload(int fd);
+
+#endif
@@ -0,0 +1,1792 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+
+#include "indexw24.h"
+#include "scanw24.h"
+
+#define INITIAL_BUCKETS 4096
+#define SNAPSHOT_MAGIC 0x77323449u  // "w24I"
+#define SNAPSHOT_VERSION 3
+#define RACY_WINDOW_NS 2000000000LL  // Directories modified this close to a publish are relisted on load, as timestamps are coarse
+#define PUBLISH_DELAY_MS 500        // Changes are coalesced for this long before a new snapshot is published
+#define JOURNAL_LIMIT 4096          // File changes listed per publish; past this, everything counts as changed
+#define ALIGN8(value) (((value) + 7) & ~(size_t)7)
+#define WATCH_MASK (IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR)
+
+// One indexed file; entries with the same basename keep their scan order inside a bucket chain
+typedef struct IndexEntry {
+    char* path;
+    const char* name;  // Basename, points into path
+    unsigned int hash;
+    off_t size;
+    struct timespec mtime;
+    mode_t mode;
+    int symlink;                    // Reached through a symlink; archives skip it, as they only take regular files
+    unsigned long long pathOffset;  // Where the last published snapshot stored the path
+    struct IndexEntry* next;
+} IndexEntry;
+
+// A watched directory and its mtime when it was last listed, persisted so a restart can tell what changed
+typedef struct {
+    char* path;
+    long long mtime;  // Nanoseconds
+    int dirty;        // Entries changed since mtime was read
+} WatchedDirectory;
+
+// Hash map from basename to entries, plus the inotify watch table
+typedef struct {
+    IndexEntry** buckets;
+    size_t bucketCount;
+    size_t entryCount;
+    WatchedDirectory* watches;  // Indexed by watch descriptor
+    int watchCapacity;
+    IndexEntry* loadedEntries;  // Entries loaded from a persisted snapshot live in one block, their paths in another
+    size_t loadedEntryCount;
+    char* loadedStrings;
+    int inotifyFd;
+    volatile int ready;  // Cleared while the whole tree is being (re)indexed
+    volatile int owner;  // This process maintains the index; other processes read the published snapshot
+    int changed;         // Modified since the last snapshot was published
+    int untracked;       // Some directories have no inotify watch, so the index can miss changes below them
+    volatile int published;  // This process has published the index it built or reconciled
+    IndexChange* journal;    // File changes since the last publish, for the change handler
+    size_t journalCount;
+    int journalLost;         // More changed than the journal holds, or the index was rebuilt
+    IndexChangeHandler changeHandler;
+    char rootPath[1024];
+    char snapshotPath[1024];
+    char lockPath[1024];
+    pthread_rwlock_t lock;
+} FileIndex;
+
+static FileIndex fileIndex = { .inotifyFd = -1, .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+// The published index: a flat, pointer-free copy every instance sharing the directory can map.
+// Buckets and chains hold entry numbers plus one, so 0 ends a chain; strings are offsets into the file.
+// After the entries comes the file table archive queries select from: one row per regular file in path
+// order, stored column by column so a predicate streams only the column it tests. The bySize and byMtime
+// columns list row numbers in key order for range queries, and extension ids index a sorted dictionary.
+// The snapshot doubles as the persisted index: the directory table records every watched directory's mtime,
+// so the next owner loads the entries as they are and relists only the directories that changed since
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    volatile int superseded;  // Set by the publisher once a newer snapshot has replaced this file
+    unsigned int bucketCount;
+    unsigned long long entryCount;
+    unsigned long long entriesOffset;
+    unsigned long long stringsOffset;
+    unsigned long long rootOffset;    // Indexed root, so an instance with another root ignores the snapshot
+    unsigned int tracked;             // Every directory was watched, so the snapshot follows changes
+    unsigned int extensionCount;      // Distinct extensions; id 0 means none, so ids run from 1
+    unsigned long long fileCount;     // Rows of the file table
+    unsigned long long sizesOffset;          // long long per row
+    unsigned long long mtimesOffset;         // long long nanoseconds per row
+    unsigned long long pathsOffset;          // unsigned long long string offset per row
+    unsigned long long depthsOffset;         // int per row, 1 for files directly in the root
+    unsigned long long extensionIdsOffset;   // int per row
+    unsigned long long bySizeOffset;         // unsigned int row numbers
+    unsigned long long byMtimeOffset;        // unsigned int row numbers
+    unsigned long long extensionsOffset;     // unsigned long long string offset per extension, sorted by name
+    long long publishedAt;                   // Realtime nanoseconds, read before the directory mtimes were
+    unsigned long long directoryCount;
+    unsigned long long directoriesOffset;    // SnapshotDirectory records, sorted by path
+} SnapshotHeader;
+
+typedef struct {
+    unsigned int hash;
+    unsigned int next;
+    unsigned long long pathOffset;
+    unsigned int nameOffset;  // Basename position within the path
+    unsigned int mode;
+    long long size;
+    long long mtime;
+    unsigned int mtimeNsec;
+    unsigned int symlink;
+} SnapshotEntry;
+
+typedef struct {
+    unsigned long long pathOffset;
+    long long mtime;  // Nanoseconds
+} SnapshotDirectory;
+
+// The snapshot this process has mapped, replaced when its publisher marks it superseded
+typedef struct {
+    SnapshotHeader* header;
+    size_t length;
+    pthread_rwlock_t lock;
+} SnapshotMapping;
+
+static SnapshotMapping mappedSnapshot = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+static SnapshotMapping publishedSnapshot = { .lock = PTHREAD_RWLOCK_INITIALIZER };  // Owner's latest, for marking
+
+// FNV-1a hash of a basename
+static unsigned int hashName(const char* name) {
+    unsigned int hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Nanoseconds since the epoch, saturated so that far-off dates still order correctly
+static long long toNanoseconds(long long seconds, long nanoseconds) {
+    if (seconds >= LLONG_MAX / 1000000000LL) return LLONG_MAX;
+    if (seconds <= LLONG_MIN / 1000000000LL) return LLONG_MIN;
+    return seconds * 1000000000LL + nanoseconds;
+}
+
+// Distinct strings interned in an open-addressing table: extensions while publishing, directory paths while
+// reconciling. The table points at the strings, which must outlive it; lookups take a length, so a prefix of
+// a longer string (a file's directory) can be looked up in place
+typedef struct {
+    const char** strings;   // By id minus one
+    unsigned int* slots;    // Ids, 0 for an empty slot
+    size_t count;
+    size_t slotCount;       // Power of two, kept at most half full
+} StringTable;
+
+// FNV-1a hash of the first length bytes of a string
+static unsigned int hashBytes(const char* text, size_t length) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Returns the id of the first length bytes of text, or 0 when the table does not hold them
+static unsigned int findString(const StringTable* table, const char* text, size_t length) {
+    if (table->slotCount == 0) return 0;
+    size_t slot = hashBytes(text, length) & (table->slotCount - 1);
+    while (table->slots[slot]) {
+        const char* candidate = table->strings[table->slots[slot] - 1];
+        if (strncmp(candidate, text, length) == 0 && candidate[length] == '\0') return table->slots[slot];
+        slot = (slot + 1) & (table->slotCount - 1);
+    }
+    return 0;
+}
+
+// Returns the id of a NUL-terminated string, adding it if it is new; 0 when out of memory
+static unsigned int internString(StringTable* table, const char* text) {
+    size_t length = strlen(text);
+    unsigned int id = findString(table, text, length);
+    if (id) return id;
+
+    if ((table->count + 1) * 2 > table->slotCount) {
+        size_t newSlotCount = table->slotCount ? table->slotCount * 2 : 256;
+        unsigned int* newSlots = calloc(newSlotCount, sizeof(unsigned int));
+        const char** newStrings = realloc(table->strings, newSlotCount / 2 * sizeof(char*));
+        if (!newSlots || !newStrings) {
+            free(newSlots);
+            if (newStrings) table->strings = newStrings;
+            return 0;
+        }
+        for (unsigned int existing = 1; existing <= table->count; existing++) {
+            const char* string = newStrings[existing - 1];
+            size_t slot = hashBytes(string, strlen(string)) & (newSlotCount - 1);
+            while (newSlots[slot]) slot = (slot + 1) & (newSlotCount - 1);
+            newSlots[slot] = existing;
+        }
+        free(table->slots);
+        table->slots = newSlots;
+        table->strings = newStrings;
+        table->slotCount = newSlotCount;
+    }
+
+    size_t slot = hashBytes(text, length) & (table->slotCount - 1);
+    while (table->slots[slot]) slot = (slot + 1) & (table->slotCount - 1);
+    table->strings[table->count++] = text;
+    table->slots[slot] = table->count;
+    return table->count;
+}
+
+static void freeStringTable(StringTable* table) {
+    free(table->strings);
+    free(table->slots);
+}
+
+// Frees an entry, unless it lives in the block loaded from a persisted snapshot
+static void freeEntry(IndexEntry* entry) {
+    if (entry >= fileIndex.loadedEntries && entry < fileIndex.loadedEntries + fileIndex.loadedEntryCount) return;
+    free(entry->path);
+    free(entry);
+}
+
+// Doubles the bucket array once the table is more than fully loaded
+static void growBuckets() {
+    size_t newCount = fileIndex.bucketCount * 2;
+    IndexEntry** newBuckets = calloc(newCount, sizeof(IndexEntry*));
+    if (!newBuckets) return;
+
+    // Walk each chain from the front and append, so same-name entries keep their order
+    IndexEntry** tails = calloc(newCount, sizeof(IndexEntry*));
+    if (!tails) {
+        free(newBuckets);
+        return;
+    }
+    for (size_t i = 0; i < fileIndex.bucketCount; i++) {
+        IndexEntry* entry = fileIndex.buckets[i];
+        while (entry) {
+            IndexEntry* next = entry->next;
+            size_t slot = entry->hash & (newCount - 1);
+            entry->next = NULL;
+            if (tails[slot]) tails[slot]->next = entry;
+            else newBuckets[slot] = entry;
+            tails[slot] = entry;
+            entry = next;
+        }
+    }
+    free(tails);
+    free(fileIndex.buckets);
+    fileIndex.buckets = newBuckets;
+    fileIndex.bucketCount = newCount;
+}
+
+// A version of a file that archive queries can select: a regular file not reached through a symlink
+static int selectable(mode_t mode, int symlink) {
+    return S_ISREG(mode) && !symlink;
+}
+
+// Records a file changing from its indexed version (NULL when new) to after (NULL when removed) for the change
+// handler. Consecutive changes to the same file, like the writes of one copy, fold into one record.
+// Only changes made after the first publish are recorded, since the handler is told about those
+static void journalChange(const char* path, const IndexEntry* before, const struct stat* after, int afterSymlink) {
+    int existed = before && selectable(before->mode, before->symlink);
+    int exists = after && selectable(after->st_mode, afterSymlink);
+    if (!fileIndex.published || fileIndex.journalLost || (!existed && !exists)) return;
+
+    IndexChange* change = fileIndex.journalCount ? &fileIndex.journal[fileIndex.journalCount - 1] : NULL;
+    if (!change || strcmp(change->path, path) != 0) {
+        if (!fileIndex.journal) fileIndex.journal = malloc(JOURNAL_LIMIT * sizeof(IndexChange));
+        char* copy = fileIndex.journal && fileIndex.journalCount < JOURNAL_LIMIT ? strdup(path) : NULL;
+        if (!copy) {
+            fileIndex.journalLost = 1;
+            return;
+        }
+        change = &fileIndex.journal[fileIndex.journalCount++];
+        change->path = copy;
+        change->depth = 0;
+        for (const char* cursor = path + strlen(fileIndex.rootPath); *cursor; cursor++) change->depth += *cursor == '/';
+        change->existed = existed;
+        change->oldSize = existed ? before->size : 0;
+        change->oldMtime = existed ? before->mtime : (struct timespec){0};
+    }
+    change->exists = exists;
+    change->size = exists ? after->st_size : 0;
+    change->mtime = exists ? after->st_mtim : (struct timespec){0};
+}
+
+// Inserts or refreshes the entry for a path; caller holds the write lock
+static void upsertEntry(const char* path, const struct stat* fileInfo, int symlink) {
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    unsigned int hash = hashName(name);
+    IndexEntry** slot = &fileIndex.buckets[hash & (fileIndex.bucketCount - 1)];
+
+    while (*slot) {
+        if ((*slot)->hash == hash && strcmp((*slot)->path, path) == 0) {
+            IndexEntry* entry = *slot;
+            if (entry->size == fileInfo->st_size && entry->mode == fileInfo->st_mode && entry->symlink == symlink &&
+                entry->mtime.tv_sec == fileInfo->st_mtim.tv_sec && entry->mtime.tv_nsec == fileInfo->st_mtim.tv_nsec) {
+                return;  // Repeated events for a version already indexed, like IN_ATTRIB after IN_CLOSE_WRITE
+            }
+            journalChange(path, entry, fileInfo, symlink);
+            (*slot)->size = fileInfo->st_size;
+            (*slot)->mtime = fileInfo->st_mtim;
+            (*slot)->mode = fileInfo->st_mode;
+            (*slot)->symlink = symlink;
+            fileIndex.changed = 1;
+            return;
+        }
+        slot = &(*slot)->next;
+    }
+
+    journalChange(path, NULL, fileInfo, symlink);
+    IndexEntry* entry = malloc(sizeof(IndexEntry));
+    if (!entry || !(entry->path = strdup(path))) {
+        free(entry);
+        return;
+    }
+    entry->name = entry->path + (name - path);
+    entry->hash = hash;
+    entry->size = fileInfo->st_size;
+    entry->mtime = fileInfo->st_mtim;
+    entry->mode = fileInfo->st_mode;
+    entry->symlink = symlink;
+    entry->next = NULL;
+    *slot = entry;  // Append at the tail to preserve scan order
+    fileIndex.changed = 1;
+
+    if (++fileIndex.entryCount > fileIndex.bucketCount) {
+        growBuckets();
+    }
+}
+
+// Removes the entry for a single path; caller holds the write lock
+static void removeEntry(const char* path) {
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    unsigned int hash = hashName(name);
+    IndexEntry** slot = &fileIndex.buckets[hash & (fileIndex.bucketCount - 1)];
+
+    while (*slot) {
+        if ((*slot)->hash == hash && strcmp((*slot)->path, path) == 0) {
+            IndexEntry* entry = *slot;
+            journalChange(path, entry, NULL, 0);
+            *slot = entry->next;
+            freeEntry(entry);
+            fileIndex.entryCount--;
+            fileIndex.changed = 1;
+            return;
+        }
+        slot = &(*slot)->next;
+    }
+}
+
+// Removes every entry below a directory that was deleted or moved away; caller holds the write lock
+static void removeSubtree(const char* directoryPath) {
+    size_t prefixLength = strlen(directoryPath);
+
+    for (size_t i = 0; i < fileIndex.bucketCount; i++) {
+        IndexEntry** slot = &fileIndex.buckets[i];
+        while (*slot) {
+            IndexEntry* entry = *slot;
+            if (strncmp(entry->path, directoryPath, prefixLength) == 0 && entry->path[prefixLength] == '/') {
+                journalChange(entry->path, entry, NULL, 0);
+                *slot = entry->next;
+                freeEntry(entry);
+                fileIndex.entryCount--;
+                fileIndex.changed = 1;
+            } else {
+                slot = &entry->next;
+            }
+        }
+    }
+
+    for (int wd = 0; wd < fileIndex.watchCapacity; wd++) {
+        char* watched = fileIndex.watches[wd].path;
+        if (watched && strncmp(watched, directoryPath, prefixLength) == 0 &&
+            (watched[prefixLength] == '/' || watched[prefixLength] == '\0')) {
+            inotify_rm_watch(fileIndex.inotifyFd, wd);
+            free(watched);
+            fileIndex.watches[wd].path = NULL;
+        }
+    }
+}
+
+// Remembers which directory a watch descriptor belongs to and its mtime when listed; caller holds the write lock
+static void registerWatch(int wd, const char* directoryPath, long long mtime) {
+    if (wd >= fileIndex.watchCapacity) {
+        int newCapacity = fileIndex.watchCapacity ? fileIndex.watchCapacity : 1024;
+        while (newCapacity <= wd) newCapacity *= 2;
+        WatchedDirectory* newWatches = realloc(fileIndex.watches, newCapacity * sizeof(WatchedDirectory));
+        if (!newWatches) return;
+        memset(newWatches + fileIndex.watchCapacity, 0, (newCapacity - fileIndex.watchCapacity) * sizeof(WatchedDirectory));
+        fileIndex.watches = newWatches;
+        fileIndex.watchCapacity = newCapacity;
+    }
+    free(fileIndex.watches[wd].path);
+    fileIndex.watches[wd].path = strdup(directoryPath);
+    fileIndex.watches[wd].mtime = mtime;
+    fileIndex.watches[wd].dirty = 0;
+}
+
+// A file or watched directory found by one scanner thread, applied to the index after the scan
+typedef struct {
+    char* path;
+    off_t size;
+    struct timespec mtime;
+    mode_t mode;
+    int symlink;
+    int wd;  // Watch descriptor for directories, -1 for files
+} PendingEntry;
+
+typedef struct {
+    PendingEntry* items;
+    size_t count;
+    size_t capacity;
+} SubtreeBatch;
+
+// Appends to a scanner thread's batch
+static void appendPending(SubtreeBatch* batch, const char* path, const struct stat* fileInfo, int symlink, int wd) {
+    if (batch->count == batch->capacity) {
+        size_t newCapacity = batch->capacity ? batch->capacity * 2 : 256;
+        PendingEntry* newItems = realloc(batch->items, newCapacity * sizeof(PendingEntry));
+        if (!newItems) return;
+        batch->items = newItems;
+        batch->capacity = newCapacity;
+    }
+    PendingEntry* item = &batch->items[batch->count];
+    if (!(item->path = strdup(path))) return;
+    item->size = fileInfo ? fileInfo->st_size : 0;
+    item->mtime = fileInfo ? fileInfo->st_mtim : (struct timespec){0};
+    item->mode = fileInfo ? fileInfo->st_mode : 0;
+    item->symlink = symlink;
+    item->wd = wd;
+    batch->count++;
+}
+
+// Scanner callback: watch each directory as soon as it is entered, so no later change is missed
+static void watchScannedDirectory(const char* path, int depth, void* threadContext) {
+    (void)depth;
+    if (fileIndex.inotifyFd < 0) return;
+
+    // Watch before reading the mtime, so a change in between is either seen by inotify or newer than the mtime
+    struct stat directoryInfo;
+    int wd = inotify_add_watch(fileIndex.inotifyFd, path, WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            fprintf(stderr, "inotify watch limit reached, %s will not be tracked\n", path);
+            fileIndex.untracked = 1;
+        }
+        return;
+    }
+    if (stat(path, &directoryInfo) != 0) directoryInfo.st_mtim = (struct timespec){0};
+    appendPending(threadContext, path, &directoryInfo, 0, wd);
+}
+
+// Scanner callback: collect a file's metadata
+static void collectScannedFile(const ScanEntry* entry, void* threadContext) {
+    appendPending(threadContext, entry->path, entry->info, entry->symlink, -1);
+}
+
+// Orders pending files by path so same-name entries get a stable order
+static int comparePending(const void* a, const void* b) {
+    return strcmp(((const PendingEntry*)a)->path, ((const PendingEntry*)b)->path);
+}
+
+// Indexes a directory tree the way findFileInDirectory walks it (skipping hidden names and following
+// file symlinks but not directory symlinks) using the parallel scanner, then applies it under the write lock
+static void indexSubtree(const char* directoryPath) {
+    int threadCount = defaultScanThreads();
+    SubtreeBatch* batches = calloc(threadCount, sizeof(SubtreeBatch));
+    void** contexts = calloc(threadCount, sizeof(void*));
+    if (!batches || !contexts) {
+        free(batches);
+        free(contexts);
+        return;
+    }
+    for (int i = 0; i < threadCount; i++) contexts[i] = &batches[i];
+
+    ScanOptions options = {0};
+    options.threadCount = threadCount;
+    options.skipHidden = 1;
+    options.followSymlinks = 1;
+    options.visit = collectScannedFile;
+    options.enterDirectory = watchScannedDirectory;
+    options.threadContexts = contexts;
+    scanTree(directoryPath, &options);
+
+    // Merge the per-thread batches and insert files in path order
+    size_t total = 0;
+    for (int i = 0; i < threadCount; i++) total += batches[i].count;
+    PendingEntry* merged = malloc((total ? total : 1) * sizeof(PendingEntry));
+    size_t used = 0;
+    for (int i = 0; i < threadCount; i++) {
+        if (merged) memcpy(merged + used, batches[i].items, batches[i].count * sizeof(PendingEntry));
+        used += batches[i].count;
+        free(batches[i].items);
+    }
+    free(batches);
+    free(contexts);
+    if (!merged) return;
+    qsort(merged, total, sizeof(PendingEntry), comparePending);
+
+    pthread_rwlock_wrlock(&fileIndex.lock);
+    for (size_t i = 0; i < total; i++) {
+        if (merged[i].wd >= 0) {
+            registerWatch(merged[i].wd, merged[i].path, toNanoseconds(merged[i].mtime.tv_sec, merged[i].mtime.tv_nsec));
+        } else {
+            struct stat fileInfo = {0};
+            fileInfo.st_size = merged[i].size;
+            fileInfo.st_mtim = merged[i].mtime;
+            fileInfo.st_mode = merged[i].mode;
+            upsertEntry(merged[i].path, &fileInfo, merged[i].symlink);
+        }
+        free(merged[i].path);
+    }
+    pthread_rwlock_unlock(&fileIndex.lock);
+    free(merged);
+}
+
+// Drops everything and indexes the whole tree again, when the index cannot be reconciled with it
+static void rebuildIndex() {
+    fileIndex.ready = 0;
+    pthread_rwlock_wrlock(&fileIndex.lock);
+    for (size_t i = 0; i < fileIndex.bucketCount; i++) {
+        IndexEntry* entry = fileIndex.buckets[i];
+        while (entry) {
+            IndexEntry* next = entry->next;
+            freeEntry(entry);
+            entry = next;
+        }
+        fileIndex.buckets[i] = NULL;
+    }
+    fileIndex.entryCount = 0;
+    fileIndex.untracked = 0;
+    fileIndex.journalLost = fileIndex.published;  // Whatever was cached may be gone
+    free(fileIndex.loadedEntries);
+    free(fileIndex.loadedStrings);
+    fileIndex.loadedEntries = NULL;
+    fileIndex.loadedEntryCount = 0;
+    fileIndex.loadedStrings = NULL;
+    for (int wd = 0; wd < fileIndex.watchCapacity; wd++) {
+        if (fileIndex.watches[wd].path) {
+            inotify_rm_watch(fileIndex.inotifyFd, wd);
+            free(fileIndex.watches[wd].path);
+            fileIndex.watches[wd].path = NULL;
+        }
+    }
+    pthread_rwlock_unlock(&fileIndex.lock);
+
+    indexSubtree(fileIndex.rootPath);
+    fileIndex.ready = 1;
+}
+
+// Applies one inotify event to the index; queue overflows are handled by the event loop
+static void applyEvent(const struct inotify_event* event) {
+    pthread_rwlock_wrlock(&fileIndex.lock);
+    if (event->wd < 0 || event->wd >= fileIndex.watchCapacity || !fileIndex.watches[event->wd].path) {
+        pthread_rwlock_unlock(&fileIndex.lock);
+        return;
+    }
+    if (event->mask & IN_IGNORED) {
+        free(fileIndex.watches[event->wd].path);
+        fileIndex.watches[event->wd].path = NULL;
+        pthread_rwlock_unlock(&fileIndex.lock);
+        return;
+    }
+    if (event->len == 0 || event->name[0] == '.') {
+        pthread_rwlock_unlock(&fileIndex.lock);
+        return;  // Events on the directory itself or on hidden entries
+    }
+    fileIndex.watches[event->wd].dirty = 1;  // Its mtime is read again before the next publish
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", fileIndex.watches[event->wd].path, event->name);
+
+    int newDirectory = 0;
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (event->mask & IN_ISDIR) removeSubtree(path);
+        else removeEntry(path);
+    } else {
+        struct stat fileInfo;
+        int symlink = lstat(path, &fileInfo) == 0 && S_ISLNK(fileInfo.st_mode);
+        if (stat(path, &fileInfo) == 0) {
+            if (S_ISDIR(fileInfo.st_mode)) {
+                newDirectory = (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO));
+            } else {
+                upsertEntry(path, &fileInfo, symlink);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&fileIndex.lock);
+
+    if (newDirectory) {
+        indexSubtree(path);  // Scanned without holding the lock
+    }
+}
+
+// Marks the snapshot file currently published as superseded, so instances that have it mapped move on
+static void markPreviousSnapshot() {
+    int fd = open(fileIndex.snapshotPath, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return;
+    SnapshotHeader* header = mmap(NULL, sizeof(SnapshotHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) return;
+    if (header->magic == SNAPSHOT_MAGIC) __atomic_store_n(&header->superseded, 1, __ATOMIC_RELEASE);
+    munmap(header, sizeof(SnapshotHeader));
+}
+
+// The text after the last dot of a basename, which is what a "*.<extension>" pattern without dots tests
+static const char* nameExtension(const char* name) {
+    const char* dot = strrchr(name, '.');
+    return dot && dot[1] ? dot + 1 : NULL;
+}
+
+// Orders index entries by path, the order archives list their members in
+static int compareEntryPaths(const void* a, const void* b) {
+    return strcmp((*(IndexEntry* const*)a)->path, (*(IndexEntry* const*)b)->path);
+}
+
+// Orders watched directories by path, so a parent always comes before its subdirectories
+static int compareDirectoryPaths(const void* a, const void* b) {
+    return strcmp((*(WatchedDirectory* const*)a)->path, (*(WatchedDirectory* const*)b)->path);
+}
+
+// Orders provisional extension ids by name, so the published dictionary can be binary searched
+static int compareExtensionIds(const void* a, const void* b, void* names) {
+    const char** table = names;
+    return strcmp(table[*(const unsigned int*)a - 1], table[*(const unsigned int*)b - 1]);
+}
+
+// Orders row numbers by a key column, ties by row so every publish sorts the same way
+static int compareRowKeys(const void* a, const void* b, void* keys) {
+    unsigned int rowA = *(const unsigned int*)a, rowB = *(const unsigned int*)b;
+    long long keyA = ((const long long*)keys)[rowA], keyB = ((const long long*)keys)[rowB];
+    if (keyA != keyB) return keyA < keyB ? -1 : 1;
+    return rowA < rowB ? -1 : rowA > rowB;
+}
+
+// Writes the index as a snapshot file and renames it over the published one; caller holds the read lock.
+// Readers keep the old file mapped until they see it marked superseded, so nothing is pulled from under them
+static void publishSnapshot(long long publishedAt) {
+    // Regular files make up the file table, in path order, with their extensions interned
+    size_t rootLength = strlen(fileIndex.rootPath);
+    size_t stringBytes = rootLength + 1, fileCount = 0, directoryCount = 0;
+    IndexEntry** files = malloc((fileIndex.entryCount ? fileIndex.entryCount : 1) * sizeof(IndexEntry*));
+    unsigned int* rowExtensions = malloc((fileIndex.entryCount ? fileIndex.entryCount : 1) * sizeof(unsigned int));
+    StringTable extensions = {0};
+    unsigned int* extensionOrder = NULL;
+    unsigned int* extensionRanks = NULL;
+    WatchedDirectory** directories = malloc((fileIndex.watchCapacity ? fileIndex.watchCapacity : 1) * sizeof(WatchedDirectory*));
+    if (!files || !rowExtensions || !directories) goto cleanup;
+    for (int wd = 0; wd < fileIndex.watchCapacity; wd++) {
+        if (!fileIndex.watches[wd].path) continue;
+        directories[directoryCount++] = &fileIndex.watches[wd];
+        stringBytes += strlen(fileIndex.watches[wd].path) + 1;
+    }
+    qsort(directories, directoryCount, sizeof(WatchedDirectory*), compareDirectoryPaths);
+    for (size_t i = 0; i < fileIndex.bucketCount; i++) {
+        for (IndexEntry* entry = fileIndex.buckets[i]; entry; entry = entry->next) {
+            stringBytes += strlen(entry->path) + 1;
+            if (S_ISREG(entry->mode) && !entry->symlink && fileCount < fileIndex.entryCount) files[fileCount++] = entry;
+        }
+    }
+    qsort(files, fileCount, sizeof(IndexEntry*), compareEntryPaths);
+    for (size_t row = 0; row < fileCount; row++) {
+        const char* extension = nameExtension(files[row]->name);
+        rowExtensions[row] = extension ? internString(&extensions, extension) : 0;
+        if (extension && !rowExtensions[row]) goto cleanup;
+    }
+    extensionOrder = malloc((extensions.count + 1) * sizeof(unsigned int));
+    extensionRanks = malloc((extensions.count + 1) * sizeof(unsigned int));
+    if (!extensionOrder || !extensionRanks) goto cleanup;
+    for (unsigned int id = 1; id <= extensions.count; id++) extensionOrder[id - 1] = id;
+    qsort_r(extensionOrder, extensions.count, sizeof(unsigned int), compareExtensionIds, extensions.strings);
+    extensionRanks[0] = 0;
+    for (size_t rank = 0; rank < extensions.count; rank++) {
+        extensionRanks[extensionOrder[rank]] = rank + 1;
+        stringBytes += strlen(extensions.strings[extensionOrder[rank] - 1]) + 1;
+    }
+
+    size_t entriesOffset = ALIGN8(sizeof(SnapshotHeader) + fileIndex.bucketCount * sizeof(unsigned int));
+    size_t sizesOffset = entriesOffset + fileIndex.entryCount * sizeof(SnapshotEntry);
+    size_t mtimesOffset = sizesOffset + fileCount * sizeof(long long);
+    size_t pathsOffset = mtimesOffset + fileCount * sizeof(long long);
+    size_t depthsOffset = pathsOffset + fileCount * sizeof(unsigned long long);
+    size_t extensionIdsOffset = depthsOffset + fileCount * sizeof(int);
+    size_t bySizeOffset = extensionIdsOffset + fileCount * sizeof(int);
+    size_t byMtimeOffset = bySizeOffset + fileCount * sizeof(unsigned int);
+    size_t extensionsOffset = ALIGN8(byMtimeOffset + fileCount * sizeof(unsigned int));
+    size_t directoriesOffset = extensionsOffset + extensions.count * sizeof(unsigned long long);
+    size_t stringsOffset = directoriesOffset + directoryCount * sizeof(SnapshotDirectory);
+    size_t length = stringsOffset + stringBytes;
+
+    char tempPath[1100];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", fileIndex.snapshotPath);
+    int fd = mkostemp(tempPath, O_CLOEXEC);
+    if (fd >= 0) fchmod(fd, 0644);  // mkostemp creates 0600; other instances may run as other users
+    if (fd < 0) goto cleanup;
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, length) == 0) mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        unlink(tempPath);
+        goto cleanup;
+    }
+
+    SnapshotHeader* header = mapping;
+    unsigned int* buckets = (unsigned int*)(header + 1);
+    SnapshotEntry* entries = (SnapshotEntry*)((char*)mapping + entriesOffset);
+    char* strings = (char*)mapping + stringsOffset;
+    size_t entryNumber = 0, stringUsed = 0;
+    for (size_t i = 0; i < fileIndex.bucketCount; i++) {
+        unsigned int* link = &buckets[i];
+        for (IndexEntry* entry = fileIndex.buckets[i]; entry && entryNumber < fileIndex.entryCount; entry = entry->next) {
+            SnapshotEntry* out = &entries[entryNumber];
+            size_t pathLength = strlen(entry->path) + 1;
+            memcpy(strings + stringUsed, entry->path, pathLength);
+            entry->pathOffset = stringsOffset + stringUsed;
+            out->hash = entry->hash;
+            out->pathOffset = entry->pathOffset;
+            out->nameOffset = entry->name - entry->path;
+            out->mode = entry->mode;
+            out->size = entry->size;
+            out->mtime = entry->mtime.tv_sec;
+            out->mtimeNsec = entry->mtime.tv_nsec;
+            out->symlink = entry->symlink;
+            stringUsed += pathLength;
+            *link = ++entryNumber;  // Chains keep the in-memory order
+            link = &out->next;
+        }
+    }
+
+    long long* sizes = (long long*)((char*)mapping + sizesOffset);
+    long long* mtimes = (long long*)((char*)mapping + mtimesOffset);
+    unsigned long long* paths = (unsigned long long*)((char*)mapping + pathsOffset);
+    int* depths = (int*)((char*)mapping + depthsOffset);
+    int* extensionIds = (int*)((char*)mapping + extensionIdsOffset);
+    unsigned int* bySize = (unsigned int*)((char*)mapping + bySizeOffset);
+    unsigned int* byMtime = (unsigned int*)((char*)mapping + byMtimeOffset);
+    for (size_t row = 0; row < fileCount; row++) {
+        const IndexEntry* entry = files[row];
+        int depth = 0;
+        for (const char* cursor = entry->path + rootLength; *cursor; cursor++) depth += *cursor == '/';
+        sizes[row] = entry->size;
+        mtimes[row] = toNanoseconds(entry->mtime.tv_sec, entry->mtime.tv_nsec);
+        paths[row] = entry->pathOffset;
+        depths[row] = depth;
+        extensionIds[row] = extensionRanks[rowExtensions[row]];
+        bySize[row] = byMtime[row] = row;
+    }
+    qsort_r(bySize, fileCount, sizeof(unsigned int), compareRowKeys, sizes);
+    qsort_r(byMtime, fileCount, sizeof(unsigned int), compareRowKeys, mtimes);
+
+    memcpy(strings + stringUsed, fileIndex.rootPath, rootLength + 1);
+    header->rootOffset = stringsOffset + stringUsed;
+    stringUsed += rootLength + 1;
+    unsigned long long* extensionNames = (unsigned long long*)((char*)mapping + extensionsOffset);
+    for (size_t rank = 0; rank < extensions.count; rank++) {
+        const char* name = extensions.strings[extensionOrder[rank] - 1];
+        size_t nameLength = strlen(name) + 1;
+        memcpy(strings + stringUsed, name, nameLength);
+        extensionNames[rank] = stringsOffset + stringUsed;
+        stringUsed += nameLength;
+    }
+    SnapshotDirectory* directoryRecords = (SnapshotDirectory*)((char*)mapping + directoriesOffset);
+    for (size_t i = 0; i < directoryCount; i++) {
+        size_t pathLength = strlen(directories[i]->path) + 1;
+        memcpy(strings + stringUsed, directories[i]->path, pathLength);
+        directoryRecords[i].pathOffset = stringsOffset + stringUsed;
+        directoryRecords[i].mtime = directories[i]->mtime;
+        stringUsed += pathLength;
+    }
+
+    header->bucketCount = fileIndex.bucketCount;
+    header->entryCount = entryNumber;
+    header->entriesOffset = entriesOffset;
+    header->stringsOffset = stringsOffset;
+    header->tracked = !fileIndex.untracked;
+    header->extensionCount = extensions.count;
+    header->fileCount = fileCount;
+    header->sizesOffset = sizesOffset;
+    header->mtimesOffset = mtimesOffset;
+    header->pathsOffset = pathsOffset;
+    header->depthsOffset = depthsOffset;
+    header->extensionIdsOffset = extensionIdsOffset;
+    header->bySizeOffset = bySizeOffset;
+    header->byMtimeOffset = byMtimeOffset;
+    header->extensionsOffset = extensionsOffset;
+    header->publishedAt = publishedAt;
+    header->directoryCount = directoryCount;
+    header->directoriesOffset = directoriesOffset;
+    header->version = SNAPSHOT_VERSION;
+    header->magic = SNAPSHOT_MAGIC;
+
+    if (!publishedSnapshot.header) markPreviousSnapshot();  // Left by an owner that has since exited
+    if (rename(tempPath, fileIndex.snapshotPath) != 0) {
+        munmap(mapping, length);
+        unlink(tempPath);
+        goto cleanup;
+    }
+    pthread_rwlock_wrlock(&publishedSnapshot.lock);
+    if (publishedSnapshot.header) {
+        __atomic_store_n(&publishedSnapshot.header->superseded, 1, __ATOMIC_RELEASE);
+        munmap(publishedSnapshot.header, publishedSnapshot.length);
+    }
+    publishedSnapshot.header = header;
+    publishedSnapshot.length = length;
+    pthread_rwlock_unlock(&publishedSnapshot.lock);
+    fileIndex.changed = 0;
+
+cleanup:
+    free(files);
+    free(rowExtensions);
+    freeStringTable(&extensions);
+    free(extensionOrder);
+    free(extensionRanks);
+    free(directories);
+}
+
+// Realtime clock in nanoseconds, comparable with file timestamps
+static long long realtimeNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return toNanoseconds(now.tv_sec, now.tv_nsec);
+}
+
+// Rereads the mtimes of directories whose entries changed; caller holds the write lock
+static void refreshDirectoryTimes() {
+    for (int wd = 0; wd < fileIndex.watchCapacity; wd++) {
+        WatchedDirectory* directory = &fileIndex.watches[wd];
+        struct stat directoryInfo;
+        if (!directory->path || !directory->dirty) continue;
+        directory->mtime = stat(directory->path, &directoryInfo) == 0 ?
+                           toNanoseconds(directoryInfo.st_mtim.tv_sec, directoryInfo.st_mtim.tv_nsec) : 0;
+        directory->dirty = 0;
+    }
+}
+
+// Hands the journaled changes to the change handler and empties the journal
+static void flushJournal() {
+    if (fileIndex.changeHandler && (fileIndex.journalCount > 0 || fileIndex.journalLost)) {
+        fileIndex.changeHandler(fileIndex.journal, fileIndex.journalCount, !fileIndex.journalLost);
+    }
+    for (size_t i = 0; i < fileIndex.journalCount; i++) free((char*)fileIndex.journal[i].path);
+    fileIndex.journalCount = 0;
+    fileIndex.journalLost = 0;
+}
+
+// Publishes under the read lock, so lookups in this process carry on meanwhile. The change handler runs
+// first, so nothing it invalidates outlives the snapshot that no longer has it
+static void publishIndex() {
+    flushJournal();
+    long long publishedAt = realtimeNanoseconds();
+    pthread_rwlock_wrlock(&fileIndex.lock);
+    refreshDirectoryTimes();
+    pthread_rwlock_unlock(&fileIndex.lock);
+
+    pthread_rwlock_rdlock(&fileIndex.lock);
+    publishSnapshot(publishedAt);
+    pthread_rwlock_unlock(&fileIndex.lock);
+}
+
+// True when count records of size bytes from offset end by limit; written so that no product or sum can wrap
+static int regionFits(unsigned long long offset, unsigned long long count, size_t size, unsigned long long limit) {
+    return offset <= limit && count <= (limit - offset) / size;
+}
+
+// True when offset points into the string section, which ends the file
+static int inStrings(const SnapshotHeader* header, size_t length, unsigned long long offset) {
+    return offset >= header->stringsOffset && offset < length;
+}
+
+// True when every offset, entry number and row number the tables hold stays inside the snapshot. Chains only
+// link forward, as publishSnapshot numbers entries in chain order, so walking one always ends
+static int snapshotValuesValid(const SnapshotHeader* header, size_t length) {
+    const char* base = (const char*)header;
+    unsigned long long entryCount = header->entryCount, rows = header->fileCount;
+    const unsigned int* buckets = (const unsigned int*)(header + 1);
+    for (size_t i = 0; i < header->bucketCount; i++) {
+        if (buckets[i] > entryCount) return 0;
+    }
+    const SnapshotEntry* entries = (const SnapshotEntry*)(base + header->entriesOffset);
+    for (size_t i = 0; i < entryCount; i++) {
+        const SnapshotEntry* entry = &entries[i];
+        if (!inStrings(header, length, entry->pathOffset) || entry->nameOffset >= length - entry->pathOffset ||
+            (entry->next != 0 && (entry->next <= i + 1 || entry->next > entryCount))) {
+            return 0;
+        }
+    }
+    const unsigned long long* paths = (const unsigned long long*)(base + header->pathsOffset);
+    const unsigned int* bySize = (const unsigned int*)(base + header->bySizeOffset);
+    const unsigned int* byMtime = (const unsigned int*)(base + header->byMtimeOffset);
+    for (size_t row = 0; row < rows; row++) {
+        if (!inStrings(header, length, paths[row]) || bySize[row] >= rows || byMtime[row] >= rows) return 0;
+    }
+    const unsigned long long* extensions = (const unsigned long long*)(base + header->extensionsOffset);
+    for (size_t i = 0; i < header->extensionCount; i++) {
+        if (!inStrings(header, length, extensions[i])) return 0;
+    }
+    const SnapshotDirectory* directories = (const SnapshotDirectory*)(base + header->directoriesOffset);
+    for (size_t i = 0; i < header->directoryCount; i++) {
+        if (!inStrings(header, length, directories[i].pathOffset)) return 0;
+    }
+    return 1;
+}
+
+// True when a mapped file is a complete snapshot of this version for the indexed root. Every table lies before
+// the strings, which end the file and are each NUL-terminated, so a last byte of 0 means any string offset
+// inside them is safe to read. The file may come from an instance run by another user, so every value a
+// lookup follows is checked too, once when the file is mapped
+static int snapshotMatches(const SnapshotHeader* header, size_t length) {
+    const char* base = (const char*)header;
+    if (length <= sizeof(SnapshotHeader) || header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+        header->stringsOffset > length || header->bucketCount == 0 ||
+        (header->bucketCount & (header->bucketCount - 1)) != 0) {
+        return 0;
+    }
+    unsigned long long tablesEnd = header->stringsOffset;
+    unsigned long long rows = header->fileCount;
+    int tablesFit = regionFits(sizeof(SnapshotHeader), header->bucketCount, sizeof(unsigned int), tablesEnd) &&
+                    regionFits(header->entriesOffset, header->entryCount, sizeof(SnapshotEntry), tablesEnd) &&
+                    regionFits(header->sizesOffset, rows, sizeof(long long), tablesEnd) &&
+                    regionFits(header->mtimesOffset, rows, sizeof(long long), tablesEnd) &&
+                    regionFits(header->pathsOffset, rows, sizeof(unsigned long long), tablesEnd) &&
+                    regionFits(header->depthsOffset, rows, sizeof(int), tablesEnd) &&
+                    regionFits(header->extensionIdsOffset, rows, sizeof(int), tablesEnd) &&
+                    regionFits(header->bySizeOffset, rows, sizeof(unsigned int), tablesEnd) &&
+                    regionFits(header->byMtimeOffset, rows, sizeof(unsigned int), tablesEnd) &&
+                    regionFits(header->extensionsOffset, header->extensionCount, sizeof(unsigned long long), tablesEnd) &&
+                    regionFits(header->directoriesOffset, header->directoryCount, sizeof(SnapshotDirectory), tablesEnd);
+    return tablesFit && inStrings(header, length, header->rootOffset) && base[length - 1] == '\0' &&
+           strcmp(base + header->rootOffset, fileIndex.rootPath) == 0 && snapshotValuesValid(header, length);
+}
+
+// Monotonic clock in seconds, for reporting how long indexing took
+static double monotonicSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// What reconciling found out about a persisted directory
+enum { DIRECTORY_UNCHANGED, DIRECTORY_CHANGED, DIRECTORY_GONE };
+
+#define CHECK_BATCH 256
+
+// A directory the index has listed before, and its mtime then
+typedef struct {
+    const char* path;
+    long long mtime;  // Nanoseconds
+} KnownDirectory;
+
+// Shared by the threads checking known directories, which claim them in batches
+typedef struct {
+    const KnownDirectory* directories;  // Sorted by path
+    size_t count;
+    long long racyAfter;   // A recorded mtime this recent may hide a later change within the same timestamp tick
+    unsigned char* states;
+    long long* mtimes;     // Current mtimes
+    int* watches;          // Watch descriptors, -1 when there is none
+    size_t next;
+} DirectoryCheck;
+
+// Check thread: watches each known directory, then compares its mtime with the recorded one
+static void* checkDirectories(void* argument) {
+    DirectoryCheck* check = argument;
+    while (1) {
+        size_t first = __atomic_fetch_add(&check->next, CHECK_BATCH, __ATOMIC_RELAXED);
+        if (first >= check->count) break;
+        size_t last = first + CHECK_BATCH < check->count ? first + CHECK_BATCH : check->count;
+        for (size_t i = first; i < last; i++) {
+            const char* path = check->directories[i].path;
+            int root = strcmp(path, fileIndex.rootPath) == 0;  // The root may be a symlink, nothing below it may
+
+            // Watch first, so a change made after the mtime is read still reaches the event loop
+            struct stat directoryInfo;
+            check->watches[i] = fileIndex.inotifyFd < 0 ? -1 :
+                                inotify_add_watch(fileIndex.inotifyFd, path, WATCH_MASK | (root ? 0 : IN_DONT_FOLLOW));
+            if (fileIndex.inotifyFd >= 0 && check->watches[i] < 0 && errno == ENOSPC) fileIndex.untracked = 1;
+            if ((root ? stat(path, &directoryInfo) : lstat(path, &directoryInfo)) != 0 || !S_ISDIR(directoryInfo.st_mode)) {
+                if (check->watches[i] >= 0) inotify_rm_watch(fileIndex.inotifyFd, check->watches[i]);
+                check->watches[i] = -1;
+                check->states[i] = DIRECTORY_GONE;
+                continue;
+            }
+            check->mtimes[i] = toNanoseconds(directoryInfo.st_mtim.tv_sec, directoryInfo.st_mtim.tv_nsec);
+            int unchanged = check->mtimes[i] == check->directories[i].mtime && check->directories[i].mtime < check->racyAfter;
+            check->states[i] = unchanged ? DIRECTORY_UNCHANGED : DIRECTORY_CHANGED;
+        }
+    }
+    return NULL;
+}
+
+// Lists a directory whose mtime changed and collects its files the way the scanner would, for the caller to
+// apply under the write lock. Subdirectories the persisted index did not have are collected for a full scan
+static void relistDirectory(const char* directoryPath, const StringTable* known, const unsigned char* states,
+                            SubtreeBatch* files, SubtreeBatch* newDirectories) {
+    int fd = open(directoryPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* directory = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!directory) {
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    struct dirent* item;
+    char path[1024];
+    while ((item = readdir(directory))) {
+        if (item->d_name[0] == '.') continue;  // Hidden names, and . and ..
+        if (snprintf(path, sizeof(path), "%s/%s", directoryPath, item->d_name) >= (int)sizeof(path)) continue;
+
+        struct stat fileInfo;
+        if (fstatat(fd, item->d_name, &fileInfo, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        if (S_ISDIR(fileInfo.st_mode)) {
+            unsigned int id = findString(known, path, strlen(path));
+            if (!id || states[id - 1] == DIRECTORY_GONE) appendPending(newDirectories, path, NULL, 0, -1);
+            continue;
+        }
+        int symlink = S_ISLNK(fileInfo.st_mode);
+        if (symlink && (fstatat(fd, item->d_name, &fileInfo, 0) != 0 || S_ISDIR(fileInfo.st_mode))) continue;
+        appendPending(files, path, &fileInfo, symlink, -1);
+    }
+    closedir(directory);
+}
+
+// Makes the entries of a persisted snapshot the in-memory index: one block of entries and one copy of the
+// string section, linked into the same bucket chains. Its values were checked by snapshotMatches; returns -1
+// when memory runs out
+static int adoptSnapshotEntries(const SnapshotHeader* header, size_t length) {
+    const char* base = (const char*)header;
+    size_t entryCount = header->entryCount;
+    IndexEntry* block = malloc((entryCount ? entryCount : 1) * sizeof(IndexEntry));
+    char* strings = malloc(length - header->stringsOffset);
+    IndexEntry** buckets = calloc(header->bucketCount, sizeof(IndexEntry*));
+    if (!block || !strings || !buckets) {
+        free(block);
+        free(strings);
+        free(buckets);
+        return -1;
+    }
+    memcpy(strings, base + header->stringsOffset, length - header->stringsOffset);
+
+    const SnapshotEntry* entries = (const SnapshotEntry*)(base + header->entriesOffset);
+    for (size_t i = 0; i < entryCount; i++) {
+        const SnapshotEntry* in = &entries[i];
+        IndexEntry* entry = &block[i];
+        entry->path = strings + (in->pathOffset - header->stringsOffset);
+        entry->name = entry->path + in->nameOffset;
+        entry->hash = in->hash;
+        entry->size = in->size;
+        entry->mtime.tv_sec = in->mtime;
+        entry->mtime.tv_nsec = in->mtimeNsec;
+        entry->mode = in->mode;
+        entry->symlink = in->symlink;
+        entry->pathOffset = 0;
+        entry->next = in->next ? &block[in->next - 1] : NULL;
+    }
+    const unsigned int* snapshotBuckets = (const unsigned int*)(header + 1);
+    for (size_t i = 0; i < header->bucketCount; i++) {
+        buckets[i] = snapshotBuckets[i] ? &block[snapshotBuckets[i] - 1] : NULL;
+    }
+
+    pthread_rwlock_wrlock(&fileIndex.lock);
+    free(fileIndex.buckets);
+    fileIndex.buckets = buckets;
+    fileIndex.bucketCount = header->bucketCount;
+    fileIndex.entryCount = entryCount;
+    fileIndex.loadedEntries = block;
+    fileIndex.loadedEntryCount = entryCount;
+    fileIndex.loadedStrings = strings;
+    pthread_rwlock_unlock(&fileIndex.lock);
+    return 0;
+}
+
+// What reconciling the known directories with the tree found
+typedef struct {
+    size_t changed;
+    size_t gone;
+    size_t added;  // Subdirectories that appeared and were scanned
+} ReconcileSummary;
+
+// Brings the index in line with the tree when it may have missed changes below known directories, and watches
+// them again. Every directory is checked in parallel; the entries of changed and vanished ones are dropped,
+// changed ones are listed again and subdirectories that appeared since are scanned. Returns -1, before
+// touching the index, if the directory list is inconsistent or memory runs out
+static int reconcileDirectories(const KnownDirectory* directories, size_t count, long long racyAfter,
+                                ReconcileSummary* summary) {
+    DirectoryCheck check = { directories, count, racyAfter };
+    check.states = malloc(count + 1);
+    check.mtimes = malloc((count + 1) * sizeof(long long));
+    check.watches = malloc((count + 1) * sizeof(int));
+    int threadCount = defaultScanThreads();
+    pthread_t* threads = malloc(threadCount * sizeof(pthread_t));
+    StringTable known = {0};
+    int failed = !check.states || !check.mtimes || !check.watches || !threads;
+    for (size_t i = 0; i < count && !failed; i++) {
+        if (internString(&known, directories[i].path) != i + 1) failed = 1;  // Out of memory or listed twice
+    }
+    if (!failed) {
+        int started = 0;
+        while (started < threadCount - 1 && pthread_create(&threads[started], NULL, checkDirectories, &check) == 0) started++;
+        checkDirectories(&check);
+        for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    memset(summary, 0, sizeof(*summary));
+    SubtreeBatch newDirectories = {0};
+    SubtreeBatch files = {0};  // Files to drop (mode 0) or refresh, applied under the write lock at the end
+    if (!failed) {
+        // Sorted by path, so a directory's parent has its final state before the directory is reached
+        for (size_t i = 0; i < count; i++) {
+            const char* path = directories[i].path;
+            const char* slash = strrchr(path, '/');
+            unsigned int parent = slash ? findString(&known, path, slash - path) : 0;
+            if (check.states[i] != DIRECTORY_GONE && parent && check.states[parent - 1] == DIRECTORY_GONE) {
+                if (check.watches[i] >= 0) inotify_rm_watch(fileIndex.inotifyFd, check.watches[i]);
+                check.watches[i] = -1;
+                check.states[i] = DIRECTORY_GONE;
+            }
+            summary->changed += check.states[i] == DIRECTORY_CHANGED;
+            summary->gone += check.states[i] == DIRECTORY_GONE;
+        }
+
+        // Collect the entries of vanished directories, and those of changed ones that are no longer files;
+        // changed directories are listed again below, which refreshes the rest. Only the index thread
+        // modifies the index and this runs on it, so the chains are read, and the files stated, without the
+        // lock, and lookups go on meanwhile
+        for (size_t i = 0; i < fileIndex.bucketCount && summary->changed + summary->gone > 0; i++) {
+            for (const IndexEntry* entry = fileIndex.buckets[i]; entry; entry = entry->next) {
+                unsigned int directory = findString(&known, entry->path, entry->name - 1 - entry->path);
+                int state = directory ? check.states[directory - 1] : DIRECTORY_GONE;
+                struct stat fileInfo;
+                if (state == DIRECTORY_GONE ||
+                    (state == DIRECTORY_CHANGED && (stat(entry->path, &fileInfo) != 0 || S_ISDIR(fileInfo.st_mode)))) {
+                    appendPending(&files, entry->path, NULL, 0, -1);
+                }
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (check.states[i] == DIRECTORY_CHANGED) {
+                relistDirectory(directories[i].path, &known, check.states, &files, &newDirectories);
+            }
+        }
+
+        pthread_rwlock_wrlock(&fileIndex.lock);
+        for (size_t i = 0; i < files.count; i++) {
+            PendingEntry* item = &files.items[i];
+            if (item->mode == 0) {
+                removeEntry(item->path);
+            } else {
+                struct stat fileInfo = {0};
+                fileInfo.st_size = item->size;
+                fileInfo.st_mtim = item->mtime;
+                fileInfo.st_mode = item->mode;
+                upsertEntry(item->path, &fileInfo, item->symlink);
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (check.watches[i] >= 0) registerWatch(check.watches[i], directories[i].path, check.mtimes[i]);
+        }
+        fileIndex.changed = 1;
+        pthread_rwlock_unlock(&fileIndex.lock);
+    }
+    for (size_t i = 0; i < files.count; i++) free(files.items[i].path);
+    free(files.items);
+    freeStringTable(&known);
+    free(check.states);
+    free(check.mtimes);
+    free(check.watches);
+    if (failed) return -1;
+
+    for (size_t i = 0; i < newDirectories.count; i++) {
+        indexSubtree(newDirectories.items[i].path);
+        free(newDirectories.items[i].path);
+    }
+    free(newDirectories.items);
+    summary->added = newDirectories.count;
+    return 0;
+}
+
+// Starts from the snapshot a previous owner left instead of scanning the whole tree. Its entries are adopted
+// as they are and its directories reconciled with the tree. A file rewritten in place does not touch its
+// directory's mtime, so one rewritten while no instance ran is noticed when it next changes.
+// Returns -1 when there is no usable snapshot, and the tree is scanned instead
+static int loadPersistedIndex() {
+    int fd = open(fileIndex.snapshotPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat fileInfo;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &fileInfo) == 0 && (size_t)fileInfo.st_size > sizeof(SnapshotHeader)) {
+        mapping = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) return -1;
+
+    size_t length = fileInfo.st_size;
+    const SnapshotHeader* header = mapping;
+    size_t directoryCount = header->directoryCount;
+    // A snapshot published while some directories had no watch does not record them, so it cannot be checked
+    if (!snapshotMatches(header, length) || !header->tracked || adoptSnapshotEntries(header, length) != 0) {
+        munmap(mapping, length);
+        return -1;
+    }
+
+    const SnapshotDirectory* records = (const SnapshotDirectory*)((const char*)mapping + header->directoriesOffset);
+    KnownDirectory* directories = malloc((directoryCount + 1) * sizeof(KnownDirectory));
+    int failed = !directories;
+    for (size_t i = 0; i < directoryCount && !failed; i++) {
+        directories[i] = (KnownDirectory){ (const char*)mapping + records[i].pathOffset, records[i].mtime };
+    }
+    ReconcileSummary summary;
+    if (!failed) failed = reconcileDirectories(directories, directoryCount, header->publishedAt - RACY_WINDOW_NS, &summary);
+    free(directories);
+    munmap(mapping, length);
+    if (failed) {
+        rebuildIndex();  // Drops whatever was adopted, then scans
+        return 0;
+    }
+    printf("File index loaded from snapshot: %zu of %zu directories changed, %zu gone, %zu new\n",
+           summary.changed, directoryCount, summary.gone, summary.added);
+    return 0;
+}
+
+// One thread restating indexed files after an overflow; files in reconciled directories may still have been
+// rewritten in place, which only the lost events would have said
+typedef struct {
+    size_t* next;  // Next unclaimed bucket, shared by the threads
+    SubtreeBatch changed;
+} RecheckWorker;
+
+#define RECHECK_BUCKETS 1024
+
+// Recheck thread: claims bucket ranges and collects files whose metadata differs, or that are gone. Only the
+// index thread modifies the index and it waits for these threads, so the chains are read without the lock
+static void* recheckEntries(void* argument) {
+    RecheckWorker* worker = argument;
+    while (1) {
+        size_t first = __atomic_fetch_add(worker->next, RECHECK_BUCKETS, __ATOMIC_RELAXED);
+        if (first >= fileIndex.bucketCount) break;
+        size_t last = first + RECHECK_BUCKETS < fileIndex.bucketCount ? first + RECHECK_BUCKETS : fileIndex.bucketCount;
+        for (size_t i = first; i < last; i++) {
+            for (const IndexEntry* entry = fileIndex.buckets[i]; entry; entry = entry->next) {
+                struct stat fileInfo;
+                int exists = lstat(entry->path, &fileInfo) == 0;
+                int symlink = exists && S_ISLNK(fileInfo.st_mode);
+                if (symlink) exists = stat(entry->path, &fileInfo) == 0;
+                if (!exists || S_ISDIR(fileInfo.st_mode)) {
+                    appendPending(&worker->changed, entry->path, NULL, 0, -1);  // Mode 0 marks it gone
+                } else if (fileInfo.st_size != entry->size || fileInfo.st_mode != entry->mode || symlink != entry->symlink ||
+                           fileInfo.st_mtim.tv_sec != entry->mtime.tv_sec || fileInfo.st_mtim.tv_nsec != entry->mtime.tv_nsec) {
+                    appendPending(&worker->changed, entry->path, &fileInfo, symlink, -1);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// Orders known directories by path, so parents come before their subdirectories
+static int compareKnownDirectories(const void* a, const void* b) {
+    return strcmp(((const KnownDirectory*)a)->path, ((const KnownDirectory*)b)->path);
+}
+
+// Recovers from an inotify queue overflow without dropping the index: every watched directory whose mtime
+// moved since events were last drained is listed again, and every remaining file is restated. The index keeps
+// answering meanwhile, and the changes found are journaled like the events that were lost
+static void recoverFromOverflow(long long lastDrained) {
+    double start = monotonicSeconds();
+
+    // Take the watched paths out of the table; reconciling registers the directories still there again
+    pthread_rwlock_wrlock(&fileIndex.lock);
+    KnownDirectory* directories = malloc((fileIndex.watchCapacity + 1) * sizeof(KnownDirectory));
+    int* oldWatches = malloc((fileIndex.watchCapacity + 1) * sizeof(int));
+    size_t count = 0;
+    for (int wd = 0; wd < fileIndex.watchCapacity && directories && oldWatches; wd++) {
+        WatchedDirectory* watch = &fileIndex.watches[wd];
+        if (!watch->path) continue;
+        directories[count] = (KnownDirectory){ watch->path, watch->mtime };
+        oldWatches[count++] = wd;
+        watch->path = NULL;
+    }
+    pthread_rwlock_unlock(&fileIndex.lock);
+    if (!directories || !oldWatches) {
+        free(directories);
+        free(oldWatches);
+        rebuildIndex();
+        return;
+    }
+
+    // Lost events are newer than the last drain, so a directory changed since then has a later mtime
+    // unless it changed within the same timestamp tick; those within the racy window are listed regardless
+    qsort(directories, count, sizeof(KnownDirectory), compareKnownDirectories);
+    ReconcileSummary summary;
+    int failed = reconcileDirectories(directories, count, lastDrained - RACY_WINDOW_NS, &summary);
+
+    pthread_rwlock_wrlock(&fileIndex.lock);
+    for (size_t i = 0; i < count; i++) {
+        int wd = oldWatches[i];
+        if (wd >= fileIndex.watchCapacity || !fileIndex.watches[wd].path) inotify_rm_watch(fileIndex.inotifyFd, wd);
+        free((char*)directories[i].path);
+    }
+    pthread_rwlock_unlock(&fileIndex.lock);
+    free(directories);
+    free(oldWatches);
+    if (failed) {
+        rebuildIndex();
+        return;
+    }
+
+    int threadCount = defaultScanThreads();
+    pthread_t* threads = malloc(threadCount * sizeof(pthread_t));
+    RecheckWorker* workers = calloc(threadCount, sizeof(RecheckWorker));
+    if (!threads || !workers) {
+        free(threads);
+        free(workers);
+        rebuildIndex();
+        return;
+    }
+    size_t nextBucket = 0;
+    for (int i = 0; i < threadCount; i++) workers[i].next = &nextBucket;
+    int started = 0;
+    while (started < threadCount - 1 && pthread_create(&threads[started], NULL, recheckEntries, &workers[started + 1]) == 0) started++;
+    recheckEntries(&workers[0]);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+    size_t rechecked = 0;
+    pthread_rwlock_wrlock(&fileIndex.lock);
+    for (int i = 0; i < threadCount; i++) {
+        for (size_t j = 0; j < workers[i].changed.count; j++) {
+            PendingEntry* item = &workers[i].changed.items[j];
+            if (item->mode == 0) {
+                removeEntry(item->path);
+            } else {
+                struct stat fileInfo = {0};
+                fileInfo.st_size = item->size;
+                fileInfo.st_mtim = item->mtime;
+                fileInfo.st_mode = item->mode;
+                upsertEntry(item->path, &fileInfo, item->symlink);
+            }
+            free(item->path);
+            rechecked++;
+        }
+        free(workers[i].changed.items);
+    }
+    pthread_rwlock_unlock(&fileIndex.lock);
+    free(workers);
+    free(threads);
+    fprintf(stderr, "inotify queue overflow: %zu of %zu directories changed, %zu gone, %zu new, %zu files changed in place, "
+            "recovered in %.2f s\n", summary.changed, count, summary.gone, summary.added, rechecked, monotonicSeconds() - start);
+}
+
+// Background thread: waits to become the index owner, builds the index, then applies inotify events as
+// they arrive and republishes the snapshot once changes have settled, telling the change handler what changed
+static void* indexThreadMain(void* argument) {
+    (void)argument;
+
+    // POSIX record locks are released when the process exits and are not inherited by forked children
+    int lockFd = open(fileIndex.lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0664);
+    struct flock ownership = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    if (lockFd >= 0) {
+        if (fcntl(lockFd, F_SETLK, &ownership) != 0) {
+            printf("File index is maintained by another instance, using its snapshot\n");
+            while (fcntl(lockFd, F_SETLKW, &ownership) != 0 && errno == EINTR) {}
+            printf("Taking over the file index\n");
+        }
+    }
+
+    fileIndex.inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (fileIndex.inotifyFd < 0) {
+        perror("inotify_init1");  // The index still works, it just will not see later changes
+        fileIndex.untracked = 1;
+    }
+    double start = monotonicSeconds();
+    long long lastDrained = realtimeNanoseconds();  // Every change before this has been applied or is queued
+    if (loadPersistedIndex() != 0) {
+        indexSubtree(fileIndex.rootPath);
+    }
+    fileIndex.owner = 1;
+    fileIndex.ready = 1;
+    publishIndex();
+    fileIndex.published = 1;
+    printf("File index ready: %zu files in %.2f s\n", fileIndex.entryCount, monotonicSeconds() - start);
+
+    char events[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (fileIndex.inotifyFd >= 0) {
+        struct pollfd pending = { fileIndex.inotifyFd, POLLIN, 0 };
+        if (poll(&pending, 1, fileIndex.changed ? PUBLISH_DELAY_MS : -1) == 0) {
+            publishIndex();  // Quiet for a while: publish what has accumulated
+            continue;
+        }
+        long long readStarted = realtimeNanoseconds();
+        ssize_t length = read(fileIndex.inotifyFd, events, sizeof(events));
+        if (length <= 0) {
+            if (length < 0 && errno == EINTR) continue;
+            perror("inotify read");
+            break;
+        }
+        int queued = 0;
+        int drained = ioctl(fileIndex.inotifyFd, FIONREAD, &queued) == 0 && queued == 0;
+        int overflowed = 0;
+        for (char* cursor = events; cursor < events + length; ) {
+            const struct inotify_event* event = (const struct inotify_event*)cursor;
+            if (event->mask & IN_Q_OVERFLOW) overflowed = 1;
+            else applyEvent(event);
+            cursor += sizeof(struct inotify_event) + event->len;
+        }
+        // Events were dropped after the queue was last drained; what they said is found again from the tree
+        if (overflowed) recoverFromOverflow(lastDrained);
+        if (drained || overflowed) lastDrained = readStarted;
+    }
+    return NULL;
+}
+
+// Fork hook: the child may inherit the lock held by the index thread, which it does not have. It never reads
+// its copy of the table, which would go stale, but the published snapshot, so a fresh lock is all it needs and
+// forks never wait for an index update to finish
+static void resetInChild() {
+    pthread_rwlock_init(&fileIndex.lock, NULL);
+    fileIndex.owner = 0;
+}
+
+int startFileIndex(const char* rootPath, const char* sharedDirectory) {
+    snprintf(fileIndex.rootPath, sizeof(fileIndex.rootPath), "%s", rootPath);
+    // Hidden names, so the index never picks up its own files when they live inside the indexed tree
+    snprintf(fileIndex.snapshotPath, sizeof(fileIndex.snapshotPath), "%s/.file-index", sharedDirectory);
+    snprintf(fileIndex.lockPath, sizeof(fileIndex.lockPath), "%s/.file-index.lock", sharedDirectory);
+    fileIndex.bucketCount = INITIAL_BUCKETS;
+    fileIndex.buckets = calloc(fileIndex.bucketCount, sizeof(IndexEntry*));
+    if (!fileIndex.buckets) return -1;
+
+    pthread_atfork(NULL, NULL, resetInChild);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, indexThreadMain, NULL) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+// Formats the w24fn reply line for one file
+static void formatFileInfo(const char* name, long size, time_t mtime, mode_t mode, char* resultInfo, size_t maxInfoLength) {
+    char timeBuffer[100];
+    struct tm modifiedTime;
+    strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", localtime_r(&mtime, &modifiedTime));
+    snprintf(resultInfo, maxInfoLength, "%s, Size: %ld bytes, Modified: %s, Permissions: %o",
+             name, size, timeBuffer, mode & (S_IRWXU | S_IRWXG | S_IRWXO));
+}
+
+// Maps the published snapshot if nothing is mapped yet or the mapped one was superseded; caller holds the write lock
+static void remapSnapshot() {
+    if (mappedSnapshot.header) {
+        if (!__atomic_load_n(&mappedSnapshot.header->superseded, __ATOMIC_ACQUIRE)) return;
+        munmap(mappedSnapshot.header, mappedSnapshot.length);
+        mappedSnapshot.header = NULL;
+    }
+
+    int fd = open(fileIndex.snapshotPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat fileInfo;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &fileInfo) == 0 && (size_t)fileInfo.st_size >= sizeof(SnapshotHeader)) {
+        mapping = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) return;
+
+    SnapshotHeader* header = mapping;
+    if (!snapshotMatches(header, fileInfo.st_size)) {
+        munmap(mapping, fileInfo.st_size);
+        return;
+    }
+    mappedSnapshot.header = header;
+    mappedSnapshot.length = fileInfo.st_size;
+}
+
+// Returns the current snapshot with the mapping's read lock held, or NULL (and no lock) when there is none yet
+static const SnapshotHeader* acquireSnapshot() {
+    pthread_rwlock_rdlock(&mappedSnapshot.lock);
+    SnapshotHeader* header = mappedSnapshot.header;
+    if (!header || __atomic_load_n(&header->superseded, __ATOMIC_ACQUIRE)) {
+        pthread_rwlock_unlock(&mappedSnapshot.lock);
+        pthread_rwlock_wrlock(&mappedSnapshot.lock);
+        remapSnapshot();
+        pthread_rwlock_unlock(&mappedSnapshot.lock);
+        pthread_rwlock_rdlock(&mappedSnapshot.lock);
+        header = mappedSnapshot.header;
+    }
+    if (!header) {
+        pthread_rwlock_unlock(&mappedSnapshot.lock);
+    }
+    return header;
+}
+
+// Looks a filename up in the published snapshot; -1 when there is none yet
+static int lookupSnapshot(const char* targetFilename, char* resultInfo, size_t maxInfoLength) {
+    const SnapshotHeader* header = acquireSnapshot();
+    if (!header) {
+        return -1;
+    }
+
+    const char* base = (const char*)header;
+    const unsigned int* buckets = (const unsigned int*)(header + 1);
+    const SnapshotEntry* entries = (const SnapshotEntry*)(base + header->entriesOffset);
+    unsigned int hash = hashName(targetFilename);
+    int found = 0;
+    for (unsigned int number = buckets[hash & (header->bucketCount - 1)]; number; number = entries[number - 1].next) {
+        const SnapshotEntry* entry = &entries[number - 1];
+        const char* name = base + entry->pathOffset + entry->nameOffset;
+        if (entry->hash == hash && strcmp(name, targetFilename) == 0) {
+            formatFileInfo(name, entry->size, entry->mtime, entry->mode, resultInfo, maxInfoLength);
+            found = 1;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&mappedSnapshot.lock);
+    return found;
+}
+
+int lookupFileIndex(const char* targetFilename, char* resultInfo, size_t maxInfoLength) {
+    int found = 0;
+
+    if (!fileIndex.owner) {
+        return lookupSnapshot(targetFilename, resultInfo, maxInfoLength);
+    }
+    if (!fileIndex.ready) {
+        return -1;  // A full rebuild is running
+    }
+    pthread_rwlock_rdlock(&fileIndex.lock);
+
+    unsigned int hash = hashName(targetFilename);
+    for (IndexEntry* entry = fileIndex.buckets[hash & (fileIndex.bucketCount - 1)]; entry; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->name, targetFilename) == 0) {
+            formatFileInfo(entry->name, (long)entry->size, entry->mtime.tv_sec, entry->mode, resultInfo, maxInfoLength);
+            found = 1;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&fileIndex.lock);
+    return found;
+}
+
+// Eight rows per step; GCC lowers these to the vector width the target has (AVX2 or SSE2 registers)
+typedef long long Int64Lanes __attribute__((vector_size(64), aligned(8), may_alias));
+typedef int Int32Lanes __attribute__((vector_size(32), aligned(4), may_alias));
+#define SELECT_LANES 8
+#define CANDIDATE_FRACTION 8  // A sorted range holding under 1/8 of the rows is cheaper to gather than a full scan
+
+// The file table columns of a mapped snapshot
+typedef struct {
+    const char* base;
+    size_t rowCount;
+    const long long* sizes;
+    const long long* mtimes;
+    const unsigned long long* paths;
+    const int* depths;
+    const int* extensionIds;
+    const unsigned int* bySize;
+    const unsigned int* byMtime;
+    const unsigned long long* extensions;
+    unsigned int extensionCount;
+} FileTable;
+
+// A query turned into bounds on the columns; a predicate the query lacks gets bounds every row passes
+typedef struct {
+    long long sizeAbove, sizeBelow;     // sizeAbove < size < sizeBelow
+    long long newerThan, notNewerThan;  // newerThan < mtime <= notNewerThan, in nanoseconds like find -newermt
+    int maxDepth;
+    int extensionIdCount;               // 0 when the query has no extensions or they need fnmatch
+    int extensionIds[MAX_EXTENSIONS];   // -1 for an extension no file has
+    int matchPatterns;                  // Some extension holds a dot or wildcard, so names go through fnmatch
+} CompiledQuery;
+
+static void mapFileTable(const SnapshotHeader* header, FileTable* table) {
+    table->base = (const char*)header;
+    table->rowCount = header->fileCount;
+    table->sizes = (const long long*)(table->base + header->sizesOffset);
+    table->mtimes = (const long long*)(table->base + header->mtimesOffset);
+    table->paths = (const unsigned long long*)(table->base + header->pathsOffset);
+    table->depths = (const int*)(table->base + header->depthsOffset);
+    table->extensionIds = (const int*)(table->base + header->extensionIdsOffset);
+    table->bySize = (const unsigned int*)(table->base + header->bySizeOffset);
+    table->byMtime = (const unsigned int*)(table->base + header->byMtimeOffset);
+    table->extensions = (const unsigned long long*)(table->base + header->extensionsOffset);
+    table->extensionCount = header->extensionCount;
+}
+
+// Binary searches the sorted extension dictionary; -1 when no file has the extension
+static int findExtensionId(const FileTable* table, const char* extension) {
+    size_t low = 0, high = table->extensionCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = strcmp(table->base + table->extensions[middle], extension);
+        if (order == 0) return middle + 1;
+        if (order < 0) low = middle + 1;
+        else high = middle;
+    }
+    return -1;
+}
+
+static void compileQuery(const SearchQuery* query, const FileTable* table, CompiledQuery* compiled) {
+    compiled->sizeAbove = query->matchSize ? query->minSize : LLONG_MIN;
+    compiled->sizeBelow = query->matchSize ? query->maxSize : LLONG_MAX;
+    compiled->newerThan = query->matchAfter ? toNanoseconds(query->after, 0) : LLONG_MIN;
+    compiled->notNewerThan = query->matchBefore ? toNanoseconds(query->before, 0) : LLONG_MAX;
+    compiled->maxDepth = query->maxDepth > 0 ? query->maxDepth : INT_MAX;
+
+    // "*.txt" matches exactly the names whose last extension is txt; anything fancier is left to fnmatch
+    compiled->matchPatterns = 0;
+    for (int i = 0; i < query->extensionCount; i++) {
+        if (query->extensions[i][0] == '\0' || strpbrk(query->extensions[i], ".*?[\\")) compiled->matchPatterns = 1;
+    }
+    compiled->extensionIdCount = compiled->matchPatterns ? 0 : query->extensionCount;
+    for (int i = 0; i < compiled->extensionIdCount; i++) {
+        compiled->extensionIds[i] = findExtensionId(table, query->extensions[i]);
+    }
+}
+
+// Scalar form of the vector test in scanRows
+static int rowMatches(const FileTable* table, const CompiledQuery* compiled, size_t row) {
+    if (!(table->sizes[row] > compiled->sizeAbove && table->sizes[row] < compiled->sizeBelow &&
+          table->mtimes[row] > compiled->newerThan && table->mtimes[row] <= compiled->notNewerThan &&
+          table->depths[row] <= compiled->maxDepth)) {
+        return 0;
+    }
+    if (compiled->extensionIdCount == 0) return 1;
+    for (int i = 0; i < compiled->extensionIdCount; i++) {
+        if (table->extensionIds[row] == compiled->extensionIds[i]) return 1;
+    }
+    return 0;
+}
+
+// Tests every row with vector compares, eight at a time, and writes the matching row numbers in path order
+static size_t scanRows(const FileTable* table, const CompiledQuery* compiled, unsigned int* rows) {
+    size_t count = 0, row = 0;
+    for (; row + SELECT_LANES <= table->rowCount; row += SELECT_LANES) {
+        Int64Lanes sizes = *(const Int64Lanes*)(table->sizes + row);
+        Int64Lanes mtimes = *(const Int64Lanes*)(table->mtimes + row);
+        Int64Lanes wide = (sizes > compiled->sizeAbove) & (sizes < compiled->sizeBelow) &
+                          (mtimes > compiled->newerThan) & (mtimes <= compiled->notNewerThan);
+        Int32Lanes keep = __builtin_convertvector(wide, Int32Lanes) &
+                          (*(const Int32Lanes*)(table->depths + row) <= compiled->maxDepth);
+        if (compiled->extensionIdCount > 0) {
+            Int32Lanes ids = *(const Int32Lanes*)(table->extensionIds + row);
+            Int32Lanes anyExtension = {0};
+            for (int i = 0; i < compiled->extensionIdCount; i++) anyExtension |= ids == compiled->extensionIds[i];
+            keep &= anyExtension;
+        }
+        // Branchless compaction: every lane is written, and only kept lanes (-1) advance the count
+        for (int lane = 0; lane < SELECT_LANES; lane++) {
+            rows[count] = row + lane;
+            count -= keep[lane];
+        }
+    }
+    for (; row < table->rowCount; row++) {
+        if (rowMatches(table, compiled, row)) rows[count++] = row;
+    }
+    return count;
+}
+
+// First position in a key-ordered row list whose key is above the bound
+static size_t positionAbove(const unsigned int* order, const long long* keys, size_t count, long long bound) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (keys[order[middle]] > bound) high = middle;
+        else low = middle + 1;
+    }
+    return low;
+}
+
+static int compareRows(const void* a, const void* b) {
+    unsigned int rowA = *(const unsigned int*)a, rowB = *(const unsigned int*)b;
+    return rowA < rowB ? -1 : rowA > rowB;
+}
+
+// Picks the matching rows, in path order. A size or date range narrow enough is read off its sorted
+// index and only those rows are tested; otherwise the whole table is scanned. The row list comes from the
+// arena when there is one. NULL when out of memory
+static unsigned int* selectRows(const FileTable* table, const CompiledQuery* compiled, const SearchQuery* query,
+                                Arena* arena, size_t* count) {
+    const unsigned int* order = NULL;
+    size_t first = 0, last = table->rowCount;
+    if (query->matchSize) {
+        order = table->bySize;
+        first = positionAbove(order, table->sizes, table->rowCount, compiled->sizeAbove);
+        last = compiled->sizeBelow == LLONG_MIN ? 0 : positionAbove(order, table->sizes, table->rowCount, compiled->sizeBelow - 1);
+    }
+    if (query->matchAfter || query->matchBefore) {
+        size_t mtimeFirst = positionAbove(table->byMtime, table->mtimes, table->rowCount, compiled->newerThan);
+        size_t mtimeLast = positionAbove(table->byMtime, table->mtimes, table->rowCount, compiled->notNewerThan);
+        if (mtimeLast < mtimeFirst) mtimeLast = mtimeFirst;
+        if (!order || mtimeLast - mtimeFirst < (last > first ? last - first : 0)) {
+            order = table->byMtime;
+            first = mtimeFirst;
+            last = mtimeLast;
+        }
+    }
+    if (last < first) last = first;
+
+    int gather = order && last - first < table->rowCount / CANDIDATE_FRACTION;
+    size_t rowsSize = ((gather ? last - first : table->rowCount) + 1) * sizeof(unsigned int);
+    unsigned int* rows = arena ? arenaAlloc(arena, rowsSize) : malloc(rowsSize);
+    if (!rows) return NULL;
+    if (gather) {
+        memcpy(rows, order + first, (last - first) * sizeof(unsigned int));
+        arenaSort(arena, rows, last - first, sizeof(unsigned int), compareRows);  // Row order is path order
+        *count = 0;
+        for (size_t i = 0; i < last - first; i++) {
+            if (rowMatches(table, compiled, rows[i])) rows[(*count)++] = rows[i];
+        }
+    } else {
+        *count = scanRows(table, compiled, rows);
+    }
+
+    if (compiled->matchPatterns) {
+        size_t kept = 0;
+        for (size_t i = 0; i < *count; i++) {
+            const char* path = table->base + table->paths[rows[i]];
+            if (nameMatchesExtensions(strrchr(path, '/') + 1, query)) rows[kept++] = rows[i];
+        }
+        *count = kept;
+    }
+    return rows;
+}
+
+int selectIndexedFiles(const SearchQuery* query, Arena* arena, FileList* list) {
+    memset(list, 0, sizeof(*list));
+    list->arena = arena;
+    const SnapshotHeader* header = acquireSnapshot();
+    if (!header) {
+        return -1;
+    }
+    if (!header->tracked) {
+        pthread_rwlock_unlock(&mappedSnapshot.lock);
+        return -1;  // Parts of the tree are not watched, so only a walk sees their current state
+    }
+
+    FileTable table;
+    CompiledQuery compiled;
+    mapFileTable(header, &table);
+    compileQuery(query, &table, &compiled);
+    size_t count = 0;
+    unsigned int* rows = selectRows(&table, &compiled, query, arena, &count);
+    int failed = !rows;
+    size_t filesSize = count * sizeof(MatchedFile);
+    if (!failed && count > 0 && !(list->files = arena ? arenaAlloc(arena, filesSize) : malloc(filesSize))) failed = 1;
+    for (size_t i = 0; i < count && !failed; i++) {
+        MatchedFile* file = &list->files[i];
+        long long mtime = table.mtimes[rows[i]];
+        const char* path = table.base + table.paths[rows[i]];
+        if (!(file->path = arena ? arenaStrdup(arena, path) : strdup(path))) {
+            failed = 1;
+            break;
+        }
+        file->size = table.sizes[rows[i]];
+        file->mtime.tv_sec = mtime / 1000000000LL;
+        file->mtime.tv_nsec = mtime % 1000000000LL;
+        if (file->mtime.tv_nsec < 0) {
+            file->mtime.tv_sec--;
+            file->mtime.tv_nsec += 1000000000L;
+        }
+        list->count++;
+    }
+    list->capacity = list->count;
+    pthread_rwlock_unlock(&mappedSnapshot.lock);
+    if (!arena) free(rows);
+
+    if (failed) {
+        freeFileList(list);
+        return -1;
+    }
+    return 0;
+}
+
+int fileIndexPublished(void) {
+    return fileIndex.published;
+}
+
+void setIndexChangeHandler(IndexChangeHandler handler) {
+    fileIndex.changeHandler = handler;
+}
@@ -0,0 +1,51 @@
+#ifndef INDEXW24_H
+#define INDEXW24_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "searchw24.h"
+
+// Builds the name -> metadata index of a directory tree in the background and keeps it current with inotify.
+// Server instances given the same sharedDirectory build it only once: whichever holds the lock file
+// maintains the index and publishes a snapshot there, which the other instances (and forked children)
+// map read-only. When the owner exits, a waiting instance takes over. The snapshot outlives the server:
+// the next owner starts from it and relists only the directories whose mtime changed in the meantime
+int startFileIndex(const char* rootPath, const char* sharedDirectory);
+
+// Returns 1 once this process owns the index and has published it, freshly built or reconciled
+int fileIndexPublished(void);
+
+// One file the index saw change. Only versions archive queries can select count: regular files not reached
+// through a symlink, so a file that turns into one is added and one that stops being one is removed
+typedef struct {
+    const char* path;
+    int depth;  // 1 for files directly in the root, like SearchQuery.maxDepth
+    int existed;
+    off_t oldSize;
+    struct timespec oldMtime;
+    int exists;
+    off_t size;
+    struct timespec mtime;
+} IndexChange;
+
+// Receives the file changes coalesced since the previous snapshot, on the index owner's thread just before the
+// next one is published. When complete is 0 more changed than could be listed, so anything may have changed
+typedef void (*IndexChangeHandler)(const IndexChange* changes, size_t count, int complete);
+
+// Sets the change handler; call before startFileIndex. Changes are reported from the first publish on,
+// including the ones an inotify queue overflow hid, which the index finds again from the tree
+void setIndexChangeHandler(IndexChangeHandler handler);
+
+// Looks a filename up in the index and formats the same "Size/Modified/Permissions" line as findFileInDirectory
+// Returns 1 when found, 0 when absent, -1 while the index is not ready yet
+int lookupFileIndex(const char* targetFilename, char* resultInfo, size_t maxInfoLength);
+
+// Selects the files an archive query matches from the published snapshot's columnar file table, sorted by
+// path like collectMatchingFiles, without a single syscall once the snapshot is mapped. The snapshot trails
+// the tree by the publish delay. With an arena the list lives in it, and selecting makes no malloc call.
+// Returns -1 while there is no snapshot or parts of the tree are not watched
+int selectIndexedFiles(const SearchQuery* query, Arena* arena, FileList* list);
+
+#endif
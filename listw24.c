@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "listw24.h"
+#include "protocolw24.h"
+
+#define LISTING_CHUNK_SIZE 65536
+#define DIRENT_BUFFER_SIZE 32768
+
+// Record layout returned by getdents64
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Memory for a listing: from its arena when it has one, otherwise from malloc
+static void* listingAlloc(Arena* arena, size_t size) {
+    return arena ? arenaAlloc(arena, size) : malloc(size);
+}
+
+static void listingFree(Arena* arena, void* memory) {
+    if (!arena) free(memory);
+}
+
+// Appends one subdirectory, growing the array as needed
+static int appendDirectory(DirectoryListing* listing, const char* name, const struct timespec* mtime) {
+    if (listing->count == listing->capacity) {
+        size_t newCapacity = listing->capacity ? listing->capacity * 2 : 64;
+        ListedDirectory* newEntries = listing->arena
+            ? arenaGrow(listing->arena, listing->entries, listing->capacity * sizeof(ListedDirectory),
+                        newCapacity * sizeof(ListedDirectory))
+            : realloc(listing->entries, newCapacity * sizeof(ListedDirectory));
+        if (!newEntries) return -1;
+        listing->entries = newEntries;
+        listing->capacity = newCapacity;
+    }
+
+    ListedDirectory* entry = &listing->entries[listing->count];
+    if (!(entry->name = listing->arena ? arenaStrdup(listing->arena, name) : strdup(name))) return -1;
+    entry->mtime = *mtime;
+    listing->count++;
+    return 0;
+}
+
+// Orders names the way alphasort does
+static int compareByName(const void* a, const void* b) {
+    return strcoll(((const ListedDirectory*)a)->name, ((const ListedDirectory*)b)->name);
+}
+
+// Orders by modification time, oldest first; equal times fall back to the name so the order is stable
+static int compareByModificationTime(const void* a, const void* b) {
+    const ListedDirectory* left = a;
+    const ListedDirectory* right = b;
+    if (left->mtime.tv_sec != right->mtime.tv_sec) return left->mtime.tv_sec < right->mtime.tv_sec ? -1 : 1;
+    if (left->mtime.tv_nsec != right->mtime.tv_nsec) return left->mtime.tv_nsec < right->mtime.tv_nsec ? -1 : 1;
+    return compareByName(a, b);
+}
+
+int listSubdirectories(const char* directoryPath, int byModificationTime, Arena* arena, DirectoryListing* listing) {
+    memset(listing, 0, sizeof(*listing));
+    listing->arena = arena;
+    int fd = open(directoryPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    char* direntBuffer = listingAlloc(arena, DIRENT_BUFFER_SIZE);
+    if (!direntBuffer) {
+        close(fd);
+        return -1;
+    }
+
+    struct stat fileInfo;
+    int result = 0;
+    while (result == 0) {
+        long bytes = syscall(SYS_getdents64, fd, direntBuffer, DIRENT_BUFFER_SIZE);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0) result = -1;
+        if (bytes <= 0) break;
+
+        for (long offset = 0; result == 0 && offset < bytes; ) {
+            struct linux_dirent64* entry = (struct linux_dirent64*)(direntBuffer + offset);
+            offset += entry->d_reclen;
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) continue;
+
+            // The only stat of this entry; -a needs it just for file systems that do not report d_type
+            struct timespec mtime = {0};
+            if (byModificationTime || entry->d_type == DT_UNKNOWN) {
+                if (fstatat(fd, entry->d_name, &fileInfo, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                if (!S_ISDIR(fileInfo.st_mode)) continue;
+                mtime = fileInfo.st_mtim;
+            }
+            result = appendDirectory(listing, entry->d_name, &mtime);
+        }
+    }
+    close(fd);
+    listingFree(arena, direntBuffer);
+
+    if (result != 0) {
+        freeDirectoryListing(listing);
+        return -1;
+    }
+    arenaSort(arena, listing->entries, listing->count, sizeof(ListedDirectory),
+              byModificationTime ? compareByModificationTime : compareByName);
+    return 0;
+}
+
+int sendDirectoryListing(ReplyChannel* channel, const DirectoryListing* listing) {
+    char* buffer = listingAlloc(listing->arena, LISTING_CHUNK_SIZE);
+    if (!buffer) return replyError(channel, "Failed to list directory.\n");
+
+    size_t used = 0;
+    for (size_t i = 0; i < listing->count; i++) {
+        size_t length = strlen(listing->entries[i].name);
+        if (used + length + 1 > LISTING_CHUNK_SIZE && used > 0) {
+            if (replyData(channel, buffer, used) != 0) {
+                listingFree(listing->arena, buffer);
+                return -1;
+            }
+            used = 0;
+        }
+        if (length + 1 > LISTING_CHUNK_SIZE) continue;  // Names are at most NAME_MAX bytes, so this never happens
+        memcpy(buffer + used, listing->entries[i].name, length);
+        buffer[used + length] = '\n';
+        used += length + 1;
+    }
+
+    int result = used > 0 ? replyData(channel, buffer, used) : 0;
+    listingFree(listing->arena, buffer);
+    return result == 0 ? replyEnd(channel) : -1;
+}
+
+void freeDirectoryListing(DirectoryListing* listing) {
+    for (size_t i = 0; !listing->arena && i < listing->count; i++) {
+        free(listing->entries[i].name);
+    }
+    listingFree(listing->arena, listing->entries);
+    memset(listing, 0, sizeof(*listing));
+}
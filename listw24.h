@@ -0,0 +1,35 @@
+#ifndef LISTW24_H
+#define LISTW24_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "protocolw24.h"
+#include "poolw24.h"
+
+// One subdirectory of the listed directory
+typedef struct {
+    char* name;
+    struct timespec mtime;
+} ListedDirectory;
+
+// Subdirectories gathered with a single fstatat per entry, then sorted in place
+typedef struct {
+    ListedDirectory* entries;
+    size_t count;
+    size_t capacity;
+    Arena* arena;  // Holds the entries, names and send buffer when set
+} DirectoryListing;
+
+// Collects the subdirectories of directoryPath (everything but "." and ".."), reading it with getdents64
+// so that with an arena listing makes no malloc call. With byModificationTime the list is ordered oldest
+// first, otherwise alphabetically like alphasort.
+int listSubdirectories(const char* directoryPath, int byModificationTime, Arena* arena, DirectoryListing* listing);
+
+// Streams the names, one per line, as data blocks followed by the end of the reply; returns 0 on success
+int sendDirectoryListing(ReplyChannel* channel, const DirectoryListing* listing);
+
+// Releases the names and array of a listing, unless they live in its arena
+void freeDirectoryListing(DirectoryListing* listing);
+
+#endif
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "loadw24.h"
+
+typedef struct {
+    long activeConnections;
+    long archiveJobs;
+} LoadCounters;
+
+static LoadCounters localCounters;  // Used until initLoadCounters maps the shared ones
+static LoadCounters* counters = &localCounters;
+
+int initLoadCounters(void) {
+    void* shared = mmap(NULL, sizeof(LoadCounters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap load counters");
+        return -1;
+    }
+    counters = shared;
+    return 0;
+}
+
+void connectionOpened(void) {
+    __atomic_add_fetch(&counters->activeConnections, 1, __ATOMIC_RELAXED);
+}
+
+void connectionClosed(void) {
+    __atomic_sub_fetch(&counters->activeConnections, 1, __ATOMIC_RELAXED);
+}
+
+void archiveJobStarted(void) {
+    __atomic_add_fetch(&counters->archiveJobs, 1, __ATOMIC_RELAXED);
+}
+
+void archiveJobFinished(void) {
+    __atomic_sub_fetch(&counters->archiveJobs, 1, __ATOMIC_RELAXED);
+}
+
+void readServerLoad(ServerLoad* load) {
+    load->activeConnections = __atomic_load_n(&counters->activeConnections, __ATOMIC_RELAXED);
+    load->archiveJobs = __atomic_load_n(&counters->archiveJobs, __ATOMIC_RELAXED);
+
+    double average = 0;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (getloadavg(&average, 1) != 1) average = 0;
+    load->cpuLoadPermille = (long)(average * 1000 / (cores > 0 ? cores : 1));
+}
+
+void formatServerLoad(char* buffer, size_t bufferSize) {
+    ServerLoad load;
+    readServerLoad(&load);
+    long others = load.activeConnections > 0 ? load.activeConnections - 1 : 0;
+    snprintf(buffer, bufferSize, "active_connections %ld\narchive_jobs %ld\ncpu_load_permille %ld\n",
+             others, load.archiveJobs, load.cpuLoadPermille);
+}
@@ -0,0 +1,27 @@
+#ifndef LOADW24_H
+#define LOADW24_H
+
+#include <stddef.h>
+
+// Server-wide load counters, kept in shared memory so forked connection handlers update the same values
+typedef struct {
+    long activeConnections;
+    long archiveJobs;         // Archive requests being built or sent
+    long cpuLoadPermille;     // One-minute load average per core, in thousandths
+} ServerLoad;
+
+// Maps the counters; call before the first fork or thread. Returns -1 if the mapping fails
+int initLoadCounters(void);
+
+// Counter updates are lock-free and async-signal-safe, so a SIGCHLD handler may close connections
+void connectionOpened(void);
+void connectionClosed(void);
+void archiveJobStarted(void);
+void archiveJobFinished(void);
+
+void readServerLoad(ServerLoad* load);
+
+// Formats the load probe reply, not counting the connection that asked
+void formatServerLoad(char* buffer, size_t bufferSize);
+
+#endif
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "metricsw24.h"
+#include "cachew24.h"
+#include "loadw24.h"
+#include "schedw24.h"
+#include "poolw24.h"
+
+#define METRIC_SHARDS 64
+#define LATENCY_BUCKETS 28  // Bucket i counts durations up to 2^i microseconds, about 134 s for the last one
+#define SCRAPE_TIMEOUT_SECONDS 2  // A scraper that stalls this long is dropped, so the next one is served
+
+static const char* commandNames[COMMAND_KINDS] = {
+    "w24fn", "dirlist", "w24fz", "w24ft", "w24fdb", "w24fda", "stats", "load", "other"
+};
+static const char* phaseNames[ARCHIVE_PHASES] = { "scan", "compress", "send" };
+static const char* classNames[JOB_CLASSES] = { "cheap", "heavy" };
+
+// Durations in power-of-two microsecond buckets; the last slot counts anything longer
+typedef struct {
+    unsigned long long count;  // Only filled in by sumHistogram; a shard's count is the sum of its buckets
+    unsigned long long sumMicros;
+    unsigned long long buckets[LATENCY_BUCKETS + 1];
+} Histogram;
+
+// What one thread or process has recorded. Shards are cache-line aligned, so writers never share a line
+typedef struct {
+    Histogram commands[COMMAND_KINDS];
+    unsigned long long commandErrors[COMMAND_KINDS];
+    Histogram phases[ARCHIVE_PHASES];
+    Histogram queueWaits[JOB_CLASSES];
+    unsigned long long bytesSent;
+} __attribute__((aligned(64))) MetricsShard;
+
+typedef struct {
+    unsigned int nextShard;
+    MetricsShard shards[METRIC_SHARDS];
+} MetricsTable;
+
+static MetricsTable* metrics;
+static __thread int shardIndex = -1;  // A forked child inherits -1 from the accepting thread, which never records
+
+int initMetrics(void) {
+    void* shared = mmap(NULL, sizeof(MetricsTable), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap metrics");
+        return -1;
+    }
+    metrics = shared;
+    return 0;
+}
+
+double metricsNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// The calling thread's shard, assigned round robin on first use; more writers than shards simply share
+static MetricsShard* ownShard(void) {
+    if (!metrics) return NULL;
+    if (shardIndex < 0) {
+        shardIndex = __atomic_fetch_add(&metrics->nextShard, 1, __ATOMIC_RELAXED) % METRIC_SHARDS;
+    }
+    return &metrics->shards[shardIndex];
+}
+
+static void addCounter(unsigned long long* counter, unsigned long long amount) {
+    __atomic_add_fetch(counter, amount, __ATOMIC_RELAXED);
+}
+
+static unsigned long long readCounter(const unsigned long long* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void addSample(Histogram* histogram, double seconds) {
+    unsigned long long micros = seconds > 0 ? (unsigned long long)(seconds * 1e6) : 0;
+    int bucket = micros <= 1 ? 0 : 64 - __builtin_clzll(micros - 1);
+    if (bucket > LATENCY_BUCKETS) bucket = LATENCY_BUCKETS;
+    addCounter(&histogram->buckets[bucket], 1);
+    addCounter(&histogram->sumMicros, micros);
+}
+
+void recordCommand(CommandKind kind, double seconds, unsigned long long bytesSent, int failed) {
+    MetricsShard* shard = ownShard();
+    if (!shard) return;
+    addSample(&shard->commands[kind], seconds);
+    if (failed) addCounter(&shard->commandErrors[kind], 1);
+    addCounter(&shard->bytesSent, bytesSent);
+}
+
+void recordArchivePhase(ArchivePhase phase, double seconds) {
+    MetricsShard* shard = ownShard();
+    if (shard) addSample(&shard->phases[phase], seconds);
+}
+
+void recordQueueWait(JobClass jobClass, double seconds) {
+    MetricsShard* shard = ownShard();
+    if (shard) addSample(&shard->queueWaits[jobClass], seconds);
+}
+
+// Sums one histogram over every shard; select picks it out of a shard. The count is the sum of the buckets,
+// overflow included, so it always agrees with them
+static void sumHistogram(Histogram* total, Histogram* (*select)(MetricsShard*, int), int which) {
+    memset(total, 0, sizeof(Histogram));
+    for (int i = 0; i < METRIC_SHARDS; i++) {
+        Histogram* histogram = select(&metrics->shards[i], which);
+        total->sumMicros += readCounter(&histogram->sumMicros);
+        for (int bucket = 0; bucket <= LATENCY_BUCKETS; bucket++) {
+            unsigned long long samples = readCounter(&histogram->buckets[bucket]);
+            total->buckets[bucket] += samples;
+            total->count += samples;
+        }
+    }
+}
+
+static Histogram* commandHistogram(MetricsShard* shard, int kind) {
+    return &shard->commands[kind];
+}
+
+static Histogram* phaseHistogram(MetricsShard* shard, int phase) {
+    return &shard->phases[phase];
+}
+
+static Histogram* queueWaitHistogram(MetricsShard* shard, int jobClass) {
+    return &shard->queueWaits[jobClass];
+}
+
+static unsigned long long sumCommandErrors(int kind) {
+    unsigned long long total = 0;
+    for (int i = 0; i < METRIC_SHARDS; i++) total += readCounter(&metrics->shards[i].commandErrors[kind]);
+    return total;
+}
+
+static unsigned long long sumBytesSent(void) {
+    unsigned long long total = 0;
+    for (int i = 0; i < METRIC_SHARDS; i++) total += readCounter(&metrics->shards[i].bytesSent);
+    return total;
+}
+
+// Upper bound, in milliseconds, of the bucket holding the given quantile
+static double quantileMillis(const Histogram* histogram, double quantile) {
+    if (histogram->count == 0) return 0;
+    unsigned long long rank = (unsigned long long)(quantile * histogram->count + 0.5);
+    if (rank < 1) rank = 1;
+    unsigned long long seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) return (double)(1ULL << bucket) / 1000.0;
+    }
+    return (double)(1ULL << LATENCY_BUCKETS) / 1000.0;
+}
+
+void formatMetricsSummary(char* buffer, size_t bufferSize) {
+    size_t used = 0;
+    if (!metrics) {
+        snprintf(buffer, bufferSize, "metrics_enabled 0\n");
+        return;
+    }
+
+    ServerLoad load;
+    readServerLoad(&load);
+    used += snprintf(buffer + used, bufferSize - used, "active_connections %ld\narchive_jobs %ld\nbytes_sent %llu\n",
+                     load.activeConnections, load.archiveJobs, sumBytesSent());
+    if (allocationCounting) {
+        used += snprintf(buffer + used, bufferSize - used, "malloc_calls %llu\n", allocationCount());
+    }
+
+    Histogram total;
+    for (int kind = 0; kind < COMMAND_KINDS && used < bufferSize; kind++) {
+        sumHistogram(&total, commandHistogram, kind);
+        if (total.count == 0) continue;
+        used += snprintf(buffer + used, bufferSize - used,
+                         "command_%s_count %llu\ncommand_%s_errors %llu\ncommand_%s_p50_ms %.3f\ncommand_%s_p99_ms %.3f\n",
+                         commandNames[kind], total.count, commandNames[kind], sumCommandErrors(kind),
+                         commandNames[kind], quantileMillis(&total, 0.50), commandNames[kind], quantileMillis(&total, 0.99));
+    }
+    for (int phase = 0; phase < ARCHIVE_PHASES && used < bufferSize; phase++) {
+        sumHistogram(&total, phaseHistogram, phase);
+        if (total.count == 0) continue;
+        used += snprintf(buffer + used, bufferSize - used,
+                         "archive_%s_count %llu\narchive_%s_p50_ms %.3f\narchive_%s_p99_ms %.3f\n",
+                         phaseNames[phase], total.count, phaseNames[phase], quantileMillis(&total, 0.50),
+                         phaseNames[phase], quantileMillis(&total, 0.99));
+    }
+    for (int jobClass = 0; jobClass < JOB_CLASSES && used < bufferSize; jobClass++) {
+        sumHistogram(&total, queueWaitHistogram, jobClass);
+        if (total.count == 0) continue;
+        used += snprintf(buffer + used, bufferSize - used, "queue_%s_wait_p50_ms %.3f\nqueue_%s_wait_p99_ms %.3f\n",
+                         classNames[jobClass], quantileMillis(&total, 0.50), classNames[jobClass], quantileMillis(&total, 0.99));
+    }
+    if (used < bufferSize) {
+        formatSchedulerStats(buffer + used, bufferSize - used);
+        used += strlen(buffer + used);
+    }
+    if (used < bufferSize) formatCacheStats(buffer + used, bufferSize - used);
+}
+
+// Writes one histogram with cumulative buckets in seconds, as Prometheus expects. +Inf adds the overflow
+// bucket to the running total, so it can never fall below a finite bucket, and _count repeats it
+static void writeHistogram(FILE* out, const char* name, const char* label, const char* value, const Histogram* histogram) {
+    unsigned long long cumulative = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        cumulative += histogram->buckets[bucket];
+        fprintf(out, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n", name, label, value, (double)(1ULL << bucket) / 1e6, cumulative);
+    }
+    cumulative += histogram->buckets[LATENCY_BUCKETS];
+    fprintf(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", name, label, value, cumulative);
+    fprintf(out, "%s_sum{%s=\"%s\"} %.6f\n", name, label, value, histogram->sumMicros / 1e6);
+    fprintf(out, "%s_count{%s=\"%s\"} %llu\n", name, label, value, cumulative);
+}
+
+// Formats every metric in the Prometheus text exposition format
+static void writePrometheusMetrics(FILE* out) {
+    Histogram total;
+    fprintf(out, "# HELP w24_command_duration_seconds Time to run a command, including sending the reply.\n");
+    fprintf(out, "# TYPE w24_command_duration_seconds histogram\n");
+    for (int kind = 0; kind < COMMAND_KINDS; kind++) {
+        sumHistogram(&total, commandHistogram, kind);
+        writeHistogram(out, "w24_command_duration_seconds", "command", commandNames[kind], &total);
+    }
+    fprintf(out, "# HELP w24_command_errors_total Commands answered with an error.\n");
+    fprintf(out, "# TYPE w24_command_errors_total counter\n");
+    for (int kind = 0; kind < COMMAND_KINDS; kind++) {
+        fprintf(out, "w24_command_errors_total{command=\"%s\"} %llu\n", commandNames[kind], sumCommandErrors(kind));
+    }
+    fprintf(out, "# HELP w24_archive_phase_seconds Time archive requests spend scanning, compressing and sending.\n");
+    fprintf(out, "# TYPE w24_archive_phase_seconds histogram\n");
+    for (int phase = 0; phase < ARCHIVE_PHASES; phase++) {
+        sumHistogram(&total, phaseHistogram, phase);
+        writeHistogram(out, "w24_archive_phase_seconds", "phase", phaseNames[phase], &total);
+    }
+    fprintf(out, "# HELP w24_queue_wait_seconds Time admitted jobs waited for a slot.\n");
+    fprintf(out, "# TYPE w24_queue_wait_seconds histogram\n");
+    for (int jobClass = 0; jobClass < JOB_CLASSES; jobClass++) {
+        sumHistogram(&total, queueWaitHistogram, jobClass);
+        writeHistogram(out, "w24_queue_wait_seconds", "class", classNames[jobClass], &total);
+    }
+
+    ServerLoad load;
+    readServerLoad(&load);
+    fprintf(out, "# TYPE w24_bytes_sent_total counter\nw24_bytes_sent_total %llu\n", sumBytesSent());
+    if (allocationCounting) {
+        fprintf(out, "# TYPE w24_malloc_calls_total counter\nw24_malloc_calls_total %llu\n", allocationCount());
+    }
+    fprintf(out, "# TYPE w24_active_connections gauge\nw24_active_connections %ld\n", load.activeConnections);
+    fprintf(out, "# TYPE w24_archive_jobs gauge\nw24_archive_jobs %ld\n", load.archiveJobs);
+
+    // The cache and the scheduler report "key value" lines already; they only need the prefix
+    char keyValues[2048];
+    formatCacheStats(keyValues, sizeof(keyValues));
+    size_t used = strlen(keyValues);
+    formatSchedulerStats(keyValues + used, sizeof(keyValues) - used);
+    char* position = NULL;
+    for (char* line = strtok_r(keyValues, "\n", &position); line; line = strtok_r(NULL, "\n", &position)) {
+        fprintf(out, "w24_%s\n", line);
+    }
+}
+
+// Answers every HTTP request on the exporter socket with the current metrics, whatever path it asks for
+static void* exporterThreadMain(void* argument) {
+    int serverSocket = (int)(long)argument;
+    while (1) {
+        int client = accept(serverSocket, NULL, NULL);
+        if (client < 0) continue;
+        // One thread serves every scrape, so a client that connects and sends nothing must not hold it
+        struct timeval timeout = { SCRAPE_TIMEOUT_SECONDS, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[1024];
+        recv(client, request, sizeof(request), 0);  // Only the request line matters, and it is ignored
+
+        char* body = NULL;
+        size_t bodyLength = 0;
+        FILE* out = open_memstream(&body, &bodyLength);
+        if (out) {
+            writePrometheusMetrics(out);
+            fclose(out);
+            char header[256];
+            int headerLength = snprintf(header, sizeof(header),
+                                        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                        "Content-Length: %zu\r\nConnection: close\r\n\r\n", bodyLength);
+            send(client, header, headerLength, MSG_NOSIGNAL | MSG_MORE);
+            send(client, body, bodyLength, MSG_NOSIGNAL);
+            free(body);
+        }
+        close(client);
+    }
+    return NULL;
+}
+
+int startMetricsExporter(int port) {
+    // Loopback only: the metrics are for a local scraper, not for clients
+    int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (serverSocket < 0) return -1;
+    int reuse = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(serverSocket, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(serverSocket, 16) != 0) {
+        perror("Metrics exporter");
+        close(serverSocket);
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, exporterThreadMain, (void*)(long)serverSocket) != 0) {
+        close(serverSocket);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
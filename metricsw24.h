@@ -0,0 +1,48 @@
+#ifndef METRICSW24_H
+#define METRICSW24_H
+
+#include <stddef.h>
+
+#include "schedw24.h"
+
+// Commands the server counts and times, whichever protocol they arrived in
+typedef enum {
+    COMMAND_W24FN,
+    COMMAND_DIRLIST,
+    COMMAND_W24FZ,
+    COMMAND_W24FT,
+    COMMAND_W24FDB,
+    COMMAND_W24FDA,
+    COMMAND_STATS,
+    COMMAND_LOAD,
+    COMMAND_OTHER,   // Invalid commands and unknown opcodes
+    COMMAND_KINDS
+} CommandKind;
+
+// Phases of an archive request: matching files, building the compressed tar, and sending it.
+// When an archive streams, compression time excludes the time spent waiting to send
+typedef enum {
+    PHASE_SCAN,
+    PHASE_COMPRESS,
+    PHASE_SEND,
+    ARCHIVE_PHASES
+} ArchivePhase;
+
+// Maps the counters in shared memory; call before the first fork or thread. Returns -1 if the mapping fails.
+// Every thread or process adds to its own shard with relaxed atomics, and readers sum the shards
+int initMetrics(void);
+
+// Monotonic time in seconds, for measuring what is recorded
+double metricsNow(void);
+
+void recordCommand(CommandKind kind, double seconds, unsigned long long bytesSent, int failed);
+void recordArchivePhase(ArchivePhase phase, double seconds);
+void recordQueueWait(JobClass jobClass, double seconds);  // Time an admitted job spent queued
+
+// Counters, bucket-estimated p50/p99 latencies, connections, bytes, cache and queue stats as "key value" lines
+void formatMetricsSummary(char* buffer, size_t bufferSize);
+
+// Serves the metrics in the Prometheus text format over HTTP on 127.0.0.1:port, from a background thread
+int startMetricsExporter(int port);
+
+#endif
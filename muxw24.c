@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "muxw24.h"
+#include "poolw24.h"
+#include "sockw24.h"
+
+#define MUX_FRAME_SIZE (64 * 1024)  // Largest data frame, so other replies get the socket between frames
+#define SESSIONS_PER_SLAB 8
+
+// Flow-control state of one reply in flight
+typedef struct {
+    uint32_t requestId;
+    int active;
+    long long credit;  // RESP_DATA bytes the reply may still send
+} StreamState;
+
+typedef struct {
+    int socket;
+    RequestHandler handler;
+    pthread_mutex_t writeLock;  // Held for the whole of each frame
+    pthread_mutex_t lock;       // Guards the fields below
+    pthread_cond_t changed;     // Credit granted, a request finished or the reader stopped
+    int readerDone;             // No more window updates will be read, so replies stop waiting for credit
+    int running;
+    StreamState streams[MAX_STREAMS_PER_CONNECTION];
+} MuxSession;
+
+// A request handed to its thread, with the stream it replies on
+typedef struct {
+    MuxSession* session;
+    StreamState* stream;
+    FrameHeader header;
+    char payload[MAX_REQUEST_PAYLOAD + 1];
+} StreamRequest;
+
+// Session and request state is pooled, so a steady stream of requests makes no malloc call
+static SlabPool sessionPool = SLAB_POOL_INITIALIZER(sizeof(MuxSession), SESSIONS_PER_SLAB);
+static SlabPool requestPool = SLAB_POOL_INITIALIZER(sizeof(StreamRequest), MAX_STREAMS_PER_CONNECTION);
+
+// Stream threads running in this process, over every session, and how many may; 0 leaves only the
+// per-connection limit
+static int streamThreads;
+static int streamThreadLimit;
+
+void setStreamThreadLimit(int limit) {
+    __atomic_store_n(&streamThreadLimit, limit, __ATOMIC_RELAXED);
+}
+
+// Claims a stream thread; returns 0 when the process already runs as many as it may
+static int claimStreamThread(void) {
+    int limit = __atomic_load_n(&streamThreadLimit, __ATOMIC_RELAXED);
+    int running = __atomic_load_n(&streamThreads, __ATOMIC_RELAXED);
+    do {
+        if (limit > 0 && running >= limit) return 0;
+    } while (!__atomic_compare_exchange_n(&streamThreads, &running, running + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
+
+// Waits until a data frame fits the stream's window, then takes the connection for the frame
+static int beginStreamFrame(ReplyChannel* channel, int opcode, unsigned long long length) {
+    StreamRequest* request = channel->session;
+    MuxSession* session = request->session;
+    if (opcode == RESP_DATA) {
+        long long needed = length < INITIAL_STREAM_WINDOW ? (long long)length : INITIAL_STREAM_WINDOW;
+        pthread_mutex_lock(&session->lock);
+        if (!session->readerDone && request->stream->credit < needed) {
+            // The client may be waiting on data a batched frame left queued before it returns credit
+            pushPendingData(session->socket);
+        }
+        while (!session->readerDone && request->stream->credit < needed) {
+            pthread_cond_wait(&session->changed, &session->lock);
+        }
+        request->stream->credit -= length;
+        pthread_mutex_unlock(&session->lock);
+    }
+    pthread_mutex_lock(&session->writeLock);
+    return 0;
+}
+
+static void endStreamFrame(ReplyChannel* channel) {
+    StreamRequest* request = channel->session;
+    pthread_mutex_unlock(&request->session->writeLock);
+}
+
+// Replies to a request that never got a stream, between the frames of running replies
+static void rejectRequest(MuxSession* session, uint32_t requestId, const char* message) {
+    ReplyChannel channel = { session->socket, 1, requestId };
+    pthread_mutex_lock(&session->writeLock);
+    replyError(&channel, message);
+    pthread_mutex_unlock(&session->writeLock);
+}
+
+static void* runStream(void* argument) {
+    StreamRequest* request = argument;
+    MuxSession* session = request->session;
+    ReplyChannel channel = { session->socket, 1, request->header.requestId, MUX_FRAME_SIZE,
+                             beginStreamFrame, endStreamFrame, request, acquireArena() };
+    channel.batch = batchingReplies();
+
+    if (!channel.arena) {
+        replyError(&channel, "Server busy.\n");
+    } else if (!session->handler(&channel, &request->header, request->payload)) {
+        shutdown(session->socket, SHUT_RD);  // Wakes the reader, which then stops like on OP_QUIT
+    }
+    releaseArena(channel.arena);
+
+    pthread_mutex_lock(&session->lock);
+    request->stream->active = 0;
+    session->running--;
+    pthread_cond_broadcast(&session->changed);
+    pthread_mutex_unlock(&session->lock);
+    poolPut(&requestPool, request);
+    __atomic_sub_fetch(&streamThreads, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Claims a stream for a new request id; returns NULL with an error message when it cannot run now
+static StreamState* openStream(MuxSession* session, uint32_t requestId, const char** error) {
+    StreamState* freeSlot = NULL;
+    for (int i = 0; i < MAX_STREAMS_PER_CONNECTION; i++) {
+        StreamState* stream = &session->streams[i];
+        if (stream->active && stream->requestId == requestId) {
+            *error = "Request id already in use.\n";
+            return NULL;
+        }
+        if (!stream->active && !freeSlot) freeSlot = stream;
+    }
+    if (!freeSlot) {
+        *error = "Too many requests in flight.\n";
+        return NULL;
+    }
+    freeSlot->requestId = requestId;
+    freeSlot->active = 1;
+    freeSlot->credit = INITIAL_STREAM_WINDOW;
+    session->running++;
+    return freeSlot;
+}
+
+// Adds credit to a running stream; updates for replies that already ended are ignored
+static void grantCredit(MuxSession* session, uint32_t requestId, unsigned long long amount) {
+    pthread_mutex_lock(&session->lock);
+    for (int i = 0; i < MAX_STREAMS_PER_CONNECTION; i++) {
+        StreamState* stream = &session->streams[i];
+        if (stream->active && stream->requestId == requestId) {
+            if (amount > INITIAL_STREAM_WINDOW * 64ULL) amount = INITIAL_STREAM_WINDOW * 64ULL;
+            stream->credit += amount;
+            pthread_cond_broadcast(&session->changed);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&session->lock);
+}
+
+void runMuxSession(int socket, RequestHandler handler) {
+    MuxSession* session = poolGet(&sessionPool);
+    if (!session) {
+        close(socket);
+        return;
+    }
+    memset(session, 0, sizeof(MuxSession));
+    session->socket = socket;
+    session->handler = handler;
+    pthread_mutex_init(&session->writeLock, NULL);
+    pthread_mutex_init(&session->lock, NULL);
+    pthread_cond_init(&session->changed, NULL);
+
+    while (1) {
+        FrameHeader header;
+        if (receiveFrameHeader(socket, &header) != 0) break;
+        if (header.version != WIRE_VERSION || header.length > MAX_REQUEST_PAYLOAD) {
+            // The rest of the stream cannot be parsed, so nothing more is read after the error
+            rejectRequest(session, header.requestId, header.version != WIRE_VERSION ? "Unsupported protocol version.\n"
+                                                                                     : "Request too large.\n");
+            break;
+        }
+
+        StreamRequest* request = poolGet(&requestPool);
+        if (!request) break;
+        if (header.length > 0 && recvAll(socket, request->payload, header.length) != 0) {
+            poolPut(&requestPool, request);
+            break;
+        }
+        request->payload[header.length] = '\0';
+
+        if (header.opcode == OP_QUIT) {
+            poolPut(&requestPool, request);
+            break;
+        }
+        if (header.opcode == OP_WINDOW_UPDATE) {
+            if (header.length >= 8) {
+                unsigned long long amount = 0;
+                for (int i = 0; i < 8; i++) amount = (amount << 8) | (unsigned char)request->payload[i];
+                grantCredit(session, header.requestId, amount);
+            }
+            poolPut(&requestPool, request);
+            continue;
+        }
+
+        const char* error = NULL;
+        pthread_mutex_lock(&session->lock);
+        request->stream = openStream(session, header.requestId, &error);
+        pthread_mutex_unlock(&session->lock);
+        if (!request->stream) {
+            rejectRequest(session, header.requestId, error);
+            poolPut(&requestPool, request);
+            continue;
+        }
+        request->session = session;
+        request->header = header;
+
+        int started = claimStreamThread();
+        if (started) {
+            pthread_t thread;
+            pthread_attr_t attributes;
+            pthread_attr_init(&attributes);
+            pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+            started = pthread_create(&thread, &attributes, runStream, request) == 0;
+            pthread_attr_destroy(&attributes);
+            if (!started) __atomic_sub_fetch(&streamThreads, 1, __ATOMIC_RELAXED);
+        }
+        if (!started) {
+            pthread_mutex_lock(&session->lock);
+            request->stream->active = 0;
+            session->running--;
+            pthread_mutex_unlock(&session->lock);
+            rejectRequest(session, header.requestId, "Server busy.\n");
+            poolPut(&requestPool, request);
+        }
+    }
+
+    // Replies in flight still finish; without a reader they are limited only by the socket buffer
+    pthread_mutex_lock(&session->lock);
+    session->readerDone = 1;
+    pthread_cond_broadcast(&session->changed);
+    while (session->running > 0) {
+        pthread_cond_wait(&session->changed, &session->lock);
+    }
+    pthread_mutex_unlock(&session->lock);
+
+    close(socket);
+    pthread_cond_destroy(&session->changed);
+    pthread_mutex_destroy(&session->lock);
+    pthread_mutex_destroy(&session->writeLock);
+    poolPut(&sessionPool, session);
+}
+
+typedef struct {
+    int socket;
+    RequestHandler handler;
+    SessionFinishedFn finished;
+} SessionStart;
+
+static SlabPool sessionStartPool = SLAB_POOL_INITIALIZER(sizeof(SessionStart), SESSIONS_PER_SLAB);
+
+static void* sessionMain(void* argument) {
+    SessionStart start = *(SessionStart*)argument;
+    poolPut(&sessionStartPool, argument);
+    runMuxSession(start.socket, start.handler);
+    if (start.finished) start.finished();
+    return NULL;
+}
+
+int startMuxSession(int socket, RequestHandler handler, SessionFinishedFn finished) {
+    SessionStart* start = poolGet(&sessionStartPool);
+    if (!start) return -1;
+    start->socket = socket;
+    start->handler = handler;
+    start->finished = finished;
+
+    pthread_t thread;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    int result = pthread_create(&thread, &attributes, sessionMain, start);
+    pthread_attr_destroy(&attributes);
+    if (result != 0) {
+        poolPut(&sessionStartPool, start);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef MUXW24_H
+#define MUXW24_H
+
+#include "protocolw24.h"
+
+// Runs one request of a multiplexed connection on its own thread; payload is NUL-terminated.
+// Replies go through channel only. Returns 0 when the request asked to close the connection
+typedef int (*RequestHandler)(ReplyChannel* channel, const FrameHeader* header, char* payload);
+
+// Serves a binary connection until the client quits or disconnects. This thread keeps reading request
+// frames and window updates while every request runs on a thread of its own, so a quick lookup is answered
+// while an archive is still streaming. Closes the socket once the last reply has ended.
+void runMuxSession(int socket, RequestHandler handler);
+
+// Caps the stream threads of every session in this process together; a request beyond it is answered
+// "Server busy." without running. 0, the default, leaves only MAX_STREAMS_PER_CONNECTION per session
+void setStreamThreadLimit(int limit);
+
+// Called once a session has closed its socket
+typedef void (*SessionFinishedFn)(void);
+
+// Runs the session on a new detached thread; returns -1, leaving the socket open, if it cannot start
+int startMuxSession(int socket, RequestHandler handler, SessionFinishedFn finished);
+
+#endif
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "poolw24.h"
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_CHUNK_SIZE (64 * 1024)  // Smallest chunk; larger ones are made for large allocations
+#define ARENAS_PER_SLAB 16
+#define SORT_RUN 16  // Elements insertion-sorted in place before merging
+
+struct ArenaChunk {
+    ArenaChunk* next;
+    size_t capacity;
+    size_t used;
+    unsigned char data[] __attribute__((aligned(ARENA_ALIGNMENT)));
+};
+
+static size_t alignSize(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static ArenaChunk* newChunk(size_t capacity) {
+    ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + capacity);
+    if (chunk) *chunk = (ArenaChunk){ NULL, capacity, 0 };
+    return chunk;
+}
+
+// Makes a chunk of at least size bytes the current one: the spare when it fits, otherwise a new one twice
+// the size of the last, so a request that outgrows the spare takes few mallocs
+static ArenaChunk* takeChunk(Arena* arena, size_t size) {
+    ArenaChunk* chunk = NULL;
+    if (arena->spare && arena->spare->capacity >= size) {
+        chunk = arena->spare;
+        arena->spare = NULL;
+    } else {
+        size_t capacity = arena->current ? arena->current->capacity * 2 : ARENA_CHUNK_SIZE;
+        while (capacity < size) capacity *= 2;
+        if (!(chunk = newChunk(capacity))) return NULL;
+    }
+    chunk->used = 0;
+    chunk->next = arena->current;
+    arena->current = chunk;
+    return chunk;
+}
+
+void* arenaAlloc(Arena* arena, size_t size) {
+    size = alignSize(size ? size : 1);
+    ArenaChunk* chunk = arena->current;
+    if (!chunk || chunk->capacity - chunk->used < size) {
+        chunk = takeChunk(arena, size);
+        if (!chunk) return NULL;
+    }
+    void* memory = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->last = memory;
+    return memory;
+}
+
+void* arenaCalloc(Arena* arena, size_t count, size_t size) {
+    if (size && count > (size_t)-1 / size) return NULL;
+    void* memory = arenaAlloc(arena, count * size);
+    if (memory) memset(memory, 0, count * size);
+    return memory;
+}
+
+void* arenaGrow(Arena* arena, void* old, size_t oldSize, size_t newSize) {
+    ArenaChunk* chunk = arena->current;
+    if (old && old == arena->last) {
+        size_t offset = (unsigned char*)old - chunk->data;
+        if (chunk->capacity - offset >= alignSize(newSize)) {
+            chunk->used = offset + alignSize(newSize);
+            return old;
+        }
+    }
+    void* memory = arenaAlloc(arena, newSize);
+    if (memory && old) memcpy(memory, old, oldSize < newSize ? oldSize : newSize);
+    return memory;
+}
+
+char* arenaStrdup(Arena* arena, const char* text) {
+    size_t length = strlen(text) + 1;
+    char* copy = arenaAlloc(arena, length);
+    if (copy) memcpy(copy, text, length);
+    return copy;
+}
+
+// Sorts a short run in place, moving each element through the spare slot at temporary
+static void insertionSort(unsigned char* base, size_t count, size_t size, unsigned char* temporary,
+                          int (*compare)(const void*, const void*)) {
+    for (size_t i = 1; i < count; i++) {
+        size_t j = i;
+        if (compare(base + (j - 1) * size, base + j * size) <= 0) continue;
+        memcpy(temporary, base + i * size, size);
+        while (j > 0 && compare(base + (j - 1) * size, temporary) > 0) {
+            memcpy(base + j * size, base + (j - 1) * size, size);
+            j--;
+        }
+        memcpy(base + j * size, temporary, size);
+    }
+}
+
+void arenaSort(Arena* arena, void* base, size_t count, size_t size, int (*compare)(const void*, const void*)) {
+    if (count < 2) return;
+    unsigned char* scratch = arena && count < (size_t)-1 / size ? arenaAlloc(arena, (count + 1) * size) : NULL;
+    if (!scratch) {
+        qsort(base, count, size, compare);
+        return;
+    }
+    unsigned char* temporary = scratch + count * size;
+    for (size_t start = 0; start < count; start += SORT_RUN) {
+        insertionSort((unsigned char*)base + start * size, count - start < SORT_RUN ? count - start : SORT_RUN,
+                      size, temporary, compare);
+    }
+
+    // Bottom-up merges between the array and the scratch copy; the left run wins ties, so the sort is stable
+    unsigned char* from = base;
+    unsigned char* to = scratch;
+    for (size_t width = SORT_RUN; width < count; width *= 2) {
+        for (size_t start = 0; start < count; start += 2 * width) {
+            size_t middle = start + width < count ? start + width : count;
+            size_t end = middle + width < count ? middle + width : count;
+            size_t left = start, right = middle, out = start;
+            while (left < middle && right < end) {
+                if (compare(from + right * size, from + left * size) < 0) {
+                    memcpy(to + out++ * size, from + right++ * size, size);
+                } else {
+                    memcpy(to + out++ * size, from + left++ * size, size);
+                }
+            }
+            memcpy(to + out * size, from + left * size, (middle - left) * size);
+            out += middle - left;
+            memcpy(to + out * size, from + right * size, (end - right) * size);
+        }
+        unsigned char* swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != base) memcpy(base, from, count * size);
+}
+
+// Frees a list of chunks, returning their total capacity
+static size_t freeChunks(ArenaChunk* chunk) {
+    size_t total = 0;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        total += chunk->capacity;
+        free(chunk);
+        chunk = next;
+    }
+    return total;
+}
+
+void arenaReset(Arena* arena) {
+    ArenaChunk* used = arena->current;
+    arena->current = NULL;
+    arena->last = NULL;
+    if (!used) return;
+    if (!used->next && !arena->spare) {
+        arena->spare = used;  // The request fit one chunk, which is what the next one gets
+        return;
+    }
+
+    // The request spread over several chunks: they are merged into one for the next request, and a rare huge
+    // request does not pin its memory for good
+    size_t total = freeChunks(used) + freeChunks(arena->spare);
+    arena->spare = newChunk(total < ARENA_RETAIN_BYTES ? total : ARENA_RETAIN_BYTES);
+}
+
+void arenaDestroy(Arena* arena) {
+    freeChunks(arena->current);
+    freeChunks(arena->spare);
+    arena->current = NULL;
+    arena->spare = NULL;
+    arena->last = NULL;
+}
+
+void* poolGet(SlabPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->freeList) {
+        // Objects are at least a pointer wide, which the free list keeps in their first bytes
+        size_t stride = alignSize(pool->objectSize > sizeof(void*) ? pool->objectSize : sizeof(void*));
+        unsigned char* slab = calloc(pool->perSlab, stride);
+        for (size_t i = 0; slab && i < pool->perSlab; i++) {
+            *(void**)(slab + i * stride) = pool->freeList;
+            pool->freeList = slab + i * stride;
+        }
+        if (slab) pool->created += pool->perSlab;
+    }
+    void* object = pool->freeList;
+    if (object) pool->freeList = *(void**)object;
+    pthread_mutex_unlock(&pool->lock);
+    return object;
+}
+
+void poolPut(SlabPool* pool, void* object) {
+    if (!object) return;
+    pthread_mutex_lock(&pool->lock);
+    *(void**)object = pool->freeList;
+    pool->freeList = object;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static SlabPool arenaPool = SLAB_POOL_INITIALIZER(sizeof(Arena), ARENAS_PER_SLAB);
+static size_t pooledSpareSize;  // Largest spare a pooled arena has kept, which the others grow to; under the lock
+
+// A pooled arena keeps its spare chunks; only its first field, which the free list borrowed, is restored
+Arena* acquireArena(void) {
+    Arena* arena = poolGet(&arenaPool);
+    if (arena) {
+        arena->current = NULL;
+        arena->last = NULL;
+    }
+    return arena;
+}
+
+static void growSpare(Arena* arena, size_t size) {
+    if (arena->spare && arena->spare->capacity >= size) return;
+    ArenaChunk* spare = newChunk(size);
+    if (!spare) return;
+    free(arena->spare);
+    arena->spare = spare;
+}
+
+// Requests do not always get the arena that served the same command before, because a client's next request
+// can start while the last one is finishing. So when an arena keeps a larger spare than any before it, the
+// arenas waiting in the pool grow theirs to match, and no arena has to grow again for that size of request
+void releaseArena(Arena* arena) {
+    if (!arena) return;
+    arenaReset(arena);
+    size_t spareSize = arena->spare ? arena->spare->capacity : 0;
+    pthread_mutex_lock(&arenaPool.lock);
+    if (spareSize > pooledSpareSize) {
+        pooledSpareSize = spareSize;
+        // Only the first field of a pooled arena holds the free list's link. Arenas no request has used yet
+        // have no spare and are left alone, so a fresh slab does not take memory it may never need
+        for (void* waiting = arenaPool.freeList; waiting; waiting = *(void**)waiting) {
+            if (((Arena*)waiting)->spare) growSpare(waiting, spareSize);
+        }
+    }
+    growSpare(arena, pooledSpareSize);
+    *(void**)arena = arenaPool.freeList;
+    arenaPool.freeList = arena;
+    pthread_mutex_unlock(&arenaPool.lock);
+}
+
+#ifdef COUNT_ALLOCATIONS
+// glibc's own entry points, which the replacements below forward to (see "Replacing malloc" in its manual)
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* memory, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void* memory);
+
+const int allocationCounting = 1;
+static unsigned long long processAllocations;  // Counted here until the shared counter is mapped
+static unsigned long long* allocations = &processAllocations;
+
+static void countAllocation(void) {
+    __atomic_fetch_add(allocations, 1, __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t size) {
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* memory, size_t size) {
+    countAllocation();
+    return __libc_realloc(memory, size);
+}
+
+void free(void* memory) {
+    __libc_free(memory);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** memory, size_t alignment, size_t size) {
+    countAllocation();
+    *memory = __libc_memalign(alignment, size);
+    return *memory ? 0 : ENOMEM;
+}
+
+void initAllocationCounter(void) {
+    unsigned long long* shared = mmap(NULL, sizeof(unsigned long long), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return;
+    *shared = processAllocations;
+    allocations = shared;
+}
+
+unsigned long long allocationCount(void) {
+    return __atomic_load_n(allocations, __ATOMIC_RELAXED);
+}
+#else
+const int allocationCounting = 0;
+
+void initAllocationCounter(void) {
+}
+
+unsigned long long allocationCount(void) {
+    return 0;
+}
+#endif
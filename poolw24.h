@@ -0,0 +1,67 @@
+#ifndef POOLW24_H
+#define POOLW24_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// Bump allocator for the memory of one request: match lists, listings, reply and archive buffers. Nothing
+// is freed on its own. A reset keeps one chunk as large as everything the request used, up to
+// ARENA_RETAIN_BYTES, so once an arena has served its largest request it stops calling malloc. Pooled
+// arenas share that size, see releaseArena
+#define ARENA_RETAIN_BYTES (16u * 1024 * 1024)
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct Arena {
+    ArenaChunk* current;  // Chunk allocations come from; earlier chunks of this request follow it
+    ArenaChunk* spare;    // Chunk kept from earlier requests, or NULL
+    void* last;           // Latest allocation, which arenaGrow can extend in place
+} Arena;
+
+// 16-byte aligned, or NULL when out of memory
+void* arenaAlloc(Arena* arena, size_t size);
+void* arenaCalloc(Arena* arena, size_t count, size_t size);
+
+// realloc for arena memory: extends the latest allocation in place when it fits, otherwise copies it
+void* arenaGrow(Arena* arena, void* old, size_t oldSize, size_t newSize);
+
+char* arenaStrdup(Arena* arena, const char* text);
+
+// Stable sort with qsort's arguments. glibc's qsort mallocs a scratch copy of the array; this one takes it
+// from the arena, and falls back to qsort when there is no arena or it is out of memory
+void arenaSort(Arena* arena, void* base, size_t count, size_t size, int (*compare)(const void*, const void*));
+
+// Forgets every allocation; memory is reused by the next request
+void arenaReset(Arena* arena);
+
+// Frees every chunk
+void arenaDestroy(Arena* arena);
+
+// Takes an arena from the process-wide pool, or makes one; releaseArena resets it and puts it back
+Arena* acquireArena(void);
+void releaseArena(Arena* arena);
+
+// Pool of fixed-size objects, such as connection and request state and I/O buffers. Objects are carved from
+// slabs that are never returned, so after warming up getting and putting an object costs a lock and no malloc
+typedef struct {
+    size_t objectSize;
+    size_t perSlab;
+    pthread_mutex_t lock;
+    void* freeList;
+    size_t created;
+} SlabPool;
+
+#define SLAB_POOL_INITIALIZER(size, perSlab) { (size), (perSlab), PTHREAD_MUTEX_INITIALIZER, NULL, 0 }
+
+// An uninitialized object, or NULL when out of memory
+void* poolGet(SlabPool* pool);
+void poolPut(SlabPool* pool, void* object);
+
+// Built with -DCOUNT_ALLOCATIONS, every malloc, calloc, realloc and memalign of every server process is
+// counted in shared memory, so the stats output shows whether requests allocate. Call initAllocationCounter
+// before the first fork; allocationCounting is 0 in normal builds
+extern const int allocationCounting;
+void initAllocationCounter(void);
+unsigned long long allocationCount(void);
+
+#endif
@@ -0,0 +1,230 @@
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "protocolw24.h"
+
+int sendAll(int socket, const void* data, size_t length) {
+    const char* cursor = data;
+    while (length > 0) {
+        ssize_t sent = send(socket, cursor, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        cursor += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+int recvAll(int socket, void* data, size_t length) {
+    char* cursor = data;
+    while (length > 0) {
+        ssize_t received = recv(socket, cursor, length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return -1;
+        cursor += received;
+        length -= received;
+    }
+    return 0;
+}
+
+// Sends a header and payload with one sendmsg, finishing any short write
+static int sendWithHeader(int socket, const void* header, size_t headerLength, const void* data, size_t length, int flags) {
+    struct iovec parts[2] = {
+        { (void*)header, headerLength },
+        { (void*)data, length },
+    };
+    struct msghdr message = {0};
+    message.msg_iov = parts;
+    message.msg_iovlen = length > 0 ? 2 : 1;
+
+    size_t remaining = headerLength + length;
+    while (remaining > 0) {
+        ssize_t sent = sendmsg(socket, &message, MSG_NOSIGNAL | flags);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        remaining -= sent;
+
+        // Skip the iovecs that were fully written and trim the partially written one
+        while (message.msg_iovlen > 0 && (size_t)sent >= message.msg_iov->iov_len) {
+            sent -= message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov->iov_base = (char*)message.msg_iov->iov_base + sent;
+            message.msg_iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+// Sends a 4-byte chunk header and its payload
+static int sendFramed(int socket, uint32_t header, const void* data, size_t length, int flags) {
+    uint32_t wireHeader = htonl(header);
+    return sendWithHeader(socket, &wireHeader, sizeof(wireHeader), data, length, flags);
+}
+
+static int sendChunks(int socket, const void* data, size_t length, int flags) {
+    while (length > 0) {
+        size_t part = length > CHUNK_LENGTH_MASK ? CHUNK_LENGTH_MASK : length;
+        if (sendFramed(socket, part, data, part, flags) != 0) return -1;
+        data = (const char*)data + part;
+        length -= part;
+    }
+    return 0;
+}
+
+int sendChunk(int socket, const void* data, size_t length) {
+    return sendChunks(socket, data, length, 0);
+}
+
+int sendErrorChunk(int socket, const char* message) {
+    // The terminator follows at once, so the message waits for it instead of leaving in a segment of its own
+    if (sendFramed(socket, CHUNK_ERROR_FLAG | strlen(message), message, strlen(message), MSG_MORE) != 0) return -1;
+    return sendEndChunk(socket);
+}
+
+int sendEndChunk(int socket) {
+    return sendFramed(socket, 0, NULL, 0, 0);
+}
+
+long receiveChunkHeader(int socket, int* isError) {
+    uint32_t wireHeader;
+    if (recvAll(socket, &wireHeader, sizeof(wireHeader)) != 0) return -1;
+    uint32_t header = ntohl(wireHeader);
+    *isError = (header & CHUNK_ERROR_FLAG) != 0;
+    return header & CHUNK_LENGTH_MASK;
+}
+
+// Writes a 64-bit value big-endian
+static void putUint64(unsigned char* out, uint64_t value) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+// Sends a frame header and its payload, or the header alone when payload is NULL
+static int writeFrame(int socket, const FrameHeader* header, const void* payload, int flags) {
+    unsigned char wireHeader[FRAME_HEADER_SIZE];
+    wireHeader[0] = WIRE_MAGIC;
+    wireHeader[1] = header->version;
+    wireHeader[2] = header->opcode;
+    wireHeader[3] = header->flags;
+    uint32_t requestId = htonl(header->requestId);
+    memcpy(wireHeader + 4, &requestId, sizeof(requestId));
+    putUint64(wireHeader + 8, header->length);
+
+    return sendWithHeader(socket, wireHeader, sizeof(wireHeader), payload, payload ? header->length : 0, flags);
+}
+
+int sendFrame(int socket, const FrameHeader* header, const void* payload, int moreData) {
+    if (moreData) return writeFrame(socket, header, NULL, MSG_MORE);
+    return writeFrame(socket, header, payload, 0);
+}
+
+int receiveFrameHeader(int socket, FrameHeader* header) {
+    unsigned char wireHeader[FRAME_HEADER_SIZE];
+    if (recvAll(socket, wireHeader, sizeof(wireHeader)) != 0 || wireHeader[0] != WIRE_MAGIC) return -1;
+
+    header->version = wireHeader[1];
+    header->opcode = wireHeader[2];
+    header->flags = wireHeader[3];
+    uint32_t requestId;
+    memcpy(&requestId, wireHeader + 4, sizeof(requestId));
+    header->requestId = ntohl(requestId);
+    header->length = 0;
+    for (int i = 8; i < FRAME_HEADER_SIZE; i++) header->length = (header->length << 8) | wireHeader[i];
+    return 0;
+}
+
+// Adds bytes to the channel's count when a send succeeded, and passes its result on
+static int countSent(ReplyChannel* channel, int result, unsigned long long bytes) {
+    if (result == 0) channel->bytesSent += bytes;
+    return result;
+}
+
+// MSG_MORE for a frame the same reply follows up on, when the channel batches
+static int batchFlags(const ReplyChannel* channel) {
+    return channel->batch ? MSG_MORE : 0;
+}
+
+// Sends one binary response frame on a channel, inside the multiplexing hooks when there are any
+static int replyFrame(ReplyChannel* channel, uint8_t opcode, const void* payload, size_t length, int flags) {
+    FrameHeader header = { WIRE_VERSION, opcode, 0, channel->requestId, length };
+    if (channel->beginFrame && channel->beginFrame(channel, opcode, length) != 0) return -1;
+    int result = writeFrame(channel->socket, &header, payload, flags);
+    if (channel->endFrame) channel->endFrame(channel);
+    return countSent(channel, result, FRAME_HEADER_SIZE + length);
+}
+
+int replyText(ReplyChannel* channel, const char* text) {
+    if (channel->binary) return replyFrame(channel, RESP_TEXT, text, strlen(text), 0);
+    return countSent(channel, sendAll(channel->socket, text, strlen(text)), strlen(text));
+}
+
+int replyArchiveBegin(ReplyChannel* channel, int wireCodec, unsigned long long contentId, unsigned long long offset) {
+    if (!channel->binary) return 0;  // Text-mode clients tell the codec from the archive's magic number
+    unsigned char payload[ARCHIVE_BEGIN_SIZE];
+    payload[0] = wireCodec;
+    for (int i = 0; i < 8; i++) {
+        payload[1 + i] = contentId >> (56 - 8 * i);
+        payload[9 + i] = offset >> (56 - 8 * i);
+    }
+    return replyFrame(channel, RESP_ARCHIVE_BEGIN, payload, sizeof(payload), batchFlags(channel));
+}
+
+int replyData(ReplyChannel* channel, const void* data, size_t length) {
+    if (!channel->binary) {
+        return countSent(channel, sendChunks(channel->socket, data, length, batchFlags(channel)), 4 + length);
+    }
+    while (length > 0) {
+        size_t part = channel->maxFrame && length > channel->maxFrame ? channel->maxFrame : length;
+        if (replyFrame(channel, RESP_DATA, data, part, batchFlags(channel)) != 0) return -1;
+        data = (const char*)data + part;
+        length -= part;
+    }
+    return 0;
+}
+
+int replyEnd(ReplyChannel* channel) {
+    if (channel->binary) return replyFrame(channel, RESP_END, NULL, 0, 0);
+    return countSent(channel, sendEndChunk(channel->socket), 4);
+}
+
+int replyError(ReplyChannel* channel, const char* message) {
+    channel->errorSent = 1;
+    if (channel->binary) return replyFrame(channel, RESP_ERROR, message, strlen(message), 0);
+    return countSent(channel, sendErrorChunk(channel->socket, message), 8 + strlen(message));
+}
+
+int replyDataHeader(ReplyChannel* channel, unsigned long long length) {
+    if (channel->binary) {
+        FrameHeader header = { WIRE_VERSION, RESP_DATA, 0, channel->requestId, length };
+        if (channel->beginFrame && channel->beginFrame(channel, RESP_DATA, length) != 0) return -1;
+        if (sendFrame(channel->socket, &header, NULL, 1) == 0) return countSent(channel, 0, FRAME_HEADER_SIZE + length);
+        replyDataSent(channel);
+        return -1;
+    }
+    // The caller sends the data itself; it is counted here, as if it always arrives
+    uint32_t wireHeader = htonl((uint32_t)length);
+    return countSent(channel, sendWithHeader(channel->socket, &wireHeader, sizeof(wireHeader), NULL, 0, MSG_MORE),
+                     sizeof(wireHeader) + length);
+}
+
+void replyDataSent(ReplyChannel* channel) {
+    if (channel->binary && channel->endFrame) channel->endFrame(channel);
+}
+
+unsigned long long maxDataLength(const ReplyChannel* channel) {
+    if (!channel->binary) return CHUNK_LENGTH_MASK;
+    return channel->maxFrame ? channel->maxFrame : UINT64_MAX;
+}
@@ -0,0 +1,138 @@
+#ifndef PROTOCOLW24_H
+#define PROTOCOLW24_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Archive and listing replies are a sequence of chunks: a 4-byte big-endian length, then that many bytes.
+// A zero-length chunk ends the reply. A chunk with CHUNK_ERROR_FLAG set carries an error message
+// instead of data and is followed by the terminator.
+#define CHUNK_ERROR_FLAG 0x80000000u
+#define CHUNK_LENGTH_MASK 0x7fffffffu
+
+// Sends or receives exactly length bytes, retrying short transfers; returns 0 on success
+int sendAll(int socket, const void* data, size_t length);
+int recvAll(int socket, void* data, size_t length);
+
+// Sends one data chunk, an error chunk, or the terminating empty chunk
+int sendChunk(int socket, const void* data, size_t length);
+int sendErrorChunk(int socket, const char* message);
+int sendEndChunk(int socket);
+
+// Reads the next chunk header; returns the payload length (0 for the terminator) or -1 on error
+long receiveChunkHeader(int socket, int* isError);
+
+// Reply to a request turned away because the server is at its limits, in place of its usual reply
+#define BUSY_REPLY_FORMAT "Server busy, retry after %d seconds.\n"
+
+// Binary protocol, version 1. Every message in either direction is a frame: a 16-byte header
+// (magic, version, opcode, flags, 32-bit request id, 64-bit payload length, big-endian) and the payload.
+// A connection speaks it when a message starts with WIRE_MAGIC, which no text command does; anything
+// else is read as a text command and answered in the framing above.
+#define WIRE_MAGIC 0xB7
+#define WIRE_VERSION 1
+#define FRAME_HEADER_SIZE 16
+#define MAX_REQUEST_PAYLOAD 4096
+
+// Request opcodes. Archive payloads start with ARCHIVE_PREFIX_SIZE bytes: the codec (a WIRE_CODEC_*
+// value), its level (0 for the default), a mask of accepted codecs (1 << WIRE_CODEC_*) and a zero byte.
+typedef enum {
+    OP_QUIT = 0x01,
+    OP_FIND_FILE = 0x02,          // Payload: file name
+    OP_LIST_DIRECTORIES = 0x03,   // No payload; LIST_BY_MTIME flag sorts by modification time
+    OP_ARCHIVE_BY_SIZE = 0x04,    // Prefix, then minimum and maximum size as 64-bit integers
+    OP_ARCHIVE_BY_TYPE = 0x05,    // Prefix, then space-separated extensions
+    OP_ARCHIVE_BEFORE = 0x06,     // Prefix, then "YYYY-MM-DD"
+    OP_ARCHIVE_AFTER = 0x07,      // Prefix, then "YYYY-MM-DD"
+    OP_STATS = 0x08,
+    OP_TEXT_COMMAND = 0x09,       // Payload: a text command, answered in frames
+    OP_WINDOW_UPDATE = 0x0A,      // Payload: 64-bit count of bytes of request id's data the client has consumed
+    OP_LOAD = 0x0B,               // Load probe: connections, archive jobs and CPU load as "key value" lines
+} RequestOpcode;
+
+// Response opcodes. A reply is one RESP_TEXT, or RESP_ARCHIVE_BEGIN (archives only) followed by any
+// number of RESP_DATA frames and RESP_END, or RESP_ERROR at any point, which ends the reply.
+typedef enum {
+    RESP_TEXT = 0x81,
+    RESP_ARCHIVE_BEGIN = 0x82,    // Payload: the WIRE_CODEC_* byte, the archive's content id and the offset of the first data byte
+    RESP_DATA = 0x83,
+    RESP_END = 0x84,
+    RESP_ERROR = 0x85,            // Payload: message
+} ResponseOpcode;
+
+#define LIST_BY_MTIME 0x01
+
+// Flag on archive requests asking for part of an archive, to resume a broken download. After the codec prefix
+// come ARCHIVE_RANGE_SIZE bytes: the content id from RESP_ARCHIVE_BEGIN, the first offset and the length
+// (0 for the rest), all 64-bit; the arguments follow. The content id names the exact matched files and codec,
+// so the range is served only while the query still yields byte-identical archive contents.
+#define ARCHIVE_RANGE 0x02
+#define ARCHIVE_RANGE_SIZE 24
+#define ARCHIVE_BEGIN_SIZE 17
+
+// Requests on one connection may be pipelined: each runs concurrently and its reply frames carry its
+// request id, so replies interleave frame by frame. Every reply may send INITIAL_STREAM_WINDOW bytes of
+// RESP_DATA payload before it must wait for OP_WINDOW_UPDATE credit; clients return credit as they
+// consume data. OP_QUIT closes the connection once every reply in flight has ended.
+#define INITIAL_STREAM_WINDOW (1024 * 1024)
+#define MAX_STREAMS_PER_CONNECTION 32
+
+#define ARCHIVE_PREFIX_SIZE 4
+#define WIRE_CODEC_GZIP 0
+#define WIRE_CODEC_ZSTD 1
+#define WIRE_CODEC_LZ4 2
+#define WIRE_CODEC_NEGOTIATE 0xff
+
+typedef struct {
+    uint8_t version;
+    uint8_t opcode;
+    uint8_t flags;
+    uint32_t requestId;
+    uint64_t length;
+} FrameHeader;
+
+// Sends a whole frame; with moreData set only the header is sent, and the payload must follow
+int sendFrame(int socket, const FrameHeader* header, const void* payload, int moreData);
+
+// Reads a frame header; returns -1 on a closed connection or a bad magic byte
+int receiveFrameHeader(int socket, FrameHeader* header);
+
+// Where one reply goes and how it is framed: text-mode chunks, or binary frames tagged with a request id.
+// On a multiplexed connection beginFrame and endFrame wrap every frame: beginFrame waits for flow-control
+// credit for data frames and takes the connection's write lock, so frames of concurrent replies never mix.
+// The server gives every request an arena for the memory it needs until the reply ends (see poolw24.h).
+struct Arena;
+
+typedef struct ReplyChannel {
+    int socket;
+    int binary;
+    uint32_t requestId;
+    size_t maxFrame;  // Largest data frame to send, 0 for no limit
+    int (*beginFrame)(struct ReplyChannel* channel, int opcode, unsigned long long length);
+    void (*endFrame)(struct ReplyChannel* channel);
+    void* session;
+    struct Arena* arena;           // Reset once the reply ends; NULL when the request has none
+    unsigned long long bytesSent;  // Reply bytes written so far, framing included
+    int errorSent;                 // The reply ended with an error
+    int batch;                     // Archive and listing data is sent with MSG_MORE, so small frames share
+                                   // segments with what follows; the frame that ends the reply flushes them
+} ReplyChannel;
+
+// A complete text reply: sent raw in text mode, as RESP_TEXT in binary mode
+int replyText(ReplyChannel* channel, const char* text);
+
+// Announces the codec and content id of the archive that follows, and where its data starts (binary mode only)
+int replyArchiveBegin(ReplyChannel* channel, int wireCodec, unsigned long long contentId, unsigned long long offset);
+
+// One block of archive or listing data, the end of it, or an error that ends it
+int replyData(ReplyChannel* channel, const void* data, size_t length);
+int replyEnd(ReplyChannel* channel);
+int replyError(ReplyChannel* channel, const char* message);
+
+// Header for length bytes of data the caller sends itself (for sendfile), queued with MSG_MORE, and
+// replyDataSent once those bytes are out. maxDataLength tells the caller how much one header may cover.
+int replyDataHeader(ReplyChannel* channel, unsigned long long length);
+void replyDataSent(ReplyChannel* channel);
+unsigned long long maxDataLength(const ReplyChannel* channel);
+
+#endif
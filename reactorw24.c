@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "reactorw24.h"
+#include "protocolw24.h"
+#include "loadw24.h"
+#include "poolw24.h"
+#include "sockw24.h"
+
+#define BUFFER_SIZE 1024
+#define MAX_EVENTS 64
+#define JOBS_PER_SLAB 64
+
+// A command read by the reactor, waiting for a worker thread
+typedef struct Job {
+    int socket;
+    int binary;  // A binary frame is waiting on the socket; the handler reads it
+    char command[BUFFER_SIZE];
+    struct Job* next;
+} Job;
+
+// Shared state between a reactor thread and its worker pool
+typedef struct {
+    int epollFd;
+    const int* serverSockets;
+    int socketCount;
+    CommandHandler handler;
+    Job* head;
+    Job* tail;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} EventLoop;
+
+// Jobs are recycled, so reading a command makes no malloc call
+static SlabPool jobPool = SLAB_POOL_INITIALIZER(sizeof(Job), JOBS_PER_SLAB);
+
+static int wakeupFd = -1;
+static void (*wakeupCallback)(void);
+
+// Closes a client connection the reactor still owns
+static void closeClient(int socket) {
+    close(socket);
+    connectionClosed();
+}
+
+// Re-arms a one-shot client socket so the reactor sees its next command
+static void rearmSocket(EventLoop* loop, int socket) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.fd = socket;
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, socket, &event) < 0) {
+        closeClient(socket);
+    }
+}
+
+// Appends a job to the queue and wakes one worker
+static void enqueueJob(EventLoop* loop, Job* job) {
+    pthread_mutex_lock(&loop->lock);
+    job->next = NULL;
+    if (loop->tail) loop->tail->next = job;
+    else loop->head = job;
+    loop->tail = job;
+    pthread_cond_signal(&loop->ready);
+    pthread_mutex_unlock(&loop->lock);
+}
+
+// Worker thread: runs command handlers on blocking sockets, then hands the socket back to the reactor
+static void* workerMain(void* argument) {
+    EventLoop* loop = argument;
+
+    while (1) {
+        pthread_mutex_lock(&loop->lock);
+        while (loop->head == NULL) {
+            pthread_cond_wait(&loop->ready, &loop->lock);
+        }
+        Job* job = loop->head;
+        loop->head = job->next;
+        if (loop->head == NULL) loop->tail = NULL;
+        pthread_mutex_unlock(&loop->lock);
+
+        // A binary connection is handed to a session thread for good, so the reactor lets go of it first:
+        // the session may close the socket, and accept reuse its number, before the handler returns
+        if (job->binary) epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, job->socket, NULL);
+
+        int result = loop->handler(job->socket, job->binary ? NULL : job->command);
+        if (result == HANDLER_DETACHED) {
+            // The handler owns the socket now
+        } else if (result) {
+            rearmSocket(loop, job->socket);
+        } else {
+            closeClient(job->socket);  // Client sent quitc
+        }
+        poolPut(&jobPool, job);
+    }
+    return NULL;
+}
+
+// Accepts every pending connection on the non-blocking listening socket
+static void acceptClients(EventLoop* loop, int serverSocket) {
+    while (1) {
+        int clientSocket = accept(serverSocket, NULL, NULL);
+        if (clientSocket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("accept failed");
+            }
+            return;
+        }
+        connectionOpened();
+        tuneClientSocket(clientSocket);
+
+        struct epoll_event event = {0};
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.fd = clientSocket;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, clientSocket, &event) < 0) {
+            perror("epoll_ctl");
+            closeClient(clientSocket);
+        }
+    }
+}
+
+// Reads one command without blocking and queues it for the worker pool.
+// Binary frames are left on the socket for the worker, which reads the whole frame with blocking reads
+static void readCommand(EventLoop* loop, int socket) {
+    Job* job = poolGet(&jobPool);
+    if (!job) {
+        closeClient(socket);
+        return;
+    }
+
+    unsigned char firstByte;
+    job->binary = recv(socket, &firstByte, 1, MSG_PEEK | MSG_DONTWAIT) == 1 && firstByte == WIRE_MAGIC;
+    if (job->binary) {
+        job->socket = socket;
+        enqueueJob(loop, job);
+        return;
+    }
+
+    ssize_t bytesRead = recv(socket, job->command, BUFFER_SIZE - 1, MSG_DONTWAIT);
+    if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        poolPut(&jobPool, job);
+        rearmSocket(loop, socket);  // Spurious wakeup
+        return;
+    }
+    if (bytesRead <= 0) {
+        poolPut(&jobPool, job);
+        closeClient(socket);  // Client disconnected
+        return;
+    }
+
+    job->command[bytesRead] = '\0';
+    job->socket = socket;
+    enqueueJob(loop, job);
+}
+
+void setEventLoopWakeup(int fd, void (*callback)(void)) {
+    wakeupFd = fd;
+    wakeupCallback = callback;
+}
+
+int defaultWorkerCount(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+// Returns 1 when fd is one of the listening sockets
+static int isListeningSocket(const int* serverSockets, int socketCount, int fd) {
+    for (int i = 0; i < socketCount; i++) {
+        if (serverSockets[i] == fd) return 1;
+    }
+    return 0;
+}
+
+// Sets up one loop: its epoll instance watching its listening sockets (and the wakeup descriptor, for the
+// first loop), and its worker threads
+static int startEventLoop(EventLoop* loop, int workerCount, int watchWakeup) {
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->ready, NULL);
+
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epollFd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    // The reactor never blocks on the listening sockets; client sockets stay blocking for the handlers
+    for (int i = 0; i < loop->socketCount; i++) {
+        int serverSocket = loop->serverSockets[i];
+        fcntl(serverSocket, F_SETFL, fcntl(serverSocket, F_GETFL) | O_NONBLOCK);
+        struct epoll_event listenEvent = {0};
+        listenEvent.events = EPOLLIN;
+        listenEvent.data.fd = serverSocket;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, serverSocket, &listenEvent) < 0) {
+            perror("epoll_ctl");
+            return -1;
+        }
+    }
+
+    if (watchWakeup && wakeupFd >= 0) {
+        struct epoll_event wakeupEvent = {0};
+        wakeupEvent.events = EPOLLIN;
+        wakeupEvent.data.fd = wakeupFd;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, wakeupFd, &wakeupEvent) < 0) {
+            perror("epoll_ctl");
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < workerCount; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerMain, loop) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    return 0;
+}
+
+// Reactor thread: accepts clients and reads their commands; returns only when epoll fails
+static int serveEvents(EventLoop* loop) {
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int ready = epoll_wait(loop->epollFd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return -1;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wakeupFd) {
+                wakeupCallback();
+            } else if (isListeningSocket(loop->serverSockets, loop->socketCount, fd)) {
+                acceptClients(loop, fd);
+            } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                closeClient(fd);
+            } else {
+                readCommand(loop, fd);
+            }
+        }
+    }
+}
+
+// A loop after the first; its sockets would keep taking connections nobody accepts, so the server stops if
+// it fails
+static void* reactorThread(void* argument) {
+    serveEvents(argument);
+    exit(1);
+}
+
+int runEventLoop(const int* serverSockets, int socketCount, int loopCount, int workerCount, CommandHandler handler) {
+    EventLoop* loops = calloc(loopCount, sizeof(EventLoop));
+    if (!loops) return -1;
+
+    // Workers are split evenly, and every loop gets at least one
+    for (int i = 0; i < loopCount; i++) {
+        loops[i].serverSockets = serverSockets + i * socketCount;
+        loops[i].socketCount = socketCount;
+        loops[i].handler = handler;
+        int workers = workerCount / loopCount + (i < workerCount % loopCount);
+        if (startEventLoop(&loops[i], workers > 0 ? workers : 1, i == 0) != 0) return -1;
+    }
+    for (int i = 1; i < loopCount; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, reactorThread, &loops[i]) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    return serveEvents(&loops[0]);
+}
@@ -0,0 +1,24 @@
+#ifndef REACTORW24_H
+#define REACTORW24_H
+
+// Handles one command received on a client socket; returns 0 when the connection should be closed,
+// or HANDLER_DETACHED when the handler took the socket over. command is NULL when a binary protocol
+// frame is waiting on the socket instead of a text command; such sockets leave the reactor beforehand
+typedef int (*CommandHandler)(int socket, char* command);
+
+#define HANDLER_DETACHED 2
+
+// Runs loopCount epoll event loops, each on its own socketCount listening sockets (serverSockets holds them
+// loop by loop) and with its share of workerCount worker threads. The first loop runs on the calling thread
+// and the others on threads of their own; the sockets of one port in different loops share it through
+// SO_REUSEPORT. Returns only when the first loop fails
+int runEventLoop(const int* serverSockets, int socketCount, int loopCount, int workerCount, CommandHandler handler);
+
+// Calls callback on the first reactor thread whenever fd turns readable, such as a signal's self-pipe; the
+// callback must drain it. Set before runEventLoop
+void setEventLoopWakeup(int fd, void (*callback)(void));
+
+// Returns the default worker count (one per online core)
+int defaultWorkerCount(void);
+
+#endif
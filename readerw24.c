@@ -0,0 +1,459 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+#include "readerw24.h"
+
+#define READ_AHEAD_FILES 64           // Files opened, statted and read ahead of the tar writer
+#define READ_AHEAD_BYTES (32 * 1024)  // Bytes read ahead per file; the rest of a larger file is read when it is written
+#define POOL_THREADS 16               // Pool threads per reader; they mostly wait on the disk, not the CPU
+
+// Files are never opened for writing or through a symlink, and a FIFO swapped in after the scan
+// must not block the open or the read
+#define READ_OPEN_FLAGS (O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC)
+
+static const char* backendNames[READER_BACKENDS] = { "auto", "uring", "threads", "blocking" };
+
+enum { SLOT_EMPTY, SLOT_PENDING, SLOT_READY };
+
+// A file of the read-ahead window: slot i % READ_AHEAD_FILES holds file i
+typedef struct {
+    int state;
+    int fd;
+    int failed;
+    int pending;  // io_uring operations not completed yet
+    struct stat info;
+#ifdef HAVE_IO_URING
+    struct statx extended;
+#endif
+    unsigned char* buffer;
+    size_t length;
+} ReadSlot;
+
+#ifdef HAVE_IO_URING
+// The rings shared with the kernel, mapped the way io_uring_setup(2) describes; no liburing needed
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned unsubmitted;
+} Uring;
+
+// Operations in flight for a slot, in the low bits of the user data
+enum { URING_OPEN, URING_STATX, URING_READ, URING_OPERATIONS = 4 };
+#endif
+
+struct FileReader {
+    ReaderBackend backend;
+    const FileList* list;
+    ReadSlot slots[READ_AHEAD_FILES];
+    size_t nextToStart;  // First file no slot was given to yet
+    size_t nextToHand;   // First file not handed out yet
+    size_t released;     // Files handed out and closed again; their slots are free
+    pthread_mutex_t lock;
+    pthread_cond_t changed;  // A slot became ready or free, or the reader is closing
+    pthread_t threads[POOL_THREADS];
+    int threadCount;
+    int closing;
+#ifdef HAVE_IO_URING
+    Uring ring;
+#endif
+};
+
+static ReaderBackend readerBackend = READER_AUTO;
+
+void setReaderBackend(ReaderBackend backend) {
+    readerBackend = backend;
+}
+
+const char* readerBackendName(ReaderBackend backend) {
+    return backend >= 0 && backend < READER_BACKENDS ? backendNames[backend] : "unknown";
+}
+
+int parseReaderBackend(const char* name) {
+    for (int i = 0; i < READER_BACKENDS; i++) {
+        if (strcmp(name, backendNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+unsigned long long fileReaderMemoryBound(void) {
+    return sizeof(FileReader) + (unsigned long long)READ_AHEAD_FILES * READ_AHEAD_BYTES;
+}
+
+// Opens, stats and reads the start of one file with blocking calls, for the pool and the blocking backend
+static void fillSlot(ReadSlot* slot, const char* path) {
+    slot->length = 0;
+    slot->fd = open(path, READ_OPEN_FLAGS);
+    slot->failed = slot->fd < 0 || fstat(slot->fd, &slot->info) != 0 || !S_ISREG(slot->info.st_mode);
+    while (!slot->failed && slot->length < READ_AHEAD_BYTES) {
+        ssize_t bytesRead = read(slot->fd, slot->buffer + slot->length, READ_AHEAD_BYTES - slot->length);
+        if (bytesRead <= 0) break;
+        slot->length += bytesRead;
+    }
+}
+
+#ifdef HAVE_IO_URING
+static void unmapUring(Uring* ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing) munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+// The kernel must know the three operations the reader uses (openat, statx and read are all from 5.6)
+static int uringSupportsReads(int ringFd) {
+    union {
+        struct io_uring_probe probe;
+        unsigned char bytes[sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)];
+    } buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    struct io_uring_probe* probe = &buffer.probe;
+    int supported = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    static const int needed[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ };
+    for (size_t i = 0; supported && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        supported = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    return supported;
+}
+
+// Creates a ring with room for entries submissions; returns -1 when the kernel, a seccomp filter or
+// the memlock limit refuses it, or it lacks an operation the reader needs
+static int setupUring(Uring* ring, unsigned entries) {
+    memset(ring, 0, sizeof(Uring));
+    struct io_uring_params params = {0};
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return -1;
+    if (!uringSupportsReads(ring->fd)) {
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->entries = params.sq_entries;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap && ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        ring->sqRing = NULL;
+        unmapUring(ring);
+        return -1;
+    }
+    ring->cqRing = singleMap ? ring->sqRing
+                             : mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                    ring->fd, IORING_OFF_CQ_RING);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = ring->cqRing == MAP_FAILED ? MAP_FAILED
+                                            : mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->cqRing == MAP_FAILED) ring->cqRing = NULL;
+        ring->sqes = NULL;
+        unmapUring(ring);
+        return -1;
+    }
+
+    char* sq = ring->sqRing;
+    char* cq = ring->cqRing;
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+// Probed once per process: whether io_uring can be used at all
+static pthread_once_t uringProbeOnce = PTHREAD_ONCE_INIT;
+static int uringUsable;
+
+static void probeUring(void) {
+    Uring ring;
+    uringUsable = setupUring(&ring, 4) == 0;
+    if (uringUsable) unmapUring(&ring);
+}
+
+// Next free submission entry, cleared; the window never has more operations in flight than the ring holds
+static struct io_uring_sqe* nextSubmission(Uring* ring, int opcode, int fd, unsigned long long userData) {
+    unsigned tail = *ring->sqTail;
+    unsigned index = tail & ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = userData;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->unsubmitted++;
+    return sqe;
+}
+
+// Submits what was queued and, when wait is set, blocks until at least one completion is there
+static int enterUring(Uring* ring, int wait) {
+    while (1) {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, wait ? 1 : 0,
+                                wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (submitted >= 0) {
+            ring->unsubmitted -= submitted;
+            return 0;
+        }
+        if (errno != EINTR && errno != EAGAIN) return -1;
+    }
+}
+
+// Opens and stats the files entering the window, both at once: the header's stat comes from the path
+// and the contents from the descriptor, like tar, and the writer pads or cuts the contents to the stat size
+static void startUringReads(FileReader* reader) {
+    while (reader->nextToStart < reader->list->count && reader->nextToStart < reader->released + READ_AHEAD_FILES) {
+        size_t index = reader->nextToStart++ % READ_AHEAD_FILES;
+        ReadSlot* slot = &reader->slots[index];
+        const char* path = reader->list->files[reader->nextToStart - 1].path;
+        slot->state = SLOT_PENDING;
+        slot->fd = -1;
+        slot->failed = 0;
+        slot->length = 0;
+        slot->pending = 2;
+
+        struct io_uring_sqe* openEntry = nextSubmission(&reader->ring, IORING_OP_OPENAT, AT_FDCWD,
+                                                        index * URING_OPERATIONS + URING_OPEN);
+        openEntry->addr = (unsigned long)path;
+        openEntry->open_flags = READ_OPEN_FLAGS;
+
+        struct io_uring_sqe* statEntry = nextSubmission(&reader->ring, IORING_OP_STATX, AT_FDCWD,
+                                                        index * URING_OPERATIONS + URING_STATX);
+        statEntry->addr = (unsigned long)path;
+        statEntry->len = STATX_BASIC_STATS;
+        statEntry->off = (unsigned long)&slot->extended;
+        statEntry->statx_flags = AT_SYMLINK_NOFOLLOW;
+    }
+}
+
+// Moves a slot along as its operations complete: an open starts the read, and the slot is ready once
+// nothing is pending
+static void completeUringOperation(FileReader* reader, const struct io_uring_cqe* cqe) {
+    ReadSlot* slot = &reader->slots[cqe->user_data / URING_OPERATIONS];
+    switch (cqe->user_data % URING_OPERATIONS) {
+    case URING_OPEN:
+        if (cqe->res < 0) {
+            slot->failed = 1;
+            break;
+        }
+        slot->fd = cqe->res;
+        struct io_uring_sqe* readEntry = nextSubmission(&reader->ring, IORING_OP_READ, slot->fd,
+                                                        cqe->user_data - URING_OPEN + URING_READ);
+        readEntry->addr = (unsigned long)slot->buffer;
+        readEntry->len = READ_AHEAD_BYTES;
+        readEntry->off = 0;
+        slot->pending++;
+        break;
+    case URING_STATX: {
+        const struct statx* extended = &slot->extended;
+        slot->failed |= cqe->res < 0;
+        memset(&slot->info, 0, sizeof(slot->info));
+        slot->info.st_mode = extended->stx_mode;
+        slot->info.st_uid = extended->stx_uid;
+        slot->info.st_gid = extended->stx_gid;
+        slot->info.st_size = extended->stx_size;
+        slot->info.st_mtim.tv_sec = extended->stx_mtime.tv_sec;
+        slot->info.st_mtim.tv_nsec = extended->stx_mtime.tv_nsec;
+        break;
+    }
+    case URING_READ:
+        slot->length = cqe->res > 0 ? (size_t)cqe->res : 0;
+        break;
+    }
+    if (--slot->pending == 0) {
+        slot->failed |= !S_ISREG(slot->info.st_mode);
+        slot->state = SLOT_READY;
+    }
+}
+
+// Submits what is queued, waits for at least one completion if asked, and handles every completion there is
+static int pollUring(FileReader* reader, int wait) {
+    Uring* ring = &reader->ring;
+    if (enterUring(ring, wait) != 0) return -1;
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        completeUringOperation(reader, &ring->cqes[head & ring->cqMask]);
+        head++;
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    return 0;
+}
+#endif
+
+ReaderBackend effectiveReaderBackend(void) {
+    if (readerBackend != READER_AUTO && readerBackend != READER_URING) return readerBackend;
+#ifdef HAVE_IO_URING
+    pthread_once(&uringProbeOnce, probeUring);
+    if (uringUsable) return READER_URING;
+#endif
+    return READER_THREADS;
+}
+
+// Pool thread: takes the next file that fits the window and fills its slot
+static void* readerThreadMain(void* argument) {
+    FileReader* reader = argument;
+    pthread_mutex_lock(&reader->lock);
+    while (!reader->closing) {
+        if (reader->nextToStart >= reader->list->count || reader->nextToStart >= reader->released + READ_AHEAD_FILES) {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+            continue;
+        }
+        size_t file = reader->nextToStart++;
+        ReadSlot* slot = &reader->slots[file % READ_AHEAD_FILES];
+        slot->state = SLOT_PENDING;
+        pthread_mutex_unlock(&reader->lock);
+        fillSlot(slot, reader->list->files[file].path);
+        pthread_mutex_lock(&reader->lock);
+        slot->state = SLOT_READY;
+        pthread_cond_broadcast(&reader->changed);
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+FileReader* openFileReader(const FileList* list, Arena* arena) {
+    FileReader* reader = arenaCalloc(arena, 1, sizeof(FileReader));
+    unsigned char* buffers = arenaAlloc(arena, (size_t)READ_AHEAD_FILES * READ_AHEAD_BYTES);
+    if (!reader || !buffers) return NULL;
+    reader->list = list;
+    for (int i = 0; i < READ_AHEAD_FILES; i++) {
+        reader->slots[i].fd = -1;
+        reader->slots[i].buffer = buffers + (size_t)i * READ_AHEAD_BYTES;
+    }
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->changed, NULL);
+
+    reader->backend = effectiveReaderBackend();
+#ifdef HAVE_IO_URING
+    // Two operations per file at most are queued at once; a ring that cannot be set up now falls back
+    if (reader->backend == READER_URING && setupUring(&reader->ring, 2 * READ_AHEAD_FILES) != 0) {
+        reader->backend = READER_THREADS;
+    }
+#endif
+    if (reader->backend == READER_THREADS) {
+        // Small lists are not worth more threads than files
+        int wanted = list->count < POOL_THREADS ? (int)list->count : POOL_THREADS;
+        while (reader->threadCount < wanted &&
+               pthread_create(&reader->threads[reader->threadCount], NULL, readerThreadMain, reader) == 0) {
+            reader->threadCount++;
+        }
+        if (reader->threadCount == 0) reader->backend = READER_BLOCKING;
+    }
+    return reader;
+}
+
+// Closes the file handed out last and frees its slot for the window
+static void releaseHandedOut(FileReader* reader) {
+    if (reader->released == reader->nextToHand) return;
+    ReadSlot* slot = &reader->slots[reader->released % READ_AHEAD_FILES];
+    if (slot->fd >= 0) close(slot->fd);
+    slot->fd = -1;
+    if (reader->backend == READER_THREADS) pthread_mutex_lock(&reader->lock);
+    slot->state = SLOT_EMPTY;
+    reader->released++;
+    if (reader->backend == READER_THREADS) {
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+    }
+}
+
+int nextReadFile(FileReader* reader, ReadFile* file) {
+    releaseHandedOut(reader);
+    if (reader->nextToHand >= reader->list->count) return 0;
+    ReadSlot* slot = &reader->slots[reader->nextToHand % READ_AHEAD_FILES];
+
+    switch (reader->backend) {
+#ifdef HAVE_IO_URING
+    case READER_URING:
+        startUringReads(reader);
+        while (slot->state != SLOT_READY) {
+            if (pollUring(reader, 1) != 0) {
+                perror("io_uring_enter");  // Not expected with a ring sized for the window
+                return -1;
+            }
+            startUringReads(reader);
+        }
+        break;
+#endif
+    case READER_THREADS:
+        pthread_mutex_lock(&reader->lock);
+        while (slot->state != SLOT_READY) pthread_cond_wait(&reader->changed, &reader->lock);
+        pthread_mutex_unlock(&reader->lock);
+        break;
+    default:
+        fillSlot(slot, reader->list->files[reader->nextToHand].path);
+        reader->nextToStart++;
+        break;
+    }
+
+    file->path = reader->list->files[reader->nextToHand].path;
+    file->skipped = slot->failed;
+    file->info = slot->info;
+    file->data = slot->buffer;
+    file->length = slot->length;
+    file->fd = slot->fd;
+    reader->nextToHand++;
+    return 1;
+}
+
+void closeFileReader(FileReader* reader) {
+    if (!reader) return;
+    if (reader->backend == READER_THREADS) {
+        pthread_mutex_lock(&reader->lock);
+        reader->closing = 1;
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+        for (int i = 0; i < reader->threadCount; i++) pthread_join(reader->threads[i], NULL);
+    }
+#ifdef HAVE_IO_URING
+    if (reader->backend == READER_URING) {
+        // The kernel may still write into the buffers and hand out descriptors until every operation completes
+        int inFlight = 1;
+        while (inFlight) {
+            inFlight = 0;
+            for (int i = 0; i < READ_AHEAD_FILES; i++) inFlight |= reader->slots[i].state == SLOT_PENDING;
+            if (inFlight && pollUring(reader, 1) != 0) break;
+        }
+        unmapUring(&reader->ring);
+    }
+#endif
+    for (int i = 0; i < READ_AHEAD_FILES; i++) {
+        if (reader->slots[i].fd >= 0) close(reader->slots[i].fd);
+    }
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->changed);
+}
@@ -0,0 +1,55 @@
+#ifndef READERW24_H
+#define READERW24_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "searchw24.h"
+
+// How the archive input stage opens, stats and reads the matched files
+typedef enum {
+    READER_AUTO,      // io_uring where the kernel has it, the thread pool otherwise
+    READER_URING,     // Batched openat/statx/read on one io_uring per archive
+    READER_THREADS,   // A pool of threads doing the same blocking calls side by side
+    READER_BLOCKING,  // One file at a time on the calling thread
+    READER_BACKENDS
+} ReaderBackend;
+
+// One file of the list, handed out in list order. A file that vanished, cannot be read or is no longer a
+// regular file is skipped. Otherwise data holds the first length bytes read (all of it unless it is large)
+// and the rest is read from fd at offset length on; both stay valid until the next call
+typedef struct {
+    const char* path;
+    int skipped;
+    struct stat info;
+    const unsigned char* data;
+    size_t length;
+    int fd;
+} ReadFile;
+
+typedef struct FileReader FileReader;
+
+// Starts reading ahead through a list, up to 64 files deep. The reader and its read-ahead buffers are taken
+// from the arena; the list and the arena must outlive the reader
+FileReader* openFileReader(const FileList* list, Arena* arena);
+
+// Waits for the next file; returns 1 when one was handed out, 0 at the end of the list and -1 if reading failed
+int nextReadFile(FileReader* reader, ReadFile* file);
+
+// Closes every file still open and stops the reader; fine to call before the end of the list
+void closeFileReader(FileReader* reader);
+
+// Sets the backend of readers opened afterwards; READER_URING falls back to the pool when io_uring is unusable
+void setReaderBackend(ReaderBackend backend);
+
+// Backend a reader opened now would use, after probing io_uring once
+ReaderBackend effectiveReaderBackend(void);
+
+// "auto", "uring", "threads", "blocking"; parseReaderBackend returns -1 for anything else
+const char* readerBackendName(ReaderBackend backend);
+int parseReaderBackend(const char* name);
+
+// Bytes one reader holds for read-ahead buffers, for budgeting concurrent archives
+unsigned long long fileReaderMemoryBound(void);
+
+#endif
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "scanw24.h"
+
+#define DIRENT_BUFFER_SIZE (64 * 1024)
+#define MAX_QUEUED_FDS 512  // Queued directories beyond this are reopened by path to bound open fds
+#define SCAN_PATH_MAX 4096
+
+// Record layout returned by getdents64
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// A directory waiting to be read
+typedef struct {
+    int fd;          // Opened relative to its parent, or -1 to open by path
+    int depth;       // The root has depth 0
+    char* path;
+} DirectoryTask;
+
+// Per-thread double-ended queue: the owner pushes and pops at the tail, thieves take from the head
+typedef struct {
+    DirectoryTask* items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+    pthread_mutex_t lock;
+} TaskDeque;
+
+// State shared by all walker threads of one scan
+typedef struct {
+    const ScanOptions* options;
+    TaskDeque* deques;
+    atomic_long pendingTasks;  // Pushed but not yet fully processed
+    atomic_int queuedFds;
+} Scanner;
+
+typedef struct {
+    Scanner* scanner;
+    int index;
+} Walker;
+
+int defaultScanThreads(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cores > 0 ? (int)cores * 2 : 4;
+    if (threads < 4) threads = 4;
+    if (threads > 32) threads = 32;
+    return threads;
+}
+
+// Adds a directory at the owner's end of a deque
+static int pushTask(TaskDeque* deque, DirectoryTask task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        size_t newCapacity = deque->capacity ? deque->capacity * 2 : 64;
+        DirectoryTask* newItems = malloc(newCapacity * sizeof(DirectoryTask));
+        if (!newItems) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < deque->count; i++) {
+            newItems[i] = deque->items[(deque->head + i) % deque->capacity];
+        }
+        free(deque->items);
+        deque->items = newItems;
+        deque->head = 0;
+        deque->capacity = newCapacity;
+    }
+    deque->items[(deque->head + deque->count) % deque->capacity] = task;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+// Takes the newest task (owner) or the oldest one (thief), keeping the owner depth-first
+static int takeTask(TaskDeque* deque, DirectoryTask* task, int steal) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == 0) {
+        pthread_mutex_unlock(&deque->lock);
+        return 0;
+    }
+    if (steal) {
+        *task = deque->items[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+    } else {
+        *task = deque->items[(deque->head + deque->count - 1) % deque->capacity];
+    }
+    deque->count--;
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+// Queues a subdirectory, opened relative to its parent's fd while the fd budget allows
+static void queueSubdirectory(Walker* walker, int parentFd, const char* name, const char* path, int depth) {
+    Scanner* scanner = walker->scanner;
+    DirectoryTask task = { -1, depth, strdup(path) };
+    if (!task.path) return;
+
+    if (atomic_fetch_add(&scanner->queuedFds, 1) < MAX_QUEUED_FDS) {
+        task.fd = openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (task.fd < 0) {
+            atomic_fetch_sub(&scanner->queuedFds, 1);
+            free(task.path);
+            return;  // Unreadable directories are skipped, as find does
+        }
+    } else {
+        atomic_fetch_sub(&scanner->queuedFds, 1);
+    }
+
+    atomic_fetch_add(&scanner->pendingTasks, 1);
+    if (pushTask(&scanner->deques[walker->index], task) != 0) {
+        if (task.fd >= 0) {
+            close(task.fd);
+            atomic_fetch_sub(&scanner->queuedFds, 1);
+        }
+        free(task.path);
+        atomic_fetch_sub(&scanner->pendingTasks, 1);
+    }
+}
+
+// Reads one directory in getdents64 batches, reporting files and queueing subdirectories
+static void processDirectory(Walker* walker, DirectoryTask* task, char* direntBuffer, char* pathBuffer) {
+    const ScanOptions* options = walker->scanner->options;
+    void* context = options->threadContexts ? options->threadContexts[walker->index] : NULL;
+
+    int fd = task->fd;
+    if (fd >= 0) {
+        atomic_fetch_sub(&walker->scanner->queuedFds, 1);
+    } else {
+        fd = open(task->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) return;
+    }
+    if (options->enterDirectory) options->enterDirectory(task->path, task->depth, context);
+
+    // Child paths are built by appending each name to the parent's path once
+    size_t prefixLength = strlen(task->path);
+    if (prefixLength + 2 >= SCAN_PATH_MAX) {
+        close(fd);
+        return;
+    }
+    memcpy(pathBuffer, task->path, prefixLength);
+    pathBuffer[prefixLength++] = '/';
+
+    int entryDepth = task->depth + 1;
+    int descend = options->maxDepth == 0 || entryDepth < options->maxDepth;
+
+    while (1) {
+        long bytes = syscall(SYS_getdents64, fd, direntBuffer, DIRENT_BUFFER_SIZE);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) break;
+
+        for (long offset = 0; offset < bytes; ) {
+            struct linux_dirent64* record = (struct linux_dirent64*)(direntBuffer + offset);
+            offset += record->d_reclen;
+
+            const char* name = record->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            if (options->skipHidden && name[0] == '.') continue;
+
+            size_t nameLength = strlen(name);
+            if (prefixLength + nameLength >= SCAN_PATH_MAX) continue;
+            memcpy(pathBuffer + prefixLength, name, nameLength + 1);
+
+            struct stat info;
+            int haveInfo = 0;
+            unsigned char type = record->d_type;
+            if (type == DT_UNKNOWN) {
+                if (fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                haveInfo = 1;
+                type = S_ISDIR(info.st_mode) ? DT_DIR : DT_REG;
+            }
+
+            if (type == DT_DIR) {
+                if (descend) queueSubdirectory(walker, fd, name, pathBuffer, entryDepth);
+                continue;
+            }
+
+            int symlink = type == DT_LNK || (haveInfo && S_ISLNK(info.st_mode));
+            if (!haveInfo || (options->followSymlinks && S_ISLNK(info.st_mode))) {
+                if (fstatat(fd, name, &info, options->followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW) != 0) continue;
+            }
+            if (S_ISDIR(info.st_mode)) continue;  // Symlinked directory
+            if (options->regularFilesOnly && !S_ISREG(info.st_mode)) continue;
+
+            ScanEntry entry = { pathBuffer, pathBuffer + prefixLength, entryDepth, &info, symlink };
+            options->visit(&entry, context);
+        }
+    }
+    close(fd);
+}
+
+// Walker thread: drains its own deque depth-first, steals when empty, and stops once no work is pending
+static void* walkerMain(void* argument) {
+    Walker* walker = argument;
+    Scanner* scanner = walker->scanner;
+    int threadCount = scanner->options->threadCount;
+    char* direntBuffer = malloc(DIRENT_BUFFER_SIZE);
+    char* pathBuffer = malloc(SCAN_PATH_MAX);
+    unsigned int seed = walker->index * 2654435761u + 1;
+    int idleRounds = 0;
+
+    while (direntBuffer && pathBuffer) {
+        DirectoryTask task;
+        int found = takeTask(&scanner->deques[walker->index], &task, 0);
+        for (int attempt = 0; !found && attempt < threadCount; attempt++) {
+            int victim = rand_r(&seed) % threadCount;
+            if (victim != walker->index) found = takeTask(&scanner->deques[victim], &task, 1);
+        }
+
+        if (!found) {
+            if (atomic_load(&scanner->pendingTasks) == 0) break;
+            if (++idleRounds < 64) {
+                sched_yield();
+            } else {
+                struct timespec pause = { 0, 100000 };
+                nanosleep(&pause, NULL);
+            }
+            continue;
+        }
+
+        idleRounds = 0;
+        processDirectory(walker, &task, direntBuffer, pathBuffer);
+        free(task.path);
+        atomic_fetch_sub(&scanner->pendingTasks, 1);
+    }
+    free(direntBuffer);
+    free(pathBuffer);
+    return NULL;
+}
+
+int scanTree(const char* rootPath, const ScanOptions* options) {
+    int threadCount = options->threadCount > 0 ? options->threadCount : 1;
+    Scanner scanner = { .options = options };
+    atomic_init(&scanner.pendingTasks, 1);
+    atomic_init(&scanner.queuedFds, 1);
+
+    DirectoryTask root = { open(rootPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC), 0, strdup(rootPath) };
+    if (root.fd < 0 || !root.path) {
+        if (root.fd >= 0) close(root.fd);
+        free(root.path);
+        return -1;
+    }
+
+    ScanOptions effective = *options;
+    effective.threadCount = threadCount;
+    scanner.options = &effective;
+    scanner.deques = calloc(threadCount, sizeof(TaskDeque));
+    Walker* walkers = calloc(threadCount, sizeof(Walker));
+    pthread_t* threads = calloc(threadCount, sizeof(pthread_t));
+    if (!scanner.deques || !walkers || !threads) {
+        close(root.fd);
+        free(root.path);
+        free(scanner.deques);
+        free(walkers);
+        free(threads);
+        return -1;
+    }
+    for (int i = 0; i < threadCount; i++) {
+        pthread_mutex_init(&scanner.deques[i].lock, NULL);
+        walkers[i].scanner = &scanner;
+        walkers[i].index = i;
+    }
+    pushTask(&scanner.deques[0], root);
+
+    // The calling thread is walker 0
+    int started = 1;
+    for (int i = 1; i < threadCount; i++) {
+        if (pthread_create(&threads[i], NULL, walkerMain, &walkers[i]) != 0) break;
+        started++;
+    }
+    walkerMain(&walkers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < threadCount; i++) {
+        pthread_mutex_destroy(&scanner.deques[i].lock);
+        free(scanner.deques[i].items);
+    }
+    free(scanner.deques);
+    free(walkers);
+    free(threads);
+    return 0;
+}
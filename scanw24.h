@@ -0,0 +1,40 @@
+#ifndef SCANW24_H
+#define SCANW24_H
+
+#include <sys/stat.h>
+
+// A non-directory entry found by the scanner; path and info are only valid during the callback
+typedef struct {
+    const char* path;
+    const char* name;
+    int depth;                 // Entries directly inside the root have depth 1
+    const struct stat* info;
+    int symlink;               // Reported through a followed symlink; info describes the target
+} ScanEntry;
+
+// Called for every matching non-directory entry, with the calling worker's private context
+typedef void (*ScanVisitFn)(const ScanEntry* entry, void* threadContext);
+
+// Called for every directory the scanner descends into, including the root
+typedef void (*ScanDirectoryFn)(const char* path, int depth, void* threadContext);
+
+typedef struct {
+    int threadCount;           // Number of walker threads, including the caller
+    int maxDepth;              // Deepest entry depth to report; 0 means unlimited
+    int skipHidden;            // Skip names starting with '.', and do not descend into them
+    int followSymlinks;        // stat() symlinks to report their target (symlinked directories are never followed)
+    int regularFilesOnly;      // Only report S_ISREG entries
+    ScanVisitFn visit;
+    ScanDirectoryFn enterDirectory;  // Optional
+    void** threadContexts;     // threadCount contexts (or NULL), one per walker thread
+} ScanOptions;
+
+// Walks a tree with a pool of threads sharing a work-stealing queue of directories.
+// Entries are read with getdents64 in large batches and stat'ed with fstatat relative to the directory fd.
+// Returns 0 on success, -1 if the root cannot be opened.
+int scanTree(const char* rootPath, const ScanOptions* options);
+
+// Suggested thread count: scans wait on I/O more than CPU, so use twice the cores
+int defaultScanThreads(void);
+
+#endif
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "schedw24.h"
+#include "metricsw24.h"
+
+#define MAX_TICKETS 512       // Running and waiting jobs together
+#define MAX_RETRY_SECONDS 300
+#define RUN_TIME_WEIGHT 0.2   // Weight of the latest job in the moving average of run times
+
+static const char* classNames[JOB_CLASSES] = { "cheap", "heavy" };
+
+enum { TICKET_FREE, TICKET_WAITING, TICKET_RUNNING };
+
+// One job waiting for or holding a slot. The owning process is recorded so the slots of a connection
+// process that died mid-job are reclaimed instead of leaking
+typedef struct {
+    int state;
+    int jobClass;
+    pid_t pid;
+    unsigned int client;
+    unsigned long long memory;
+    unsigned long long sequence;  // Arrival order
+    double since;                 // When it was queued, then when it started
+} Ticket;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;  // Broadcast whenever a slot frees up or the head of a queue moves
+    SchedulerLimits limits;
+    Ticket tickets[MAX_TICKETS];
+    unsigned long long nextSequence;
+    int running[JOB_CLASSES];
+    int queued[JOB_CLASSES];
+    unsigned long long reservedMemory;
+    unsigned long long admitted[JOB_CLASSES];
+    unsigned long long rejected[JOB_CLASSES];
+    double averageRunSeconds[JOB_CLASSES];
+} Scheduler;
+
+static Scheduler* scheduler;
+
+void defaultSchedulerLimits(SchedulerLimits* limits) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+    limits->maxRunning[JOB_CHEAP] = 4 * cores;
+    limits->maxRunning[JOB_HEAVY] = cores > 1 ? cores / 2 : 1;
+    limits->heavyMemoryBudget = 512ULL * 1024 * 1024;
+    limits->maxQueued = 64;
+    limits->maxQueuedPerClient = 8;
+    limits->maxWaitSeconds = 30;
+}
+
+// Process-shared and robust like the cache table's lock; the condition variable waits on the monotonic clock
+int initScheduler(const SchedulerLimits* limits) {
+    Scheduler* shared = mmap(NULL, sizeof(Scheduler), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap scheduler");
+        return -1;
+    }
+    pthread_mutexattr_t mutexAttributes;
+    pthread_mutexattr_init(&mutexAttributes);
+    pthread_mutexattr_setpshared(&mutexAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutexAttributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shared->lock, &mutexAttributes);
+    pthread_mutexattr_destroy(&mutexAttributes);
+
+    pthread_condattr_t conditionAttributes;
+    pthread_condattr_init(&conditionAttributes);
+    pthread_condattr_setpshared(&conditionAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&conditionAttributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&shared->changed, &conditionAttributes);
+    pthread_condattr_destroy(&conditionAttributes);
+
+    shared->limits = *limits;
+    for (int i = 0; i < JOB_CLASSES; i++) {
+        if (shared->limits.maxRunning[i] < 1) shared->limits.maxRunning[i] = 1;
+    }
+    scheduler = shared;
+    return 0;
+}
+
+// Frees a ticket and updates the counts it was part of; caller holds the lock
+static void releaseTicket(Ticket* ticket) {
+    if (ticket->state == TICKET_RUNNING) {
+        scheduler->running[ticket->jobClass]--;
+        if (ticket->jobClass == JOB_HEAVY) scheduler->reservedMemory -= ticket->memory;
+    } else if (ticket->state == TICKET_WAITING) {
+        scheduler->queued[ticket->jobClass]--;
+    }
+    ticket->state = TICKET_FREE;
+}
+
+// Reclaims the tickets of processes that exited without finishing their jobs; caller holds the lock
+static void reclaimAbandonedTickets() {
+    pid_t self = getpid();
+    for (int i = 0; i < MAX_TICKETS; i++) {
+        Ticket* ticket = &scheduler->tickets[i];
+        if (ticket->state != TICKET_FREE && ticket->pid != self && kill(ticket->pid, 0) != 0 && errno == ESRCH) {
+            releaseTicket(ticket);
+        }
+    }
+}
+
+static void lockScheduler() {
+    if (pthread_mutex_lock(&scheduler->lock) == EOWNERDEAD) {
+        // A connection process died holding it; the counts are rebuilt from the tickets it left
+        pthread_mutex_consistent(&scheduler->lock);
+        reclaimAbandonedTickets();
+    }
+}
+
+void updateSchedulerLimits(const SchedulerLimits* limits) {
+    if (!scheduler) return;
+    lockScheduler();
+    scheduler->limits = *limits;
+    for (int i = 0; i < JOB_CLASSES; i++) {
+        if (scheduler->limits.maxRunning[i] < 1) scheduler->limits.maxRunning[i] = 1;
+    }
+    pthread_cond_broadcast(&scheduler->changed);  // Raised limits may let queued jobs start now
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+// Jobs a client has running in a class, plus its jobs queued ahead of sequence
+static int clientShare(int jobClass, unsigned int client, unsigned long long sequence) {
+    int share = 0;
+    for (int i = 0; i < MAX_TICKETS; i++) {
+        const Ticket* ticket = &scheduler->tickets[i];
+        if (ticket->state == TICKET_FREE || ticket->jobClass != jobClass || ticket->client != client) continue;
+        share += ticket->state == TICKET_RUNNING || ticket->sequence < sequence;
+    }
+    return share;
+}
+
+// The waiting ticket of a class that gets the next slot: the one whose client has the smallest share,
+// the oldest among equals. Caller holds the lock
+static int nextInLine(int jobClass) {
+    int best = -1, bestShare = 0;
+    for (int i = 0; i < MAX_TICKETS; i++) {
+        const Ticket* ticket = &scheduler->tickets[i];
+        if (ticket->state != TICKET_WAITING || ticket->jobClass != jobClass) continue;
+        int share = clientShare(jobClass, ticket->client, ticket->sequence);
+        if (best < 0 || share < bestShare || (share == bestShare && ticket->sequence < scheduler->tickets[best].sequence)) {
+            best = i;
+            bestShare = share;
+        }
+    }
+    return best;
+}
+
+// A job fits when its class has a free slot and, for archives, the memory it reserves is left in the budget.
+// An archive larger than the whole budget still runs once no other archive does
+static int jobFits(int jobClass, unsigned long long memory) {
+    if (scheduler->running[jobClass] >= scheduler->limits.maxRunning[jobClass]) return 0;
+    return jobClass != JOB_HEAVY || scheduler->running[JOB_HEAVY] == 0 ||
+           scheduler->reservedMemory + memory <= scheduler->limits.heavyMemoryBudget;
+}
+
+// Seconds until a slot is likely free for a job joining the back of the queue; caller holds the lock
+static int estimateRetryAfter(int jobClass) {
+    double slotsAhead = (double)(scheduler->queued[jobClass] + 1) / scheduler->limits.maxRunning[jobClass];
+    int seconds = (int)(scheduler->averageRunSeconds[jobClass] * slotsAhead + 0.999);
+    if (seconds < 1) seconds = 1;
+    return seconds > MAX_RETRY_SECONDS ? MAX_RETRY_SECONDS : seconds;
+}
+
+// Turns a job away; caller holds the lock
+static int rejectJob(int jobClass, int* retryAfterSeconds) {
+    scheduler->rejected[jobClass]++;
+    *retryAfterSeconds = estimateRetryAfter(jobClass);
+    return -1;
+}
+
+int admitJob(JobClass jobClass, unsigned int client, unsigned long long memory, int* retryAfterSeconds) {
+    if (!scheduler) return MAX_TICKETS;  // No scheduler: everything runs at once, and finishJob ignores the ticket
+
+    lockScheduler();
+    double arrived = metricsNow();
+    int slot = -1;
+    int waitingForClient = 0;
+    for (int i = 0; i < MAX_TICKETS; i++) {
+        const Ticket* ticket = &scheduler->tickets[i];
+        if (ticket->state == TICKET_FREE && slot < 0) slot = i;
+        waitingForClient += ticket->state == TICKET_WAITING && ticket->jobClass == (int)jobClass && ticket->client == client;
+    }
+    int mustQueue = scheduler->queued[jobClass] > 0 || !jobFits(jobClass, memory);
+    if (slot < 0 || (mustQueue && (scheduler->queued[jobClass] >= scheduler->limits.maxQueued ||
+                                   waitingForClient >= scheduler->limits.maxQueuedPerClient))) {
+        reclaimAbandonedTickets();  // Counted again next time, in case a dead process was holding the slots
+        int result = rejectJob(jobClass, retryAfterSeconds);
+        pthread_mutex_unlock(&scheduler->lock);
+        return result;
+    }
+
+    Ticket* ticket = &scheduler->tickets[slot];
+    *ticket = (Ticket){ TICKET_WAITING, jobClass, getpid(), client, memory, scheduler->nextSequence++, arrived };
+    scheduler->queued[jobClass]++;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += scheduler->limits.maxWaitSeconds;
+    while (nextInLine(jobClass) != slot || !jobFits(jobClass, memory)) {
+        // Wake at least once a second to reclaim slots of processes that died, which nobody broadcasts
+        struct timespec wake;
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        if (wake.tv_sec > deadline.tv_sec || (wake.tv_sec == deadline.tv_sec && wake.tv_nsec >= deadline.tv_nsec)) {
+            releaseTicket(ticket);
+            pthread_cond_broadcast(&scheduler->changed);  // Whoever was queued behind may be next now
+            int result = rejectJob(jobClass, retryAfterSeconds);
+            pthread_mutex_unlock(&scheduler->lock);
+            return result;
+        }
+        wake.tv_sec += 1;
+        if (wake.tv_sec > deadline.tv_sec) wake = deadline;
+        if (pthread_cond_timedwait(&scheduler->changed, &scheduler->lock, &wake) == EOWNERDEAD) {
+            pthread_mutex_consistent(&scheduler->lock);
+        }
+        reclaimAbandonedTickets();
+    }
+
+    scheduler->queued[jobClass]--;
+    scheduler->running[jobClass]++;
+    if (jobClass == JOB_HEAVY) scheduler->reservedMemory += memory;
+    scheduler->admitted[jobClass]++;
+    ticket->state = TICKET_RUNNING;
+    ticket->since = metricsNow();
+    pthread_cond_broadcast(&scheduler->changed);  // The next in line may fit as well
+    pthread_mutex_unlock(&scheduler->lock);
+    recordQueueWait(jobClass, ticket->since - arrived);
+    return slot;
+}
+
+void finishJob(int ticket) {
+    if (!scheduler || ticket < 0 || ticket >= MAX_TICKETS) return;
+
+    lockScheduler();
+    Ticket* finished = &scheduler->tickets[ticket];
+    if (finished->state == TICKET_RUNNING) {
+        double* average = &scheduler->averageRunSeconds[finished->jobClass];
+        double seconds = metricsNow() - finished->since;
+        *average = *average > 0 ? *average + RUN_TIME_WEIGHT * (seconds - *average) : seconds;
+        releaseTicket(finished);
+        pthread_cond_broadcast(&scheduler->changed);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+void formatSchedulerStats(char* buffer, size_t bufferSize) {
+    if (!scheduler) {
+        snprintf(buffer, bufferSize, "scheduler_enabled 0\n");
+        return;
+    }
+    lockScheduler();
+    size_t used = 0;
+    for (int i = 0; i < JOB_CLASSES && used < bufferSize; i++) {
+        used += snprintf(buffer + used, bufferSize - used,
+                         "queue_%s_running %d\nqueue_%s_limit %d\nqueue_%s_depth %d\nqueue_%s_admitted %llu\n"
+                         "queue_%s_rejected %llu\nqueue_%s_run_avg_ms %.3f\n",
+                         classNames[i], scheduler->running[i], classNames[i], scheduler->limits.maxRunning[i],
+                         classNames[i], scheduler->queued[i], classNames[i], scheduler->admitted[i],
+                         classNames[i], scheduler->rejected[i], classNames[i], scheduler->averageRunSeconds[i] * 1000);
+    }
+    if (used < bufferSize) {
+        snprintf(buffer + used, bufferSize - used, "queue_heavy_memory_bytes %llu\nqueue_heavy_memory_budget_bytes %llu\n",
+                 scheduler->reservedMemory, scheduler->limits.heavyMemoryBudget);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+}
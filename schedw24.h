@@ -0,0 +1,45 @@
+#ifndef SCHEDW24_H
+#define SCHEDW24_H
+
+#include <stddef.h>
+
+// Classes of requests admitted separately, so archive builds cannot crowd out lookups and listings
+typedef enum {
+    JOB_CHEAP,  // w24fn and dirlist
+    JOB_HEAVY,  // Archive requests
+    JOB_CLASSES
+} JobClass;
+
+typedef struct {
+    int maxRunning[JOB_CLASSES];           // Jobs of each class running at once
+    unsigned long long heavyMemoryBudget;  // Bytes the running heavy jobs may reserve together
+    int maxQueued;                         // Jobs of a class waiting for a slot, over all clients
+    int maxQueuedPerClient;
+    int maxWaitSeconds;                    // A queued job is turned away once it has waited this long
+} SchedulerLimits;
+
+// Half the cores for archives, four lookups per core, 512 MB of compression buffers and a 30 s queue
+void defaultSchedulerLimits(SchedulerLimits* limits);
+
+// Maps the scheduler state; call before the first fork or thread. Returns -1 if the mapping fails.
+// Every connection process and thread admits its jobs against the same counters and queues
+int initScheduler(const SchedulerLimits* limits);
+
+// Replaces the limits of every process sharing the scheduler. Running jobs keep their slots and memory even
+// when that is now over the limit; new jobs wait until enough of them finish
+void updateSchedulerLimits(const SchedulerLimits* limits);
+
+// Admits a job of a class for a client (its address), reserving memory bytes of the heavy budget.
+// While the class is at its limits the job waits in the class queue, and a freed slot goes to the waiting
+// job whose client has the fewest jobs running or queued ahead of it, so no client can take every slot.
+// Returns a ticket to pass to finishJob, or -1 when the queue is full or the wait ran out; then
+// *retryAfterSeconds estimates when a slot will be free
+int admitJob(JobClass jobClass, unsigned int client, unsigned long long memory, int* retryAfterSeconds);
+
+// Ends an admitted job and hands its slot to the next in line
+void finishJob(int ticket);
+
+// Running and queued jobs, admissions and rejections per class, and the reserved memory, as "key value" lines
+void formatSchedulerStats(char* buffer, size_t bufferSize);
+
+#endif
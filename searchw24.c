@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "searchw24.h"
+#include "scanw24.h"
+
+// Matches find -newermt, which compares full timestamps: 00:00:00.5 is newer than 00:00:00
+static int isNewerThan(const struct stat* fileInfo, time_t reference) {
+    return fileInfo->st_mtim.tv_sec > reference ||
+           (fileInfo->st_mtim.tv_sec == reference && fileInfo->st_mtim.tv_nsec > 0);
+}
+
+int nameMatchesExtensions(const char* name, const SearchQuery* query) {
+    if (query->extensionCount == 0) return 1;
+
+    char pattern[256];
+    for (int i = 0; i < query->extensionCount; i++) {
+        snprintf(pattern, sizeof(pattern), "*.%s", query->extensions[i]);
+        if (fnmatch(pattern, name, 0) == 0) return 1;
+    }
+    return 0;
+}
+
+int fileMatchesQuery(const char* name, const struct stat* fileInfo, const SearchQuery* query) {
+    if (query->matchSize && !(fileInfo->st_size > query->minSize && fileInfo->st_size < query->maxSize)) {
+        return 0;
+    }
+    if (query->matchAfter && !isNewerThan(fileInfo, query->after)) {
+        return 0;
+    }
+    if (query->matchBefore && isNewerThan(fileInfo, query->before)) {
+        return 0;
+    }
+    return nameMatchesExtensions(name, query);
+}
+
+// Appends a match to the list, growing it as needed
+static int appendMatch(FileList* list, const char* path, const struct stat* fileInfo) {
+    if (list->count == list->capacity) {
+        size_t newCapacity = list->capacity ? list->capacity * 2 : 64;
+        MatchedFile* newFiles = realloc(list->files, newCapacity * sizeof(MatchedFile));
+        if (!newFiles) return -1;
+        list->files = newFiles;
+        list->capacity = newCapacity;
+    }
+
+    MatchedFile* file = &list->files[list->count];
+    if (!(file->path = strdup(path))) return -1;
+    file->size = fileInfo->st_size;
+    file->mtime = fileInfo->st_mtim;
+    list->count++;
+    return 0;
+}
+
+// Per-thread state of a parallel search; each scanner thread appends to its own list
+typedef struct {
+    const SearchQuery* query;
+    FileList list;
+    int failed;
+} SearchWorker;
+
+// Scanner callback: evaluates the query predicates against one regular file
+static void visitCandidate(const ScanEntry* entry, void* threadContext) {
+    SearchWorker* worker = threadContext;
+    if (worker->failed || !fileMatchesQuery(entry->name, entry->info, worker->query)) return;
+    if (appendMatch(&worker->list, entry->path, entry->info) != 0) worker->failed = 1;
+}
+
+// Orders matches by path so the same tree always produces the same archive
+static int compareMatchedFiles(const void* a, const void* b) {
+    return strcmp(((const MatchedFile*)a)->path, ((const MatchedFile*)b)->path);
+}
+
+int collectMatchingFiles(const char* rootPath, const SearchQuery* query, FileList* list) {
+    memset(list, 0, sizeof(*list));
+
+    int threadCount = defaultScanThreads();
+    SearchWorker* workers = calloc(threadCount, sizeof(SearchWorker));
+    void** contexts = calloc(threadCount, sizeof(void*));
+    if (!workers || !contexts) {
+        free(workers);
+        free(contexts);
+        return -1;
+    }
+    for (int i = 0; i < threadCount; i++) {
+        workers[i].query = query;
+        contexts[i] = &workers[i];
+    }
+
+    // Unreadable directories are skipped and symlinks are not followed, as find does
+    ScanOptions options = {0};
+    options.threadCount = threadCount;
+    options.maxDepth = query->maxDepth;
+    options.skipHidden = 1;
+    options.regularFilesOnly = 1;
+    options.visit = visitCandidate;
+    options.threadContexts = contexts;
+    scanTree(rootPath, &options);
+
+    // Move every worker's matches into one list
+    int failed = 0;
+    size_t total = 0;
+    for (int i = 0; i < threadCount; i++) {
+        failed |= workers[i].failed;
+        total += workers[i].list.count;
+    }
+    if (!failed && total > 0 && !(list->files = malloc(total * sizeof(MatchedFile)))) failed = 1;
+    for (int i = 0; i < threadCount; i++) {
+        if (!failed) {
+            memcpy(list->files + list->count, workers[i].list.files, workers[i].list.count * sizeof(MatchedFile));
+            list->count += workers[i].list.count;
+            free(workers[i].list.files);
+        } else {
+            freeFileList(&workers[i].list);
+        }
+    }
+    list->capacity = list->count;
+    free(workers);
+    free(contexts);
+    if (failed) {
+        freeFileList(list);
+        return -1;
+    }
+
+    qsort(list->files, list->count, sizeof(MatchedFile), compareMatchedFiles);
+    return 0;
+}
+
+// Orders extensions alphabetically for the canonical query key
+static int compareExtensions(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+void formatQueryKey(const SearchQuery* query, char* buffer, size_t bufferSize) {
+    size_t used = snprintf(buffer, bufferSize, "depth=%d", query->maxDepth);
+
+    if (query->matchSize && used < bufferSize) {
+        used += snprintf(buffer + used, bufferSize - used, " size=%ld..%ld", query->minSize, query->maxSize);
+    }
+    if (query->matchBefore && used < bufferSize) {
+        used += snprintf(buffer + used, bufferSize - used, " before=%lld", (long long)query->before);
+    }
+    if (query->matchAfter && used < bufferSize) {
+        used += snprintf(buffer + used, bufferSize - used, " after=%lld", (long long)query->after);
+    }
+    if (query->extensionCount > 0 && used < bufferSize) {
+        // "w24ft txt pdf" and "w24ft pdf txt pdf" select the same files
+        const char* sorted[MAX_EXTENSIONS];
+        memcpy(sorted, query->extensions, query->extensionCount * sizeof(char*));
+        qsort(sorted, query->extensionCount, sizeof(char*), compareExtensions);
+        used += snprintf(buffer + used, bufferSize - used, " ext=");
+        for (int i = 0; i < query->extensionCount && used < bufferSize; i++) {
+            if (i > 0 && strcmp(sorted[i], sorted[i - 1]) == 0) continue;
+            used += snprintf(buffer + used, bufferSize - used, "%s/", sorted[i]);
+        }
+    }
+}
+
+int parseQueryKey(char* key, SearchQuery* query) {
+    memset(query, 0, sizeof(*query));
+    char* savePointer = NULL;
+    int hasDepth = 0;
+    for (char* field = strtok_r(key, " ", &savePointer); field; field = strtok_r(NULL, " ", &savePointer)) {
+        long long value;
+        if (strncmp(field, "depth=", 6) == 0) {
+            if (sscanf(field + 6, "%d", &query->maxDepth) != 1) return -1;
+            hasDepth = 1;
+        } else if (strncmp(field, "size=", 5) == 0) {
+            if (sscanf(field + 5, "%ld..%ld", &query->minSize, &query->maxSize) != 2) return -1;
+            query->matchSize = 1;
+        } else if (strncmp(field, "before=", 7) == 0) {
+            if (sscanf(field + 7, "%lld", &value) != 1) return -1;
+            query->before = value;
+            query->matchBefore = 1;
+        } else if (strncmp(field, "after=", 6) == 0) {
+            if (sscanf(field + 6, "%lld", &value) != 1) return -1;
+            query->after = value;
+            query->matchAfter = 1;
+        } else if (strncmp(field, "ext=", 4) == 0) {
+            // Each extension is followed by a '/'
+            char* extension = field + 4;
+            char* end;
+            while ((end = strchr(extension, '/')) != NULL) {
+                if (query->extensionCount == MAX_EXTENSIONS) return -1;
+                *end = '\0';
+                query->extensions[query->extensionCount++] = extension;
+                extension = end + 1;
+            }
+        }
+    }
+    return hasDepth && query->maxDepth >= 0 ? 0 : -1;
+}
+
+// Mixes bytes into a 64-bit FNV-1a hash
+static unsigned long long hashBytes(unsigned long long hash, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+unsigned long long fingerprintFileList(const FileList* list) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < list->count; i++) {
+        const MatchedFile* file = &list->files[i];
+        long long metadata[3] = { file->size, file->mtime.tv_sec, file->mtime.tv_nsec };
+        hash = hashBytes(hash, file->path, strlen(file->path) + 1);
+        hash = hashBytes(hash, metadata, sizeof(metadata));
+    }
+    return hash;
+}
+
+void freeFileList(FileList* list) {
+    for (size_t i = 0; !list->arena && i < list->count; i++) {
+        free(list->files[i].path);
+    }
+    if (!list->arena) free(list->files);
+    memset(list, 0, sizeof(*list));
+}
+
+int parseSearchFields(const char* dateString, struct tm* result) {
+    static const char* formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d" };
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        memset(result, 0, sizeof(*result));
+        char* end = strptime(dateString, formats[i], result);
+        if (end != NULL && *end == '\0') {
+            result->tm_isdst = -1;  // Let mktime apply daylight saving time for that date
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int parseSearchDate(const char* dateString, time_t* result) {
+    struct tm tm;
+    if (parseSearchFields(dateString, &tm) != 0) return -1;
+    *result = mktime(&tm);
+    return *result == (time_t)-1 ? -1 : 0;
+}
@@ -0,0 +1,70 @@
+#ifndef SEARCHW24_H
+#define SEARCHW24_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "poolw24.h"
+
+#define MAX_EXTENSIONS 8
+
+// Predicates of the archive commands, evaluated in-process instead of through find
+typedef struct {
+    int maxDepth;                 // 1 = files directly in the root, 2 = one level of subdirectories, 0 = all
+    int matchSize;                // Size strictly between minSize and maxSize (find -size +Nc -size -Nc)
+    long minSize;
+    long maxSize;
+    int extensionCount;           // Name matches any "*.<extension>" pattern
+    const char* extensions[MAX_EXTENSIONS];
+    int matchBefore;              // Modified at or before this time (find ! -newermt)
+    time_t before;
+    int matchAfter;               // Modified strictly after this time (find -newermt)
+    time_t after;
+} SearchQuery;
+
+// A regular file selected by a query
+typedef struct {
+    char* path;
+    off_t size;
+    struct timespec mtime;
+} MatchedFile;
+
+// Growable list of matches, sorted by path once collection finishes
+typedef struct {
+    MatchedFile* files;
+    size_t count;
+    size_t capacity;
+    Arena* arena;  // Holds the array and paths when set, so freeing the list only forgets them
+} FileList;
+
+// Walks rootPath up to query->maxDepth with the parallel scanner and collects every non-hidden regular file that matches
+int collectMatchingFiles(const char* rootPath, const SearchQuery* query, FileList* list);
+
+// Checks a basename against the query's "*.<extension>" patterns with fnmatch; true when the query has none
+int nameMatchesExtensions(const char* name, const SearchQuery* query);
+
+// Checks one file's metadata and basename against the query predicates, leaving depth to the caller
+int fileMatchesQuery(const char* name, const struct stat* fileInfo, const SearchQuery* query);
+
+// Writes a canonical text form of a query, so equivalent requests share a cache key
+void formatQueryKey(const SearchQuery* query, char* buffer, size_t bufferSize);
+
+// Reads a key written by formatQueryKey back into a query, ignoring fields it does not know (like a codec
+// appended to the key). Extensions point into key, which is modified; returns -1 if a field is malformed
+int parseQueryKey(char* key, SearchQuery* query);
+
+// Hashes the paths, sizes and mtimes of a sorted file list; any change to the matched set changes it
+unsigned long long fingerprintFileList(const FileList* list);
+
+// Releases the paths and array of a file list, unless they live in its arena
+void freeFileList(FileList* list);
+
+// Parses "YYYY-MM-DD" (optionally followed by " HH:MM[:SS]") as local time, like find -newermt
+int parseSearchDate(const char* dateString, time_t* result);
+
+// Same, but leaves the fields for the caller to adjust before mktime; tm_isdst is -1
+int parseSearchFields(const char* dateString, struct tm* result);
+
+#endif
@@ -1,3 +1,6 @@
+// Build: gcc -o serverw24 serverw24.c reactorw24.c indexw24.c searchw24.c archivew24.c protocolw24.c transferw24.c cachew24.c scanw24.c listw24.c codecw24.c muxw24.c loadw24.c metricsw24.c schedw24.c readerw24.c poolw24.c configw24.c sockw24.c -pthread -lz
+// Optional codecs: add -DHAVE_ZSTD -lzstd and/or -DHAVE_LZ4 -llz4
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,72 +10,288 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "reactorw24.h"
+#include "indexw24.h"
+#include "searchw24.h"
+#include "archivew24.h"
+#include "protocolw24.h"
+#include "transferw24.h"
+#include "cachew24.h"
+#include "listw24.h"
+#include "codecw24.h"
+#include "muxw24.h"
+#include "loadw24.h"
+#include "metricsw24.h"
+#include "schedw24.h"
+#include "readerw24.h"
+#include "poolw24.h"
+#include "configw24.h"
+#include "sockw24.h"
 
-#define SERVER_PORT 6969
 #define BUFFER_SIZE 1024
-#define TEMP_DIRECTORY "/home/patel489/server_temp"
+#define STATS_BUFFER_SIZE 8192
+#define BUFFERED_ARCHIVE_BYTES (1024 * 1024)  // An uncached archive larger than this is built in a spool file
+
+int spoolArchives = 0; // Build even small archives into a temporary file and send them with sendfile(); atomic, as a reload may change it
+char homeDirectory[CONFIG_PATH_SIZE]; // Tree the commands search, list and archive; instances sharing a temp directory must share it too
+char tempDirectory[CONFIG_PATH_SIZE]; // Spool files, and the index snapshot and archive cache shared by instances using it
+int searchDepths[DEPTH_COMMANDS]; // Levels each archive command searches, 0 for the whole tree; read through searchDepth()
+
+// Settings in effect, from the config file and command line; only the accepting thread reads or replaces them
+ServerConfig serverConfig;
+int serverArgumentCount;
+char** serverArguments;  // Kept to reread the config on reload
+int serverSockets[MAX_ACCEPT_LOOPS * MAX_PORTS];  // One socket per port for each accept loop, loop by loop
+int listenerCount;
+int reloadFd = -1;
+
+// Part of an archive a client asks for to resume a download (see ARCHIVE_RANGE); length 0 runs to the end
+typedef struct {
+    unsigned long long contentId;
+    unsigned long long offset;
+    unsigned long long length;
+} ArchiveRange;
 
 // Function prototypes, describing the actions and parameters
+void crequest(int socket);
+int handleClientCommand(int socket, char* commandBuffer);
+int runTextCommand(ReplyChannel* channel, char* commandBuffer);
+int dispatchTextCommand(ReplyChannel* channel, char* commandBuffer);
+CommandKind classifyTextCommand(const char* command);
+int admitCommand(ReplyChannel* channel, CommandKind kind, int* ticket);
+int admitClientJob(ReplyChannel* channel, JobClass jobClass, unsigned long long memory, int textReply);
+int runBinaryRequest(ReplyChannel* channel, const FrameHeader* header, char* payload);
+int dispatchBinaryRequest(ReplyChannel* channel, const FrameHeader* header, char* payload);
+int parseExtensions(const char* text, char fileTypes[][10]);
+long long readInt64(const unsigned char* data);
+void findFile(ReplyChannel* channel, const char* filename);
 int findFileInDirectory(const char* directoryPath, const char* targetFilename, char* resultInfo, size_t maxInfoLength);
-void listDirectoryContents(int socket, const char* sortFlag);
-int sortByModificationTime(const struct dirent **a, const struct dirent **b);
-void searchByFileSizeAndArchive(int socket, long minSize, long maxSize);
-void searchByFileExtensionAndArchive(int socket, char fileTypes[][10], int fileTypeCount);
-void searchByDateBeforeAndArchive(int socket, char* dateString);
-void searchByDateAfterAndArchive(int socket, char* dateString);
-void archiveFilesAndSend(int socket, char* archivePath, int operationResult);
+void listDirectoryContents(ReplyChannel* channel, const char* sortFlag);
+int isArchiveCommand(const char* command);
+int searchDepth(int command);
+void searchByFileSizeAndArchive(ReplyChannel* channel, long minSize, long maxSize, const CodecChoice* codec, const ArchiveRange* range);
+void searchByFileExtensionAndArchive(ReplyChannel* channel, char fileTypes[][10], int fileTypeCount, const CodecChoice* codec, const ArchiveRange* range);
+void searchByDateBeforeAndArchive(ReplyChannel* channel, char* dateString, const CodecChoice* codec, const ArchiveRange* range);
+void searchByDateAfterAndArchive(ReplyChannel* channel, char* dateString, const CodecChoice* codec, const ArchiveRange* range);
+void buildArchiveAndSend(ReplyChannel* channel, const SearchQuery* query, const CodecChoice* codec, const ArchiveRange* range);
+void sendArchiveForQuery(ReplyChannel* channel, const SearchQuery* query, const CodecChoice* codec, const ArchiveRange* range);
+int sendCachedArchive(ReplyChannel* channel, int fd, const ArchiveRange* range);
+int archiveAffectedByChanges(const char* queryKey, void* context);
+void invalidateChangedArchives(const IndexChange* changes, size_t count, int complete);
+void sendServerStats(ReplyChannel* channel);
+void sendServerLoad(ReplyChannel* channel);
+void reapChildren(int signalNumber);
+void applyServerConfig(const ServerConfig* config);
+void reloadServerConfig(void);
+int acceptClients(int loop);
+void* acceptThread(void* argument);
+void acceptAndFork(int serverSocket);
 void ensureDirectoryExists(const char* path);
 
 // Main server process that listens and accepts client connections
-int main() {
-    ensureDirectoryExists(TEMP_DIRECTORY);  // Ensure the temporary directory exists
-
-    int serverSocket, clientSocket, clientStructSize;
-    struct sockaddr_in serverAddr, clientAddr;
-
-    // Create TCP socket
-    serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSocket == -1) {
-        printf("Socket creation Unsuccessful\n");
+// Usage: serverw24 [--config FILE] [--port N]... [--root DIR] [--temp-dir DIR] [--backlog N] [--send-buffer BYTES|auto] [--receive-buffer BYTES] [--link-mbps N] [--nodelay yes|no] [--cork yes|no] [--accept-loops N] [--epoll] [--workers N] [--spool] [--cache-bytes N] [--compress-threads N] [--compression-level CODEC:LEVEL]... [--reader auto|uring|threads|blocking] [--metrics-port N] [--max-archive-jobs N] [--max-lookups N] [--archive-memory-mb N] [--queue-limit N] [--queue-per-client N] [--queue-wait S] [--w24fz-depth N] [--w24ft-depth N] [--w24fdb-depth N] [--w24fda-depth N]
+// Every option can also be set in the --config file as "name = value"; the command line wins. SIGHUP rereads both
+int main(int argc, char *argv[]) {
+    char error[256];
+    if (loadServerConfig(argc, argv, &serverConfig, error, sizeof(error)) != 0) {
+        fprintf(stderr, "%s\nUsage: %s [--config FILE] [--port N]... [--root DIR] [--temp-dir DIR] [--backlog N] [--send-buffer BYTES|auto] [--receive-buffer BYTES] [--link-mbps N] [--nodelay yes|no] [--cork yes|no] [--accept-loops N] [--epoll] [--workers N] [--spool] [--cache-bytes N] [--compress-threads N] [--compression-level CODEC:LEVEL]... [--reader auto|uring|threads|blocking] [--metrics-port N] [--max-archive-jobs N] [--max-lookups N] [--archive-memory-mb N] [--queue-limit N] [--queue-per-client N] [--queue-wait S] [--w24fz-depth N] [--w24ft-depth N] [--w24fdb-depth N] [--w24fda-depth N]\n", error, argv[0]);
         return 1;
     }
+    serverArgumentCount = argc;
+    serverArguments = argv;
+    snprintf(homeDirectory, sizeof(homeDirectory), "%s", serverConfig.root);
+    snprintf(tempDirectory, sizeof(tempDirectory), "%s", serverConfig.tempDirectory);
+    int portCount = serverConfig.portCount;
+
+    applyServerConfig(&serverConfig);  // Archive, compression and reader settings, applied again on every reload
+    // Without TZ, glibc rereads the zone file and copies its name on every mktime of a date query
+    setenv("TZ", ":/etc/localtime", 0);
+    tzset();
+    printf("Archive input: %s\n", readerBackendName(effectiveReaderBackend()));  // Probes io_uring once, before forking
+    initAllocationCounter();  // Counts the mallocs of every connection process, in -DCOUNT_ALLOCATIONS builds
+    initLoadCounters();  // Shared with the connection processes, which report archive jobs into it
+    initMetrics();  // Likewise for command counters and latencies, read by the stats command and the exporter
+    initScheduler(&serverConfig.limits);  // Likewise for the slots and queues every archive and lookup is admitted through
+    if (serverConfig.metricsPort > 0 && startMetricsExporter(serverConfig.metricsPort) == 0) {
+        printf("Prometheus metrics on http://127.0.0.1:%d/metrics\n", serverConfig.metricsPort);
+    }
+    ensureDirectoryExists(tempDirectory);  // Ensure the temporary directory exists
+
+    // Cached archives are shared by every connection, and by every instance using the same temporary directory
+    char cacheDirectory[1024];
+    snprintf(cacheDirectory, sizeof(cacheDirectory), "%s/cache", tempDirectory);
+    initArchiveCache(cacheDirectory, serverConfig.cacheBytes);
+
+    setIndexChangeHandler(invalidateChangedArchives);  // Drops cached archives as soon as their files change
+    startFileIndex(homeDirectory, tempDirectory);  // Index the tree in the background for w24fn lookups and archive queries
+
+    // One listening socket per port for every accept loop; all of them serve the same commands. With several
+    // loops the sockets of a port share it through SO_REUSEPORT, and the kernel spreads connections over them
+    int acceptLoops = serverConfig.acceptLoops;
+    for (int loop = 0; loop < acceptLoops; loop++) {
+        for (int i = 0; i < portCount; i++) {
+            serverSockets[listenerCount] = openListeningSocket(serverConfig.ports[i], acceptLoops > 1);
+            if (serverSockets[listenerCount++] < 0) {
+                return 1;
+            }
+            if (loop == 0) printf("Server listening on port %d...\n", serverConfig.ports[i]);
+        }
+    }
+    if (acceptLoops > 1) printf("%d accept loops\n", acceptLoops);
+    reloadFd = openReloadSignal();  // The first accept loop rereads the config when SIGHUP arrives
+
+    if (serverConfig.eventLoop) {
+        // One process serves every client, so a disconnected client must not kill it with SIGPIPE
+        signal(SIGPIPE, SIG_IGN);
+        printf("Event loop mode with %d worker threads\n", serverConfig.workers);
+        // Binary requests run on stream threads rather than the workers. They are bounded by the worker count
+        // too, with room for as many streams as one connection may have per worker, since a stream spends most
+        // of its time waiting on the client
+        setStreamThreadLimit(serverConfig.workers * MAX_STREAMS_PER_CONNECTION);
+        if (reloadFd >= 0) setEventLoopWakeup(reloadFd, reloadServerConfig);
+        return runEventLoop(serverSockets, portCount, acceptLoops, serverConfig.workers, handleClientCommand) == 0 ? 0 : 1;
+    }
 
-    // Setup server address
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(SERVER_PORT);
+    // The parent counts connections: one per accepted client, until its process is reaped
+    struct sigaction reaper = {0};
+    reaper.sa_handler = reapChildren;
+    reaper.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &reaper, NULL);
+
+    // Accept loops after the first run on threads of their own, each forking children for its sockets
+    for (int loop = 1; loop < acceptLoops; loop++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, acceptThread, (void*)(intptr_t)loop) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    return acceptClients(0) == 0 ? 0 : 1;
+}
 
-    // Bind socket to the server address
-    if (bind(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
-        perror("bind failed. Error");
-        return 1;
+// Continuously accepts client connections on the sockets of one accept loop, one per port, and handles
+// them in child processes. The first loop also watches the reload signal, the last poll entry (ignored
+// by poll when it is -1). Returns only when poll fails
+int acceptClients(int loop) {
+    int portCount = serverConfig.portCount;
+    const int* sockets = serverSockets + loop * portCount;
+    struct pollfd listening[MAX_PORTS + 1];
+    for (int i = 0; i < portCount; i++) {
+        listening[i] = (struct pollfd){ sockets[i], POLLIN, 0 };
+    }
+    listening[portCount] = (struct pollfd){ loop == 0 ? reloadFd : -1, POLLIN, 0 };
+    while (1) {
+        if (poll(listening, portCount + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return -1;
+        }
+        for (int i = 0; i < portCount; i++) {
+            if (listening[i].revents & POLLIN) {
+                acceptAndFork(sockets[i]);
+            }
+        }
+        if (listening[portCount].revents & POLLIN) {
+            reloadServerConfig();
+        }
     }
+    return 0;
+}
 
-    // Start listening for client connections
-    listen(serverSocket, 3);
-    printf("Server listening on port %d...\n", SERVER_PORT);
-    clientStructSize = sizeof(struct sockaddr_in);
+// An accept loop after the first; its sockets would keep taking connections nobody accepts, so the server
+// stops if it fails
+void* acceptThread(void* argument) {
+    if (acceptClients((int)(intptr_t)argument) != 0) exit(1);
+    return NULL;
+}
 
-    // Continuously accept client connections and handle them in child processes
-    while ((clientSocket = accept(serverSocket, (struct sockaddr *)&clientAddr, (socklen_t*)&clientStructSize))) {
-        pid_t processID = fork();
+// Applies the settings requests read as they run. Connection processes forked before a reload keep theirs
+void applyServerConfig(const ServerConfig* config) {
+    __atomic_store_n(&spoolArchives, config->spool, __ATOMIC_RELAXED);
+    for (int command = 0; command < DEPTH_COMMANDS; command++) {
+        __atomic_store_n(&searchDepths[command], config->searchDepth[command], __ATOMIC_RELAXED);
+    }
+    setCompressionThreads(config->compressionThreads);
+    for (int id = 0; id < CODEC_COUNT; id++) {
+        setDefaultCompressionLevel(id, config->compressionLevels[id]);
+    }
+    setReaderBackend(config->readerBackend);
+    setSocketSettings(config);
+}
 
-        if (processID == 0) { // Child process handles client requests
-            crequest(clientSocket);
-            exit(0);
-        } else if (processID > 0) { // Parent process goes back to listening
-            close(clientSocket);
-        } else { // Fork failed
-            perror("fork failed");
-        }
+// Rereads the config file and command line after SIGHUP, without touching open connections. Limits, the
+// cache budget, compression, search depths, the backlog and socket options apply to what starts next; the
+// ports, the served tree, the temp directory, the server mode, its workers and accept loops and the metrics
+// port are set up once, so changing them takes a restart
+void reloadServerConfig(void) {
+    acknowledgeReload(reloadFd);
+    ServerConfig fresh;
+    char error[256];
+    if (loadServerConfig(serverArgumentCount, serverArguments, &fresh, error, sizeof(error)) != 0) {
+        fprintf(stderr, "Config reload failed, keeping the current settings: %s\n", error);
+        return;
     }
 
-    if (clientSocket < 0) {
-        perror("Sorry! Cannot Accept");
-        return 1;
+    int restartNeeded = fresh.portCount != serverConfig.portCount ||
+                        memcmp(fresh.ports, serverConfig.ports, sizeof(fresh.ports)) != 0 ||
+                        strcmp(fresh.root, serverConfig.root) != 0 ||
+                        strcmp(fresh.tempDirectory, serverConfig.tempDirectory) != 0 ||
+                        fresh.eventLoop != serverConfig.eventLoop || fresh.workers != serverConfig.workers ||
+                        fresh.acceptLoops != serverConfig.acceptLoops || fresh.metricsPort != serverConfig.metricsPort;
+    memcpy(fresh.ports, serverConfig.ports, sizeof(fresh.ports));
+    fresh.portCount = serverConfig.portCount;
+    memcpy(fresh.root, serverConfig.root, sizeof(fresh.root));
+    memcpy(fresh.tempDirectory, serverConfig.tempDirectory, sizeof(fresh.tempDirectory));
+    fresh.eventLoop = serverConfig.eventLoop;
+    fresh.workers = serverConfig.workers;
+    fresh.acceptLoops = serverConfig.acceptLoops;
+    fresh.metricsPort = serverConfig.metricsPort;
+    serverConfig = fresh;
+
+    applyServerConfig(&serverConfig);
+    updateSchedulerLimits(&serverConfig.limits);
+    setArchiveCacheBudget(serverConfig.cacheBytes);
+    for (int i = 0; i < listenerCount; i++) {
+        configureListeningSocket(serverSockets[i]);
     }
+    printf("Config reloaded%s\n", restartNeeded ? "; changes to ports, root, temp-dir, epoll, workers, accept-loops and metrics-port take effect on restart" : "");
+    fflush(stdout);
+}
 
-    return 0;
+// Accepts one client and hands it to a child process
+void acceptAndFork(int serverSocket) {
+    struct sockaddr_in clientAddr;
+    socklen_t clientStructSize = sizeof(clientAddr);
+    int clientSocket = accept(serverSocket, (struct sockaddr *)&clientAddr, &clientStructSize);
+    if (clientSocket < 0) {
+        if (errno != EINTR) perror("Sorry! Cannot Accept");
+        return;
+    }
+    connectionOpened();
+    fflush(stdout);  // The index thread logs too; a child would print whatever was still buffered again on exit
+    pid_t processID = fork();
+
+    if (processID == 0) { // Child process handles client requests
+        signal(SIGHUP, SIG_IGN);  // Only the listening process reloads; a connection keeps the settings it started with
+        tuneClientSocket(clientSocket);
+        crequest(clientSocket);
+        exit(0);
+    } else if (processID > 0) { // Parent process goes back to listening
+        close(clientSocket);
+    } else { // Fork failed
+        perror("fork failed");
+        close(clientSocket);
+        connectionClosed();
+    }
 }
 
 // Function to handle client requests
@@ -80,91 +299,290 @@ void crequest(int socket) {
     char commandBuffer[BUFFER_SIZE];
 
     while (1) {
+        // A binary connection becomes a multiplexed session; a text command is whatever one recv() returns
+        unsigned char firstByte;
+        if (recv(socket, &firstByte, 1, MSG_PEEK) <= 0) {
+            break; // Exit loop if client disconnects
+        }
+        if (firstByte == WIRE_MAGIC) {
+            runMuxSession(socket, runBinaryRequest);  // Binary clients pipeline requests until they quit
+            return;
+        }
+
         memset(commandBuffer, 0, BUFFER_SIZE);
         ssize_t bytesRead = recv(socket, commandBuffer, BUFFER_SIZE - 1, 0);
-        commandBuffer[bytesRead] = '\0'; // Ensure the command is NULL-terminated
-
-        if (bytesRead <= 0 || strcmp(commandBuffer, "quitc") == 0) {
-            break; // Exit loop if client disconnects or sends quit command
+        if (bytesRead <= 0) {
+            break; // Exit loop if client disconnects
         }
+        commandBuffer[bytesRead] = '\0'; // Ensure the command is NULL-terminated
 
-        // Process command by removing any newline characters
-        commandBuffer[strcspn(commandBuffer, "\n")] = 0;
-        commandBuffer[strcspn(commandBuffer, "\r")] = 0;
-
-        // Handle different commands for various operations
-        if (strncmp(commandBuffer, "w24fn ", 6) == 0 && strlen(commandBuffer) > 6) {
-            char* filename = commandBuffer + 6;
-            char fileInfo[BUFFER_SIZE] = {0};
-            if (!findFileInDirectory("/home/patel489", filename, fileInfo, sizeof(fileInfo))) {
-                char* msg = "File is not present\n";
-                send(socket, msg, strlen(msg), 0);
-            } else {
-                send(socket, fileInfo, strlen(fileInfo), 0);
-            }
-        } else if (strcmp(commandBuffer, "dirlist -a") == 0) {
-            listDirectoryContents(socket, "-a");
-        } else if (strcmp(commandBuffer, "dirlist -t") == 0) {
-            listDirectoryContents(socket, "-t");
-        } else if (strncmp(commandBuffer, "w24fz ", 6) == 0 && strlen(commandBuffer) > 6) {
-            long size1, size2;
-            sscanf(commandBuffer + 6, "%ld %ld", &size1, &size2);
-            searchByFileSizeAndArchive(socket, size1, size2);
-        } else if (strncmp(commandBuffer, "w24ft ", 6) == 0 && strlen(commandBuffer) > 6) {
-            char fileTypes[3][10];
-            int count = sscanf(commandBuffer + 6, "%s %s %s", fileTypes[0], fileTypes[1], fileTypes[2]);
-            searchByFileExtensionAndArchive(socket, fileTypes, count);
-        } else if (strncmp(commandBuffer, "w24fdb ", 7) == 0 && strlen(commandBuffer) > 7) {
-            char* dateString = commandBuffer + 7;
-            searchByDateBeforeAndArchive(socket, dateString);
-        } else if (strncmp(commandBuffer, "w24fda ", 7) == 0 && strlen(commandBuffer) > 7) {
-            char* dateString = commandBuffer + 7;
-            searchByDateAfterAndArchive(socket, dateString);
-        } else {
-            char* msg = "Invalid command or syntax error\n";
-            send(socket, msg, strlen(msg), 0);
+        if (!handleClientCommand(socket, commandBuffer)) {
+            break; // Exit loop if client sends quit command
         }
     }
     close(socket);
 }
 
-// Lists contents of a directory sorted alphabetically or by modification time
-void listDirectoryContents(int socket, const char* sortFlag) {
-    DIR *dir;
-    struct dirent **namelist;
-    int n;
-    char buffer[BUFFER_SIZE] = {0};
-    char path[1024] = "/home/patel489"; // Path to the directory to list
+// Runs a single client request from the event loop: a text command, or for a binary connection (commandBuffer
+// is NULL) a multiplexed session on its own thread. Returns 0 when the connection should be closed
+int handleClientCommand(int socket, char* commandBuffer) {
+    if (!commandBuffer) {
+        return startMuxSession(socket, runBinaryRequest, connectionClosed) == 0 ? HANDLER_DETACHED : 0;
+    }
+    // The arena goes back to the process's pool, so the connection's next command reuses its memory
+    ReplyChannel channel = { socket, 0, 0 };
+    channel.arena = acquireArena();
+    channel.batch = batchingReplies();
+    if (!channel.arena) {
+        replyError(&channel, "Server busy.\n");
+        return 1;
+    }
+    int keepOpen = runTextCommand(&channel, commandBuffer);
+    releaseArena(channel.arena);
+    return keepOpen;
+}
+
+// Splits up to three extensions, as "w24ft" accepts
+int parseExtensions(const char* text, char fileTypes[][10]) {
+    int count = sscanf(text, "%9s %9s %9s", fileTypes[0], fileTypes[1], fileTypes[2]);
+    return count > 0 ? count : 0;
+}
+
+// Runs one text command, replying on the channel in text framing or, for OP_TEXT_COMMAND, in binary frames,
+// and records its latency, reply size and outcome
+int runTextCommand(ReplyChannel* channel, char* commandBuffer) {
+    if (strcmp(commandBuffer, "quitc") == 0) {
+        return 0;
+    }
+    // Process command by removing any newline characters
+    commandBuffer[strcspn(commandBuffer, "\n")] = 0;
+    commandBuffer[strcspn(commandBuffer, "\r")] = 0;
+
+    CommandKind kind = classifyTextCommand(commandBuffer);
+    double start = metricsNow();
+    int keepOpen = 1, ticket;
+    if (admitCommand(channel, kind, &ticket)) {
+        keepOpen = dispatchTextCommand(channel, commandBuffer);
+        finishJob(ticket);
+    }
+    recordCommand(kind, metricsNow() - start, channel->bytesSent, channel->errorSent);
+    return keepOpen;
+}
 
-    int dirFilter(const struct dirent *entry) {
-        // Filter to exclude current and parent directory entries
-        return (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0);
+// Maps a text command to the name it is counted under
+CommandKind classifyTextCommand(const char* command) {
+    if (strncmp(command, "w24fn ", 6) == 0) return COMMAND_W24FN;
+    if (strncmp(command, "dirlist ", 8) == 0) return COMMAND_DIRLIST;
+    if (strncmp(command, "w24fz ", 6) == 0) return COMMAND_W24FZ;
+    if (strncmp(command, "w24ft ", 6) == 0) return COMMAND_W24FT;
+    if (strncmp(command, "w24fdb ", 7) == 0) return COMMAND_W24FDB;
+    if (strncmp(command, "w24fda ", 7) == 0) return COMMAND_W24FDA;
+    if (strcmp(command, "stats") == 0) return COMMAND_STATS;
+    if (strcmp(command, "load") == 0) return COMMAND_LOAD;
+    return COMMAND_OTHER;
+}
+
+// Parses a text command and runs it
+int dispatchTextCommand(ReplyChannel* channel, char* commandBuffer) {
+    // Archive commands may name a codec or list the codecs the client accepts
+    CodecChoice codec;
+    if (isArchiveCommand(commandBuffer) && negotiateCodec(commandBuffer, &codec) != 0) {
+        replyError(channel, "Unsupported codec, expected --codec=gzip|zstd|lz4[:level].\n");
+        return 1;
     }
 
-    n = scandir(path, &namelist, dirFilter, (strcmp(sortFlag, "-a") == 0) ? alphasort : sortByModificationTime);
-    if (n < 0) {
-        perror("scandir");
-        send(socket, "Failed to open directory.\n", 26, 0);
+    // Handle different commands for various operations
+    if (strncmp(commandBuffer, "w24fn ", 6) == 0 && strlen(commandBuffer) > 6) {
+        findFile(channel, commandBuffer + 6);
+    } else if (strcmp(commandBuffer, "stats") == 0) {
+        sendServerStats(channel);
+    } else if (strcmp(commandBuffer, "load") == 0) {
+        sendServerLoad(channel);
+    } else if (strcmp(commandBuffer, "dirlist -a") == 0) {
+        listDirectoryContents(channel, "-a");
+    } else if (strcmp(commandBuffer, "dirlist -t") == 0) {
+        listDirectoryContents(channel, "-t");
+    } else if (strncmp(commandBuffer, "w24fz ", 6) == 0 && strlen(commandBuffer) > 6) {
+        long size1, size2;
+        sscanf(commandBuffer + 6, "%ld %ld", &size1, &size2);
+        searchByFileSizeAndArchive(channel, size1, size2, &codec, NULL);
+    } else if (strncmp(commandBuffer, "w24ft ", 6) == 0 && strlen(commandBuffer) > 6) {
+        char fileTypes[3][10];
+        int count = parseExtensions(commandBuffer + 6, fileTypes);
+        searchByFileExtensionAndArchive(channel, fileTypes, count, &codec, NULL);
+    } else if (strncmp(commandBuffer, "w24fdb ", 7) == 0 && strlen(commandBuffer) > 7) {
+        char* dateString = commandBuffer + 7;
+        searchByDateBeforeAndArchive(channel, dateString, &codec, NULL);
+    } else if (strncmp(commandBuffer, "w24fda ", 7) == 0 && strlen(commandBuffer) > 7) {
+        char* dateString = commandBuffer + 7;
+        searchByDateAfterAndArchive(channel, dateString, &codec, NULL);
     } else {
-        for (int i = 0; i < n; i++) {
-            strcat(buffer, namelist[i]->d_name);
-            strcat(buffer, "\n");
-            free(namelist[i]);
+        replyText(channel, "Invalid command or syntax error\n");
+    }
+    return 1;
+}
+
+// Reads a 64-bit big-endian integer from a request payload
+long long readInt64(const unsigned char* data) {
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; i++) value = (value << 8) | data[i];
+    return (long long)value;
+}
+
+// Runs one binary request on its stream of a multiplexed connection and records it like runTextCommand does;
+// returns 0 when the connection should be closed
+int runBinaryRequest(ReplyChannel* channel, const FrameHeader* header, char* payload) {
+    if (header->opcode == OP_TEXT_COMMAND) {
+        return runTextCommand(channel, payload);  // Recorded under the command it carries
+    }
+    CommandKind kind = COMMAND_OTHER;
+    switch (header->opcode) {
+    case OP_FIND_FILE: kind = COMMAND_W24FN; break;
+    case OP_LIST_DIRECTORIES: kind = COMMAND_DIRLIST; break;
+    case OP_ARCHIVE_BY_SIZE: kind = COMMAND_W24FZ; break;
+    case OP_ARCHIVE_BY_TYPE: kind = COMMAND_W24FT; break;
+    case OP_ARCHIVE_BEFORE: kind = COMMAND_W24FDB; break;
+    case OP_ARCHIVE_AFTER: kind = COMMAND_W24FDA; break;
+    case OP_STATS: kind = COMMAND_STATS; break;
+    case OP_LOAD: kind = COMMAND_LOAD; break;
+    }
+    double start = metricsNow();
+    int keepOpen = 1, ticket;
+    if (admitCommand(channel, kind, &ticket)) {
+        keepOpen = dispatchBinaryRequest(channel, header, payload);
+        finishJob(ticket);
+    }
+    recordCommand(kind, metricsNow() - start, channel->bytesSent, channel->errorSent);
+    return keepOpen;
+}
+
+// Lookups and listings are admitted as cheap jobs before they run; archives are admitted once they miss the
+// cache, and stats and load always run so an overloaded server can still be watched. Returns 0 after replying busy
+int admitCommand(ReplyChannel* channel, CommandKind kind, int* ticket) {
+    *ticket = -1;
+    if (kind != COMMAND_W24FN && kind != COMMAND_DIRLIST) return 1;
+    *ticket = admitClientJob(channel, JOB_CHEAP, 0, kind == COMMAND_W24FN);
+    return *ticket >= 0;
+}
+
+// Admits a job for the client at the other end of the channel, which queues fairly against other clients by
+// address. When it is turned away the client is told when to retry, as raw text for a text-mode w24fn reply
+// and as an error otherwise, and -1 is returned
+int admitClientJob(ReplyChannel* channel, JobClass jobClass, unsigned long long memory, int textReply) {
+    struct sockaddr_in peer;
+    socklen_t peerLength = sizeof(peer);
+    unsigned int client = 0;
+    if (getpeername(channel->socket, (struct sockaddr*)&peer, &peerLength) == 0 && peer.sin_family == AF_INET) {
+        client = peer.sin_addr.s_addr;
+    }
+
+    int retryAfter = 0;
+    int ticket = admitJob(jobClass, client, memory, &retryAfter);
+    if (ticket < 0) {
+        char message[64];
+        snprintf(message, sizeof(message), BUSY_REPLY_FORMAT, retryAfter);
+        if (textReply) replyText(channel, message);
+        else replyError(channel, message);
+        channel->errorSent = 1;
+    }
+    return ticket;
+}
+
+// Decodes a binary request's payload and runs it
+int dispatchBinaryRequest(ReplyChannel* channel, const FrameHeader* header, char* payload) {
+    // Archive requests start with the codec prefix; the arguments follow it
+    int isArchive = header->opcode >= OP_ARCHIVE_BY_SIZE && header->opcode <= OP_ARCHIVE_AFTER;
+    CodecChoice codec;
+    char* arguments = payload;
+    if (isArchive) {
+        // The payload buffer is reused between requests, so bytes past a short payload belong to an older one
+        if (header->length < ARCHIVE_PREFIX_SIZE) {
+            replyError(channel, "Malformed request.\n");
+            return 1;
+        }
+        const unsigned char* prefix = (const unsigned char*)payload;
+        int requested = prefix[0] == WIRE_CODEC_NEGOTIATE ? -1 : prefix[0];
+        if (selectCodec(requested, prefix[1], prefix[2], &codec) != 0) {
+            replyError(channel, "Unsupported codec.\n");
+            return 1;
+        }
+        arguments = payload + ARCHIVE_PREFIX_SIZE;
+    }
+
+    // A ranged request quotes the archive it resumes before the arguments
+    ArchiveRange range, *requestedRange = NULL;
+    if (isArchive && (header->flags & ARCHIVE_RANGE)) {
+        if (header->length < ARCHIVE_PREFIX_SIZE + ARCHIVE_RANGE_SIZE) {
+            replyError(channel, "Malformed request.\n");
+            return 1;
         }
-        free(namelist);
-        send(socket, buffer, strlen(buffer), 0);
+        range.contentId = readInt64((unsigned char*)arguments);
+        range.offset = readInt64((unsigned char*)arguments + 8);
+        range.length = readInt64((unsigned char*)arguments + 16);
+        requestedRange = &range;
+        arguments += ARCHIVE_RANGE_SIZE;
+    }
+
+    switch (header->opcode) {
+    case OP_FIND_FILE:
+        findFile(channel, payload);
+        break;
+    case OP_LIST_DIRECTORIES:
+        listDirectoryContents(channel, (header->flags & LIST_BY_MTIME) ? "-t" : "-a");
+        break;
+    case OP_STATS:
+        sendServerStats(channel);
+        break;
+    case OP_LOAD:
+        sendServerLoad(channel);
+        break;
+    case OP_ARCHIVE_BY_SIZE:
+        if (header->length < (unsigned long long)(arguments - payload) + 16) {
+            replyError(channel, "Malformed request.\n");
+            break;
+        }
+        searchByFileSizeAndArchive(channel, readInt64((unsigned char*)arguments),
+                                   readInt64((unsigned char*)arguments + 8), &codec, requestedRange);
+        break;
+    case OP_ARCHIVE_BY_TYPE: {
+        char fileTypes[3][10];
+        int count = parseExtensions(arguments, fileTypes);
+        searchByFileExtensionAndArchive(channel, fileTypes, count, &codec, requestedRange);
+        break;
+    }
+    case OP_ARCHIVE_BEFORE:
+        searchByDateBeforeAndArchive(channel, arguments, &codec, requestedRange);
+        break;
+    case OP_ARCHIVE_AFTER:
+        searchByDateAfterAndArchive(channel, arguments, &codec, requestedRange);
+        break;
+    default:
+        replyError(channel, "Unknown request.\n");
+        break;
     }
+    return 1;
 }
 
-// Compares two directory entries by modification time for sorting
-int sortByModificationTime(const struct dirent **a, const struct dirent **b) {
-    struct stat sa, sb;
-    char pathA[1024], pathB[1024];
-    snprintf(pathA, sizeof(pathA), "/home/patel489/%s", (*a)->d_name);
-    snprintf(pathB, sizeof(pathB), "/home/patel489/%s", (*b)->d_name);
-    stat(pathA, &sa);
-    stat(pathB, &sb);
-    return (sa.st_ctime > sb.st_ctime) - (sa.st_ctime < sb.st_ctime);
+// Replies to w24fn with the file's details from the index
+void findFile(ReplyChannel* channel, const char* filename) {
+    char fileInfo[BUFFER_SIZE] = {0};
+    int found = lookupFileIndex(filename, fileInfo, sizeof(fileInfo));
+    if (found < 0) {
+        found = findFileInDirectory(homeDirectory, filename, fileInfo, sizeof(fileInfo));  // Index still building
+    }
+    replyText(channel, found ? fileInfo : "File is not present\n");
+}
+
+// Lists the subdirectories of the home directory sorted alphabetically or by modification time
+void listDirectoryContents(ReplyChannel* channel, const char* sortFlag) {
+    DirectoryListing listing;
+    if (listSubdirectories(homeDirectory, strcmp(sortFlag, "-t") == 0, channel->arena, &listing) != 0) {
+        perror("listSubdirectories");
+        replyError(channel, "Failed to open directory.\n");
+        return;
+    }
+    sendDirectoryListing(channel, &listing);
+    freeDirectoryListing(&listing);
 }
 
 // Recursively searches for a file within a directory and subdirectories
@@ -195,7 +613,8 @@ int findFileInDirectory(const char* directoryPath, const char* targetFilename, c
         } else if (strcmp(entry->d_name, targetFilename) == 0) {
             // When target file is found, format file information
             char timeBuffer[100];
-            strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", localtime(&fileInfo.st_mtime));
+            struct tm modifiedTime;
+            strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", localtime_r(&fileInfo.st_mtime, &modifiedTime));
             snprintf(resultInfo, maxInfoLength, "%s, Size: %ld bytes, Modified: %s, Permissions: %o",
                      entry->d_name, fileInfo.st_size, timeBuffer, fileInfo.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO));
             closedir(dir);
@@ -206,102 +625,301 @@ int findFileInDirectory(const char* directoryPath, const char* targetFilename, c
     return 0;  // File not found after checking all files
 }
 
-// Searches for files within a specific size range, archives them, and sends the archive to the client
-void searchByFileSizeAndArchive(int socket, long minSize, long maxSize) {
-    char findCommand[1024];
-    char archivePath[1024];
-    sprintf(archivePath, "%s/temp.tar.gz", TEMP_DIRECTORY);
+// Levels an archive command searches; a reload may store a new value while workers run commands
+int searchDepth(int command) {
+    return __atomic_load_n(&searchDepths[command], __ATOMIC_RELAXED);
+}
 
-    // Construct the find command to locate files within the specified size range and exclude hidden files
-    sprintf(findCommand, "find /home/patel489 -maxdepth 2 -type f -size +%ldc -size -%ldc ! -name '.*' -print0 | tar -czvf %s --null -T - > /dev/null 2>&1", minSize, maxSize, archivePath);
-    int result = system(findCommand);
-    archiveFilesAndSend(socket, archivePath, result);
+// Searches for files within a specific size range, archives them, and sends the archive to the client
+void searchByFileSizeAndArchive(ReplyChannel* channel, long minSize, long maxSize, const CodecChoice* codec, const ArchiveRange* range) {
+    SearchQuery query = { .maxDepth = searchDepth(DEPTH_W24FZ), .matchSize = 1, .minSize = minSize, .maxSize = maxSize };
+    buildArchiveAndSend(channel, &query, codec, range);
 }
 
 // Searches for files matching specific file extensions, archives them, and sends the archive
-void searchByFileExtensionAndArchive(int socket, char fileTypes[][10], int fileTypeCount) {
-    char findCommand[1024];
-    char archivePath[1024];
-    char extensionFilter[512] = "";
+void searchByFileExtensionAndArchive(ReplyChannel* channel, char fileTypes[][10], int fileTypeCount, const CodecChoice* codec, const ArchiveRange* range) {
+    SearchQuery query = { .maxDepth = searchDepth(DEPTH_W24FT) };
+    for (int i = 0; i < fileTypeCount && i < MAX_EXTENSIONS; i++) {
+        query.extensions[query.extensionCount++] = fileTypes[i];
+    }
+    buildArchiveAndSend(channel, &query, codec, range);
+}
 
-    sprintf(archivePath, "%s/temp.tar.gz", TEMP_DIRECTORY);
-    strcat(extensionFilter, "\\( ! -name '.*' "); // Start condition group to exclude hidden files
+// Returns 1 for the commands that reply with an archive
+int isArchiveCommand(const char* command) {
+    return strncmp(command, "w24fz ", 6) == 0 || strncmp(command, "w24ft ", 6) == 0 ||
+           strncmp(command, "w24fdb ", 7) == 0 || strncmp(command, "w24fda ", 7) == 0;
+}
 
-    for (int i = 0; i < fileTypeCount; i++) {
-        if (i > 0) strcat(extensionFilter, " -o ");
-        strcat(extensionFilter, "-name '*.");
-        strcat(extensionFilter, fileTypes[i]);
-        strcat(extensionFilter, "'");
+// Searches for files modified before a specified date, archives them, and sends the archive
+void searchByDateBeforeAndArchive(ReplyChannel* channel, char* dateString, const CodecChoice* codec, const ArchiveRange* range) {
+    SearchQuery query = { .maxDepth = searchDepth(DEPTH_W24FDB), .matchBefore = 1 };
+    // Up to the same time the next day, to include all files from the specified day. A calendar day rather
+    // than 24 hours, which is an hour short or long on the days daylight saving time starts or ends
+    struct tm day;
+    int valid = parseSearchFields(dateString, &day) == 0;
+    if (valid) {
+        day.tm_mday += 1;  // mktime carries it into the next month or year
+        day.tm_isdst = -1;
+        query.before = mktime(&day);
+        valid = query.before != (time_t)-1;
+    }
+    if (!valid) {
+        replyError(channel, "Invalid date format, expected YYYY-MM-DD.\n");
+        return;
     }
-    strcat(extensionFilter, " \\)"); // Close condition group
+    buildArchiveAndSend(channel, &query, codec, range);
+}
 
-    sprintf(findCommand, "find /home/patel489 -maxdepth 1 -type f %s -print0 | tar -czvf %s --null -T - > /dev/null 2>&1", extensionFilter, archivePath);
-    int result = system(findCommand);
-    archiveFilesAndSend(socket, archivePath, result);
+// Searches for files modified after a specified date, archives them, and sends the archive
+void searchByDateAfterAndArchive(ReplyChannel* channel, char* dateString, const CodecChoice* codec, const ArchiveRange* range) {
+    SearchQuery query = { .maxDepth = searchDepth(DEPTH_W24FDA), .matchAfter = 1 };
+    if (parseSearchDate(dateString, &query.after) != 0) {
+        replyError(channel, "Invalid date format, expected YYYY-MM-DD.\n");
+        return;
+    }
+    buildArchiveAndSend(channel, &query, codec, range);
 }
 
-// Searches for files modified before a specified date, archives them, and sends the archive
-void searchByDateBeforeAndArchive(int socket, char* dateString) {
-    char archivePath[1024];
-    sprintf(archivePath, "%s/temp.tar.gz", TEMP_DIRECTORY);
-
-    char findCommand[2048];
-    char adjustedDateString[20];
-    struct tm tm = {0};
-    if (strptime(dateString, "%Y-%m-%d", &tm) != NULL) {
-        tm.tm_mday += 1;  // Adjust the day to include all files from the specified day
-        strftime(adjustedDateString, sizeof(adjustedDateString), "%Y-%m-%d", &tm);
+// Compressed output of an archive, kept until the heavy slot is released: in memory while it is small, then
+// in an unnamed spool file
+typedef struct {
+    char* data;
+    size_t length;
+    int fd;  // Spool file once the output outgrew BUFFERED_ARCHIVE_BYTES, or -1
+} ArchiveBuffer;
+
+// Writes all bytes to a file descriptor, retrying short writes
+int writeAllToFd(int fd, const void* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return -1;
+        data = (const char*)data + written;
+        length -= written;
+    }
+    return 0;
+}
+
+// Sink that collects compressed archive output in memory, moving it to a spool file once it would not fit
+int writeArchiveToBuffer(void* context, const void* data, size_t length) {
+    ArchiveBuffer* buffer = context;
+    if (buffer->fd < 0 && buffer->length + length > BUFFERED_ARCHIVE_BYTES) {
+        buffer->fd = open(tempDirectory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (buffer->fd < 0 || writeAllToFd(buffer->fd, buffer->data, buffer->length) != 0) return -1;
+    }
+    if (buffer->fd >= 0) return writeAllToFd(buffer->fd, data, length);
+    if (!buffer->data && !(buffer->data = malloc(BUFFERED_ARCHIVE_BYTES))) return -1;
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+// Sink that appends compressed archive output to a spool file
+int writeArchiveToSpool(void* context, const void* data, size_t length) {
+    return writeAllToFd(*(int*)context, data, length);
+}
+
+// Sends the archive for a query, counted as an archive job while it runs so the load probe sees it
+void buildArchiveAndSend(ReplyChannel* channel, const SearchQuery* query, const CodecChoice* codec, const ArchiveRange* range) {
+    archiveJobStarted();
+    sendArchiveForQuery(channel, query, codec, range);
+    archiveJobFinished();
+}
+
+// Collects the files matching a query and sends them to the client as a chunked, compressed tar
+// A repeated query over unchanged files is answered from the result cache. Otherwise the archive is built
+// with a heavy slot held and sent once the slot is released, so a client that reads slowly, or not at all,
+// keeps no slot from other requests. It is built in memory while small, and otherwise in a spool file, which
+// is kept as the cached copy when the cache is on. A ranged request is served from the cached archive, which
+// is rebuilt first if it was evicted
+void sendArchiveForQuery(ReplyChannel* channel, const SearchQuery* query, const CodecChoice* codec, const ArchiveRange* range) {
+    FileList matches;
+    double scanStart = metricsNow();
+    // The file index answers from its columnar snapshot; the tree is only walked while it is unavailable
+    if (selectIndexedFiles(query, channel->arena, &matches) != 0 &&
+        collectMatchingFiles(homeDirectory, query, &matches) != 0) {
+        perror("Failed to search files");
+        replyError(channel, "Failed to search files.\n");
+        return;
+    }
+    recordArchivePhase(PHASE_SCAN, metricsNow() - scanStart);
+    if (matches.count == 0) {
+        freeFileList(&matches);
+        replyError(channel, "No file found.\n");
+        return;
+    }
+
+    // The cache key is the normalized query and codec plus a fingerprint of exactly which file versions matched
+    char queryKey[512], codecSpec[32];
+    formatQueryKey(query, queryKey, sizeof(queryKey));
+    formatCodecSpec(codec, codecSpec, sizeof(codecSpec));
+    size_t keyLength = strlen(queryKey);
+    snprintf(queryKey + keyLength, sizeof(queryKey) - keyLength, " codec=%s", codecSpec);
+    unsigned long long fingerprint = fingerprintFileList(&matches);
+    unsigned long long contentId = archiveContentId(queryKey, fingerprint);
+    if (range && range->contentId != contentId) {
+        freeFileList(&matches);
+        replyError(channel, "The matching files have changed since the download started, run the command again.\n");
+        return;
+    }
+
+    // A cached archive is only copied out; building one takes a heavy slot, the compressor's memory and the reader's
+    int cachedFd = lookupCachedArchive(queryKey, fingerprint);
+    int ticket = -1;
+    if (cachedFd < 0) {
+        unsigned long long matchedBytes = 0;
+        for (size_t i = 0; i < matches.count; i++) matchedBytes += matches.files[i].size;
+        ticket = admitClientJob(channel, JOB_HEAVY, compressorMemoryBound(codec, matchedBytes) + fileReaderMemoryBound(), 0);
+        if (ticket < 0) {
+            freeFileList(&matches);
+            return;
+        }
+    }
+    if (cachedFd >= 0) {
+        freeFileList(&matches);
+        replyArchiveBegin(channel, codec->id, contentId, range ? range->offset : 0);
+        sendCachedArchive(channel, cachedFd, range);
+        close(cachedFd);
+        return;
+    }
+
+    // A spool file is named when it becomes the cached copy; O_TMPFILE gives any other its own unnamed file
+    // that disappears on close
+    char cachePath[1024];
+    int caching = archiveCacheEnabled();
+    ArchiveBuffer buffer = { NULL, 0, -1 };
+    ArchiveSink sink = { writeArchiveToBuffer, &buffer };
+    int spooling = __atomic_load_n(&spoolArchives, __ATOMIC_RELAXED) || range || caching;
+    if (spooling) {
+        buffer.fd = caching ? createCacheFile(cachePath, sizeof(cachePath))
+                            : open(tempDirectory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        sink = (ArchiveSink){ writeArchiveToSpool, &buffer.fd };
+    }
+    double compressStart = metricsNow();
+    int result = spooling && buffer.fd < 0 ? -1 : writeTarArchive(&matches, codec, &sink, channel->arena);
+    recordArchivePhase(PHASE_COMPRESS, metricsNow() - compressStart);
+    finishJob(ticket);
+    freeFileList(&matches);
+
+    if (result != 0) {
+        perror("Failed to create tar file");
+        replyError(channel, "Failed to create tar file.\n");
+    } else if (buffer.fd >= 0) {
+        replyArchiveBegin(channel, codec->id, contentId, range ? range->offset : 0);
+        sendCachedArchive(channel, buffer.fd, range);
     } else {
-        strncpy(adjustedDateString, dateString, sizeof(adjustedDateString));
+        replyArchiveBegin(channel, codec->id, contentId, 0);
+        TransferStats stats;
+        beginTransferStats(&stats, "buffer");
+        double sendStart = metricsNow();
+        stats.bytes = buffer.length;
+        stats.syscalls++;
+        if (replyData(channel, buffer.data, buffer.length) == 0 && replyEnd(channel) == 0) {
+            reportTransferStats(&stats);
+        }
+        recordArchivePhase(PHASE_SEND, metricsNow() - sendStart);
     }
 
-    // Construct the find command to locate files modified before the specified date
-    sprintf(findCommand, "find /home/patel489 -maxdepth 1 -type f ! -newermt '%s' ! -name '.*' -print0 | tar -czvf %s --null -T - > /dev/null 2>&1", adjustedDateString, archivePath);
-    int result = system(findCommand);
-    archiveFilesAndSend(socket, archivePath, result);
+    if (buffer.fd >= 0 && close(buffer.fd) != 0) result = -1;
+    if (caching && buffer.fd >= 0) {
+        if (result == 0) storeCachedArchive(queryKey, fingerprint, cachePath);
+        else unlink(cachePath);
+    }
+    free(buffer.data);
 }
 
-// Searches for files modified after a specified date, archives them, and sends the archive
-void searchByDateAfterAndArchive(int socket, char* dateString) {
-    char archivePath[1024];
-    sprintf(archivePath, "%s/temp.tar.gz", TEMP_DIRECTORY);
-
-    char findCommand[2048];
-    sprintf(findCommand, "find /home/patel489 -maxdepth 2 -type f ! -name '.*' -newermt '%s' -print0 | tar -czvf %s --null -T - > /dev/null 2>&1", dateString, archivePath);
-    int result = system(findCommand);
-    archiveFilesAndSend(socket, archivePath, result);
-}
-
-// Sends the archived files to the client, handling the file transfer and error management
-void archiveFilesAndSend(int socket, char* archivePath, int operationResult) {
-    if (operationResult == 0) {
-        struct stat fileInfo;
-        if (stat(archivePath, &fileInfo) == 0 && fileInfo.st_size > 0) {
-            int fileSize = fileInfo.st_size;
-            send(socket, &fileSize, sizeof(fileSize), 0);  // First, send the size of the file
-
-            FILE *file = fopen(archivePath, "rb");
-            if (file) {
-                char buffer[BUFFER_SIZE];
-                int bytesRead;
-                while ((bytesRead = fread(buffer, 1, BUFFER_SIZE, file)) > 0) {
-                    send(socket, buffer, bytesRead, 0);  // Send the file content in chunks
-                }
-                fclose(file);
-            } else {
-                char *msg = "Error opening file.\n";
-                send(socket, msg, strlen(msg), 0);
-            }
-        } else {
-            char *msg = "No file found or file created is empty.\n";
-            send(socket, msg, strlen(msg), 0);
+// File changes reported by the index, checked against the query of each cached archive
+typedef struct {
+    const IndexChange* changes;
+    size_t count;
+    int complete;
+} ChangeBatch;
+
+// True when a change may alter what a cached query matched: a file within its depth whose old or new version
+// matches. Keys that do not parse count as affected
+int archiveAffectedByChanges(const char* queryKey, void* context) {
+    const ChangeBatch* batch = context;
+    char key[512];
+    SearchQuery query;
+    snprintf(key, sizeof(key), "%s", queryKey);
+    if (!batch->complete || parseQueryKey(key, &query) != 0) return 1;
+
+    for (size_t i = 0; i < batch->count; i++) {
+        const IndexChange* change = &batch->changes[i];
+        if (change->depth > query.maxDepth) continue;
+        const char* name = strrchr(change->path, '/');
+        name = name ? name + 1 : change->path;
+        struct stat version = {0};
+        version.st_size = change->oldSize;
+        version.st_mtim = change->oldMtime;
+        if (change->existed && fileMatchesQuery(name, &version, &query)) return 1;
+        version.st_size = change->size;
+        version.st_mtim = change->mtime;
+        if (change->exists && fileMatchesQuery(name, &version, &query)) return 1;
+    }
+    return 0;
+}
+
+// Index change handler: drops the cached archives whose matched sets changed, on the index owner's thread.
+// The fingerprint check on lookup stays, for archives built from a snapshot older than the changes
+void invalidateChangedArchives(const IndexChange* changes, size_t count, int complete) {
+    ChangeBatch batch = { changes, count, complete };
+    size_t dropped = invalidateCachedArchives(archiveAffectedByChanges, &batch);
+    if (dropped > 0) {
+        printf("Dropped %zu cached archives affected by %s file changes\n", dropped, complete ? "the latest" : "many");
+    }
+}
+
+// Sends a finished archive file, or the requested range of it, with sendfile() and logs the transfer cost
+int sendCachedArchive(ReplyChannel* channel, int fd, const ArchiveRange* range) {
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0) return -1;
+    unsigned long long offset = 0, length = fileInfo.st_size;
+    if (range) {
+        if (range->offset > (unsigned long long)fileInfo.st_size) {
+            replyError(channel, "Range starts past the end of the archive.\n");
+            return -1;
         }
+        offset = range->offset;
+        length = fileInfo.st_size - offset;
+        if (range->length && range->length < length) length = range->length;
+    }
+
+    TransferStats stats;
+    beginTransferStats(&stats, "sendfile");
+    double sendStart = metricsNow();
+    int result = sendFileRangeAsChunks(channel, fd, offset, length, &stats);
+    recordArchivePhase(PHASE_SEND, metricsNow() - sendStart);
+    if (result == 0) {
+        reportTransferStats(&stats);
     } else {
-        perror("Failed to create tar file");
-        char *msg = "Failed to create tar file.\n";
-        send(socket, msg, strlen(msg), 0);
+        perror("Failed to send archive");
+    }
+    return result;
+}
+
+// Replies to the stats command with the server's counters, latencies and cache statistics
+void sendServerStats(ReplyChannel* channel) {
+    char statsText[STATS_BUFFER_SIZE];
+    formatMetricsSummary(statsText, sizeof(statsText));
+    replyText(channel, statsText);
+}
+
+// Answers the load probe clients use to pick the least busy server
+void sendServerLoad(ReplyChannel* channel) {
+    char loadText[BUFFER_SIZE];
+    formatServerLoad(loadText, sizeof(loadText));
+    replyText(channel, loadText);
+}
+
+// Reaps finished connection processes, so they neither linger as zombies nor count as connections
+void reapChildren(int signalNumber) {
+    int savedErrno = errno;
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+        connectionClosed();
     }
-    remove(archivePath);  // Clean up the temporary file
+    errno = savedErrno;
 }
 
 // Checks if a directory exists, and creates it if it does not
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "sockw24.h"
+
+#define TCP_WMEM_PATH "/proc/sys/net/ipv4/tcp_wmem"
+#define DEFAULT_AUTOTUNE_LIMIT (4 * 1024 * 1024)  // The kernel's default third tcp_wmem value
+
+// Read by every accepting thread while a reload may replace them, so each is loaded on its own
+static int backlog = 128;
+static int noDelay = 1;
+static int batchReplies = 1;
+static int sendBufferBytes = SEND_BUFFER_AUTO;
+static int receiveBufferBytes = 0;
+static int linkMbps = 1000;
+
+static pthread_once_t autotuneOnce = PTHREAD_ONCE_INIT;
+static long long autotuneLimit = DEFAULT_AUTOTUNE_LIMIT;  // Largest send buffer autotuning grows to
+
+static void readAutotuneLimit(void) {
+    FILE* file = fopen(TCP_WMEM_PATH, "r");
+    long long minimum, initial, maximum;
+    if (file && fscanf(file, "%lld %lld %lld", &minimum, &initial, &maximum) == 3 && maximum > 0) {
+        autotuneLimit = maximum;
+    }
+    if (file) fclose(file);
+}
+
+void setSocketSettings(const ServerConfig* config) {
+    pthread_once(&autotuneOnce, readAutotuneLimit);
+    __atomic_store_n(&backlog, config->backlog, __ATOMIC_RELAXED);
+    __atomic_store_n(&noDelay, config->noDelay, __ATOMIC_RELAXED);
+    __atomic_store_n(&batchReplies, config->batchReplies, __ATOMIC_RELAXED);
+    __atomic_store_n(&sendBufferBytes, config->sendBufferBytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&receiveBufferBytes, config->receiveBufferBytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&linkMbps, config->linkMbps, __ATOMIC_RELAXED);
+}
+
+int openListeningSocket(int port, int reusePort) {
+    struct sockaddr_in serverAddr;
+
+    // Create TCP socket
+    int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (serverSocket == -1) {
+        printf("Socket creation Unsuccessful\n");
+        return -1;
+    }
+    int enable = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (reusePort && setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+        perror("SO_REUSEPORT");
+        close(serverSocket);
+        return -1;
+    }
+
+    // Setup server address
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+    serverAddr.sin_port = htons(port);
+
+    // Bind socket to the server address
+    if (bind(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
+        perror("bind failed. Error");
+        close(serverSocket);
+        return -1;
+    }
+
+    // Start listening for client connections
+    configureListeningSocket(serverSocket);
+    return serverSocket;
+}
+
+void configureListeningSocket(int serverSocket) {
+    int receiveBuffer = __atomic_load_n(&receiveBufferBytes, __ATOMIC_RELAXED);
+    if (receiveBuffer > 0) {
+        setsockopt(serverSocket, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(int));
+    }
+    if (listen(serverSocket, __atomic_load_n(&backlog, __ATOMIC_RELAXED)) < 0) {
+        perror("listen");
+    }
+}
+
+// Autotuning grows a send buffer up to the third tcp_wmem value, which covers 1 Gbit/s to about 16 ms away.
+// A farther or faster client would stall on the buffer, so its socket gets room for two bandwidth-delay
+// products of the round trip measured by the handshake, as far as net.core.wmem_max allows. Setting
+// SO_SNDBUF turns autotuning off, so it is only done where autotuning falls short
+static void sizeSendBuffer(int clientSocket) {
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    if (getsockopt(clientSocket, IPPROTO_TCP, TCP_INFO, &info, &length) != 0 || info.tcpi_rtt == 0) return;
+
+    // Mbit/s are 125000 bytes per second, and tcpi_rtt is in microseconds
+    long long bandwidthDelay = (long long)__atomic_load_n(&linkMbps, __ATOMIC_RELAXED) * 125000 * info.tcpi_rtt / 1000000;
+    if (2 * bandwidthDelay <= autotuneLimit) return;
+
+    // The kernel doubles the value for its bookkeeping, which makes the two products
+    int bytes = bandwidthDelay < INT_MAX / 2 ? (int)bandwidthDelay : INT_MAX / 2;
+    if (setsockopt(clientSocket, SOL_SOCKET, SO_SNDBUFFORCE, &bytes, sizeof(bytes)) != 0) {
+        setsockopt(clientSocket, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+    }
+}
+
+void tuneClientSocket(int clientSocket) {
+    // Nagle would hold a reply's last small write until the client acknowledges the one before, which a
+    // client waiting for the rest of the reply delays by up to 40 ms
+    int enable = __atomic_load_n(&noDelay, __ATOMIC_RELAXED);
+    if (enable) setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    int sendBuffer = __atomic_load_n(&sendBufferBytes, __ATOMIC_RELAXED);
+    if (sendBuffer == SEND_BUFFER_AUTO) {
+        sizeSendBuffer(clientSocket);
+    } else if (sendBuffer > 0) {
+        setsockopt(clientSocket, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+    }
+}
+
+int batchingReplies(void) {
+    return __atomic_load_n(&batchReplies, __ATOMIC_RELAXED);
+}
+
+void pushPendingData(int socket) {
+    // Clearing the cork pushes out queued data even when it was never set, Nagle permitting
+    int disable = 0;
+    setsockopt(socket, IPPROTO_TCP, TCP_CORK, &disable, sizeof(disable));
+}
@@ -0,0 +1,28 @@
+#ifndef SOCKW24_H
+#define SOCKW24_H
+
+#include "configw24.h"
+
+// Socket settings every listening and client socket gets, taken from the config. Safe to call while other
+// threads accept; connections accepted afterwards get the new values
+void setSocketSettings(const ServerConfig* config);
+
+// Creates a TCP socket listening on port with SO_REUSEADDR, so a restarted server can bind while
+// connections of the last one linger in TIME_WAIT, or returns -1 after reporting why it could not. With
+// reusePort set, several sockets bind the same port and the kernel spreads new connections over them
+int openListeningSocket(int port, int reusePort);
+
+// Sets the backlog, and the receive buffer accepted sockets inherit (it must be set before the handshake to
+// count in the window scale). Calling it again on a listening socket applies new values from then on
+void configureListeningSocket(int serverSocket);
+
+// Applies the per-connection settings to a socket just accepted: TCP_NODELAY, and the send buffer
+void tuneClientSocket(int clientSocket);
+
+// Whether replies batch data frames with MSG_MORE (see ReplyChannel.batch)
+int batchingReplies(void);
+
+// Sends whatever MSG_MORE or a cork left queued on the socket, before a reply stops to wait
+void pushPendingData(int socket);
+
+#endif
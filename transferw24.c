@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "transferw24.h"
+#include "protocolw24.h"
+#include "poolw24.h"
+
+#define SPLICE_CHUNK (1 << 20)
+#define COPY_BUFFER_SIZE 65536
+#define COPY_BUFFERS_PER_SLAB 4
+
+// Buffers of the copy fallback, kept between transfers
+static SlabPool copyBuffers = SLAB_POOL_INITIALIZER(COPY_BUFFER_SIZE, COPY_BUFFERS_PER_SLAB);
+
+// Monotonic time in seconds
+static double monotonicSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void beginTransferStats(TransferStats* stats, const char* method) {
+    memset(stats, 0, sizeof(*stats));
+    stats->method = method;
+    stats->startTime = monotonicSeconds();
+}
+
+void reportTransferStats(const TransferStats* stats) {
+    double elapsed = monotonicSeconds() - stats->startTime;
+    double megabytes = stats->bytes / (1024.0 * 1024.0);
+    printf("Transfer: %llu bytes in %.3f s (%.1f MB/s, %.2f syscalls/MB, %s)\n",
+           stats->bytes, elapsed, elapsed > 0 ? megabytes / elapsed : 0.0,
+           megabytes > 0 ? stats->syscalls / megabytes : 0.0, stats->method);
+}
+
+// Moves data file -> pipe -> socket; returns bytes sent, or -1 with errno set
+static off_t spliceRange(int socket, int fd, off_t offset, off_t length, TransferStats* stats) {
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) return -1;
+
+    off_t sent = 0;
+    while (sent < length) {
+        size_t wanted = length - sent < SPLICE_CHUNK ? length - sent : SPLICE_CHUNK;
+        loff_t fileOffset = offset + sent;
+        ssize_t inPipe = splice(fd, &fileOffset, pipeFds[1], NULL, wanted, SPLICE_F_MOVE | SPLICE_F_MORE);
+        stats->syscalls++;
+        if (inPipe < 0 && errno == EINTR) continue;
+        if (inPipe <= 0) {
+            if (inPipe == 0) errno = EIO;  // File shrank under us
+            sent = sent > 0 ? sent : -1;
+            break;
+        }
+
+        // Drain everything that entered the pipe, resuming partial socket writes
+        while (inPipe > 0) {
+            ssize_t out = splice(pipeFds[0], NULL, socket, NULL, inPipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+            stats->syscalls++;
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) {
+                close(pipeFds[0]);
+                close(pipeFds[1]);
+                return -1;
+            }
+            inPipe -= out;
+            sent += out;
+            stats->bytes += out;
+        }
+    }
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    return sent;
+}
+
+// Last resort: copy through a user-space buffer
+static int copyRange(int socket, int fd, off_t offset, off_t length, TransferStats* stats) {
+    char* buffer = poolGet(&copyBuffers);
+    if (!buffer) return -1;
+
+    while (length > 0) {
+        size_t wanted = length < COPY_BUFFER_SIZE ? length : COPY_BUFFER_SIZE;
+        ssize_t bytesRead = pread(fd, buffer, wanted, offset);
+        stats->syscalls++;
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead <= 0) {
+            poolPut(&copyBuffers, buffer);
+            return -1;
+        }
+        for (ssize_t written = 0; written < bytesRead; ) {
+            ssize_t out = send(socket, buffer + written, bytesRead - written, MSG_NOSIGNAL);
+            stats->syscalls++;
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) {
+                poolPut(&copyBuffers, buffer);
+                return -1;
+            }
+            written += out;
+        }
+        offset += bytesRead;
+        length -= bytesRead;
+        stats->bytes += bytesRead;
+    }
+    poolPut(&copyBuffers, buffer);
+    return 0;
+}
+
+int sendFileRange(int socket, int fd, off_t offset, off_t length, TransferStats* stats) {
+    off_t end = offset + length;
+
+    // sendfile() advances offset itself and may send less than asked; keep going until done
+    while (offset < end) {
+        ssize_t sent = sendfile(socket, fd, &offset, end - offset);
+        stats->syscalls++;
+        if (sent > 0) {
+            stats->bytes += sent;
+            stats->method = "sendfile";
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent == 0) return -1;  // File shrank under us
+        if (errno != EINVAL && errno != ENOSYS) return -1;
+
+        // This file/socket pair does not support sendfile: try splice, then plain copies
+        off_t spliced = spliceRange(socket, fd, offset, end - offset, stats);
+        if (spliced > 0) {
+            stats->method = "splice";
+            offset += spliced;
+            if (offset == end) return 0;
+        }
+        if (spliced < 0 && errno != EINVAL && errno != ENOSYS) return -1;
+        stats->method = "read/send";
+        return copyRange(socket, fd, offset, end - offset, stats);
+    }
+    return 0;
+}
+
+// Frames the file bytes from offset up to end as chunks followed by the terminator
+static int sendChunkedRange(ReplyChannel* channel, int fd, off_t offset, off_t end, TransferStats* stats) {
+    while (offset < end) {
+        off_t part = end - offset;
+        if ((unsigned long long)part > maxDataLength(channel)) part = maxDataLength(channel);
+
+        // MSG_MORE lets the header leave in the same segment as the first file bytes
+        stats->syscalls++;
+        if (replyDataHeader(channel, part) != 0) return -1;
+        int result = sendFileRange(channel->socket, fd, offset, part, stats);
+        replyDataSent(channel);
+        if (result != 0) return -1;
+        offset += part;
+    }
+    stats->syscalls++;
+    return replyEnd(channel);
+}
+
+int sendFileAsChunks(ReplyChannel* channel, int fd, TransferStats* stats) {
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0) return -1;
+    return sendFileRangeAsChunks(channel, fd, 0, fileInfo.st_size, stats);
+}
+
+int sendFileRangeAsChunks(ReplyChannel* channel, int fd, off_t offset, off_t length, TransferStats* stats) {
+    // Cork the socket so headers, file data and the terminator go out in full segments; uncorking
+    // flushes the tail at once instead of leaving the small terminator to wait on a delayed ACK. A
+    // multiplexed connection is left uncorked, since the cork would hold back the other replies' frames
+    // too; the headers' MSG_MORE still joins each one to its data
+    int cork = channel->batch && !channel->beginFrame;
+    int enable = 1, disable = 0;
+    if (cork) setsockopt(channel->socket, IPPROTO_TCP, TCP_CORK, &enable, sizeof(enable));
+    int result = sendChunkedRange(channel, fd, offset, offset + length, stats);
+    if (cork) setsockopt(channel->socket, IPPROTO_TCP, TCP_CORK, &disable, sizeof(disable));
+    return result;
+}
@@ -0,0 +1,33 @@
+#ifndef TRANSFERW24_H
+#define TRANSFERW24_H
+
+#include <sys/types.h>
+
+#include "protocolw24.h"
+
+// Counters for one response transfer, used to report throughput and syscall cost
+typedef struct {
+    unsigned long long bytes;
+    unsigned long syscalls;
+    double startTime;
+    const char* method;  // "sendfile", "splice", "read/send" or "buffer"
+} TransferStats;
+
+// Starts timing a transfer
+void beginTransferStats(TransferStats* stats, const char* method);
+
+// Prints bytes/sec and syscalls-per-MB for a finished transfer
+void reportTransferStats(const TransferStats* stats);
+
+// Sends length bytes of fd starting at offset to the socket without copying through user space.
+// Uses sendfile(), falls back to splice() through a pipe, then to read/send; short writes are resumed.
+// Returns 0 on success and -1 when the socket or file fails.
+int sendFileRange(int socket, int fd, off_t offset, off_t length, TransferStats* stats);
+
+// Sends a whole file as archive data on a reply channel (see protocolw24.h), then ends the reply
+int sendFileAsChunks(ReplyChannel* channel, int fd, TransferStats* stats);
+
+// Same for length bytes of the file starting at offset, to resume a download
+int sendFileRangeAsChunks(ReplyChannel* channel, int fd, off_t offset, off_t length, TransferStats* stats);
+
+#endif